@@ -0,0 +1,535 @@
+//=====================================================================================================
+// ahrs.hpp
+//=====================================================================================================
+//
+// Header-only C++ interface: ahrs::Filter<T, Algorithm>, with T float or double and Algorithm
+// ahrs::Madgwick or ahrs::Mahony.
+//
+// Precision and gains are template parameters instead of build settings, so a float filter and a
+// double precision reference can run in the same binary, and the update inlines into the caller's
+// loop with the gains as constants. Other gains are selected by deriving from an algorithm:
+//
+//     struct FastMadgwick : ahrs::Madgwick { static constexpr double beta = 0.1; };
+//     ahrs::Filter<float, FastMadgwick> filter(400.0f);
+//
+// The kernels are those of madgwick_ahrs.c / mahony_ahrs.c, written once for both precisions. With
+// T = MA_PRECISION and the default gains the quaternions match the C API bit for bit, as long as
+// both are compiled with the same floating point contraction (checked by bench/cpp_bench.cpp).
+//
+//=====================================================================================================
+#ifndef __AHRS_HPP__
+#define __AHRS_HPP__
+
+#include "madgwick_ahrs.h"
+#include "mahony_ahrs.h"
+#include <cmath>
+#include <cstddef>
+
+namespace ahrs {
+
+//---------------------------------------------------------------------------------------------------
+// Types
+
+template<typename T> struct Quaternion {
+	T q0, q1, q2, q3;
+};
+
+template<typename T> struct Euler {
+	T yaw, pitch, roll;
+};
+
+// AHRSSensorArray for any precision. Sample i is (x[i * stride], y[i * stride], z[i * stride]).
+template<typename T> struct SensorArray {
+	const T* x;
+	const T* y;
+	const T* z;
+	std::size_t stride;
+
+	static SensorArray interleaved(const T* xyz, std::size_t stride){
+		SensorArray array = { xyz, xyz + 1, xyz + 2, stride };
+		return array;
+	}
+	static SensorArray planar(const T* x, const T* y, const T* z){
+		SensorArray array = { x, y, z, 1 };
+		return array;
+	}
+};
+
+namespace detail {
+
+// inv_sqrt of arhs.h for both precisions, independent of MA_DOUBLE_PRECISION
+inline float inv_sqrt(float x){ return ahrs_rsqrt_f(x); }
+inline double inv_sqrt(double x){ return ahrs_rsqrt_d(x); }
+
+template<typename T> inline Euler<T> to_euler(const T* q){
+	Euler<T> e;
+	e.yaw = std::atan2(2 * q[0] * q[3] + 2 * q[1] * q[2], 1 - 2 * q[2] * q[2] - 2 * q[3] * q[3]);
+	T sinp = 2 * q[0] * q[2] - 2 * q[1] * q[3];
+	if(sinp >= 1) e.pitch = static_cast<T>(M_PI / 2);
+	else if(sinp <= -1) e.pitch = static_cast<T>(-M_PI / 2);
+	else e.pitch = std::asin(sinp);
+	e.roll = std::atan2(2 * q[0] * q[1] + 2 * q[2] * q[3], 1 - 2 * q[1] * q[1] - 2 * q[2] * q[2]);
+	return e;
+}
+
+} // namespace detail
+
+//====================================================================================================
+// Algorithms
+//
+// An algorithm provides its gains as constexpr members, the per-filter State<T> besides the
+// quaternion, and imu_step / step kernels. Kernels read the gains from the `Gains` parameter, the
+// most derived algorithm type, so a derived struct only has to redeclare the gains.
+
+struct Madgwick {
+	static constexpr double beta = BETA;    // 2 * proportional gain
+
+	template<typename T> struct State {
+		void reset(){}
+	};
+
+	//-----------------------------------------------------------------------------------------------
+	// IMU algorithm step, madgwick_imu_step
+	template<typename Gains, typename T>
+	MA_INLINE void imu_step(T* q, State<T>&, T dt, T gx, T gy, T gz, T ax, T ay, T az)
+	{
+		const T beta = static_cast<T>(Gains::beta);
+		T q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+		T recipNorm;
+		T s0, s1, s2, s3;
+		T qDot1, qDot2, qDot3, qDot4;
+		T _2q0, _2q1, _2q2, _2q3, _4q0, _4q1, _4q2 ,_8q1, _8q2, q0q0, q1q1, q2q2, q3q3;
+
+		// Rate of change of quaternion from gyroscope
+		qDot1 = T(0.5) * (-q1 * gx - q2 * gy - q3 * gz);
+		qDot2 = T(0.5) * (q0 * gx + q2 * gz - q3 * gy);
+		qDot3 = T(0.5) * (q0 * gy - q1 * gz + q3 * gx);
+		qDot4 = T(0.5) * (q0 * gz + q1 * gy - q2 * gx);
+
+		// Compute feedback only if accelerometer measurement valid (avoids NaN in accelerometer normalisation)
+		if(!((ax == T(0)) && (ay == T(0)) && (az == T(0)))) {
+
+			// Normalise accelerometer measurement
+			recipNorm = detail::inv_sqrt(ax * ax + ay * ay + az * az);
+			ax *= recipNorm;
+			ay *= recipNorm;
+			az *= recipNorm;
+
+			// Auxiliary variables to avoid repeated arithmetic
+			_2q0 = T(2) * q0;
+			_2q1 = T(2) * q1;
+			_2q2 = T(2) * q2;
+			_2q3 = T(2) * q3;
+			_4q0 = T(4) * q0;
+			_4q1 = T(4) * q1;
+			_4q2 = T(4) * q2;
+			_8q1 = T(8) * q1;
+			_8q2 = T(8) * q2;
+			q0q0 = q0 * q0;
+			q1q1 = q1 * q1;
+			q2q2 = q2 * q2;
+			q3q3 = q3 * q3;
+
+			// Gradient decent algorithm corrective step
+			s0 = _4q0 * q2q2 + _2q2 * ax + _4q0 * q1q1 - _2q1 * ay;
+			s1 = _4q1 * q3q3 - _2q3 * ax + T(4) * q0q0 * q1 - _2q0 * ay - _4q1 + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az;
+			s2 = T(4) * q0q0 * q2 + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay - _4q2 + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az;
+			s3 = T(4) * q1q1 * q3 - _2q1 * ax + T(4) * q2q2 * q3 - _2q2 * ay;
+			recipNorm = s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3;
+			recipNorm = recipNorm > T(0) ? detail::inv_sqrt(recipNorm) : T(0); // normalise step magnitude, a zero gradient gives no feedback
+			s0 *= recipNorm;
+			s1 *= recipNorm;
+			s2 *= recipNorm;
+			s3 *= recipNorm;
+
+			// Apply feedback step
+			qDot1 -= beta * s0;
+			qDot2 -= beta * s1;
+			qDot3 -= beta * s2;
+			qDot4 -= beta * s3;
+		}
+
+		// Integrate rate of change of quaternion to yield quaternion
+		q0 += qDot1 * dt;
+		q1 += qDot2 * dt;
+		q2 += qDot3 * dt;
+		q3 += qDot4 * dt;
+
+		// Normalise quaternion
+		recipNorm = detail::inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+		q[0] = q0 * recipNorm;
+		q[1] = q1 * recipNorm;
+		q[2] = q2 * recipNorm;
+		q[3] = q3 * recipNorm;
+	}
+
+	//-----------------------------------------------------------------------------------------------
+	// AHRS algorithm step, madgwick_step
+	template<typename Gains, typename T>
+	MA_INLINE void step(T* q, State<T>& state, T dt, T gx, T gy, T gz, T ax, T ay, T az, T mx, T my, T mz)
+	{
+		const T beta = static_cast<T>(Gains::beta);
+		T q0, q1, q2, q3;
+		T recipNorm;
+		T s0, s1, s2, s3;
+		T qDot1, qDot2, qDot3, qDot4;
+		T hx, hy;
+		T _2q0mx, _2q0my, _2q0mz, _2q1mx, _2bx, _2bz, _4bx, _4bz, _2q0, _2q1, _2q2, _2q3, _2q0q2, _2q2q3, q0q0, q0q1, q0q2, q0q3, q1q1, q1q2, q1q3, q2q2, q2q3, q3q3;
+
+		// Use IMU algorithm if magnetometer measurement invalid (avoids NaN in magnetometer normalisation)
+		if((mx == T(0)) && (my == T(0)) && (mz == T(0))) {
+			imu_step<Gains>(q, state, dt, gx, gy, gz, ax, ay, az);
+			return;
+		}
+		q0 = q[0];
+		q1 = q[1];
+		q2 = q[2];
+		q3 = q[3];
+
+		// Rate of change of quaternion from gyroscope
+		qDot1 = T(0.5) * (-q1 * gx - q2 * gy - q3 * gz);
+		qDot2 = T(0.5) * (q0 * gx + q2 * gz - q3 * gy);
+		qDot3 = T(0.5) * (q0 * gy - q1 * gz + q3 * gx);
+		qDot4 = T(0.5) * (q0 * gz + q1 * gy - q2 * gx);
+
+		// Compute feedback only if accelerometer measurement valid (avoids NaN in accelerometer normalisation)
+		if(!((ax == T(0)) && (ay == T(0)) && (az == T(0)))) {
+			// Normalise accelerometer measurement
+			recipNorm = detail::inv_sqrt(ax * ax + ay * ay + az * az);
+			ax *= recipNorm;
+			ay *= recipNorm;
+			az *= recipNorm;
+
+			// Normalise magnetometer measurement
+			recipNorm = detail::inv_sqrt(mx * mx + my * my + mz * mz);
+			mx *= recipNorm;
+			my *= recipNorm;
+			mz *= recipNorm;
+
+			// Auxiliary variables to avoid repeated arithmetic
+			_2q0mx = T(2) * q0 * mx;
+			_2q0my = T(2) * q0 * my;
+			_2q0mz = T(2) * q0 * mz;
+			_2q1mx = T(2) * q1 * mx;
+			_2q0 = T(2) * q0;
+			_2q1 = T(2) * q1;
+			_2q2 = T(2) * q2;
+			_2q3 = T(2) * q3;
+			_2q0q2 = T(2) * q0 * q2;
+			_2q2q3 = T(2) * q2 * q3;
+			q0q0 = q0 * q0;
+			q0q1 = q0 * q1;
+			q0q2 = q0 * q2;
+			q0q3 = q0 * q3;
+			q1q1 = q1 * q1;
+			q1q2 = q1 * q2;
+			q1q3 = q1 * q3;
+			q2q2 = q2 * q2;
+			q2q3 = q2 * q3;
+			q3q3 = q3 * q3;
+
+			// Reference direction of Earth's magnetic field
+			hx = mx * q0q0 - _2q0my * q3 + _2q0mz * q2 + mx * q1q1 + _2q1 * my * q2 + _2q1 * mz * q3 - mx * q2q2 - mx * q3q3;
+			hy = _2q0mx * q3 + my * q0q0 - _2q0mz * q1 + _2q1mx * q2 - my * q1q1 + my * q2q2 + _2q2 * mz * q3 - my * q3q3;
+			_2bx = std::sqrt(hx * hx + hy * hy);
+			_2bz = -_2q0mx * q2 + _2q0my * q1 + mz * q0q0 + _2q1mx * q3 - mz * q1q1 + _2q2 * my * q3 - mz * q2q2 + mz * q3q3;
+			_4bx = T(2) * _2bx;
+			_4bz = T(2) * _2bz;
+
+			// Gradient decent algorithm corrective step
+			s0 = -_2q2 * (T(2) * q1q3 - _2q0q2 - ax) + _2q1 * (T(2) * q0q1 + _2q2q3 - ay) - _2bz * q2 * (_2bx * (T(0.5) - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (-_2bx * q3 + _2bz * q1) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + _2bx * q2 * (_2bx * (q0q2 + q1q3) + _2bz * (T(0.5) - q1q1 - q2q2) - mz);
+			s1 = _2q3 * (T(2) * q1q3 - _2q0q2 - ax) + _2q0 * (T(2) * q0q1 + _2q2q3 - ay) - T(4) * q1 * (1 - T(2) * q1q1 - T(2) * q2q2 - az) + _2bz * q3 * (_2bx * (T(0.5) - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (_2bx * q2 + _2bz * q0) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + (_2bx * q3 - _4bz * q1) * (_2bx * (q0q2 + q1q3) + _2bz * (T(0.5) - q1q1 - q2q2) - mz);
+			s2 = -_2q0 * (T(2) * q1q3 - _2q0q2 - ax) + _2q3 * (T(2) * q0q1 + _2q2q3 - ay) - T(4) * q2 * (1 - T(2) * q1q1 - T(2) * q2q2 - az) + (-_4bx * q2 - _2bz * q0) * (_2bx * (T(0.5) - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (_2bx * q1 + _2bz * q3) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + (_2bx * q0 - _4bz * q2) * (_2bx * (q0q2 + q1q3) + _2bz * (T(0.5) - q1q1 - q2q2) - mz);
+			s3 = _2q1 * (T(2) * q1q3 - _2q0q2 - ax) + _2q2 * (T(2) * q0q1 + _2q2q3 - ay) + (-_4bx * q3 + _2bz * q1) * (_2bx * (T(0.5) - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (-_2bx * q0 + _2bz * q2) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + _2bx * q1 * (_2bx * (q0q2 + q1q3) + _2bz * (T(0.5) - q1q1 - q2q2) - mz);
+			recipNorm = s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3;
+			recipNorm = recipNorm > T(0) ? detail::inv_sqrt(recipNorm) : T(0); // normalise step magnitude, a zero gradient gives no feedback
+			s0 *= recipNorm;
+			s1 *= recipNorm;
+			s2 *= recipNorm;
+			s3 *= recipNorm;
+
+			// Apply feedback step
+			qDot1 -= beta * s0;
+			qDot2 -= beta * s1;
+			qDot3 -= beta * s2;
+			qDot4 -= beta * s3;
+		}
+
+		// Integrate rate of change of quaternion to yield quaternion
+		q0 += qDot1 * dt;
+		q1 += qDot2 * dt;
+		q2 += qDot3 * dt;
+		q3 += qDot4 * dt;
+
+		// Normalise quaternion
+		recipNorm = detail::inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+		q[0] = q0 * recipNorm;
+		q[1] = q1 * recipNorm;
+		q[2] = q2 * recipNorm;
+		q[3] = q3 * recipNorm;
+	}
+};
+
+struct Mahony {
+	static constexpr double two_kp = TWO_KP;    // 2 * proportional gain (Kp)
+	static constexpr double two_ki = TWO_KI;    // 2 * integral gain (Ki), 0 removes the integral feedback
+
+	template<typename T> struct State {
+		T integralFB[3];    // integral error terms scaled by Ki
+		void reset(){ integralFB[0] = integralFB[1] = integralFB[2] = T(0); }
+	};
+
+	//-----------------------------------------------------------------------------------------------
+	// Integral and proportional feedback of mahony_imu_step / mahony_step
+	template<typename Gains, typename T>
+	MA_INLINE void feedback(State<T>& state, T dt, T& gx, T& gy, T& gz, T halfex, T halfey, T halfez)
+	{
+		const T two_kp = static_cast<T>(Gains::two_kp);
+		const T two_ki = static_cast<T>(Gains::two_ki);
+
+		// Compute and apply integral feedback if enabled
+		if(two_ki > T(0)) {
+			state.integralFB[0] += two_ki * halfex * dt; // integral error scaled by Ki
+			state.integralFB[1] += two_ki * halfey * dt;
+			state.integralFB[2] += two_ki * halfez * dt;
+			gx += state.integralFB[0]; // apply integral feedback
+			gy += state.integralFB[1];
+			gz += state.integralFB[2];
+		} else {
+			state.reset(); // prevent integral windup
+		}
+
+		// Apply proportional feedback
+		gx += two_kp * halfex;
+		gy += two_kp * halfey;
+		gz += two_kp * halfez;
+	}
+
+	// Integrates the corrected rate of change and normalises the quaternion
+	template<typename T>
+	MA_INLINE void integrate(T* q, T dt, T gx, T gy, T gz)
+	{
+		T q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+		T qa, qb, qc, recipNorm;
+
+		// Integrate rate of change of quaternion
+		gx *= (T(0.5) * dt); // pre-multiply common factors
+		gy *= (T(0.5) * dt);
+		gz *= (T(0.5) * dt);
+		qa = q0;
+		qb = q1;
+		qc = q2;
+		q0 += (-qb * gx - qc * gy - q3 * gz);
+		q1 += (qa * gx + qc * gz - q3 * gy);
+		q2 += (qa * gy - qb * gz + q3 * gx);
+		q3 += (qa * gz + qb * gy - qc * gx);
+
+		// Normalise quaternion
+		recipNorm = detail::inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+		q[0] = q0 * recipNorm;
+		q[1] = q1 * recipNorm;
+		q[2] = q2 * recipNorm;
+		q[3] = q3 * recipNorm;
+	}
+
+	//-----------------------------------------------------------------------------------------------
+	// IMU algorithm step, mahony_imu_step
+	template<typename Gains, typename T>
+	MA_INLINE void imu_step(T* q, State<T>& state, T dt, T gx, T gy, T gz, T ax, T ay, T az)
+	{
+		const T q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+
+		// Compute feedback only if accelerometer measurement valid (avoids NaN in accelerometer normalisation)
+		if(!((ax == T(0)) && (ay == T(0)) && (az == T(0)))) {
+
+			// Normalise accelerometer measurement
+			T recipNorm = detail::inv_sqrt(ax * ax + ay * ay + az * az);
+			ax *= recipNorm;
+			ay *= recipNorm;
+			az *= recipNorm;
+
+			// Estimated direction of gravity and vector perpendicular to magnetic flux
+			T halfvx = q1 * q3 - q0 * q2;
+			T halfvy = q0 * q1 + q2 * q3;
+			T halfvz = q0 * q0 - T(0.5) + q3 * q3;
+
+			// Error is sum of cross product between estimated and measured direction of gravity
+			feedback<Gains>(state, dt, gx, gy, gz, ay * halfvz - az * halfvy, az * halfvx - ax * halfvz, ax * halfvy - ay * halfvx);
+		}
+		integrate(q, dt, gx, gy, gz);
+	}
+
+	//-----------------------------------------------------------------------------------------------
+	// AHRS algorithm step, mahony_step
+	template<typename Gains, typename T>
+	MA_INLINE void step(T* q, State<T>& state, T dt, T gx, T gy, T gz, T ax, T ay, T az, T mx, T my, T mz)
+	{
+		// Use IMU algorithm if magnetometer measurement invalid (avoids NaN in magnetometer normalisation)
+		if((mx == T(0)) && (my == T(0)) && (mz == T(0))) {
+			imu_step<Gains>(q, state, dt, gx, gy, gz, ax, ay, az);
+			return;
+		}
+		const T q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+
+		// Compute feedback only if accelerometer measurement valid (avoids NaN in accelerometer normalisation)
+		if(!((ax == T(0)) && (ay == T(0)) && (az == T(0)))) {
+
+			// Normalise accelerometer measurement
+			T recipNorm = detail::inv_sqrt(ax * ax + ay * ay + az * az);
+			ax *= recipNorm;
+			ay *= recipNorm;
+			az *= recipNorm;
+
+			// Normalise magnetometer measurement
+			recipNorm = detail::inv_sqrt(mx * mx + my * my + mz * mz);
+			mx *= recipNorm;
+			my *= recipNorm;
+			mz *= recipNorm;
+
+			// Auxiliary variables to avoid repeated arithmetic
+			const T q0q0 = q0 * q0;
+			const T q0q1 = q0 * q1;
+			const T q0q2 = q0 * q2;
+			const T q0q3 = q0 * q3;
+			const T q1q1 = q1 * q1;
+			const T q1q2 = q1 * q2;
+			const T q1q3 = q1 * q3;
+			const T q2q2 = q2 * q2;
+			const T q2q3 = q2 * q3;
+			const T q3q3 = q3 * q3;
+
+			// Reference direction of Earth's magnetic field
+			T hx = T(2) * (mx * (T(0.5) - q2q2 - q3q3) + my * (q1q2 - q0q3) + mz * (q1q3 + q0q2));
+			T hy = T(2) * (mx * (q1q2 + q0q3) + my * (T(0.5) - q1q1 - q3q3) + mz * (q2q3 - q0q1));
+			T bx = std::sqrt(hx * hx + hy * hy);
+			T bz = T(2) * (mx * (q1q3 - q0q2) + my * (q2q3 + q0q1) + mz * (T(0.5) - q1q1 - q2q2));
+
+			// Estimated direction of gravity and magnetic field
+			T halfvx = q1q3 - q0q2;
+			T halfvy = q0q1 + q2q3;
+			T halfvz = q0q0 - T(0.5) + q3q3;
+			T halfwx = bx * (T(0.5) - q2q2 - q3q3) + bz * (q1q3 - q0q2);
+			T halfwy = bx * (q1q2 - q0q3) + bz * (q0q1 + q2q3);
+			T halfwz = bx * (q0q2 + q1q3) + bz * (T(0.5) - q1q1 - q2q2);
+
+			// Error is sum of cross product between estimated direction and measured direction of field vectors
+			feedback<Gains>(state, dt, gx, gy, gz,
+				(ay * halfvz - az * halfvy) + (my * halfwz - mz * halfwy),
+				(az * halfvx - ax * halfvz) + (mz * halfwx - mx * halfwz),
+				(ax * halfvy - ay * halfvx) + (mx * halfwy - my * halfwx));
+		}
+		integrate(q, dt, gx, gy, gz);
+	}
+};
+
+//====================================================================================================
+// Filter
+
+template<typename T, typename Algorithm>
+class Filter {
+public:
+	typedef typename Algorithm::template State<T> State;
+
+	// sample_rate must be positive, as for create_madgwick_ahrs / create_mahony_ahrs
+	explicit Filter(T sample_rate) : sample_rate_(sample_rate), sample_period_(T(1) / sample_rate) {
+		reset();
+	}
+
+	// Resets the filter when the sample rate changes, same semantics as *_update_sample_rate
+	void update_sample_rate(T sample_rate){
+		if(sample_rate <= 0) return;
+		if(sample_rate != sample_rate_) {
+			sample_rate_ = sample_rate;
+			sample_period_ = T(1) / sample_rate;
+			reset();
+		}
+	}
+
+	void reset(){
+		// quaternion of sensor frame relative to auxiliary frame
+		q_[0] = T(1);
+		q_[1] = T(0);
+		q_[2] = T(0);
+		q_[3] = T(0);
+		state_.reset();
+	}
+
+	T sample_rate() const { return sample_rate_; }
+
+	Quaternion<T> quaternion() const {
+		Quaternion<T> q = { q_[0], q_[1], q_[2], q_[3] };
+		return q;
+	}
+
+	// Computed from the quaternion on every call, same convention as *_get_euler
+	Euler<T> euler() const { return detail::to_euler(q_); }
+
+	void update_imu(T gx, T gy, T gz, T ax, T ay, T az){
+		Algorithm::template imu_step<Algorithm>(q_, state_, sample_period_, gx, gy, gz, ax, ay, az);
+	}
+
+	void update(T gx, T gy, T gz, T ax, T ay, T az, T mx, T my, T mz){
+		Algorithm::template step<Algorithm>(q_, state_, sample_period_, gx, gy, gz, ax, ay, az, mx, my, mz);
+	}
+
+	// Batched updates, same semantics as *_update_imu_batch / *_update_batch. The state is kept in
+	// locals for the duration of the loop. `quaternions` may be NULL.
+	void update_imu_batch(SensorArray<T> gyro, SensorArray<T> accel, std::size_t count, T* quaternions){
+		T q[4] = { q_[0], q_[1], q_[2], q_[3] };
+		State state = state_;
+		const T dt = sample_period_;
+		std::size_t g = 0, a = 0;
+		for(std::size_t i = 0; i < count; i++, g += gyro.stride, a += accel.stride) {
+			Algorithm::template imu_step<Algorithm>(q, state, dt, gyro.x[g], gyro.y[g], gyro.z[g], accel.x[a], accel.y[a], accel.z[a]);
+			if(quaternions != NULL) {
+				quaternions[0] = q[0];
+				quaternions[1] = q[1];
+				quaternions[2] = q[2];
+				quaternions[3] = q[3];
+				quaternions += 4;
+			}
+		}
+		store(q, state);
+	}
+
+	void update_batch(SensorArray<T> gyro, SensorArray<T> accel, SensorArray<T> mag, std::size_t count, T* quaternions){
+		T q[4] = { q_[0], q_[1], q_[2], q_[3] };
+		State state = state_;
+		const T dt = sample_period_;
+		std::size_t g = 0, a = 0, m = 0;
+		for(std::size_t i = 0; i < count; i++, g += gyro.stride, a += accel.stride, m += mag.stride) {
+			Algorithm::template step<Algorithm>(q, state, dt, gyro.x[g], gyro.y[g], gyro.z[g], accel.x[a], accel.y[a], accel.z[a], mag.x[m], mag.y[m], mag.z[m]);
+			if(quaternions != NULL) {
+				quaternions[0] = q[0];
+				quaternions[1] = q[1];
+				quaternions[2] = q[2];
+				quaternions[3] = q[3];
+				quaternions += 4;
+			}
+		}
+		store(q, state);
+	}
+
+private:
+	void store(const T* q, const State& state){
+		q_[0] = q[0];
+		q_[1] = q[1];
+		q_[2] = q[2];
+		q_[3] = q[3];
+		state_ = state;
+	}
+
+	T sample_rate_;
+	T sample_period_;   // 1 / sample_rate_
+	T q_[4];
+	State state_;
+};
+
+typedef Filter<float, Madgwick> MadgwickFilterf;
+typedef Filter<double, Madgwick> MadgwickFilterd;
+typedef Filter<float, Mahony> MahonyFilterf;
+typedef Filter<double, Mahony> MahonyFilterd;
+
+} // namespace ahrs
+
+#endif /* __AHRS_HPP__ */
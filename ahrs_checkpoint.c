@@ -0,0 +1,424 @@
+//=====================================================================================================
+// ahrs_checkpoint.c
+//=====================================================================================================
+//
+// Binary checkpoints of filter state, see ahrs_checkpoint.h.
+//
+// Workspaces are saved as fixed records of doubles, one per filter. Banks are saved as their state
+// arrays, trimmed to `count` and back to back, in the build's precision: a memcpy per array on both
+// ends when the precisions agree. sample_period is not saved, it follows from sample_rate.
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "ahrs_checkpoint.h"
+#include <string.h>
+
+typedef struct {
+    double sample_rate;
+    double beta;
+    double zeta;
+    double q[4];
+    double bias[3];
+    double max_dt;
+    uint64_t timestamp;
+    uint64_t accel_timestamp;
+    uint64_t mag_timestamp;
+    int32_t gap_policy;
+    int32_t has_timestamp;
+    int32_t has_accel_timestamp;
+    int32_t has_mag_timestamp;
+} MadgwickCheckpointRecord;
+
+typedef struct {
+    double sample_rate;
+    double two_kp;
+    double two_ki;
+    double q[4];
+    double integralFB[3];
+    double max_dt;
+    uint64_t timestamp;
+    uint64_t accel_timestamp;
+    uint64_t mag_timestamp;
+    int32_t gap_policy;
+    int32_t has_timestamp;
+    int32_t has_accel_timestamp;
+    int32_t has_mag_timestamp;
+} MahonyCheckpointRecord;
+
+// The layout is the file format: fail the build if a compiler pads it differently
+typedef char ahrs_checkpoint_header_size_check[sizeof(AHRSCheckpointHeader) == 32 ? 1 : -1];
+typedef char madgwick_checkpoint_record_size_check[sizeof(MadgwickCheckpointRecord) == 128 ? 1 : -1];
+typedef char mahony_checkpoint_record_size_check[sizeof(MahonyCheckpointRecord) == 128 ? 1 : -1];
+
+// Fields are copied in host order, so the little-endian format needs a little-endian host
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "ahrs_checkpoint: the checkpoint format is little-endian and big-endian hosts are not supported"
+#endif
+
+// Values per filter of each kind, AHRSCheckpointHeader.fields
+#define MADGWICK_RECORD_FIELDS 16
+#define MAHONY_RECORD_FIELDS 16
+#define MADGWICK_BANK_FIELDS 6      // sample_rate, q0 .. q3, beta
+#define MAHONY_BANK_FIELDS 10       // sample_rate, q0 .. q3, integralFBx .. z, two_kp, two_ki
+
+//====================================================================================================
+// Format
+
+static uint16_t checkpoint_fields(uint16_t kind){
+	switch(kind) {
+	case AHRS_CHECKPOINT_MADGWICK: return MADGWICK_RECORD_FIELDS;
+	case AHRS_CHECKPOINT_MAHONY: return MAHONY_RECORD_FIELDS;
+	case AHRS_CHECKPOINT_MADGWICK_BANK: return MADGWICK_BANK_FIELDS;
+	case AHRS_CHECKPOINT_MAHONY_BANK: return MAHONY_BANK_FIELDS;
+	default: return 0;
+	}
+}
+
+// Bytes per filter in the payload
+static size_t checkpoint_stride(uint16_t kind, size_t precision){
+	switch(kind) {
+	case AHRS_CHECKPOINT_MADGWICK: return sizeof(MadgwickCheckpointRecord);
+	case AHRS_CHECKPOINT_MAHONY: return sizeof(MahonyCheckpointRecord);
+	default: return checkpoint_fields(kind) * precision;
+	}
+}
+
+// FNV-1a over 64-bit words with a fold per word, about 2 bytes per cycle
+static uint64_t checkpoint_checksum(const unsigned char* data, size_t size){
+	uint64_t h = 0xcbf29ce484222325ull;
+	size_t i = 0;
+	for(; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, sizeof(word));
+		h = (h ^ word) * 0x100000001b3ull;
+		h ^= h >> 32;
+	}
+	for(; i < size; i++) h = (h ^ data[i]) * 0x100000001b3ull;
+	return h;
+}
+
+static size_t checkpoint_size(uint16_t kind, size_t count){
+	return sizeof(AHRSCheckpointHeader) + count * checkpoint_stride(kind, sizeof(MA_PRECISION));
+}
+
+// Header of a payload already in place after it
+static void checkpoint_finish(void* buffer, uint16_t kind, size_t count){
+	AHRSCheckpointHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, AHRS_CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.version = AHRS_CHECKPOINT_VERSION;
+	header.kind = kind;
+	header.precision = kind == AHRS_CHECKPOINT_MADGWICK || kind == AHRS_CHECKPOINT_MAHONY ? sizeof(double) : sizeof(MA_PRECISION);
+	header.fields = checkpoint_fields(kind);
+	header.count = count;
+	header.checksum = checkpoint_checksum((const unsigned char *) buffer + sizeof(header), count * checkpoint_stride(kind, header.precision));
+	memcpy(buffer, &header, sizeof(header));
+}
+
+// Payload of an intact checkpoint in `buffer`, NULL if there is none
+static const unsigned char* checkpoint_payload(const void* buffer, size_t size, AHRSCheckpointHeader* header){
+	if(buffer == NULL || size < sizeof(AHRSCheckpointHeader)) return NULL;
+	memcpy(header, buffer, sizeof(*header));
+	if(memcmp(header->magic, AHRS_CHECKPOINT_MAGIC, sizeof(header->magic)) != 0) return NULL;
+	if(header->version != AHRS_CHECKPOINT_VERSION) return NULL;
+	if(checkpoint_fields(header->kind) == 0 || header->fields != checkpoint_fields(header->kind)) return NULL;
+	if(header->precision != sizeof(float) && header->precision != sizeof(double)) return NULL;
+	if((header->kind == AHRS_CHECKPOINT_MADGWICK || header->kind == AHRS_CHECKPOINT_MAHONY) && header->precision != sizeof(double)) return NULL;
+	const size_t stride = checkpoint_stride(header->kind, header->precision);
+	if(header->count > (size - sizeof(AHRSCheckpointHeader)) / stride) return NULL;
+	const unsigned char* payload = (const unsigned char *) buffer + sizeof(AHRSCheckpointHeader);
+	if(checkpoint_checksum(payload, (size_t) header->count * stride) != header->checksum) return NULL;
+	return payload;
+}
+
+static const unsigned char* checkpoint_expect(const void* buffer, size_t size, uint16_t kind, size_t count, size_t* precision){
+	AHRSCheckpointHeader header;
+	const unsigned char* payload = checkpoint_payload(buffer, size, &header);
+	if(payload == NULL || header.kind != kind || header.count != count) return NULL;
+	*precision = header.precision;
+	return payload;
+}
+
+static MA_PRECISION checkpoint_value(const unsigned char* from, size_t precision){
+	if(precision == sizeof(float)) {
+		float value;
+		memcpy(&value, from, sizeof(value));
+		return (MA_PRECISION) value;
+	}
+	double value;
+	memcpy(&value, from, sizeof(value));
+	return (MA_PRECISION) value;
+}
+
+static void checkpoint_read_array(MA_PRECISION* to, const unsigned char* from, size_t precision, size_t count){
+	if(precision == sizeof(MA_PRECISION)) {
+		memcpy(to, from, count * sizeof(MA_PRECISION));
+		return;
+	}
+	for(size_t i = 0; i < count; i++) to[i] = checkpoint_value(from + i * precision, precision);
+}
+
+// Sample rates at the start of a bank payload, all > 0 (NaN included in the rejects)
+static int checkpoint_rates_valid(const unsigned char* rates, size_t precision, size_t count){
+	for(size_t i = 0; i < count; i++)
+		if(!(checkpoint_value(rates + i * precision, precision) > 0)) return 0;
+	return 1;
+}
+
+static int checkpoint_gap_valid(double sample_rate, double max_dt, int32_t gap_policy){
+	return sample_rate > 0 && max_dt >= 0 && (gap_policy == AHRS_GAP_PROPAGATE || gap_policy == AHRS_GAP_CLAMP);
+}
+
+uint16_t ahrs_checkpoint_kind(const void* buffer, size_t size, uint64_t* count){
+	AHRSCheckpointHeader header;
+	if(checkpoint_payload(buffer, size, &header) == NULL) return 0;
+	if(count != NULL) *count = header.count;
+	return header.kind;
+}
+
+//====================================================================================================
+// Workspaces
+
+size_t madgwick_ahrs_checkpoint_size(size_t count){
+	return checkpoint_size(AHRS_CHECKPOINT_MADGWICK, count);
+}
+
+size_t mahony_ahrs_checkpoint_size(size_t count){
+	return checkpoint_size(AHRS_CHECKPOINT_MAHONY, count);
+}
+
+size_t madgwick_ahrs_checkpoint(const MadgwickAHRS* workspaces, size_t count, void* buffer, size_t size){
+	if(workspaces == NULL || count == 0 || buffer == NULL) return 0;
+	const size_t bytes = madgwick_ahrs_checkpoint_size(count);
+	if(size < bytes) return 0;
+	unsigned char* payload = (unsigned char *) buffer + sizeof(AHRSCheckpointHeader);
+	for(size_t i = 0; i < count; i++) {
+		const MadgwickAHRS* w = &workspaces[i];
+		MadgwickCheckpointRecord record;
+		memset(&record, 0, sizeof(record));
+		record.sample_rate = w->sample_rate;
+		record.beta = w->beta;
+		record.zeta = w->zeta;
+		record.q[0] = w->q0;
+		record.q[1] = w->q1;
+		record.q[2] = w->q2;
+		record.q[3] = w->q3;
+		record.bias[0] = w->bias_x;
+		record.bias[1] = w->bias_y;
+		record.bias[2] = w->bias_z;
+		record.max_dt = w->max_dt;
+		record.timestamp = w->timestamp;
+		record.accel_timestamp = w->accel_timestamp;
+		record.mag_timestamp = w->mag_timestamp;
+		record.gap_policy = w->gap_policy;
+		record.has_timestamp = w->has_timestamp;
+		record.has_accel_timestamp = w->has_accel_timestamp;
+		record.has_mag_timestamp = w->has_mag_timestamp;
+		memcpy(payload + i * sizeof(record), &record, sizeof(record));
+	}
+	checkpoint_finish(buffer, AHRS_CHECKPOINT_MADGWICK, count);
+	return bytes;
+}
+
+size_t mahony_ahrs_checkpoint(const MahonyAHRS* workspaces, size_t count, void* buffer, size_t size){
+	if(workspaces == NULL || count == 0 || buffer == NULL) return 0;
+	const size_t bytes = mahony_ahrs_checkpoint_size(count);
+	if(size < bytes) return 0;
+	unsigned char* payload = (unsigned char *) buffer + sizeof(AHRSCheckpointHeader);
+	for(size_t i = 0; i < count; i++) {
+		const MahonyAHRS* w = &workspaces[i];
+		MahonyCheckpointRecord record;
+		memset(&record, 0, sizeof(record));
+		record.sample_rate = w->sample_rate;
+		record.two_kp = w->two_kp;
+		record.two_ki = w->two_ki;
+		record.q[0] = w->q0;
+		record.q[1] = w->q1;
+		record.q[2] = w->q2;
+		record.q[3] = w->q3;
+		record.integralFB[0] = w->integralFBx;
+		record.integralFB[1] = w->integralFBy;
+		record.integralFB[2] = w->integralFBz;
+		record.max_dt = w->max_dt;
+		record.timestamp = w->timestamp;
+		record.accel_timestamp = w->accel_timestamp;
+		record.mag_timestamp = w->mag_timestamp;
+		record.gap_policy = w->gap_policy;
+		record.has_timestamp = w->has_timestamp;
+		record.has_accel_timestamp = w->has_accel_timestamp;
+		record.has_mag_timestamp = w->has_mag_timestamp;
+		memcpy(payload + i * sizeof(record), &record, sizeof(record));
+	}
+	checkpoint_finish(buffer, AHRS_CHECKPOINT_MAHONY, count);
+	return bytes;
+}
+
+int madgwick_ahrs_restore(MadgwickAHRS* workspaces, size_t count, const void* buffer, size_t size){
+	if(workspaces == NULL || count == 0) return -1;
+	size_t precision;
+	const unsigned char* payload = checkpoint_expect(buffer, size, AHRS_CHECKPOINT_MADGWICK, count, &precision);
+	if(payload == NULL) return -1;
+	MadgwickCheckpointRecord record;
+	for(size_t i = 0; i < count; i++) {
+		memcpy(&record, payload + i * sizeof(record), sizeof(record));
+		if(!checkpoint_gap_valid(record.sample_rate, record.max_dt, record.gap_policy)) return -1;
+	}
+	for(size_t i = 0; i < count; i++) {
+		MadgwickAHRS* w = &workspaces[i];
+		memcpy(&record, payload + i * sizeof(record), sizeof(record));
+		w->sample_rate = (MA_PRECISION) record.sample_rate;
+		w->beta = (MA_PRECISION) record.beta;
+		w->zeta = (MA_PRECISION) record.zeta;
+		w->q0 = (MA_PRECISION) record.q[0];
+		w->q1 = (MA_PRECISION) record.q[1];
+		w->q2 = (MA_PRECISION) record.q[2];
+		w->q3 = (MA_PRECISION) record.q[3];
+		w->bias_x = (MA_PRECISION) record.bias[0];
+		w->bias_y = (MA_PRECISION) record.bias[1];
+		w->bias_z = (MA_PRECISION) record.bias[2];
+		w->max_dt = (MA_PRECISION) record.max_dt;
+		w->gap_policy = record.gap_policy;
+		w->has_timestamp = record.has_timestamp != 0;
+		w->has_accel_timestamp = record.has_accel_timestamp != 0;
+		w->has_mag_timestamp = record.has_mag_timestamp != 0;
+		w->timestamp = record.timestamp;
+		w->accel_timestamp = record.accel_timestamp;
+		w->mag_timestamp = record.mag_timestamp;
+		w->yaw = 0.0f;
+		w->pitch = 0.0f;
+		w->roll = 0.0f;
+		w->euler_dirty = 1;
+	}
+	return 0;
+}
+
+int mahony_ahrs_restore(MahonyAHRS* workspaces, size_t count, const void* buffer, size_t size){
+	if(workspaces == NULL || count == 0) return -1;
+	size_t precision;
+	const unsigned char* payload = checkpoint_expect(buffer, size, AHRS_CHECKPOINT_MAHONY, count, &precision);
+	if(payload == NULL) return -1;
+	MahonyCheckpointRecord record;
+	for(size_t i = 0; i < count; i++) {
+		memcpy(&record, payload + i * sizeof(record), sizeof(record));
+		if(!checkpoint_gap_valid(record.sample_rate, record.max_dt, record.gap_policy)) return -1;
+	}
+	for(size_t i = 0; i < count; i++) {
+		MahonyAHRS* w = &workspaces[i];
+		memcpy(&record, payload + i * sizeof(record), sizeof(record));
+		w->sample_rate = (MA_PRECISION) record.sample_rate;
+		w->two_kp = (MA_PRECISION) record.two_kp;
+		w->two_ki = (MA_PRECISION) record.two_ki;
+		w->q0 = (MA_PRECISION) record.q[0];
+		w->q1 = (MA_PRECISION) record.q[1];
+		w->q2 = (MA_PRECISION) record.q[2];
+		w->q3 = (MA_PRECISION) record.q[3];
+		w->integralFBx = (MA_PRECISION) record.integralFB[0];
+		w->integralFBy = (MA_PRECISION) record.integralFB[1];
+		w->integralFBz = (MA_PRECISION) record.integralFB[2];
+		w->max_dt = (MA_PRECISION) record.max_dt;
+		w->gap_policy = record.gap_policy;
+		w->has_timestamp = record.has_timestamp != 0;
+		w->has_accel_timestamp = record.has_accel_timestamp != 0;
+		w->has_mag_timestamp = record.has_mag_timestamp != 0;
+		w->timestamp = record.timestamp;
+		w->accel_timestamp = record.accel_timestamp;
+		w->mag_timestamp = record.mag_timestamp;
+		w->yaw = 0.0f;
+		w->pitch = 0.0f;
+		w->roll = 0.0f;
+		w->euler_dirty = 1;
+	}
+	return 0;
+}
+
+//====================================================================================================
+// Banks
+
+// The saved arrays, in payload order
+static void madgwick_bank_arrays(const MadgwickAHRSBank* bank, MA_PRECISION** arrays){
+	arrays[0] = bank->sample_rate;
+	arrays[1] = bank->q0;
+	arrays[2] = bank->q1;
+	arrays[3] = bank->q2;
+	arrays[4] = bank->q3;
+	arrays[5] = bank->beta;
+}
+
+static void mahony_bank_arrays(const MahonyAHRSBank* bank, MA_PRECISION** arrays){
+	arrays[0] = bank->sample_rate;
+	arrays[1] = bank->q0;
+	arrays[2] = bank->q1;
+	arrays[3] = bank->q2;
+	arrays[4] = bank->q3;
+	arrays[5] = bank->integralFBx;
+	arrays[6] = bank->integralFBy;
+	arrays[7] = bank->integralFBz;
+	arrays[8] = bank->two_kp;
+	arrays[9] = bank->two_ki;
+}
+
+static void checkpoint_write_arrays(void* buffer, MA_PRECISION* const* arrays, int fields, size_t count){
+	unsigned char* payload = (unsigned char *) buffer + sizeof(AHRSCheckpointHeader);
+	for(int f = 0; f < fields; f++) memcpy(payload + f * count * sizeof(MA_PRECISION), arrays[f], count * sizeof(MA_PRECISION));
+}
+
+static void checkpoint_read_arrays(MA_PRECISION* const* arrays, const unsigned char* payload, size_t precision, int fields, size_t count){
+	for(int f = 0; f < fields; f++) checkpoint_read_array(arrays[f], payload + f * count * precision, precision, count);
+}
+
+size_t madgwick_ahrs_bank_checkpoint_size(size_t count){
+	return checkpoint_size(AHRS_CHECKPOINT_MADGWICK_BANK, count);
+}
+
+size_t mahony_ahrs_bank_checkpoint_size(size_t count){
+	return checkpoint_size(AHRS_CHECKPOINT_MAHONY_BANK, count);
+}
+
+size_t madgwick_ahrs_bank_checkpoint(const MadgwickAHRSBank* bank, void* buffer, size_t size){
+	if(bank == NULL || bank->count == 0 || buffer == NULL) return 0;
+	const size_t bytes = madgwick_ahrs_bank_checkpoint_size(bank->count);
+	if(size < bytes) return 0;
+	MA_PRECISION* arrays[MADGWICK_BANK_FIELDS];
+	madgwick_bank_arrays(bank, arrays);
+	checkpoint_write_arrays(buffer, arrays, MADGWICK_BANK_FIELDS, bank->count);
+	checkpoint_finish(buffer, AHRS_CHECKPOINT_MADGWICK_BANK, bank->count);
+	return bytes;
+}
+
+size_t mahony_ahrs_bank_checkpoint(const MahonyAHRSBank* bank, void* buffer, size_t size){
+	if(bank == NULL || bank->count == 0 || buffer == NULL) return 0;
+	const size_t bytes = mahony_ahrs_bank_checkpoint_size(bank->count);
+	if(size < bytes) return 0;
+	MA_PRECISION* arrays[MAHONY_BANK_FIELDS];
+	mahony_bank_arrays(bank, arrays);
+	checkpoint_write_arrays(buffer, arrays, MAHONY_BANK_FIELDS, bank->count);
+	checkpoint_finish(buffer, AHRS_CHECKPOINT_MAHONY_BANK, bank->count);
+	return bytes;
+}
+
+int madgwick_ahrs_bank_restore(MadgwickAHRSBank* bank, const void* buffer, size_t size){
+	if(bank == NULL || bank->count == 0) return -1;
+	size_t precision;
+	const unsigned char* payload = checkpoint_expect(buffer, size, AHRS_CHECKPOINT_MADGWICK_BANK, bank->count, &precision);
+	if(payload == NULL || !checkpoint_rates_valid(payload, precision, bank->count)) return -1;
+	MA_PRECISION* arrays[MADGWICK_BANK_FIELDS];
+	madgwick_bank_arrays(bank, arrays);
+	checkpoint_read_arrays(arrays, payload, precision, MADGWICK_BANK_FIELDS, bank->count);
+	for(size_t i = 0; i < bank->count; i++) bank->sample_period[i] = 1.0f / bank->sample_rate[i];
+	return 0;
+}
+
+int mahony_ahrs_bank_restore(MahonyAHRSBank* bank, const void* buffer, size_t size){
+	if(bank == NULL || bank->count == 0) return -1;
+	size_t precision;
+	const unsigned char* payload = checkpoint_expect(buffer, size, AHRS_CHECKPOINT_MAHONY_BANK, bank->count, &precision);
+	if(payload == NULL || !checkpoint_rates_valid(payload, precision, bank->count)) return -1;
+	MA_PRECISION* arrays[MAHONY_BANK_FIELDS];
+	mahony_bank_arrays(bank, arrays);
+	checkpoint_read_arrays(arrays, payload, precision, MAHONY_BANK_FIELDS, bank->count);
+	for(size_t i = 0; i < bank->count; i++) bank->sample_period[i] = 1.0f / bank->sample_rate[i];
+	return 0;
+}
@@ -0,0 +1,86 @@
+//=====================================================================================================
+// ahrs_checkpoint.h
+//=====================================================================================================
+//
+// Versioned binary checkpoints of filter state, to move a running filter to another process (or
+// keep it across a restart) without reconverging from the identity quaternion.
+//
+// A checkpoint is an AHRSCheckpointHeader followed by the state of header.count filters:
+//   kind AHRS_CHECKPOINT_MADGWICK / _MAHONY            one record per workspace (the arrays of a pool
+//                                                      or a single filter), values as double
+//   kind AHRS_CHECKPOINT_MADGWICK_BANK / _MAHONY_BANK  header.fields state arrays of count elements,
+//                                                      in the precision of the writer's build
+// Every piece of state the filter carries on is saved: quaternion, sample rate, gains, the Mahony
+// integral feedback, and the Madgwick gyro bias, gap policy and last sensor timestamps of workspaces;
+// the Euler angles are recomputed on demand. Restores accept either precision. The header checksums
+// the payload.
+// Fields are in host byte order (little-endian on all supported targets, checked at build time), as
+// in ahrs_log.h; the buffer needs no particular alignment.
+//
+// A bank checkpoint is a copy of its arrays plus a checksum pass, a few GB/s: 10000 Mahony filters
+// take 0.4 MB and about 0.15 ms, and go to a file or socket in one write (bench/checkpoint_bench.c).
+//
+//=====================================================================================================
+#ifndef __AHRS_CHECKPOINT_H__
+#define __AHRS_CHECKPOINT_H__
+
+#include "madgwick_ahrs.h"
+#include "mahony_ahrs.h"
+#include "madgwick_ahrs_bank.h"
+#include "mahony_ahrs_bank.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AHRS_CHECKPOINT_MAGIC "AHRSCKP"    // 8 bytes including the terminating NUL
+#define AHRS_CHECKPOINT_VERSION 2
+#define AHRS_CHECKPOINT_MADGWICK 1
+#define AHRS_CHECKPOINT_MAHONY 2
+#define AHRS_CHECKPOINT_MADGWICK_BANK 3
+#define AHRS_CHECKPOINT_MAHONY_BANK 4
+
+typedef struct {
+    char magic[8];
+    uint16_t version;
+    uint16_t kind;
+    uint16_t precision;     // bytes per floating point value of the payload, 4 or 8
+    uint16_t fields;        // values per filter
+    uint64_t count;         // filters
+    uint64_t checksum;      // of the payload
+} AHRSCheckpointHeader;     // 32 bytes
+
+//---------------------------------------------------------------------------------------------------
+// Function declarations
+
+// Bytes of the checkpoint of `count` workspaces, or of the `count` filters of a bank
+size_t madgwick_ahrs_checkpoint_size(size_t count);
+size_t mahony_ahrs_checkpoint_size(size_t count);
+size_t madgwick_ahrs_bank_checkpoint_size(size_t count);
+size_t mahony_ahrs_bank_checkpoint_size(size_t count);
+
+// Writes the checkpoint of workspaces[0 .. count - 1], or of filters 0 .. bank->count - 1, to `buffer`.
+// Returns the bytes written, 0 when `size` is too small or there is nothing to save.
+size_t madgwick_ahrs_checkpoint(const MadgwickAHRS* workspaces, size_t count, void* buffer, size_t size);
+size_t mahony_ahrs_checkpoint(const MahonyAHRS* workspaces, size_t count, void* buffer, size_t size);
+size_t madgwick_ahrs_bank_checkpoint(const MadgwickAHRSBank* bank, void* buffer, size_t size);
+size_t mahony_ahrs_bank_checkpoint(const MahonyAHRSBank* bank, void* buffer, size_t size);
+
+// Restores workspaces[0 .. count - 1] (allocated, need not be initialised), or the filters of the
+// bank, from the first `size` bytes of `buffer`. Returns 0, or -1 and leaves the filters untouched
+// when the buffer is not an intact checkpoint of this kind and count (bank: bank->count), or holds a
+// sample rate <= 0.
+int madgwick_ahrs_restore(MadgwickAHRS* workspaces, size_t count, const void* buffer, size_t size);
+int mahony_ahrs_restore(MahonyAHRS* workspaces, size_t count, const void* buffer, size_t size);
+int madgwick_ahrs_bank_restore(MadgwickAHRSBank* bank, const void* buffer, size_t size);
+int mahony_ahrs_bank_restore(MahonyAHRSBank* bank, const void* buffer, size_t size);
+
+// Kind of the checkpoint in `buffer` and its filter count, e.g. to create the bank to restore into;
+// 0 when it is not an intact checkpoint. `count` may be NULL.
+uint16_t ahrs_checkpoint_kind(const void* buffer, size_t size, uint64_t* count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AHRS_CHECKPOINT_H__ */
@@ -0,0 +1,114 @@
+//=====================================================================================================
+// ahrs_dispatch.c
+//=====================================================================================================
+//
+// Load-time selection of the bank kernels, see ahrs_dispatch.h. The kernel variants are
+// madgwick_ahrs_bank_kernel.c, mahony_ahrs_bank_kernel.c and ahrs_quaternion_kernel.c compiled with
+// AHRS_KERNEL_TARGET set to
+// sse2, sse4_2, avx2 and avx512; each public entry point is a GNU indirect function whose resolver
+// runs once, while the dynamic linker (or the startup code of a static executable) relocates it.
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "ahrs_dispatch.h"
+#include "madgwick_ahrs_bank.h"
+#include "mahony_ahrs_bank.h"
+#include "ahrs_quaternion.h"
+#include "ahrs_simd.h"
+
+#if AHRS_DISPATCH
+
+//---------------------------------------------------------------------------------------------------
+// Variants
+
+typedef enum {
+	AHRS_TARGET_SSE2,
+	AHRS_TARGET_SSE4_2,
+	AHRS_TARGET_AVX2,
+	AHRS_TARGET_AVX512,
+} AHRSTarget;
+
+static const char* const ahrs_target_names[] = { "sse2", "sse4.2", "avx2", "avx512" };
+static const int ahrs_target_bytes[] = { 16, 16, 32, 64 };
+
+#define AHRS_DECLARE_VARIANTS(NAME, PARAMETERS) \
+	void NAME##_sse2 PARAMETERS; \
+	void NAME##_sse4_2 PARAMETERS; \
+	void NAME##_avx2 PARAMETERS; \
+	void NAME##_avx512 PARAMETERS;
+
+#define MADGWICK_IMU_PARAMETERS (MadgwickAHRSBank*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*)
+#define MADGWICK_PARAMETERS (MadgwickAHRSBank*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*)
+#define MAHONY_IMU_PARAMETERS (MahonyAHRSBank*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*)
+#define MAHONY_PARAMETERS (MahonyAHRSBank*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*)
+
+AHRS_DECLARE_VARIANTS(madgwick_ahrs_bank_update_imu, MADGWICK_IMU_PARAMETERS)
+AHRS_DECLARE_VARIANTS(madgwick_ahrs_bank_update, MADGWICK_PARAMETERS)
+AHRS_DECLARE_VARIANTS(mahony_ahrs_bank_update_imu, MAHONY_IMU_PARAMETERS)
+AHRS_DECLARE_VARIANTS(mahony_ahrs_bank_update, MAHONY_PARAMETERS)
+
+#define ROTATE_PARAMETERS (const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, size_t, MA_PRECISION*, MA_PRECISION*, MA_PRECISION*)
+#define LINEAR_PARAMETERS (const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, MA_PRECISION, size_t, MA_PRECISION*, MA_PRECISION*, MA_PRECISION*)
+#define MATRIX_PARAMETERS (const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, const MA_PRECISION*, size_t, MA_PRECISION*)
+
+AHRS_DECLARE_VARIANTS(ahrs_quaternion_rotate, ROTATE_PARAMETERS)
+AHRS_DECLARE_VARIANTS(ahrs_quaternion_rotate_inverse, ROTATE_PARAMETERS)
+AHRS_DECLARE_VARIANTS(ahrs_quaternion_linear_acceleration, LINEAR_PARAMETERS)
+AHRS_DECLARE_VARIANTS(ahrs_quaternion_to_matrix, MATRIX_PARAMETERS)
+
+// Widest variant the CPU runs. __builtin_cpu_supports also checks that the OS saves the AVX and
+// AVX-512 registers. Resolvers run before constructors, hence the explicit __builtin_cpu_init.
+static AHRSTarget ahrs_target(void){
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f")) return AHRS_TARGET_AVX512;
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return AHRS_TARGET_AVX2;
+	if(__builtin_cpu_supports("sse4.2")) return AHRS_TARGET_SSE4_2;
+	return AHRS_TARGET_SSE2;
+}
+
+//---------------------------------------------------------------------------------------------------
+// Resolvers
+
+#define AHRS_DISPATCH_FUNCTION(NAME, PARAMETERS) \
+	typedef void (*NAME##_function) PARAMETERS; \
+	static NAME##_function NAME##_resolve(void){ \
+		switch(ahrs_target()) { \
+		case AHRS_TARGET_AVX512: return NAME##_avx512; \
+		case AHRS_TARGET_AVX2: return NAME##_avx2; \
+		case AHRS_TARGET_SSE4_2: return NAME##_sse4_2; \
+		default: return NAME##_sse2; \
+		} \
+	} \
+	void NAME PARAMETERS __attribute__((ifunc(#NAME "_resolve")));
+
+AHRS_DISPATCH_FUNCTION(madgwick_ahrs_bank_update_imu, MADGWICK_IMU_PARAMETERS)
+AHRS_DISPATCH_FUNCTION(madgwick_ahrs_bank_update, MADGWICK_PARAMETERS)
+AHRS_DISPATCH_FUNCTION(mahony_ahrs_bank_update_imu, MAHONY_IMU_PARAMETERS)
+AHRS_DISPATCH_FUNCTION(mahony_ahrs_bank_update, MAHONY_PARAMETERS)
+AHRS_DISPATCH_FUNCTION(ahrs_quaternion_rotate, ROTATE_PARAMETERS)
+AHRS_DISPATCH_FUNCTION(ahrs_quaternion_rotate_inverse, ROTATE_PARAMETERS)
+AHRS_DISPATCH_FUNCTION(ahrs_quaternion_linear_acceleration, LINEAR_PARAMETERS)
+AHRS_DISPATCH_FUNCTION(ahrs_quaternion_to_matrix, MATRIX_PARAMETERS)
+
+const char* ahrs_bank_isa(void){
+	return ahrs_target_names[ahrs_target()];
+}
+
+int ahrs_bank_lanes(void){
+	return ahrs_target_bytes[ahrs_target()] / (int) sizeof(MA_PRECISION);
+}
+
+#else
+
+const char* ahrs_bank_isa(void){
+	return AHRS_SIMD_ISA;
+}
+
+int ahrs_bank_lanes(void){
+	return AHRS_SIMD_WIDTH;
+}
+
+#endif
@@ -0,0 +1,29 @@
+//=====================================================================================================
+// ahrs_dispatch.h
+//=====================================================================================================
+//
+// Instruction set of the filter bank kernels. Built with AHRS_DISPATCH (the default with GCC or
+// Clang on x86-64 ELF targets), the bank update entry points and the planar quaternion kernels of
+// ahrs_quaternion.h are resolved once, when the library is loaded, to the widest of their SSE2,
+// SSE4.2, AVX2 + FMA and AVX-512F variants that the CPU and OS support; otherwise they use the
+// instruction set the library was compiled for.
+//
+//=====================================================================================================
+#ifndef __AHRS_DISPATCH_H__
+#define __AHRS_DISPATCH_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Name of the instruction set the bank kernels run with, e.g. "avx2"
+const char* ahrs_bank_isa(void);
+
+// Filters stepped per vector instruction by the bank kernels, at MA_PRECISION
+int ahrs_bank_lanes(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AHRS_DISPATCH_H__ */
@@ -0,0 +1,36 @@
+//=====================================================================================================
+// ahrs_fixed.c
+//=====================================================================================================
+//
+// Seed table of the integer rsqrt, see ahrs_fixed.h.
+//
+//=====================================================================================================
+#include "ahrs_fixed.h"
+
+// round(2^30 / sqrt((i + 64.5) / 256)): 1 / sqrt at the centre of each 1/256 wide mantissa interval
+const uint32_t ahrs_fixed_rsqrt_seed[192] = {
+	2139143874, 2122751726, 2106730729, 2091067086, 2075747707, 2060760163, 2046092644, 2031733922,
+	2017673311, 2003900636, 1990406202, 1977180765, 1964215505, 1951502003, 1939032214, 1926798450,
+	1914793358, 1903009903, 1891441346, 1880081235, 1868923385, 1857961863, 1847190978, 1836605270,
+	1826199490, 1815968600, 1805907755, 1796012296, 1786277740, 1776699774, 1767274245, 1757997150,
+	1748864636, 1739872984, 1731018611, 1722298059, 1713707990, 1705245183, 1696906526, 1688689013,
+	1680589738, 1672605894, 1664734763, 1656973720, 1649320221, 1641771805, 1634326089, 1626980766,
+	1619733600, 1612582423, 1605525136, 1598559701, 1591684144, 1584896547, 1578195052, 1571577853,
+	1565043197, 1558589383, 1552214758, 1545917715, 1539696693, 1533550174, 1527476684, 1521474788,
+	1515543090, 1509680232, 1503884893, 1498155787, 1492491662, 1486891298, 1481353508, 1475877137,
+	1470461055, 1465104167, 1459805400, 1454563712, 1449378085, 1444247527, 1439171070, 1434147770,
+	1429176706, 1424256978, 1419387709, 1414568043, 1409797142, 1405074190, 1400398389, 1395768961,
+	1391185142, 1386646190, 1382151377, 1377699992, 1373291341, 1368924744, 1364599536, 1360315069,
+	1356070705, 1351865825, 1347699819, 1343572091, 1339482060, 1335429155, 1331412818, 1327432501,
+	1323487671, 1319577802, 1315702382, 1311860907, 1308052885, 1304277832, 1300535277, 1296824755,
+	1293145812, 1289498003, 1285880891, 1282294047, 1278737053, 1275209495, 1271710972, 1268241085,
+	1264799448, 1261385678, 1257999402, 1254640252, 1251307868, 1248001897, 1244721991, 1241467811,
+	1238239020, 1235035292, 1231856302, 1228701736, 1225571280, 1222464631, 1219381487, 1216321553,
+	1213284541, 1210270165, 1207278145, 1204308207, 1201360079, 1198433497, 1195528200, 1192643930,
+	1189780435, 1186937467, 1184114781, 1181312139, 1178529303, 1175766042, 1173022127, 1170297333,
+	1167591440, 1164904229, 1162235487, 1159585004, 1156952571, 1154337986, 1151741047, 1149161556,
+	1146599320, 1144054146, 1141525847, 1139014236, 1136519130, 1134040351, 1131577719, 1129131062,
+	1126700207, 1124284984, 1121885226, 1119500771, 1117131454, 1114777118, 1112437604, 1110112758,
+	1107802427, 1105506461, 1103224711, 1100957032, 1098703280, 1096463311, 1094236988, 1092024170,
+	1089824724, 1087638513, 1085465407, 1083305275, 1081157988, 1079023419, 1076901444, 1074791939,
+};
@@ -0,0 +1,170 @@
+//=====================================================================================================
+// ahrs_fixed.h
+//=====================================================================================================
+//
+// Fixed-point arithmetic of the integer filters (madgwick_ahrs_fixed.h, mahony_ahrs_fixed.h), for
+// cores without an FPU. Nothing here or in the integer filters touches float at run time.
+//
+// Q formats, value = integer / 2^frac, all int32_t:
+//   AHRS_FIXED_Q_UNIT  30  quaternion, normalised vectors, orientation errors    range +-2
+//   AHRS_FIXED_Q_RATE  24  angular rate in rad/s, filter gains (beta, 2Kp, 2Ki)   range +-128
+//   AHRS_FIXED_Q_TIME  30  sample period in s                                     up to 2 s
+// Accelerometer and magnetometer readings are plain int32_t in any scale (raw sensor counts are
+// fine): the filters only use their direction, normalised with the integer rsqrt below.
+//
+// Saturation: where a result can leave its format it is clamped to +-INT32_MAX instead of wrapping,
+// so that an out of range gyro reading or gain costs accuracy on that sample rather than flipping the
+// sign of the state. The Mahony integral feedback is additionally held within +-2 rad/s (Q_UNIT).
+// Products are formed in 64 bits and truncated towards -infinity when shifted back.
+//
+//=====================================================================================================
+#ifndef __AHRS_FIXED_H__
+#define __AHRS_FIXED_H__
+
+#include "arhs.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AHRS_FIXED_Q_UNIT 30
+#define AHRS_FIXED_Q_RATE 24
+#define AHRS_FIXED_Q_TIME 30
+
+// Compile-time conversion of a constant, e.g. AHRS_FIXED(0.033, AHRS_FIXED_Q_RATE); rounds to nearest
+#define AHRS_FIXED(VALUE, FRAC) ((int32_t)((VALUE) * (double)(1L << (FRAC)) + ((VALUE) < 0 ? -0.5 : 0.5)))
+
+// Strided view over int32_t 3-axis samples, as AHRSSensorArray for the float filters
+typedef struct {
+    const int32_t* x;
+    const int32_t* y;
+    const int32_t* z;
+    size_t stride;
+} AHRSFixedSensorArray;
+
+static inline AHRSFixedSensorArray ahrs_fixed_sensor_array_interleaved(const int32_t* xyz, size_t stride){
+	AHRSFixedSensorArray array = { xyz, xyz + 1, xyz + 2, stride };
+	return array;
+}
+
+static inline AHRSFixedSensorArray ahrs_fixed_sensor_array_planar(const int32_t* x, const int32_t* y, const int32_t* z){
+	AHRSFixedSensorArray array = { x, y, z, 1 };
+	return array;
+}
+
+//---------------------------------------------------------------------------------------------------
+// Integer reciprocal square root
+
+// 2^30 / sqrt((i + 64.5) / 256) for i = 0 .. 191, the Newton seed per 8-bit mantissa
+extern const uint32_t ahrs_fixed_rsqrt_seed[192];
+
+MA_INLINE int ahrs_fixed_clz64(uint64_t x){
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_clzll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index;
+	_BitScanReverse64(&index, x);
+	return 63 - (int) index;
+#else
+	int n = 0;
+	while(!(x & ((uint64_t)1 << 63))) {
+		x <<= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+// 1 / sqrt(x) = result / 2^*exponent for x > 0, result in [2^30, 2^31] and *exponent in 31 .. 62.
+// The argument is shifted by an even count into [2^62, 2^64), which leaves a mantissa m in [1/4, 1);
+// a table seed good to 0.4% and two Newton steps y * (3 - m y^2) / 2 give about 30 correct bits.
+MA_INLINE uint32_t ahrs_fixed_rsqrt(uint64_t x, int* exponent){
+	int shift = ahrs_fixed_clz64(x) & ~1;
+	uint64_t m = x << shift;
+	uint64_t m31 = m >> 33; // Q31
+	uint64_t y = ahrs_fixed_rsqrt_seed[(m >> 56) - 64]; // Q30
+	for(int i = 0; i < 2; i++) {
+		int64_t p = (int64_t)((m31 * ((y * y) >> 30)) >> 31); // m y^2, Q30
+		y = (y * (uint64_t)((3LL << 30) - p)) >> 31;
+	}
+	*exponent = 62 - shift / 2;
+	return (uint32_t) y;
+}
+
+//---------------------------------------------------------------------------------------------------
+// Helpers of the integer kernels
+
+MA_INLINE int32_t ahrs_fixed_saturate(int64_t x){
+	return x > INT32_MAX ? INT32_MAX : x < -INT32_MAX ? -INT32_MAX : (int32_t) x;
+}
+
+// a * b / 2^frac
+MA_INLINE int64_t ahrs_fixed_mul(int64_t a, int64_t b, int frac){
+	return (a * b) >> frac;
+}
+
+// Scales v[0 .. n - 1] to unit length in Q_UNIT. Returns 0 when v is zero (v is left unchanged).
+MA_INLINE int ahrs_fixed_normalise(int32_t* v, int n){
+	uint64_t sum = 0;
+	for(int i = 0; i < n; i++) sum += (uint64_t)((int64_t) v[i] * v[i]); // < n * 2^62, fits for n <= 4
+	if(sum == 0) return 0;
+	int exponent;
+	int64_t r = ahrs_fixed_rsqrt(sum, &exponent);
+	for(int i = 0; i < n; i++) v[i] = (int32_t)((v[i] * r) >> (exponent - AHRS_FIXED_Q_UNIT));
+	return 1;
+}
+
+// ahrs_fixed_normalise for a 64-bit vector: shifted down to int32_t first
+MA_INLINE int ahrs_fixed_normalise_wide(const int64_t* w, int32_t* v, int n){
+	uint64_t largest = 0;
+	for(int i = 0; i < n; i++) {
+		uint64_t a = (uint64_t)(w[i] < 0 ? -w[i] : w[i]);
+		if(a > largest) largest = a;
+	}
+	int shift = 0;
+	while((largest >> shift) >= ((uint64_t)1 << 30)) shift++;
+	for(int i = 0; i < n; i++) v[i] = (int32_t)(w[i] >> shift);
+	return ahrs_fixed_normalise(v, n);
+}
+
+// Rotates q (Q_UNIT) by the body rate (gx, gy, gz) (Q_RATE) held for dt (Q_TIME), first order, and
+// renormalises: q += q * (0, g) * dt / 2, the integration of the float kernels. `correction`, when not
+// NULL, is subtracted from the increment (Q_UNIT, already scaled by dt), the Madgwick feedback step.
+MA_INLINE void ahrs_fixed_integrate(int32_t* q, int32_t dt, int32_t gx, int32_t gy, int32_t gz, const int32_t* correction){
+	// half angle increments, Q_UNIT: Q_RATE * Q_TIME / 2^(Q_RATE + 1)
+	int64_t hx = ahrs_fixed_saturate(ahrs_fixed_mul(gx, dt, AHRS_FIXED_Q_RATE + 1));
+	int64_t hy = ahrs_fixed_saturate(ahrs_fixed_mul(gy, dt, AHRS_FIXED_Q_RATE + 1));
+	int64_t hz = ahrs_fixed_saturate(ahrs_fixed_mul(gz, dt, AHRS_FIXED_Q_RATE + 1));
+	int64_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	int64_t d0 = (-q1 * hx - q2 * hy - q3 * hz) >> AHRS_FIXED_Q_UNIT;
+	int64_t d1 = (q0 * hx + q2 * hz - q3 * hy) >> AHRS_FIXED_Q_UNIT;
+	int64_t d2 = (q0 * hy - q1 * hz + q3 * hx) >> AHRS_FIXED_Q_UNIT;
+	int64_t d3 = (q0 * hz + q1 * hy - q2 * hx) >> AHRS_FIXED_Q_UNIT;
+	if(correction != NULL) {
+		d0 -= correction[0];
+		d1 -= correction[1];
+		d2 -= correction[2];
+		d3 -= correction[3];
+	}
+	int32_t next[4] = { ahrs_fixed_saturate(q0 + d0), ahrs_fixed_saturate(q1 + d1), ahrs_fixed_saturate(q2 + d2), ahrs_fixed_saturate(q3 + d3) };
+	if(!ahrs_fixed_normalise(next, 4)) return; // a zero quaternion is unreachable from a unit one; keep q
+	q[0] = next[0];
+	q[1] = next[1];
+	q[2] = next[2];
+	q[3] = next[3];
+}
+
+// Sample period in Q_TIME of an integer rate in Hz, 0 for rate 0
+MA_INLINE int32_t ahrs_fixed_period(uint32_t sample_rate){
+	if(sample_rate == 0) return 0;
+	return (int32_t)((((uint64_t)1 << AHRS_FIXED_Q_TIME) + sample_rate / 2) / sample_rate);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AHRS_FIXED_H__ */
@@ -0,0 +1,320 @@
+//=====================================================================================================
+// ahrs_fleet.c
+//=====================================================================================================
+//
+// Sharded multi-threaded fleet of filters, see ahrs_fleet.h.
+//
+// Worker 0 is the thread calling ahrs_fleet_update, workers 1..n-1 are pool threads parked on a
+// condition variable between updates. An update publishes the inputs, bumps a generation counter,
+// runs shard 0 itself and waits until every pool thread has finished its shard.
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "ahrs_fleet.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct {
+    void* filter;
+    AHRSFleetAlgorithm algorithm;
+    MA_PRECISION sample_rate;
+    size_t worker;      // AHRS_FLEET_INVALID until the first balance after it was added
+    uint64_t work;      // samples since the previous balance, gathered from the shard at balance
+} AHRSFleetDevice;
+
+// Devices of one worker. Only that worker touches `work` and `samples` during an update.
+typedef struct {
+    AHRSFleet* fleet;
+    pthread_t thread;
+    size_t* devices;    // indices, ascending
+    uint64_t* work;     // samples per device since the previous balance, parallel to devices
+    size_t count;
+    size_t capacity;
+    uint64_t samples;   // sum of work
+} AHRSFleetShard;
+
+struct AHRSFleet {
+    AHRSFleetDevice* devices;
+    size_t device_count;
+    size_t device_capacity;
+    int unbalanced;     // devices added since the previous balance
+
+    AHRSFleetShard* shards;
+    size_t worker_count;
+    size_t thread_count; // pool threads started, worker_count - 1 once created
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    const AHRSFleetInput* inputs;
+    uint64_t generation;
+    size_t running;     // pool threads still working on the current generation
+    int stop;
+};
+
+//---------------------------------------------------------------------------------------------------
+// Workers
+
+static void fleet_update_device(AHRSFleetDevice* device, const AHRSFleetInput* in){
+	if(device->algorithm == AHRS_FLEET_MADGWICK) {
+		if(in->mag.x != NULL) madgwick_ahrs_update_batch((MadgwickAHRS *) device->filter, in->gyro, in->accel, in->mag, in->count, in->quaternions);
+		else madgwick_ahrs_update_imu_batch((MadgwickAHRS *) device->filter, in->gyro, in->accel, in->count, in->quaternions);
+	} else {
+		if(in->mag.x != NULL) mahony_ahrs_update_batch((MahonyAHRS *) device->filter, in->gyro, in->accel, in->mag, in->count, in->quaternions);
+		else mahony_ahrs_update_imu_batch((MahonyAHRS *) device->filter, in->gyro, in->accel, in->count, in->quaternions);
+	}
+}
+
+static void fleet_run_shard(AHRSFleetShard* shard, const AHRSFleetInput* inputs){
+	AHRSFleetDevice* devices = shard->fleet->devices;
+	uint64_t samples = 0;
+	for(size_t k = 0; k < shard->count; k++) {
+		const AHRSFleetInput* in = &inputs[shard->devices[k]];
+		if(in->count == 0) continue;
+		fleet_update_device(&devices[shard->devices[k]], in);
+		shard->work[k] += in->count;
+		samples += in->count;
+	}
+	shard->samples += samples;
+}
+
+static void* fleet_worker(void* argument){
+	AHRSFleetShard* shard = (AHRSFleetShard *) argument;
+	AHRSFleet* fleet = shard->fleet;
+	uint64_t seen = 0;
+	pthread_mutex_lock(&fleet->lock);
+	for(;;) {
+		while(fleet->generation == seen && !fleet->stop) pthread_cond_wait(&fleet->start, &fleet->lock);
+		if(fleet->stop) break;
+		seen = fleet->generation;
+		const AHRSFleetInput* inputs = fleet->inputs;
+		pthread_mutex_unlock(&fleet->lock);
+
+		fleet_run_shard(shard, inputs);
+
+		pthread_mutex_lock(&fleet->lock);
+		if(--fleet->running == 0) pthread_cond_signal(&fleet->done);
+	}
+	pthread_mutex_unlock(&fleet->lock);
+	return NULL;
+}
+
+//---------------------------------------------------------------------------------------------------
+// Balance: longest processing time first, each device to the least loaded worker
+
+typedef struct {
+    double weight;
+    size_t device;
+    size_t worker;
+} AHRSFleetWeight;
+
+static int fleet_weight_compare(const void* a, const void* b){
+	const AHRSFleetWeight* x = (const AHRSFleetWeight *) a;
+	const AHRSFleetWeight* y = (const AHRSFleetWeight *) b;
+	if(x->weight != y->weight) return x->weight > y->weight ? -1 : 1;
+	return x->device < y->device ? -1 : x->device > y->device;
+}
+
+static int fleet_balance(AHRSFleet* fleet){
+	AHRSFleetWeight* weights = (AHRSFleetWeight *) malloc((fleet->device_count + 1) * sizeof(AHRSFleetWeight));
+	double* load = (double *) calloc(fleet->worker_count, sizeof(double));
+	size_t* counts = (size_t *) calloc(fleet->worker_count, sizeof(size_t));
+	if(weights == NULL || load == NULL || counts == NULL) {
+		free(weights);
+		free(load);
+		free(counts);
+		return -1;
+	}
+
+	// Gather the observed work; devices not observed yet are weighed by their rate, scaled to
+	// samples with the ratio of observed work to nominal rate of the others
+	for(size_t w = 0; w < fleet->worker_count; w++) {
+		AHRSFleetShard* shard = &fleet->shards[w];
+		for(size_t k = 0; k < shard->count; k++) fleet->devices[shard->devices[k]].work = shard->work[k];
+	}
+	double observed = 0.0, observed_rate = 0.0;
+	for(size_t d = 0; d < fleet->device_count; d++) {
+		if(fleet->devices[d].worker == AHRS_FLEET_INVALID) continue;
+		observed += (double) fleet->devices[d].work;
+		observed_rate += fleet->devices[d].sample_rate;
+	}
+	double scale = observed > 0.0 ? observed / observed_rate : 1.0;
+	for(size_t d = 0; d < fleet->device_count; d++) {
+		const AHRSFleetDevice* device = &fleet->devices[d];
+		weights[d].weight = device->worker != AHRS_FLEET_INVALID && observed > 0.0 ? (double) device->work : scale * device->sample_rate;
+		weights[d].device = d;
+	}
+	qsort(weights, fleet->device_count, sizeof(AHRSFleetWeight), fleet_weight_compare);
+
+	for(size_t d = 0; d < fleet->device_count; d++) {
+		size_t least = 0;
+		for(size_t w = 1; w < fleet->worker_count; w++)
+			if(load[w] < load[least]) least = w;
+		load[least] += weights[d].weight;
+		weights[d].worker = least;
+		counts[least]++;
+	}
+
+	// Reserve first, so running out of memory leaves the previous assignment intact
+	for(size_t w = 0; w < fleet->worker_count; w++) {
+		AHRSFleetShard* shard = &fleet->shards[w];
+		if(counts[w] <= shard->capacity) continue;
+		size_t* devices = (size_t *) realloc(shard->devices, counts[w] * sizeof(size_t));
+		if(devices != NULL) shard->devices = devices;
+		uint64_t* work = (uint64_t *) realloc(shard->work, counts[w] * sizeof(uint64_t));
+		if(work != NULL) shard->work = work;
+		if(devices == NULL || work == NULL) {
+			free(counts);
+			free(load);
+			free(weights);
+			return -1;
+		}
+		shard->capacity = counts[w];
+	}
+	for(size_t d = 0; d < fleet->device_count; d++) fleet->devices[weights[d].device].worker = weights[d].worker;
+	free(counts);
+	free(load);
+	free(weights);
+
+	// Rebuild the shards in device order, so each worker walks its inputs forwards
+	for(size_t w = 0; w < fleet->worker_count; w++) {
+		fleet->shards[w].count = 0;
+		fleet->shards[w].samples = 0;
+	}
+	for(size_t d = 0; d < fleet->device_count; d++) {
+		AHRSFleetShard* shard = &fleet->shards[fleet->devices[d].worker];
+		shard->devices[shard->count] = d;
+		shard->work[shard->count] = 0;
+		shard->count++;
+		fleet->devices[d].work = 0;
+	}
+	fleet->unbalanced = 0;
+	return 0;
+}
+
+//====================================================================================================
+// Functions
+
+AHRSFleet* create_ahrs_fleet(size_t worker_count){
+	if(worker_count == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		worker_count = cpus > 0 ? (size_t) cpus : 1;
+	}
+	AHRSFleet* fleet = (AHRSFleet *) calloc(1, sizeof(AHRSFleet));
+	if(fleet == NULL) return NULL;
+	fleet->shards = (AHRSFleetShard *) calloc(worker_count, sizeof(AHRSFleetShard));
+	if(fleet->shards == NULL) {
+		free(fleet);
+		return NULL;
+	}
+	fleet->worker_count = worker_count;
+	pthread_mutex_init(&fleet->lock, NULL);
+	pthread_cond_init(&fleet->start, NULL);
+	pthread_cond_init(&fleet->done, NULL);
+	for(size_t w = 0; w < worker_count; w++) fleet->shards[w].fleet = fleet;
+	for(size_t w = 1; w < worker_count; w++) {
+		if(pthread_create(&fleet->shards[w].thread, NULL, fleet_worker, &fleet->shards[w]) != 0) {
+			free_ahrs_fleet(fleet);
+			return NULL;
+		}
+		fleet->thread_count++;
+	}
+	return fleet;
+}
+
+void free_ahrs_fleet(AHRSFleet* fleet){
+	if(fleet == NULL) return;
+	pthread_mutex_lock(&fleet->lock);
+	fleet->stop = 1;
+	pthread_cond_broadcast(&fleet->start);
+	pthread_mutex_unlock(&fleet->lock);
+	for(size_t w = 1; w <= fleet->thread_count; w++) pthread_join(fleet->shards[w].thread, NULL);
+	pthread_cond_destroy(&fleet->done);
+	pthread_cond_destroy(&fleet->start);
+	pthread_mutex_destroy(&fleet->lock);
+
+	for(size_t d = 0; d < fleet->device_count; d++) {
+		if(fleet->devices[d].algorithm == AHRS_FLEET_MADGWICK) free_madgwick_ahrs((MadgwickAHRS *) fleet->devices[d].filter);
+		else free_mahony_ahrs((MahonyAHRS *) fleet->devices[d].filter);
+	}
+	for(size_t w = 0; w < fleet->worker_count; w++) {
+		free(fleet->shards[w].devices);
+		free(fleet->shards[w].work);
+	}
+	free(fleet->shards);
+	free(fleet->devices);
+	free(fleet);
+}
+
+size_t ahrs_fleet_add_device(AHRSFleet* fleet, AHRSFleetAlgorithm algorithm, MA_PRECISION sample_rate){
+	if(fleet == NULL || sample_rate <= 0) return AHRS_FLEET_INVALID;
+	if(fleet->device_count == fleet->device_capacity) {
+		size_t capacity = fleet->device_capacity ? 2 * fleet->device_capacity : 64;
+		AHRSFleetDevice* devices = (AHRSFleetDevice *) realloc(fleet->devices, capacity * sizeof(AHRSFleetDevice));
+		if(devices == NULL) return AHRS_FLEET_INVALID;
+		fleet->devices = devices;
+		fleet->device_capacity = capacity;
+	}
+	void* filter = algorithm == AHRS_FLEET_MADGWICK ? (void *) create_madgwick_ahrs(sample_rate) : (void *) create_mahony_ahrs(sample_rate);
+	if(filter == NULL) return AHRS_FLEET_INVALID;
+	AHRSFleetDevice* device = &fleet->devices[fleet->device_count];
+	device->filter = filter;
+	device->algorithm = algorithm;
+	device->sample_rate = sample_rate;
+	device->worker = AHRS_FLEET_INVALID;
+	device->work = 0;
+	fleet->unbalanced = 1;
+	return fleet->device_count++;
+}
+
+size_t ahrs_fleet_device_count(const AHRSFleet* fleet){
+	return fleet == NULL ? 0 : fleet->device_count;
+}
+
+size_t ahrs_fleet_worker_count(const AHRSFleet* fleet){
+	return fleet == NULL ? 0 : fleet->worker_count;
+}
+
+void* ahrs_fleet_filter(AHRSFleet* fleet, size_t device){
+	if(fleet == NULL || device >= fleet->device_count) return NULL;
+	return fleet->devices[device].filter;
+}
+
+int ahrs_fleet_update(AHRSFleet* fleet, const AHRSFleetInput* inputs){
+	if(fleet == NULL || inputs == NULL) return -1;
+	if(fleet->device_count == 0) return 0;
+	if(fleet->unbalanced && fleet_balance(fleet) != 0) return -1;
+
+	pthread_mutex_lock(&fleet->lock);
+	fleet->inputs = inputs;
+	fleet->running = fleet->thread_count;
+	fleet->generation++;
+	pthread_cond_broadcast(&fleet->start);
+	pthread_mutex_unlock(&fleet->lock);
+
+	fleet_run_shard(&fleet->shards[0], inputs);
+
+	pthread_mutex_lock(&fleet->lock);
+	while(fleet->running > 0) pthread_cond_wait(&fleet->done, &fleet->lock);
+	pthread_mutex_unlock(&fleet->lock);
+	return 0;
+}
+
+void ahrs_fleet_rebalance(AHRSFleet* fleet){
+	if(fleet == NULL) return;
+	fleet_balance(fleet);
+}
+
+size_t ahrs_fleet_device_worker(const AHRSFleet* fleet, size_t device){
+	if(fleet == NULL || device >= fleet->device_count) return AHRS_FLEET_INVALID;
+	return fleet->devices[device].worker;
+}
+
+uint64_t ahrs_fleet_worker_samples(const AHRSFleet* fleet, size_t worker){
+	if(fleet == NULL || worker >= fleet->worker_count) return 0;
+	return fleet->shards[worker].samples;
+}
@@ -0,0 +1,83 @@
+//=====================================================================================================
+// ahrs_fleet.h
+//=====================================================================================================
+//
+// Fleet of independent per-device filters (MadgwickAHRS or MahonyAHRS) updated in parallel by a
+// pool of worker threads.
+//
+// Devices are partitioned into one shard per worker and a device is only ever updated by the worker
+// owning its shard, so the filters need no locks: the workers synchronise once per
+// ahrs_fleet_update call, not per sample. Shards are balanced by work, not by device count: a device
+// weighs its sample count since the previous balance, or its nominal sample rate before it has been
+// observed, so a 1 kHz device counts as much as twenty 50 Hz ones. Assignments stay fixed until
+// ahrs_fleet_rebalance, or until devices are added.
+//
+// Apart from ahrs_fleet_update itself, no function may be called while an update is running.
+// POSIX threads; the library only includes the fleet where they are available (AHRS_HAVE_FLEET).
+//
+//=====================================================================================================
+#ifndef __AHRS_FLEET_H__
+#define __AHRS_FLEET_H__
+
+#include "madgwick_ahrs.h"
+#include "mahony_ahrs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AHRS_FLEET_INVALID ((size_t) -1)
+
+typedef enum {
+    AHRS_FLEET_MADGWICK,
+    AHRS_FLEET_MAHONY
+} AHRSFleetAlgorithm;
+
+// Samples of one device for one ahrs_fleet_update call
+typedef struct {
+    AHRSSensorArray gyro;
+    AHRSSensorArray accel;
+    AHRSSensorArray mag;        // mag.x == NULL: IMU update without magnetometer
+    size_t count;               // number of samples, 0 when the device has none this time
+    MA_PRECISION* quaternions;  // NULL, or 4 * count elements receiving q after every sample
+} AHRSFleetInput;
+
+// Holds threads, so only handled through pointers
+typedef struct AHRSFleet AHRSFleet;
+
+// `worker_count` threads including the caller's; 0 for one per online CPU
+AHRSFleet* create_ahrs_fleet(size_t worker_count);
+void free_ahrs_fleet(AHRSFleet* fleet);
+
+//---------------------------------------------------------------------------------------------------
+// Function declarations
+
+// Adds a device with a new filter and returns its index (0, 1, 2, ... in order of addition), or
+// AHRS_FLEET_INVALID when out of memory. The device is assigned to a worker by the next update.
+size_t ahrs_fleet_add_device(AHRSFleet* fleet, AHRSFleetAlgorithm algorithm, MA_PRECISION sample_rate);
+
+size_t ahrs_fleet_device_count(const AHRSFleet* fleet);
+size_t ahrs_fleet_worker_count(const AHRSFleet* fleet);
+
+// MadgwickAHRS* or MahonyAHRS* of `device`, e.g. to change gains or read Euler angles between updates
+void* ahrs_fleet_filter(AHRSFleet* fleet, size_t device);
+
+// Runs inputs[device] through the filter of every device (ahrs_fleet_device_count entries) and
+// returns when all are done. Returns 0, or -1 for NULL arguments or when assigning added devices
+// runs out of memory; then no device has been updated and the next call retries the assignment.
+int ahrs_fleet_update(AHRSFleet* fleet, const AHRSFleetInput* inputs);
+
+// Reassigns the devices to workers by the samples each received since the previous balance
+void ahrs_fleet_rebalance(AHRSFleet* fleet);
+
+// Worker owning `device`, AHRS_FLEET_INVALID before its first update
+size_t ahrs_fleet_device_worker(const AHRSFleet* fleet, size_t device);
+
+// Samples processed by `worker` since the previous balance, to judge the balance
+uint64_t ahrs_fleet_worker_samples(const AHRSFleet* fleet, size_t worker);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AHRS_FLEET_H__ */
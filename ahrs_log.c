@@ -0,0 +1,45 @@
+//=====================================================================================================
+// ahrs_log.c
+//=====================================================================================================
+//
+// Binary IMU log format, see ahrs_log.h.
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "ahrs_log.h"
+#include <string.h>
+
+// The layout is the file format: fail the build if a compiler pads it differently
+typedef char ahrs_log_header_size_check[sizeof(AHRSLogHeader) == 32 ? 1 : -1];
+typedef char ahrs_log_record_size_check[sizeof(AHRSLogRecord) == 48 ? 1 : -1];
+typedef char ahrs_log_quaternion_size_check[sizeof(AHRSLogQuaternion) == 16 ? 1 : -1];
+
+// Logs are mapped and read in host order, so the little-endian format needs a little-endian host
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "ahrs_log: the log format is little-endian and big-endian hosts are not supported"
+#endif
+
+//====================================================================================================
+// Functions
+
+void ahrs_log_header_init(AHRSLogHeader* header, uint16_t kind, double sample_rate, uint64_t record_count){
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, AHRS_LOG_MAGIC, sizeof(header->magic));
+	header->version = AHRS_LOG_VERSION;
+	header->kind = kind;
+	header->record_size = kind == AHRS_LOG_KIND_SAMPLES ? sizeof(AHRSLogRecord) : sizeof(AHRSLogQuaternion);
+	header->sample_rate = sample_rate;
+	header->record_count = record_count;
+}
+
+int ahrs_log_header_valid(const AHRSLogHeader* header, uint16_t kind, uint64_t file_size){
+	if(header == NULL || file_size < sizeof(AHRSLogHeader)) return 0;
+	if(memcmp(header->magic, AHRS_LOG_MAGIC, sizeof(header->magic)) != 0) return 0;
+	if(header->version != AHRS_LOG_VERSION || header->kind != kind) return 0;
+	if(header->record_size != (kind == AHRS_LOG_KIND_SAMPLES ? sizeof(AHRSLogRecord) : sizeof(AHRSLogQuaternion))) return 0;
+	if(!(header->sample_rate > 0)) return 0;
+	return header->record_count <= (file_size - sizeof(AHRSLogHeader)) / header->record_size;
+}
@@ -0,0 +1,89 @@
+//=====================================================================================================
+// ahrs_log.h
+//=====================================================================================================
+//
+// Fixed-record binary IMU log format, made to be memory mapped and fed to the batch updates without
+// parsing or copying.
+//
+// A file is an AHRSLogHeader followed by header.record_count records of header.record_size bytes:
+//   kind AHRS_LOG_KIND_SAMPLES      AHRSLogRecord, timestamp + device id + 9-axis sample
+//   kind AHRS_LOG_KIND_QUATERNIONS  AHRSLogQuaternion, one per sample record of the replayed log
+// Fields are in host byte order (little-endian on all supported targets, checked at build time),
+// samples are float regardless of MA_PRECISION. Records of one device should be stored in runs of
+// consecutive samples (e.g. sorted by device, then time): every run goes through one batch update call.
+//
+//=====================================================================================================
+#ifndef __AHRS_LOG_H__
+#define __AHRS_LOG_H__
+
+#include "arhs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AHRS_LOG_MAGIC "AHRSLOG"    // 8 bytes including the terminating NUL
+#define AHRS_LOG_VERSION 1
+#define AHRS_LOG_KIND_SAMPLES 1
+#define AHRS_LOG_KIND_QUATERNIONS 2
+
+typedef struct {
+    char magic[8];
+    uint16_t version;
+    uint16_t kind;
+    uint32_t record_size;
+    double sample_rate;     // Hz, nominal rate of every device in the log
+    uint64_t record_count;
+} AHRSLogHeader;            // 32 bytes, records start 8-byte aligned
+
+typedef struct {
+    uint64_t timestamp;     // ns
+    uint32_t device_id;
+    float gyro[3];          // rad/s
+    float accel[3];
+    float mag[3];           // all zero when the device has no magnetometer
+} AHRSLogRecord;            // 48 bytes
+
+typedef struct {
+    float q[4];             // q0, q1, q2, q3 after the sample
+} AHRSLogQuaternion;
+
+// Stride of the sensor fields in AHRSLogRecord arrays, in floats
+#define AHRS_LOG_RECORD_STRIDE (sizeof(AHRSLogRecord) / sizeof(float))
+
+//---------------------------------------------------------------------------------------------------
+// Function declarations
+
+void ahrs_log_header_init(AHRSLogHeader* header, uint16_t kind, double sample_rate, uint64_t record_count);
+
+// 1 when `header` starts a valid log of `kind` whose records fit in `file_size` bytes, else 0
+int ahrs_log_header_valid(const AHRSLogHeader* header, uint16_t kind, uint64_t file_size);
+
+static inline const AHRSLogRecord* ahrs_log_records(const AHRSLogHeader* header){
+	return (const AHRSLogRecord *) (header + 1);
+}
+
+static inline AHRSLogQuaternion* ahrs_log_quaternions(AHRSLogHeader* header){
+	return (AHRSLogQuaternion *) (header + 1);
+}
+
+#if !MA_DOUBLE_PRECISION
+// Sensor views straight into mapped records, for the *_batch updates (float builds only)
+static inline AHRSSensorArray ahrs_log_gyro(const AHRSLogRecord* records){
+	return ahrs_sensor_array_interleaved(records->gyro, AHRS_LOG_RECORD_STRIDE);
+}
+
+static inline AHRSSensorArray ahrs_log_accel(const AHRSLogRecord* records){
+	return ahrs_sensor_array_interleaved(records->accel, AHRS_LOG_RECORD_STRIDE);
+}
+
+static inline AHRSSensorArray ahrs_log_mag(const AHRSLogRecord* records){
+	return ahrs_sensor_array_interleaved(records->mag, AHRS_LOG_RECORD_STRIDE);
+}
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AHRS_LOG_H__ */
@@ -0,0 +1,148 @@
+//=====================================================================================================
+// ahrs_parallel.c
+//=====================================================================================================
+//
+// Chunked parallel batch updates, see ahrs_parallel.h.
+//
+// Chunk 0 runs on the calling thread, chunks 1..n-1 on threads started for the call. Every chunk
+// works on its own copy of the filter and writes a disjoint range of the output, so the threads share
+// nothing but the read-only samples.
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "ahrs_parallel.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Batch update of one filter, IMU when mag.x == NULL
+typedef void (*AHRSParallelBatch)(void* filter, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions);
+
+typedef struct {
+    void* filter;       // copy of the workspace, aligned for chunks k > 0
+    AHRSParallelBatch batch;
+    AHRSSensorArray gyro;
+    AHRSSensorArray accel;
+    AHRSSensorArray mag;
+    size_t warmup;      // samples before `start` run without output
+    size_t start;
+    size_t count;
+    MA_PRECISION* quaternions;
+    pthread_t thread;
+    int started;
+} AHRSParallelChunk;
+
+static void madgwick_parallel_batch(void* filter, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions){
+	if(mag.x != NULL) madgwick_ahrs_update_batch((MadgwickAHRS *) filter, gyro, accel, mag, count, quaternions);
+	else madgwick_ahrs_update_imu_batch((MadgwickAHRS *) filter, gyro, accel, count, quaternions);
+}
+
+static void mahony_parallel_batch(void* filter, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions){
+	if(mag.x != NULL) mahony_ahrs_update_batch((MahonyAHRS *) filter, gyro, accel, mag, count, quaternions);
+	else mahony_ahrs_update_imu_batch((MahonyAHRS *) filter, gyro, accel, count, quaternions);
+}
+
+// `array` from sample `first` on
+static AHRSSensorArray parallel_slice(AHRSSensorArray array, size_t first){
+	if(array.x == NULL) return array;
+	const size_t offset = first * array.stride;
+	AHRSSensorArray slice = { array.x + offset, array.y + offset, array.z + offset, array.stride };
+	return slice;
+}
+
+static void* parallel_run_chunk(void* arg){
+	AHRSParallelChunk* chunk = (AHRSParallelChunk *) arg;
+	const size_t first = chunk->start - chunk->warmup;
+	if(chunk->warmup > 0)
+		chunk->batch(chunk->filter, parallel_slice(chunk->gyro, first), parallel_slice(chunk->accel, first), parallel_slice(chunk->mag, first), chunk->warmup, NULL);
+	chunk->batch(chunk->filter, parallel_slice(chunk->gyro, chunk->start), parallel_slice(chunk->accel, chunk->start), parallel_slice(chunk->mag, chunk->start),
+		chunk->count, chunk->quaternions + 4 * chunk->start);
+	return NULL;
+}
+
+// Number of chunks: thread_count (0: online CPUs), at most one per `warmup` samples
+static size_t parallel_chunk_count(size_t thread_count, size_t warmup, size_t count){
+	if(thread_count == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		thread_count = cpus > 0 ? (size_t) cpus : 1;
+	}
+	const size_t limit = warmup > 0 ? count / warmup : count;
+	if(thread_count > limit) thread_count = limit;
+	return thread_count > 0 ? thread_count : 1;
+}
+
+// Splits the stream over `n` chunks with their filter copies in `filters` (filter_size bytes each,
+// copies of the workspace; chunks k > 0 already aligned), runs them and waits for all
+static void parallel_run(AHRSParallelChunk* chunks, size_t n, char* filters, size_t filter_size, AHRSParallelBatch batch, size_t warmup, AHRSSensorArray gyro,
+	AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions){
+	for(size_t k = 0; k < n; k++) {
+		AHRSParallelChunk* chunk = &chunks[k];
+		chunk->filter = filters + k * filter_size;
+		chunk->batch = batch;
+		chunk->gyro = gyro;
+		chunk->accel = accel;
+		chunk->mag = mag;
+		chunk->start = count / n * k;
+		chunk->count = (k + 1 < n ? count / n * (k + 1) : count) - chunk->start;
+		chunk->warmup = k > 0 ? warmup : 0;
+		chunk->quaternions = quaternions;
+		chunk->started = k > 0 && pthread_create(&chunk->thread, NULL, parallel_run_chunk, chunk) == 0;
+	}
+	parallel_run_chunk(&chunks[0]);
+	for(size_t k = 1; k < n; k++) {
+		if(chunks[k].started) pthread_join(chunks[k].thread, NULL);
+		else parallel_run_chunk(&chunks[k]);
+	}
+}
+
+// First sample of chunk k > 0, where its warm-up starts
+static size_t parallel_first(size_t k, size_t n, size_t warmup, size_t count){
+	return count / n * k - warmup;
+}
+
+// Parallel batch update of either filter: `workspace` is filter_size bytes with q0, q1, q2, q3 in a
+// row at q_offset. Copies it per chunk, aligns chunks k > 0 at the first sample of their warm-up,
+// runs them and leaves the last chunk's state in the workspace.
+static int parallel_update(void* workspace, size_t filter_size, size_t q_offset, AHRSParallelBatch batch, size_t thread_count, size_t warmup,
+	AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions){
+	if(workspace == NULL || gyro.x == NULL || accel.x == NULL || quaternions == NULL) return -1;
+	if(count == 0) return 0;
+	const size_t n = parallel_chunk_count(thread_count, warmup, count);
+	AHRSParallelChunk* chunks = (AHRSParallelChunk *) malloc(n * sizeof(AHRSParallelChunk));
+	char* filters = (char *) malloc(n * filter_size);
+	if(chunks == NULL || filters == NULL) {
+		free(chunks);
+		free(filters);
+		return -1;
+	}
+	for(size_t k = 0; k < n; k++) {
+		memcpy(filters + k * filter_size, workspace, filter_size);
+		if(k == 0) continue;
+		const size_t first = parallel_first(k, n, warmup, count);
+		const size_t a = first * accel.stride, m = first * mag.stride;
+		MA_PRECISION q[4];
+		ahrs_align(q, mag.x != NULL, accel.x[a], accel.y[a], accel.z[a], mag.x ? mag.x[m] : 0.0f, mag.x ? mag.y[m] : 0.0f, mag.x ? mag.z[m] : 0.0f);
+		memcpy(filters + k * filter_size + q_offset, q, sizeof(q));
+	}
+	parallel_run(chunks, n, filters, filter_size, batch, warmup, gyro, accel, mag, count, quaternions);
+	memcpy(workspace, filters + (n - 1) * filter_size, filter_size);
+	free(chunks);
+	free(filters);
+	return 0;
+}
+
+//====================================================================================================
+// Functions
+
+int madgwick_ahrs_update_batch_parallel(MadgwickAHRS* workspace, size_t thread_count, size_t warmup, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions){
+	return parallel_update(workspace, sizeof(MadgwickAHRS), offsetof(MadgwickAHRS, q0), madgwick_parallel_batch, thread_count, warmup, gyro, accel, mag, count, quaternions);
+}
+
+int mahony_ahrs_update_batch_parallel(MahonyAHRS* workspace, size_t thread_count, size_t warmup, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions){
+	return parallel_update(workspace, sizeof(MahonyAHRS), offsetof(MahonyAHRS, q0), mahony_parallel_batch, thread_count, warmup, gyro, accel, mag, count, quaternions);
+}
@@ -0,0 +1,49 @@
+//=====================================================================================================
+// ahrs_parallel.h
+//=====================================================================================================
+//
+// One long sample stream (e.g. a 10 hour, 1 kHz recording) split into time chunks that run through
+// the batch updates on all cores at once, instead of one core doing the whole stream.
+//
+// The filters forget their initial state within a bounded time, so chunk k > 0 starts a copy of the
+// filter `warmup` samples before its first sample, aligned from that sample's accelerometer and
+// magnetometer (ahrs_align), runs the warm-up samples without output and then writes its own. The
+// first chunk continues the caller's filter exactly as the sequential batch update would. The chunk
+// outputs are written in place, so the result is one quaternion per sample as from the sequential
+// update; it differs from it only at the start of chunks, by what the warm-up has not converged.
+// bench/parallel_bench.c reports that divergence and the speedup against the thread count.
+//
+// The speedup against the core count is unverified: the bench has only run on a single CPU, where
+// the threads time-share and it shows the chunking and warm-up overhead alone (0.92 - 0.96 at 4
+// threads with a 30 s warm-up over 10 minutes). With idle cores the longest chunk bounds it at
+// count / (count / thread_count + warmup); the memory bandwidth of the sample stream may cap it lower.
+//
+// Each call starts and joins its threads; the filter's state afterwards is that of the last chunk.
+// Fixed sample rate only (no timestamps). POSIX threads, built where the fleet is (AHRS_HAVE_FLEET).
+//
+//=====================================================================================================
+#ifndef __AHRS_PARALLEL_H__
+#define __AHRS_PARALLEL_H__
+
+#include "madgwick_ahrs.h"
+#include "mahony_ahrs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------------------------------
+// Function declarations
+
+// Runs `count` samples through `workspace` in up to `thread_count` chunks (0: one per online CPU,
+// fewer when the chunks would be shorter than the warm-up) and writes q0, q1, q2, q3 of every sample
+// to `quaternions` (4 * count elements). mag.x == NULL runs the IMU updates. When a thread cannot be
+// started its chunk runs on the calling thread. Returns 0, or -1 for NULL arguments or out of memory.
+int madgwick_ahrs_update_batch_parallel(MadgwickAHRS* workspace, size_t thread_count, size_t warmup, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions);
+int mahony_ahrs_update_batch_parallel(MahonyAHRS* workspace, size_t thread_count, size_t warmup, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AHRS_PARALLEL_H__ */
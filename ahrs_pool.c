@@ -0,0 +1,251 @@
+//=====================================================================================================
+// ahrs_pool.c
+//=====================================================================================================
+//
+// Workspace pools, see ahrs_pool.h.
+//
+// The handle table is the usual sparse / dense pair: a handle names an entry, the entry names the
+// slot its filter currently lives in, and each slot names its entry back so that the swap on release
+// can repoint the moved filter's entry. Free entries are chained through their slot field.
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "ahrs_pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define HANDLE_INDEX_MASK (AHRS_POOL_MAX_CAPACITY - 1)
+
+//====================================================================================================
+// Handle table
+
+static int handle_table_init(AHRSHandleTable* t, size_t capacity){
+	t->capacity = capacity;
+	t->count = 0;
+	t->slot = (uint32_t *) malloc(capacity * sizeof(uint32_t));
+	t->entry = (uint32_t *) malloc(capacity * sizeof(uint32_t));
+	t->generation = (uint8_t *) malloc(capacity);
+	if(t->slot == NULL || t->entry == NULL || t->generation == NULL) {
+		free(t->slot);
+		free(t->entry);
+		free(t->generation);
+		return -1;
+	}
+	for(size_t i = 0; i < capacity; i++) {
+		t->slot[i] = (uint32_t)(i + 1);
+		t->generation[i] = 1;
+	}
+	t->free_entry = 0;
+	return 0;
+}
+
+static void handle_table_destroy(AHRSHandleTable* t){
+	free(t->slot);
+	free(t->entry);
+	free(t->generation);
+}
+
+// New handle at slot count - 1, AHRS_HANDLE_INVALID when full
+static AHRSHandle handle_table_acquire(AHRSHandleTable* t){
+	if(t->count == t->capacity) return AHRS_HANDLE_INVALID;
+	uint32_t e = t->free_entry;
+	t->free_entry = t->slot[e];
+	t->slot[e] = (uint32_t) t->count;
+	t->entry[t->count++] = e;
+	return (AHRSHandle) t->generation[e] << AHRS_HANDLE_INDEX_BITS | e;
+}
+
+size_t ahrs_handle_table_slot(const AHRSHandleTable* t, AHRSHandle handle){
+	if(t == NULL) return AHRS_POOL_NO_SLOT;
+	size_t e = handle & HANDLE_INDEX_MASK;
+	if(e >= t->capacity || t->generation[e] != handle >> AHRS_HANDLE_INDEX_BITS) return AHRS_POOL_NO_SLOT;
+	return t->slot[e];
+}
+
+// Frees the entry of `handle` and repoints the last slot's entry at `*slot`, its new home. Returns
+// the old last slot (the caller moves that filter into `*slot`), AHRS_POOL_NO_SLOT when stale.
+static size_t handle_table_release(AHRSHandleTable* t, AHRSHandle handle, size_t* slot){
+	*slot = ahrs_handle_table_slot(t, handle);
+	if(*slot == AHRS_POOL_NO_SLOT) return AHRS_POOL_NO_SLOT;
+	uint32_t e = handle & HANDLE_INDEX_MASK;
+	size_t last = --t->count;
+	uint32_t moved = t->entry[last];
+	t->entry[*slot] = moved;
+	t->slot[moved] = (uint32_t) *slot;
+
+	if(++t->generation[e] == 0) t->generation[e] = 1; // 0 would make AHRS_HANDLE_INVALID reachable
+	t->slot[e] = t->free_entry;
+	t->free_entry = e;
+	return last;
+}
+
+//====================================================================================================
+// Workspace arrays
+
+MadgwickAHRSPool* create_madgwick_ahrs_pool(size_t capacity){
+	if(capacity == 0 || capacity > AHRS_POOL_MAX_CAPACITY) return NULL;
+	MadgwickAHRSPool* pool = (MadgwickAHRSPool *) malloc(sizeof(MadgwickAHRSPool));
+	if(pool == NULL) return NULL;
+	pool->filters = (MadgwickAHRS *) ahrs_aligned_alloc(AHRS_POOL_ALIGNMENT, capacity * sizeof(MadgwickAHRS));
+	if(pool->filters == NULL || handle_table_init(&pool->handles, capacity) != 0) {
+		ahrs_aligned_free(pool->filters);
+		free(pool);
+		return NULL;
+	}
+	pool->count = 0;
+	pool->capacity = capacity;
+	return pool;
+}
+
+void free_madgwick_ahrs_pool(MadgwickAHRSPool* pool){
+	if(pool == NULL) return;
+	handle_table_destroy(&pool->handles);
+	ahrs_aligned_free(pool->filters);
+	free(pool);
+}
+
+AHRSHandle madgwick_ahrs_pool_acquire(MadgwickAHRSPool* pool, MA_PRECISION sample_rate){
+	if(pool == NULL || sample_rate <= 0) return AHRS_HANDLE_INVALID;
+	AHRSHandle handle = handle_table_acquire(&pool->handles);
+	if(handle == AHRS_HANDLE_INVALID) return AHRS_HANDLE_INVALID;
+	madgwick_ahrs_init(&pool->filters[pool->count++], sample_rate);
+	return handle;
+}
+
+void madgwick_ahrs_pool_release(MadgwickAHRSPool* pool, AHRSHandle handle){
+	if(pool == NULL) return;
+	size_t slot, last = handle_table_release(&pool->handles, handle, &slot);
+	if(last == AHRS_POOL_NO_SLOT) return;
+	if(slot != last) memcpy(&pool->filters[slot], &pool->filters[last], sizeof(MadgwickAHRS));
+	pool->count = last;
+}
+
+MadgwickAHRS* madgwick_ahrs_pool_get(MadgwickAHRSPool* pool, AHRSHandle handle){
+	if(pool == NULL) return NULL;
+	size_t slot = ahrs_handle_table_slot(&pool->handles, handle);
+	return slot == AHRS_POOL_NO_SLOT ? NULL : &pool->filters[slot];
+}
+
+MahonyAHRSPool* create_mahony_ahrs_pool(size_t capacity){
+	if(capacity == 0 || capacity > AHRS_POOL_MAX_CAPACITY) return NULL;
+	MahonyAHRSPool* pool = (MahonyAHRSPool *) malloc(sizeof(MahonyAHRSPool));
+	if(pool == NULL) return NULL;
+	pool->filters = (MahonyAHRS *) ahrs_aligned_alloc(AHRS_POOL_ALIGNMENT, capacity * sizeof(MahonyAHRS));
+	if(pool->filters == NULL || handle_table_init(&pool->handles, capacity) != 0) {
+		ahrs_aligned_free(pool->filters);
+		free(pool);
+		return NULL;
+	}
+	pool->count = 0;
+	pool->capacity = capacity;
+	return pool;
+}
+
+void free_mahony_ahrs_pool(MahonyAHRSPool* pool){
+	if(pool == NULL) return;
+	handle_table_destroy(&pool->handles);
+	ahrs_aligned_free(pool->filters);
+	free(pool);
+}
+
+AHRSHandle mahony_ahrs_pool_acquire(MahonyAHRSPool* pool, MA_PRECISION sample_rate){
+	if(pool == NULL || sample_rate <= 0) return AHRS_HANDLE_INVALID;
+	AHRSHandle handle = handle_table_acquire(&pool->handles);
+	if(handle == AHRS_HANDLE_INVALID) return AHRS_HANDLE_INVALID;
+	mahony_ahrs_init(&pool->filters[pool->count++], sample_rate);
+	return handle;
+}
+
+void mahony_ahrs_pool_release(MahonyAHRSPool* pool, AHRSHandle handle){
+	if(pool == NULL) return;
+	size_t slot, last = handle_table_release(&pool->handles, handle, &slot);
+	if(last == AHRS_POOL_NO_SLOT) return;
+	if(slot != last) memcpy(&pool->filters[slot], &pool->filters[last], sizeof(MahonyAHRS));
+	pool->count = last;
+}
+
+MahonyAHRS* mahony_ahrs_pool_get(MahonyAHRSPool* pool, AHRSHandle handle){
+	if(pool == NULL) return NULL;
+	size_t slot = ahrs_handle_table_slot(&pool->handles, handle);
+	return slot == AHRS_POOL_NO_SLOT ? NULL : &pool->filters[slot];
+}
+
+//====================================================================================================
+// Bank lanes
+
+MadgwickAHRSBankPool* create_madgwick_ahrs_bank_pool(size_t capacity){
+	if(capacity == 0 || capacity > AHRS_POOL_MAX_CAPACITY) return NULL;
+	MadgwickAHRSBankPool* pool = (MadgwickAHRSBankPool *) malloc(sizeof(MadgwickAHRSBankPool));
+	if(pool == NULL) return NULL;
+	pool->bank = create_madgwick_ahrs_bank(capacity, 1.0f);
+	if(pool->bank == NULL || handle_table_init(&pool->handles, capacity) != 0) {
+		free_madgwick_ahrs_bank(pool->bank);
+		free(pool);
+		return NULL;
+	}
+	pool->bank->count = 0;
+	return pool;
+}
+
+void free_madgwick_ahrs_bank_pool(MadgwickAHRSBankPool* pool){
+	if(pool == NULL) return;
+	handle_table_destroy(&pool->handles);
+	free_madgwick_ahrs_bank(pool->bank);
+	free(pool);
+}
+
+AHRSHandle madgwick_ahrs_bank_pool_acquire(MadgwickAHRSBankPool* pool, MA_PRECISION sample_rate){
+	if(pool == NULL || sample_rate <= 0) return AHRS_HANDLE_INVALID;
+	AHRSHandle handle = handle_table_acquire(&pool->handles);
+	if(handle == AHRS_HANDLE_INVALID) return AHRS_HANDLE_INVALID;
+	madgwick_ahrs_bank_reset(pool->bank, pool->bank->count++, sample_rate);
+	return handle;
+}
+
+void madgwick_ahrs_bank_pool_release(MadgwickAHRSBankPool* pool, AHRSHandle handle){
+	if(pool == NULL) return;
+	size_t slot, last = handle_table_release(&pool->handles, handle, &slot);
+	if(last == AHRS_POOL_NO_SLOT) return;
+	if(slot != last) madgwick_ahrs_bank_move(pool->bank, last, slot);
+	pool->bank->count = last;
+}
+
+MahonyAHRSBankPool* create_mahony_ahrs_bank_pool(size_t capacity){
+	if(capacity == 0 || capacity > AHRS_POOL_MAX_CAPACITY) return NULL;
+	MahonyAHRSBankPool* pool = (MahonyAHRSBankPool *) malloc(sizeof(MahonyAHRSBankPool));
+	if(pool == NULL) return NULL;
+	pool->bank = create_mahony_ahrs_bank(capacity, 1.0f);
+	if(pool->bank == NULL || handle_table_init(&pool->handles, capacity) != 0) {
+		free_mahony_ahrs_bank(pool->bank);
+		free(pool);
+		return NULL;
+	}
+	pool->bank->count = 0;
+	return pool;
+}
+
+void free_mahony_ahrs_bank_pool(MahonyAHRSBankPool* pool){
+	if(pool == NULL) return;
+	handle_table_destroy(&pool->handles);
+	free_mahony_ahrs_bank(pool->bank);
+	free(pool);
+}
+
+AHRSHandle mahony_ahrs_bank_pool_acquire(MahonyAHRSBankPool* pool, MA_PRECISION sample_rate){
+	if(pool == NULL || sample_rate <= 0) return AHRS_HANDLE_INVALID;
+	AHRSHandle handle = handle_table_acquire(&pool->handles);
+	if(handle == AHRS_HANDLE_INVALID) return AHRS_HANDLE_INVALID;
+	mahony_ahrs_bank_reset(pool->bank, pool->bank->count++, sample_rate);
+	return handle;
+}
+
+void mahony_ahrs_bank_pool_release(MahonyAHRSBankPool* pool, AHRSHandle handle){
+	if(pool == NULL) return;
+	size_t slot, last = handle_table_release(&pool->handles, handle, &slot);
+	if(last == AHRS_POOL_NO_SLOT) return;
+	if(slot != last) mahony_ahrs_bank_move(pool->bank, last, slot);
+	pool->bank->count = last;
+}
@@ -0,0 +1,110 @@
+//=====================================================================================================
+// ahrs_pool.h
+//=====================================================================================================
+//
+// Workspace pools for fleets whose devices come and go: one preallocated, cache-line aligned block of
+// filters instead of a malloc per filter, with O(1) acquire / release and stable integer handles.
+//
+// The live filters are kept dense: a pool of n live filters holds them in slots 0 .. n - 1, so a loop
+// over all of them walks memory linearly. Releasing a filter moves the last live one into its slot,
+// which is why callers hold handles, not pointers or slot numbers: a handle stays valid until its
+// filter is released, and a released handle is recognised as stale (up to 255 reuses of its entry).
+//
+//   MadgwickAHRSPool / MahonyAHRSPool          array of MadgwickAHRS / MahonyAHRS workspaces
+//   MadgwickAHRSBankPool / MahonyAHRSBankPool  lanes of a structure-of-arrays bank; the bank's count
+//                                              follows the live filters, so its updates step exactly
+//                                              those and input element i belongs to slot i
+//
+//=====================================================================================================
+#ifndef __AHRS_POOL_H__
+#define __AHRS_POOL_H__
+
+#include "madgwick_ahrs.h"
+#include "mahony_ahrs.h"
+#include "madgwick_ahrs_bank.h"
+#include "mahony_ahrs_bank.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Handle: entry index in the low AHRS_HANDLE_INDEX_BITS bits, reuse generation (1..255) above
+typedef uint32_t AHRSHandle;
+#define AHRS_HANDLE_INVALID 0u
+#define AHRS_HANDLE_INDEX_BITS 24
+#define AHRS_POOL_MAX_CAPACITY ((size_t)1 << AHRS_HANDLE_INDEX_BITS)
+#define AHRS_POOL_NO_SLOT ((size_t) -1)
+
+// Handle entries to dense slots, shared by all the pools
+typedef struct {
+    size_t capacity;
+    size_t count;           // live slots 0 .. count - 1
+    uint32_t* slot;         // per entry: its slot while live, the next free entry while free
+    uint32_t* entry;        // per slot: the entry pointing at it
+    uint8_t* generation;    // per entry
+    uint32_t free_entry;    // head of the free list, capacity when empty
+} AHRSHandleTable;
+
+typedef struct {
+    MadgwickAHRS* filters;  // filters[0 .. count - 1] are live, AHRS_POOL_ALIGNMENT aligned
+    size_t count;
+    size_t capacity;
+    AHRSHandleTable handles;
+} MadgwickAHRSPool;
+
+typedef struct {
+    MahonyAHRS* filters;    // filters[0 .. count - 1] are live, AHRS_POOL_ALIGNMENT aligned
+    size_t count;
+    size_t capacity;
+    AHRSHandleTable handles;
+} MahonyAHRSPool;
+
+typedef struct {
+    MadgwickAHRSBank* bank; // bank->count is the number of live filters
+    AHRSHandleTable handles;
+} MadgwickAHRSBankPool;
+
+typedef struct {
+    MahonyAHRSBank* bank;   // bank->count is the number of live filters
+    AHRSHandleTable handles;
+} MahonyAHRSBankPool;
+
+#define AHRS_POOL_ALIGNMENT 64
+
+// NULL for capacity 0 or above AHRS_POOL_MAX_CAPACITY, or out of memory
+MadgwickAHRSPool* create_madgwick_ahrs_pool(size_t capacity);
+void free_madgwick_ahrs_pool(MadgwickAHRSPool* pool);
+MahonyAHRSPool* create_mahony_ahrs_pool(size_t capacity);
+void free_mahony_ahrs_pool(MahonyAHRSPool* pool);
+MadgwickAHRSBankPool* create_madgwick_ahrs_bank_pool(size_t capacity);
+void free_madgwick_ahrs_bank_pool(MadgwickAHRSBankPool* pool);
+MahonyAHRSBankPool* create_mahony_ahrs_bank_pool(size_t capacity);
+void free_mahony_ahrs_bank_pool(MahonyAHRSBankPool* pool);
+
+//---------------------------------------------------------------------------------------------------
+// Function declarations
+
+// A new filter as from create_*, AHRS_HANDLE_INVALID when the pool is full or sample_rate <= 0
+AHRSHandle madgwick_ahrs_pool_acquire(MadgwickAHRSPool* pool, MA_PRECISION sample_rate);
+AHRSHandle mahony_ahrs_pool_acquire(MahonyAHRSPool* pool, MA_PRECISION sample_rate);
+AHRSHandle madgwick_ahrs_bank_pool_acquire(MadgwickAHRSBankPool* pool, MA_PRECISION sample_rate);
+AHRSHandle mahony_ahrs_bank_pool_acquire(MahonyAHRSBankPool* pool, MA_PRECISION sample_rate);
+
+// Releases the filter of `handle`; stale handles are ignored. Moves the last live filter.
+void madgwick_ahrs_pool_release(MadgwickAHRSPool* pool, AHRSHandle handle);
+void mahony_ahrs_pool_release(MahonyAHRSPool* pool, AHRSHandle handle);
+void madgwick_ahrs_bank_pool_release(MadgwickAHRSBankPool* pool, AHRSHandle handle);
+void mahony_ahrs_bank_pool_release(MahonyAHRSBankPool* pool, AHRSHandle handle);
+
+// Workspace of `handle`, NULL when stale; valid until the next release
+MadgwickAHRS* madgwick_ahrs_pool_get(MadgwickAHRSPool* pool, AHRSHandle handle);
+MahonyAHRS* mahony_ahrs_pool_get(MahonyAHRSPool* pool, AHRSHandle handle);
+
+// Current slot of `handle` (bank lane / filters index), AHRS_POOL_NO_SLOT when stale
+size_t ahrs_handle_table_slot(const AHRSHandleTable* handles, AHRSHandle handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AHRS_POOL_H__ */
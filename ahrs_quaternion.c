@@ -0,0 +1,43 @@
+//=====================================================================================================
+// ahrs_quaternion.c
+//=====================================================================================================
+//
+// Array kernels over quaternion streams, see ahrs_quaternion.h.
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "ahrs_quaternion.h"
+#include <math.h>
+
+//====================================================================================================
+// Functions
+
+void ahrs_quaternion_to_euler_batch(const MA_PRECISION* quaternions, size_t count, MA_PRECISION* euler)
+{
+	if(quaternions == NULL || euler == NULL) return;
+	for(size_t i = 0; i < count; i++, quaternions += 4, euler += 3) {
+		QUATERNION_TO_EULER(quaternions[0], quaternions[1], quaternions[2], quaternions[3], euler[0], euler[1], euler[2]);
+	}
+}
+
+void ahrs_quaternion_to_euler_planar(const MA_PRECISION* q0, const MA_PRECISION* q1, const MA_PRECISION* q2, const MA_PRECISION* q3, size_t count, MA_PRECISION* yaw, MA_PRECISION* pitch, MA_PRECISION* roll)
+{
+	if(q0 == NULL || q1 == NULL || q2 == NULL || q3 == NULL || yaw == NULL || pitch == NULL || roll == NULL) return;
+	for(size_t i = 0; i < count; i++) {
+		QUATERNION_TO_EULER(q0[i], q1[i], q2[i], q3[i], yaw[i], pitch[i], roll[i]);
+	}
+}
+
+void ahrs_quaternion_to_planar(const MA_PRECISION* quaternions, size_t count, MA_PRECISION* q0, MA_PRECISION* q1, MA_PRECISION* q2, MA_PRECISION* q3)
+{
+	if(quaternions == NULL || q0 == NULL || q1 == NULL || q2 == NULL || q3 == NULL) return;
+	for(size_t i = 0; i < count; i++, quaternions += 4) {
+		q0[i] = quaternions[0];
+		q1[i] = quaternions[1];
+		q2[i] = quaternions[2];
+		q3[i] = quaternions[3];
+	}
+}
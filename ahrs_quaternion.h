@@ -0,0 +1,62 @@
+//=====================================================================================================
+// ahrs_quaternion.h
+//=====================================================================================================
+//
+// Array kernels over the quaternion streams written by the batch update functions.
+// Interleaved quaternion arrays hold q0, q1, q2, q3 per sample, the layout of the `quaternions`
+// output of *_update_batch. Planar arrays hold one contiguous array per component, element i of each
+// belonging to sample i, the layout of the filter banks and of the SIMD kernels below, which step
+// ahrs_bank_lanes() samples per instruction with runtime dispatch (ahrs_dispatch.h).
+//
+// The earth frame is the filters' (x north, z up): R(q) rotates a sensor frame vector into it and
+// its transpose back. The batch updates can write the linear acceleration themselves
+// (*_update_batch_linear) without the quaternions going through memory at all; the kernels here are
+// for quaternions that are already stored. bench/downstream_bench.c compares them with per-sample
+// scalar code.
+//
+//=====================================================================================================
+#ifndef __AHRS_QUATERNION_H__
+#define __AHRS_QUATERNION_H__
+
+#include "arhs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------------------------------------
+// Function declarations
+
+// Converts `count` quaternions to yaw, pitch, roll (3 * count elements), same convention as *_get_euler
+void ahrs_quaternion_to_euler_batch(const MA_PRECISION* quaternions, size_t count, MA_PRECISION* euler);
+
+// Planar yaw, pitch and roll of planar quaternions, as ahrs_quaternion_to_euler_batch. The angles
+// take the libm atan2 and asin per sample, which bound its speed whatever the layout.
+void ahrs_quaternion_to_euler_planar(const MA_PRECISION* q0, const MA_PRECISION* q1, const MA_PRECISION* q2, const MA_PRECISION* q3, size_t count, MA_PRECISION* yaw, MA_PRECISION* pitch, MA_PRECISION* roll);
+
+// Splits `count` interleaved quaternions into planar arrays
+void ahrs_quaternion_to_planar(const MA_PRECISION* quaternions, size_t count, MA_PRECISION* q0, MA_PRECISION* q1, MA_PRECISION* q2, MA_PRECISION* q3);
+
+//---------------------------------------------------------------------------------------------------
+// SIMD kernels over planar arrays. Vector i is rotated by quaternion i; the outputs may be the input
+// vector arrays themselves.
+
+// Sensor to earth frame, R(q) v
+void ahrs_quaternion_rotate(const MA_PRECISION* q0, const MA_PRECISION* q1, const MA_PRECISION* q2, const MA_PRECISION* q3, const MA_PRECISION* x, const MA_PRECISION* y, const MA_PRECISION* z, size_t count, MA_PRECISION* out_x, MA_PRECISION* out_y, MA_PRECISION* out_z);
+
+// Earth to sensor frame, R(q)^T v
+void ahrs_quaternion_rotate_inverse(const MA_PRECISION* q0, const MA_PRECISION* q1, const MA_PRECISION* q2, const MA_PRECISION* q3, const MA_PRECISION* x, const MA_PRECISION* y, const MA_PRECISION* z, size_t count, MA_PRECISION* out_x, MA_PRECISION* out_y, MA_PRECISION* out_z);
+
+// Earth frame linear acceleration, R(q) a - (0, 0, gravity), as ahrs_linear_acceleration (arhs.h);
+// `gravity` is 1 for samples in g, 9.80665 in m/s^2
+void ahrs_quaternion_linear_acceleration(const MA_PRECISION* q0, const MA_PRECISION* q1, const MA_PRECISION* q2, const MA_PRECISION* q3, const MA_PRECISION* ax, const MA_PRECISION* ay, const MA_PRECISION* az, MA_PRECISION gravity, size_t count, MA_PRECISION* out_x, MA_PRECISION* out_y, MA_PRECISION* out_z);
+
+// Rotation matrices R(q) as 9 planes of `count` elements (9 * count): element (r, c) of sample i at
+// matrix[(3 * r + c) * count + i]
+void ahrs_quaternion_to_matrix(const MA_PRECISION* q0, const MA_PRECISION* q1, const MA_PRECISION* q2, const MA_PRECISION* q3, size_t count, MA_PRECISION* matrix);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AHRS_QUATERNION_H__ */
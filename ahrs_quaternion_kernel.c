@@ -0,0 +1,155 @@
+//=====================================================================================================
+// ahrs_quaternion_kernel.c
+//=====================================================================================================
+//
+// SIMD kernels over planar quaternion arrays, see ahrs_quaternion.h. With runtime dispatch this file
+// is compiled once per instruction set and ahrs_dispatch.c picks the variant (see ahrs_simd.h).
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "ahrs_quaternion.h"
+#include "ahrs_simd.h"
+
+#define QUATERNION_ROTATE 0
+#define QUATERNION_ROTATE_INVERSE 1
+#define QUATERNION_LINEAR 2
+
+#define QUATERNION_VECTOR_INPUTS 7 // q0 q1 q2 q3 x y z
+
+//====================================================================================================
+// Kernels
+
+// R(q), row-major, of AHRS_SIMD_WIDTH quaternions
+static inline void quaternion_matrix(ahrs_vec q0, ahrs_vec q1, ahrs_vec q2, ahrs_vec q3, ahrs_vec* r)
+{
+	const ahrs_vec one = ahrs_vec_set1(1.0f);
+	const ahrs_vec two = ahrs_vec_set1(2.0f);
+	ahrs_vec _2q1 = ahrs_vec_mul(two, q1);
+	ahrs_vec _2q2 = ahrs_vec_mul(two, q2);
+	ahrs_vec _2q3 = ahrs_vec_mul(two, q3);
+	ahrs_vec _2q0q1 = ahrs_vec_mul(_2q1, q0), _2q0q2 = ahrs_vec_mul(_2q2, q0), _2q0q3 = ahrs_vec_mul(_2q3, q0);
+	ahrs_vec _2q1q1 = ahrs_vec_mul(_2q1, q1), _2q1q2 = ahrs_vec_mul(_2q2, q1), _2q1q3 = ahrs_vec_mul(_2q3, q1);
+	ahrs_vec _2q2q2 = ahrs_vec_mul(_2q2, q2), _2q2q3 = ahrs_vec_mul(_2q3, q2), _2q3q3 = ahrs_vec_mul(_2q3, q3);
+	r[0] = ahrs_vec_sub(one, ahrs_vec_add(_2q2q2, _2q3q3));
+	r[1] = ahrs_vec_sub(_2q1q2, _2q0q3);
+	r[2] = ahrs_vec_add(_2q1q3, _2q0q2);
+	r[3] = ahrs_vec_add(_2q1q2, _2q0q3);
+	r[4] = ahrs_vec_sub(one, ahrs_vec_add(_2q1q1, _2q3q3));
+	r[5] = ahrs_vec_sub(_2q2q3, _2q0q1);
+	r[6] = ahrs_vec_sub(_2q1q3, _2q0q2);
+	r[7] = ahrs_vec_add(_2q2q3, _2q0q1);
+	r[8] = ahrs_vec_sub(one, ahrs_vec_add(_2q1q1, _2q2q2));
+}
+
+// Rotates the AHRS_SIMD_WIDTH vectors at in[k] + offset into out[k] + offset; `mode` is a
+// compile-time constant at every call site
+static inline void quaternion_rotate_step(const MA_PRECISION* const* in, MA_PRECISION* const* out, size_t offset, int mode, ahrs_vec gravity)
+{
+	ahrs_vec r[9];
+	quaternion_matrix(ahrs_vec_loadu(in[0] + offset), ahrs_vec_loadu(in[1] + offset), ahrs_vec_loadu(in[2] + offset), ahrs_vec_loadu(in[3] + offset), r);
+	ahrs_vec x = ahrs_vec_loadu(in[4] + offset);
+	ahrs_vec y = ahrs_vec_loadu(in[5] + offset);
+	ahrs_vec z = ahrs_vec_loadu(in[6] + offset);
+	ahrs_vec ox, oy, oz;
+	if(mode == QUATERNION_ROTATE_INVERSE) {
+		ox = ahrs_vec_add(ahrs_vec_add(ahrs_vec_mul(r[0], x), ahrs_vec_mul(r[3], y)), ahrs_vec_mul(r[6], z));
+		oy = ahrs_vec_add(ahrs_vec_add(ahrs_vec_mul(r[1], x), ahrs_vec_mul(r[4], y)), ahrs_vec_mul(r[7], z));
+		oz = ahrs_vec_add(ahrs_vec_add(ahrs_vec_mul(r[2], x), ahrs_vec_mul(r[5], y)), ahrs_vec_mul(r[8], z));
+	} else {
+		ox = ahrs_vec_add(ahrs_vec_add(ahrs_vec_mul(r[0], x), ahrs_vec_mul(r[1], y)), ahrs_vec_mul(r[2], z));
+		oy = ahrs_vec_add(ahrs_vec_add(ahrs_vec_mul(r[3], x), ahrs_vec_mul(r[4], y)), ahrs_vec_mul(r[5], z));
+		oz = ahrs_vec_add(ahrs_vec_add(ahrs_vec_mul(r[6], x), ahrs_vec_mul(r[7], y)), ahrs_vec_mul(r[8], z));
+		if(mode == QUATERNION_LINEAR) oz = ahrs_vec_sub(oz, gravity);
+	}
+	ahrs_vec_storeu(out[0] + offset, ox);
+	ahrs_vec_storeu(out[1] + offset, oy);
+	ahrs_vec_storeu(out[2] + offset, oz);
+}
+
+// Copies the first `remaining` lanes of staged outputs to out[k] + offset
+static inline void quaternion_unstage_tail(MA_PRECISION* const* out, MA_PRECISION staged[][AHRS_SIMD_WIDTH], size_t output_count, size_t offset, size_t remaining)
+{
+	for(size_t k = 0; k < output_count; k++)
+		for(size_t lane = 0; lane < remaining; lane++)
+			out[k][offset + lane] = staged[k][lane];
+}
+
+// Runs the rotation over all vectors, the last partial vector through zero padded buffers whose
+// padding lanes are dropped
+static inline void quaternion_rotate_run(const MA_PRECISION* const* in, MA_PRECISION* const* out, size_t count, int mode, MA_PRECISION gravity)
+{
+	const ahrs_vec g = ahrs_vec_set1(gravity);
+	size_t i = 0;
+	for(; i + AHRS_SIMD_WIDTH <= count; i += AHRS_SIMD_WIDTH)
+		quaternion_rotate_step(in, out, i, mode, g);
+	if(i < count) {
+		MA_PRECISION staged[QUATERNION_VECTOR_INPUTS][AHRS_SIMD_WIDTH];
+		MA_PRECISION staged_out[3][AHRS_SIMD_WIDTH];
+		const MA_PRECISION* staged_in[QUATERNION_VECTOR_INPUTS];
+		MA_PRECISION* const staged_out_arrays[3] = { staged_out[0], staged_out[1], staged_out[2] };
+		ahrs_bank_stage_tail(staged, staged_in, in, QUATERNION_VECTOR_INPUTS, i, count - i);
+		quaternion_rotate_step(staged_in, staged_out_arrays, 0, mode, g);
+		quaternion_unstage_tail(out, staged_out, 3, i, count - i);
+	}
+}
+
+static inline void quaternion_matrix_step(const MA_PRECISION* const* in, MA_PRECISION* const* out, size_t offset)
+{
+	ahrs_vec r[9];
+	quaternion_matrix(ahrs_vec_loadu(in[0] + offset), ahrs_vec_loadu(in[1] + offset), ahrs_vec_loadu(in[2] + offset), ahrs_vec_loadu(in[3] + offset), r);
+	for(int k = 0; k < 9; k++)
+		ahrs_vec_storeu(out[k] + offset, r[k]);
+}
+
+//====================================================================================================
+// Functions
+
+void AHRS_KERNEL_NAME(ahrs_quaternion_rotate)(const MA_PRECISION* q0, const MA_PRECISION* q1, const MA_PRECISION* q2, const MA_PRECISION* q3, const MA_PRECISION* x, const MA_PRECISION* y, const MA_PRECISION* z, size_t count, MA_PRECISION* out_x, MA_PRECISION* out_y, MA_PRECISION* out_z)
+{
+	if(q0 == NULL || q1 == NULL || q2 == NULL || q3 == NULL || x == NULL || y == NULL || z == NULL || out_x == NULL || out_y == NULL || out_z == NULL) return;
+	const MA_PRECISION* in[QUATERNION_VECTOR_INPUTS] = { q0, q1, q2, q3, x, y, z };
+	MA_PRECISION* const out[3] = { out_x, out_y, out_z };
+	quaternion_rotate_run(in, out, count, QUATERNION_ROTATE, 0.0f);
+}
+
+void AHRS_KERNEL_NAME(ahrs_quaternion_rotate_inverse)(const MA_PRECISION* q0, const MA_PRECISION* q1, const MA_PRECISION* q2, const MA_PRECISION* q3, const MA_PRECISION* x, const MA_PRECISION* y, const MA_PRECISION* z, size_t count, MA_PRECISION* out_x, MA_PRECISION* out_y, MA_PRECISION* out_z)
+{
+	if(q0 == NULL || q1 == NULL || q2 == NULL || q3 == NULL || x == NULL || y == NULL || z == NULL || out_x == NULL || out_y == NULL || out_z == NULL) return;
+	const MA_PRECISION* in[QUATERNION_VECTOR_INPUTS] = { q0, q1, q2, q3, x, y, z };
+	MA_PRECISION* const out[3] = { out_x, out_y, out_z };
+	quaternion_rotate_run(in, out, count, QUATERNION_ROTATE_INVERSE, 0.0f);
+}
+
+void AHRS_KERNEL_NAME(ahrs_quaternion_linear_acceleration)(const MA_PRECISION* q0, const MA_PRECISION* q1, const MA_PRECISION* q2, const MA_PRECISION* q3, const MA_PRECISION* ax, const MA_PRECISION* ay, const MA_PRECISION* az, MA_PRECISION gravity, size_t count, MA_PRECISION* out_x, MA_PRECISION* out_y, MA_PRECISION* out_z)
+{
+	if(q0 == NULL || q1 == NULL || q2 == NULL || q3 == NULL || ax == NULL || ay == NULL || az == NULL || out_x == NULL || out_y == NULL || out_z == NULL) return;
+	const MA_PRECISION* in[QUATERNION_VECTOR_INPUTS] = { q0, q1, q2, q3, ax, ay, az };
+	MA_PRECISION* const out[3] = { out_x, out_y, out_z };
+	quaternion_rotate_run(in, out, count, QUATERNION_LINEAR, gravity);
+}
+
+void AHRS_KERNEL_NAME(ahrs_quaternion_to_matrix)(const MA_PRECISION* q0, const MA_PRECISION* q1, const MA_PRECISION* q2, const MA_PRECISION* q3, size_t count, MA_PRECISION* matrix)
+{
+	if(q0 == NULL || q1 == NULL || q2 == NULL || q3 == NULL || matrix == NULL) return;
+	const MA_PRECISION* in[4] = { q0, q1, q2, q3 };
+	MA_PRECISION* out[9];
+	for(int k = 0; k < 9; k++)
+		out[k] = matrix + (size_t) k * count;
+	size_t i = 0;
+	for(; i + AHRS_SIMD_WIDTH <= count; i += AHRS_SIMD_WIDTH)
+		quaternion_matrix_step(in, out, i);
+	if(i < count) {
+		MA_PRECISION staged[4][AHRS_SIMD_WIDTH];
+		MA_PRECISION staged_out[9][AHRS_SIMD_WIDTH];
+		const MA_PRECISION* staged_in[4];
+		MA_PRECISION* staged_out_arrays[9];
+		for(int k = 0; k < 9; k++)
+			staged_out_arrays[k] = staged_out[k];
+		ahrs_bank_stage_tail(staged, staged_in, in, 4, i, count - i);
+		quaternion_matrix_step(staged_in, staged_out_arrays, 0);
+		quaternion_unstage_tail(out, staged_out, 9, i, count - i);
+	}
+}
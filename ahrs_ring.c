@@ -0,0 +1,172 @@
+//=====================================================================================================
+// ahrs_ring.c
+//=====================================================================================================
+//
+// SPSC sample ring and quaternion seqlock, see ahrs_ring.h.
+//
+// head and tail count samples since creation and are masked into the slot array, so head - tail is
+// the fill level without a wasted slot. Each index is written by one side only and sits on its own
+// cache line next to that side's cached copy of the other index, so the two threads only share a
+// line when the cached copy runs out.
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "ahrs_ring.h"
+#include <stdatomic.h>
+#include <string.h>
+
+#define AHRS_RING_CACHE_LINE 64
+
+typedef char ahrs_ring_sample_stride_check[sizeof(AHRSRingSample) % sizeof(MA_PRECISION) == 0 ? 1 : -1];
+
+struct AHRSSampleRing {
+    _Alignas(AHRS_RING_CACHE_LINE) atomic_size_t head; // next slot to write, producer
+    size_t cached_tail;                                 // producer's last view of tail
+    _Alignas(AHRS_RING_CACHE_LINE) atomic_size_t tail; // next slot to read, consumer
+    size_t cached_head;                                 // consumer's last view of head
+    _Alignas(AHRS_RING_CACHE_LINE) size_t mask;        // capacity - 1
+    AHRSRingSample* slots;
+};
+
+struct AHRSQuaternionSeqlock {
+    _Alignas(AHRS_RING_CACHE_LINE) atomic_uint sequence; // odd while a publish is in progress
+    _Atomic MA_PRECISION q[4];
+    _Atomic uint64_t timestamp;
+};
+
+//====================================================================================================
+// Functions
+
+AHRSSampleRing* create_ahrs_sample_ring(size_t capacity){
+	if(capacity == 0 || capacity > ((size_t) -1 >> 2) / sizeof(AHRSRingSample)) return NULL;
+	size_t size = 1;
+	while(size < capacity) size <<= 1;
+	AHRSSampleRing* ring = (AHRSSampleRing *) ahrs_aligned_alloc(AHRS_RING_CACHE_LINE, sizeof(AHRSSampleRing));
+	if(ring == NULL) return NULL;
+	ring->slots = (AHRSRingSample *) ahrs_aligned_alloc(AHRS_RING_CACHE_LINE, size * sizeof(AHRSRingSample));
+	if(ring->slots == NULL) {
+		ahrs_aligned_free(ring);
+		return NULL;
+	}
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	ring->cached_tail = 0;
+	ring->cached_head = 0;
+	ring->mask = size - 1;
+	return ring;
+}
+
+void free_ahrs_sample_ring(AHRSSampleRing* ring){
+	if(ring == NULL) return;
+	ahrs_aligned_free(ring->slots);
+	ahrs_aligned_free(ring);
+}
+
+size_t ahrs_ring_push(AHRSSampleRing* ring, const AHRSRingSample* samples, size_t count){
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	size_t capacity = ring->mask + 1;
+	if(capacity - (head - ring->cached_tail) < count)
+		ring->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	size_t space = capacity - (head - ring->cached_tail);
+	if(count > space) count = space;
+	if(count == 0) return 0;
+
+	size_t first = head & ring->mask;
+	size_t span = count < capacity - first ? count : capacity - first;
+	memcpy(ring->slots + first, samples, span * sizeof(AHRSRingSample));
+	memcpy(ring->slots, samples + span, (count - span) * sizeof(AHRSRingSample));
+	atomic_store_explicit(&ring->head, head + count, memory_order_release);
+	return count;
+}
+
+// Consumer side: samples available from `*tail`, 0 when empty
+static size_t ring_available(AHRSSampleRing* ring, size_t* tail){
+	*tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	if(ring->cached_head == *tail) ring->cached_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	return ring->cached_head - *tail;
+}
+
+// Publishes q after the drained samples and hands their slots back to the producer
+static void ring_release(AHRSSampleRing* ring, size_t tail, size_t count, MA_PRECISION q0, MA_PRECISION q1, MA_PRECISION q2, MA_PRECISION q3, AHRSQuaternionSeqlock* seqlock){
+	if(seqlock != NULL) {
+		AHRSOrientation orientation = { q0, q1, q2, q3, ring->slots[(tail + count - 1) & ring->mask].timestamp };
+		ahrs_seqlock_publish(seqlock, &orientation);
+	}
+	atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+}
+
+#define RING_GYRO(SLOT) ahrs_sensor_array_interleaved((SLOT)->gyro, AHRS_RING_SAMPLE_STRIDE)
+#define RING_ACCEL(SLOT) ahrs_sensor_array_interleaved((SLOT)->accel, AHRS_RING_SAMPLE_STRIDE)
+#define RING_MAG(SLOT) ahrs_sensor_array_interleaved((SLOT)->mag, AHRS_RING_SAMPLE_STRIDE)
+
+size_t ahrs_ring_drain_madgwick(AHRSSampleRing* ring, MadgwickAHRS* workspace, AHRSQuaternionSeqlock* seqlock){
+	size_t tail, count = ring_available(ring, &tail);
+	if(count == 0) return 0;
+	size_t first = tail & ring->mask;
+	size_t span = count < ring->mask + 1 - first ? count : ring->mask + 1 - first;
+	const AHRSRingSample* slot = ring->slots + first;
+	madgwick_ahrs_update_batch(workspace, RING_GYRO(slot), RING_ACCEL(slot), RING_MAG(slot), span, NULL);
+	if(count > span) madgwick_ahrs_update_batch(workspace, RING_GYRO(ring->slots), RING_ACCEL(ring->slots), RING_MAG(ring->slots), count - span, NULL);
+	ring_release(ring, tail, count, workspace->q0, workspace->q1, workspace->q2, workspace->q3, seqlock);
+	return count;
+}
+
+size_t ahrs_ring_drain_mahony(AHRSSampleRing* ring, MahonyAHRS* workspace, AHRSQuaternionSeqlock* seqlock){
+	size_t tail, count = ring_available(ring, &tail);
+	if(count == 0) return 0;
+	size_t first = tail & ring->mask;
+	size_t span = count < ring->mask + 1 - first ? count : ring->mask + 1 - first;
+	const AHRSRingSample* slot = ring->slots + first;
+	mahony_ahrs_update_batch(workspace, RING_GYRO(slot), RING_ACCEL(slot), RING_MAG(slot), span, NULL);
+	if(count > span) mahony_ahrs_update_batch(workspace, RING_GYRO(ring->slots), RING_ACCEL(ring->slots), RING_MAG(ring->slots), count - span, NULL);
+	ring_release(ring, tail, count, workspace->q0, workspace->q1, workspace->q2, workspace->q3, seqlock);
+	return count;
+}
+
+//---------------------------------------------------------------------------------------------------
+// Seqlock. The fields are relaxed atomics so that a torn read is not a data race; the sequence
+// number and the fences order them.
+
+AHRSQuaternionSeqlock* create_ahrs_quaternion_seqlock(void){
+	AHRSQuaternionSeqlock* seqlock = (AHRSQuaternionSeqlock *) ahrs_aligned_alloc(AHRS_RING_CACHE_LINE, sizeof(AHRSQuaternionSeqlock));
+	if(seqlock == NULL) return NULL;
+	atomic_init(&seqlock->sequence, 0);
+	atomic_init(&seqlock->q[0], 1.0f);
+	for(int i = 1; i < 4; i++) atomic_init(&seqlock->q[i], 0.0f);
+	atomic_init(&seqlock->timestamp, 0);
+	return seqlock;
+}
+
+void free_ahrs_quaternion_seqlock(AHRSQuaternionSeqlock* seqlock){
+	ahrs_aligned_free(seqlock);
+}
+
+void ahrs_seqlock_publish(AHRSQuaternionSeqlock* seqlock, const AHRSOrientation* orientation){
+	unsigned sequence = atomic_load_explicit(&seqlock->sequence, memory_order_relaxed);
+	atomic_store_explicit(&seqlock->sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&seqlock->q[0], orientation->q0, memory_order_relaxed);
+	atomic_store_explicit(&seqlock->q[1], orientation->q1, memory_order_relaxed);
+	atomic_store_explicit(&seqlock->q[2], orientation->q2, memory_order_relaxed);
+	atomic_store_explicit(&seqlock->q[3], orientation->q3, memory_order_relaxed);
+	atomic_store_explicit(&seqlock->timestamp, orientation->timestamp, memory_order_relaxed);
+	atomic_store_explicit(&seqlock->sequence, sequence + 2, memory_order_release);
+}
+
+unsigned ahrs_seqlock_read(const AHRSQuaternionSeqlock* seqlock, AHRSOrientation* orientation){
+	AHRSQuaternionSeqlock* s = (AHRSQuaternionSeqlock *) seqlock; // atomic loads take non-const pointers before C17
+	for(;;) {
+		unsigned before = atomic_load_explicit(&s->sequence, memory_order_acquire);
+		if(before & 1) continue;
+		orientation->q0 = atomic_load_explicit(&s->q[0], memory_order_relaxed);
+		orientation->q1 = atomic_load_explicit(&s->q[1], memory_order_relaxed);
+		orientation->q2 = atomic_load_explicit(&s->q[2], memory_order_relaxed);
+		orientation->q3 = atomic_load_explicit(&s->q[3], memory_order_relaxed);
+		orientation->timestamp = atomic_load_explicit(&s->timestamp, memory_order_relaxed);
+		atomic_thread_fence(memory_order_acquire);
+		if(atomic_load_explicit(&s->sequence, memory_order_relaxed) == before) return before / 2;
+	}
+}
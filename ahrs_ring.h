@@ -0,0 +1,81 @@
+//=====================================================================================================
+// ahrs_ring.h
+//=====================================================================================================
+//
+// Lock-free hand-off between a sensor reader thread and a filter thread.
+//
+// AHRSSampleRing is a bounded single-producer / single-consumer ring of raw 9-axis samples: the
+// reader pushes, the filter thread drains whatever has arrived into one batched update (two when the
+// samples wrap around the end of the ring), reading the samples in place in the ring. Neither side
+// ever blocks or takes a lock; a full ring makes ahrs_ring_push accept fewer samples.
+//
+// AHRSQuaternionSeqlock publishes the latest quaternion of the filter thread to any number of
+// readers. The writer never waits for readers; a reader that overlaps a write retries.
+//
+// Built on C11 atomics, so the structures are opaque and handled through pointers.
+//
+//=====================================================================================================
+#ifndef __AHRS_RING_H__
+#define __AHRS_RING_H__
+
+#include "madgwick_ahrs.h"
+#include "mahony_ahrs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// One raw sample. The sensor fields are read by the batch updates with a stride of
+// AHRS_RING_SAMPLE_STRIDE elements.
+typedef struct {
+    uint64_t timestamp;         // any unit, carried to the published quaternion
+    MA_PRECISION gyro[3];       // rad/s
+    MA_PRECISION accel[3];
+    MA_PRECISION mag[3];        // all zero without magnetometer (IMU update for that sample)
+} AHRSRingSample;
+
+#define AHRS_RING_SAMPLE_STRIDE (sizeof(AHRSRingSample) / sizeof(MA_PRECISION))
+
+// Quaternion as published by the filter thread
+typedef struct {
+    MA_PRECISION q0;
+    MA_PRECISION q1;
+    MA_PRECISION q2;
+    MA_PRECISION q3;
+    uint64_t timestamp;         // of the last sample included
+} AHRSOrientation;
+
+typedef struct AHRSSampleRing AHRSSampleRing;
+typedef struct AHRSQuaternionSeqlock AHRSQuaternionSeqlock;
+
+// Room for `capacity` samples, rounded up to a power of two
+AHRSSampleRing* create_ahrs_sample_ring(size_t capacity);
+void free_ahrs_sample_ring(AHRSSampleRing* ring);
+
+AHRSQuaternionSeqlock* create_ahrs_quaternion_seqlock(void);
+void free_ahrs_quaternion_seqlock(AHRSQuaternionSeqlock* seqlock);
+
+//---------------------------------------------------------------------------------------------------
+// Function declarations
+
+// Producer thread only. Appends up to `count` samples and returns how many fitted.
+size_t ahrs_ring_push(AHRSSampleRing* ring, const AHRSRingSample* samples, size_t count);
+
+// Consumer thread only. Runs every sample available through the filter's batch update, publishes the
+// resulting quaternion to `seqlock` (may be NULL) and returns the number of samples, 0 when the ring
+// was empty. Call in a loop, backing off when it returns 0.
+size_t ahrs_ring_drain_madgwick(AHRSSampleRing* ring, MadgwickAHRS* workspace, AHRSQuaternionSeqlock* seqlock);
+size_t ahrs_ring_drain_mahony(AHRSSampleRing* ring, MahonyAHRS* workspace, AHRSQuaternionSeqlock* seqlock);
+
+// Single writer
+void ahrs_seqlock_publish(AHRSQuaternionSeqlock* seqlock, const AHRSOrientation* orientation);
+
+// Any thread. Copies the latest consistent orientation and returns the number of publishes it
+// reflects (0: nothing published yet), so readers can tell whether it changed.
+unsigned ahrs_seqlock_read(const AHRSQuaternionSeqlock* seqlock, AHRSOrientation* orientation);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AHRS_RING_H__ */
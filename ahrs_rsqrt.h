@@ -0,0 +1,132 @@
+//=====================================================================================================
+// ahrs_rsqrt.h
+//=====================================================================================================
+//
+// Reciprocal square root backends for the normalisations in the filters (inv_sqrt):
+//   AHRS_RSQRT_EXACT     1 / sqrt(x): correctly rounded square root, then a division
+//   AHRS_RSQRT_HARDWARE  the CPU's estimate instruction refined by Newton-Raphson steps to about
+//                        full precision: rsqrtss (float) and, with AVX-512F, vrsqrt14sd (double) on
+//                        x86; frsqrte on AArch64. Exact where the target has no estimate.
+//   AHRS_RSQRT_MAGIC     the 0x5f3759df bit trick with one Newton-Raphson step, the original inv_sqrt
+//                        (relative error up to ~1.8e-3 in both precisions)
+//
+// AHRS_RSQRT picks the backend of inv_sqrt at compile time (CMake option AHRS_RSQRT); the filter
+// banks follow it through ahrs_vec_rsqrt. Every backend is available in both precisions as
+// ahrs_rsqrt_<backend>_f / _d, e.g. for bench/rsqrt_bench.c, which measures their speed and accuracy.
+// Only the exact backend returns inf for 0; callers must not normalise zero vectors.
+//
+//=====================================================================================================
+#ifndef __AHRS_RSQRT_H__
+#define __AHRS_RSQRT_H__
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#define AHRS_RSQRT_EXACT 0
+#define AHRS_RSQRT_HARDWARE 1
+#define AHRS_RSQRT_MAGIC 2
+
+#ifndef AHRS_RSQRT
+#define AHRS_RSQRT AHRS_RSQRT_EXACT
+#endif
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <immintrin.h>
+#define AHRS_RSQRT_X86 1
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define AHRS_RSQRT_AARCH64 1
+#endif
+
+//---------------------------------------------------------------------------------------------------
+// Exact
+
+static inline float ahrs_rsqrt_exact_f(float x){
+	return 1.0f / sqrtf(x);
+}
+
+static inline double ahrs_rsqrt_exact_d(double x){
+	return 1.0 / sqrt(x);
+}
+
+//---------------------------------------------------------------------------------------------------
+// Hardware estimate + Newton-Raphson, y' = y * (1.5 - 0.5 * x * y * y) doubles the correct bits
+
+static inline float ahrs_rsqrt_hardware_f(float x){
+#if defined(AHRS_RSQRT_X86)
+	float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x))); // 12 bits
+	return y * (1.5f - 0.5f * x * y * y);
+#elif defined(AHRS_RSQRT_AARCH64)
+	float y = vrsqrtes_f32(x); // 8 bits, vrsqrtss_f32(a, b) = (3 - a * b) / 2
+	y = y * vrsqrtss_f32(x * y, y);
+	return y * vrsqrtss_f32(x * y, y);
+#else
+	return ahrs_rsqrt_exact_f(x);
+#endif
+}
+
+static inline double ahrs_rsqrt_hardware_d(double x){
+#if defined(AHRS_RSQRT_X86) && defined(__AVX512F__)
+	double y = _mm_cvtsd_f64(_mm_rsqrt14_sd(_mm_setzero_pd(), _mm_set_sd(x))); // 14 bits
+	y = y * (1.5 - 0.5 * x * y * y);
+	return y * (1.5 - 0.5 * x * y * y);
+#elif defined(AHRS_RSQRT_AARCH64)
+	double y = vrsqrted_f64(x); // 8 bits
+	y = y * vrsqrtsd_f64(x * y, y);
+	y = y * vrsqrtsd_f64(x * y, y);
+	return y * vrsqrtsd_f64(x * y, y);
+#else
+	return ahrs_rsqrt_exact_d(x); // no double precision estimate before AVX-512
+#endif
+}
+
+//---------------------------------------------------------------------------------------------------
+// Magic number. See: http://en.wikipedia.org/wiki/Fast_inverse_square_root
+// The bits are copied with memcpy into an integer of the same width, which compilers turn into a
+// register move; reading them through a pointer of another type is undefined behaviour.
+
+static inline float ahrs_rsqrt_magic_f(float x){
+	float halfx = 0.5f * x;
+	int32_t i;
+	memcpy(&i, &x, sizeof(i));
+	i = 0x5f3759df - (i >> 1);
+	float y;
+	memcpy(&y, &i, sizeof(y));
+	return y * (1.5f - (halfx * y * y));
+}
+
+static inline double ahrs_rsqrt_magic_d(double x){
+	double halfx = 0.5 * x;
+	int64_t i;
+	memcpy(&i, &x, sizeof(i));
+	i = 0x5fe6eb50c7b537a9LL - (i >> 1);
+	double y;
+	memcpy(&y, &i, sizeof(y));
+	return y * (1.5 - (halfx * y * y));
+}
+
+//---------------------------------------------------------------------------------------------------
+// Backend selected by AHRS_RSQRT
+
+static inline float ahrs_rsqrt_f(float x){
+#if AHRS_RSQRT == AHRS_RSQRT_HARDWARE
+	return ahrs_rsqrt_hardware_f(x);
+#elif AHRS_RSQRT == AHRS_RSQRT_MAGIC
+	return ahrs_rsqrt_magic_f(x);
+#else
+	return ahrs_rsqrt_exact_f(x);
+#endif
+}
+
+static inline double ahrs_rsqrt_d(double x){
+#if AHRS_RSQRT == AHRS_RSQRT_HARDWARE
+	return ahrs_rsqrt_hardware_d(x);
+#elif AHRS_RSQRT == AHRS_RSQRT_MAGIC
+	return ahrs_rsqrt_magic_d(x);
+#else
+	return ahrs_rsqrt_exact_d(x);
+#endif
+}
+
+#endif /* __AHRS_RSQRT_H__ */
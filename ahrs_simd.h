@@ -0,0 +1,235 @@
+//=====================================================================================================
+// ahrs_simd.h
+//=====================================================================================================
+//
+// Minimal SIMD layer used by the structure-of-arrays filter banks.
+// The widest instruction set enabled at compile time is used (AVX-512F, AVX2, SSE4.2, SSE2), with a
+// one-lane scalar fallback, for both MA_PRECISION float and double. Masks are produced by the
+// comparisons and consumed by ahrs_vec_select, so data dependent branches become blends;
+// ahrs_mask_all lets a kernel pick a specialised path when every lane qualifies for it.
+//
+// Runtime dispatch (AHRS_DISPATCH, ahrs_dispatch.c): the bank kernels are compiled once per
+// instruction set with AHRS_KERNEL_TARGET naming the variant, and AHRS_KERNEL_NAME appends it to
+// their entry points; the public entry points are resolved to the best variant at load time.
+//
+//=====================================================================================================
+#ifndef __AHRS_SIMD_H__
+#define __AHRS_SIMD_H__
+
+#include "arhs.h"
+#include <math.h>
+
+#if defined(__AVX512F__) || defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// Every bank array is padded to a multiple of this many lanes, enough for the widest vector
+#define AHRS_BANK_PADDING 16
+#define AHRS_BANK_ALIGNMENT 64
+
+#if defined(AHRS_KERNEL_TARGET)
+#define AHRS_KERNEL_CONCAT_(NAME, TARGET) NAME##_##TARGET
+#define AHRS_KERNEL_CONCAT(NAME, TARGET) AHRS_KERNEL_CONCAT_(NAME, TARGET)
+#define AHRS_KERNEL_NAME(NAME) AHRS_KERNEL_CONCAT(NAME, AHRS_KERNEL_TARGET)
+#else
+#define AHRS_KERNEL_NAME(NAME) NAME
+#endif
+
+#if defined(__AVX512F__)
+#define AHRS_SIMD_ISA "avx512"
+#if MA_DOUBLE_PRECISION
+#define AHRS_SIMD_WIDTH 8
+typedef __m512d ahrs_vec;
+typedef __mmask8 ahrs_mask;
+static inline ahrs_vec ahrs_vec_load(const MA_PRECISION* p){ return _mm512_load_pd(p); }
+static inline ahrs_vec ahrs_vec_loadu(const MA_PRECISION* p){ return _mm512_loadu_pd(p); }
+static inline void ahrs_vec_store(MA_PRECISION* p, ahrs_vec v){ _mm512_store_pd(p, v); }
+static inline void ahrs_vec_storeu(MA_PRECISION* p, ahrs_vec v){ _mm512_storeu_pd(p, v); }
+static inline ahrs_vec ahrs_vec_set1(MA_PRECISION x){ return _mm512_set1_pd(x); }
+static inline ahrs_vec ahrs_vec_add(ahrs_vec a, ahrs_vec b){ return _mm512_add_pd(a, b); }
+static inline ahrs_vec ahrs_vec_sub(ahrs_vec a, ahrs_vec b){ return _mm512_sub_pd(a, b); }
+static inline ahrs_vec ahrs_vec_mul(ahrs_vec a, ahrs_vec b){ return _mm512_mul_pd(a, b); }
+static inline ahrs_vec ahrs_vec_div(ahrs_vec a, ahrs_vec b){ return _mm512_div_pd(a, b); }
+static inline ahrs_vec ahrs_vec_sqrt(ahrs_vec a){ return _mm512_sqrt_pd(a); }
+static inline ahrs_vec ahrs_vec_rsqrt_estimate(ahrs_vec a){ return _mm512_rsqrt14_pd(a); }
+#define AHRS_VEC_RSQRT_NEWTON_STEPS 2 // 14 bit estimate
+static inline ahrs_mask ahrs_vec_eq_zero(ahrs_vec a){ return _mm512_cmp_pd_mask(a, _mm512_setzero_pd(), _CMP_EQ_OQ); }
+static inline ahrs_vec ahrs_vec_select(ahrs_mask m, ahrs_vec a, ahrs_vec b){ return _mm512_mask_blend_pd(m, b, a); }
+#else
+#define AHRS_SIMD_WIDTH 16
+typedef __m512 ahrs_vec;
+typedef __mmask16 ahrs_mask;
+static inline ahrs_vec ahrs_vec_load(const MA_PRECISION* p){ return _mm512_load_ps(p); }
+static inline ahrs_vec ahrs_vec_loadu(const MA_PRECISION* p){ return _mm512_loadu_ps(p); }
+static inline void ahrs_vec_store(MA_PRECISION* p, ahrs_vec v){ _mm512_store_ps(p, v); }
+static inline void ahrs_vec_storeu(MA_PRECISION* p, ahrs_vec v){ _mm512_storeu_ps(p, v); }
+static inline ahrs_vec ahrs_vec_set1(MA_PRECISION x){ return _mm512_set1_ps(x); }
+static inline ahrs_vec ahrs_vec_add(ahrs_vec a, ahrs_vec b){ return _mm512_add_ps(a, b); }
+static inline ahrs_vec ahrs_vec_sub(ahrs_vec a, ahrs_vec b){ return _mm512_sub_ps(a, b); }
+static inline ahrs_vec ahrs_vec_mul(ahrs_vec a, ahrs_vec b){ return _mm512_mul_ps(a, b); }
+static inline ahrs_vec ahrs_vec_div(ahrs_vec a, ahrs_vec b){ return _mm512_div_ps(a, b); }
+static inline ahrs_vec ahrs_vec_sqrt(ahrs_vec a){ return _mm512_sqrt_ps(a); }
+static inline ahrs_vec ahrs_vec_rsqrt_estimate(ahrs_vec a){ return _mm512_rsqrt14_ps(a); }
+#define AHRS_VEC_RSQRT_NEWTON_STEPS 1
+static inline ahrs_mask ahrs_vec_eq_zero(ahrs_vec a){ return _mm512_cmp_ps_mask(a, _mm512_setzero_ps(), _CMP_EQ_OQ); }
+static inline ahrs_vec ahrs_vec_select(ahrs_mask m, ahrs_vec a, ahrs_vec b){ return _mm512_mask_blend_ps(m, b, a); }
+#endif
+static inline ahrs_mask ahrs_mask_and(ahrs_mask a, ahrs_mask b){ return a & b; }
+static inline ahrs_mask ahrs_mask_or(ahrs_mask a, ahrs_mask b){ return a | b; }
+static inline int ahrs_mask_all(ahrs_mask m){ return m == (ahrs_mask) ((1u << AHRS_SIMD_WIDTH) - 1); }
+
+#elif defined(__AVX2__)
+#define AHRS_SIMD_ISA "avx2"
+#if MA_DOUBLE_PRECISION
+#define AHRS_SIMD_WIDTH 4
+typedef __m256d ahrs_vec;
+typedef __m256d ahrs_mask;
+static inline ahrs_vec ahrs_vec_load(const MA_PRECISION* p){ return _mm256_load_pd(p); }
+static inline ahrs_vec ahrs_vec_loadu(const MA_PRECISION* p){ return _mm256_loadu_pd(p); }
+static inline void ahrs_vec_store(MA_PRECISION* p, ahrs_vec v){ _mm256_store_pd(p, v); }
+static inline void ahrs_vec_storeu(MA_PRECISION* p, ahrs_vec v){ _mm256_storeu_pd(p, v); }
+static inline ahrs_vec ahrs_vec_set1(MA_PRECISION x){ return _mm256_set1_pd(x); }
+static inline ahrs_vec ahrs_vec_add(ahrs_vec a, ahrs_vec b){ return _mm256_add_pd(a, b); }
+static inline ahrs_vec ahrs_vec_sub(ahrs_vec a, ahrs_vec b){ return _mm256_sub_pd(a, b); }
+static inline ahrs_vec ahrs_vec_mul(ahrs_vec a, ahrs_vec b){ return _mm256_mul_pd(a, b); }
+static inline ahrs_vec ahrs_vec_div(ahrs_vec a, ahrs_vec b){ return _mm256_div_pd(a, b); }
+static inline ahrs_vec ahrs_vec_sqrt(ahrs_vec a){ return _mm256_sqrt_pd(a); }
+static inline ahrs_mask ahrs_vec_eq_zero(ahrs_vec a){ return _mm256_cmp_pd(a, _mm256_setzero_pd(), _CMP_EQ_OQ); }
+static inline ahrs_vec ahrs_vec_select(ahrs_mask m, ahrs_vec a, ahrs_vec b){ return _mm256_blendv_pd(b, a, m); }
+static inline ahrs_mask ahrs_mask_and(ahrs_mask a, ahrs_mask b){ return _mm256_and_pd(a, b); }
+static inline ahrs_mask ahrs_mask_or(ahrs_mask a, ahrs_mask b){ return _mm256_or_pd(a, b); }
+static inline int ahrs_mask_all(ahrs_mask m){ return _mm256_movemask_pd(m) == (1 << AHRS_SIMD_WIDTH) - 1; }
+#else
+#define AHRS_SIMD_WIDTH 8
+typedef __m256 ahrs_vec;
+typedef __m256 ahrs_mask;
+static inline ahrs_vec ahrs_vec_load(const MA_PRECISION* p){ return _mm256_load_ps(p); }
+static inline ahrs_vec ahrs_vec_loadu(const MA_PRECISION* p){ return _mm256_loadu_ps(p); }
+static inline void ahrs_vec_store(MA_PRECISION* p, ahrs_vec v){ _mm256_store_ps(p, v); }
+static inline void ahrs_vec_storeu(MA_PRECISION* p, ahrs_vec v){ _mm256_storeu_ps(p, v); }
+static inline ahrs_vec ahrs_vec_set1(MA_PRECISION x){ return _mm256_set1_ps(x); }
+static inline ahrs_vec ahrs_vec_add(ahrs_vec a, ahrs_vec b){ return _mm256_add_ps(a, b); }
+static inline ahrs_vec ahrs_vec_sub(ahrs_vec a, ahrs_vec b){ return _mm256_sub_ps(a, b); }
+static inline ahrs_vec ahrs_vec_mul(ahrs_vec a, ahrs_vec b){ return _mm256_mul_ps(a, b); }
+static inline ahrs_vec ahrs_vec_div(ahrs_vec a, ahrs_vec b){ return _mm256_div_ps(a, b); }
+static inline ahrs_vec ahrs_vec_sqrt(ahrs_vec a){ return _mm256_sqrt_ps(a); }
+static inline ahrs_vec ahrs_vec_rsqrt_estimate(ahrs_vec a){ return _mm256_rsqrt_ps(a); }
+#define AHRS_VEC_RSQRT_NEWTON_STEPS 1 // 12 bit estimate
+static inline ahrs_mask ahrs_vec_eq_zero(ahrs_vec a){ return _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_EQ_OQ); }
+static inline ahrs_vec ahrs_vec_select(ahrs_mask m, ahrs_vec a, ahrs_vec b){ return _mm256_blendv_ps(b, a, m); }
+static inline ahrs_mask ahrs_mask_and(ahrs_mask a, ahrs_mask b){ return _mm256_and_ps(a, b); }
+static inline ahrs_mask ahrs_mask_or(ahrs_mask a, ahrs_mask b){ return _mm256_or_ps(a, b); }
+static inline int ahrs_mask_all(ahrs_mask m){ return _mm256_movemask_ps(m) == (1 << AHRS_SIMD_WIDTH) - 1; }
+#endif
+
+#elif defined(__SSE2__) || defined(_M_X64)
+#if defined(__SSE4_2__)
+#define AHRS_SIMD_ISA "sse4.2"
+#else
+#define AHRS_SIMD_ISA "sse2"
+#endif
+#if MA_DOUBLE_PRECISION
+#define AHRS_SIMD_WIDTH 2
+typedef __m128d ahrs_vec;
+typedef __m128d ahrs_mask;
+static inline ahrs_vec ahrs_vec_load(const MA_PRECISION* p){ return _mm_load_pd(p); }
+static inline ahrs_vec ahrs_vec_loadu(const MA_PRECISION* p){ return _mm_loadu_pd(p); }
+static inline void ahrs_vec_store(MA_PRECISION* p, ahrs_vec v){ _mm_store_pd(p, v); }
+static inline void ahrs_vec_storeu(MA_PRECISION* p, ahrs_vec v){ _mm_storeu_pd(p, v); }
+static inline ahrs_vec ahrs_vec_set1(MA_PRECISION x){ return _mm_set1_pd(x); }
+static inline ahrs_vec ahrs_vec_add(ahrs_vec a, ahrs_vec b){ return _mm_add_pd(a, b); }
+static inline ahrs_vec ahrs_vec_sub(ahrs_vec a, ahrs_vec b){ return _mm_sub_pd(a, b); }
+static inline ahrs_vec ahrs_vec_mul(ahrs_vec a, ahrs_vec b){ return _mm_mul_pd(a, b); }
+static inline ahrs_vec ahrs_vec_div(ahrs_vec a, ahrs_vec b){ return _mm_div_pd(a, b); }
+static inline ahrs_vec ahrs_vec_sqrt(ahrs_vec a){ return _mm_sqrt_pd(a); }
+static inline ahrs_mask ahrs_vec_eq_zero(ahrs_vec a){ return _mm_cmpeq_pd(a, _mm_setzero_pd()); }
+#if defined(__SSE4_1__)
+static inline ahrs_vec ahrs_vec_select(ahrs_mask m, ahrs_vec a, ahrs_vec b){ return _mm_blendv_pd(b, a, m); }
+#else
+static inline ahrs_vec ahrs_vec_select(ahrs_mask m, ahrs_vec a, ahrs_vec b){ return _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b)); }
+#endif
+static inline ahrs_mask ahrs_mask_and(ahrs_mask a, ahrs_mask b){ return _mm_and_pd(a, b); }
+static inline ahrs_mask ahrs_mask_or(ahrs_mask a, ahrs_mask b){ return _mm_or_pd(a, b); }
+static inline int ahrs_mask_all(ahrs_mask m){ return _mm_movemask_pd(m) == (1 << AHRS_SIMD_WIDTH) - 1; }
+#else
+#define AHRS_SIMD_WIDTH 4
+typedef __m128 ahrs_vec;
+typedef __m128 ahrs_mask;
+static inline ahrs_vec ahrs_vec_load(const MA_PRECISION* p){ return _mm_load_ps(p); }
+static inline ahrs_vec ahrs_vec_loadu(const MA_PRECISION* p){ return _mm_loadu_ps(p); }
+static inline void ahrs_vec_store(MA_PRECISION* p, ahrs_vec v){ _mm_store_ps(p, v); }
+static inline void ahrs_vec_storeu(MA_PRECISION* p, ahrs_vec v){ _mm_storeu_ps(p, v); }
+static inline ahrs_vec ahrs_vec_set1(MA_PRECISION x){ return _mm_set1_ps(x); }
+static inline ahrs_vec ahrs_vec_add(ahrs_vec a, ahrs_vec b){ return _mm_add_ps(a, b); }
+static inline ahrs_vec ahrs_vec_sub(ahrs_vec a, ahrs_vec b){ return _mm_sub_ps(a, b); }
+static inline ahrs_vec ahrs_vec_mul(ahrs_vec a, ahrs_vec b){ return _mm_mul_ps(a, b); }
+static inline ahrs_vec ahrs_vec_div(ahrs_vec a, ahrs_vec b){ return _mm_div_ps(a, b); }
+static inline ahrs_vec ahrs_vec_sqrt(ahrs_vec a){ return _mm_sqrt_ps(a); }
+static inline ahrs_vec ahrs_vec_rsqrt_estimate(ahrs_vec a){ return _mm_rsqrt_ps(a); }
+#define AHRS_VEC_RSQRT_NEWTON_STEPS 1 // 12 bit estimate
+static inline ahrs_mask ahrs_vec_eq_zero(ahrs_vec a){ return _mm_cmpeq_ps(a, _mm_setzero_ps()); }
+#if defined(__SSE4_1__)
+static inline ahrs_vec ahrs_vec_select(ahrs_mask m, ahrs_vec a, ahrs_vec b){ return _mm_blendv_ps(b, a, m); }
+#else
+static inline ahrs_vec ahrs_vec_select(ahrs_mask m, ahrs_vec a, ahrs_vec b){ return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+#endif
+static inline ahrs_mask ahrs_mask_and(ahrs_mask a, ahrs_mask b){ return _mm_and_ps(a, b); }
+static inline ahrs_mask ahrs_mask_or(ahrs_mask a, ahrs_mask b){ return _mm_or_ps(a, b); }
+static inline int ahrs_mask_all(ahrs_mask m){ return _mm_movemask_ps(m) == (1 << AHRS_SIMD_WIDTH) - 1; }
+#endif
+
+#else
+#define AHRS_SIMD_ISA "scalar"
+#define AHRS_SIMD_WIDTH 1
+typedef MA_PRECISION ahrs_vec;
+typedef int ahrs_mask;
+static inline ahrs_vec ahrs_vec_load(const MA_PRECISION* p){ return *p; }
+static inline ahrs_vec ahrs_vec_loadu(const MA_PRECISION* p){ return *p; }
+static inline void ahrs_vec_store(MA_PRECISION* p, ahrs_vec v){ *p = v; }
+static inline void ahrs_vec_storeu(MA_PRECISION* p, ahrs_vec v){ *p = v; }
+static inline ahrs_vec ahrs_vec_set1(MA_PRECISION x){ return x; }
+static inline ahrs_vec ahrs_vec_add(ahrs_vec a, ahrs_vec b){ return a + b; }
+static inline ahrs_vec ahrs_vec_sub(ahrs_vec a, ahrs_vec b){ return a - b; }
+static inline ahrs_vec ahrs_vec_mul(ahrs_vec a, ahrs_vec b){ return a * b; }
+static inline ahrs_vec ahrs_vec_div(ahrs_vec a, ahrs_vec b){ return a / b; }
+static inline ahrs_vec ahrs_vec_sqrt(ahrs_vec a){ return SQRT(a); }
+static inline ahrs_mask ahrs_vec_eq_zero(ahrs_vec a){ return a == 0.0f; }
+static inline ahrs_vec ahrs_vec_select(ahrs_mask m, ahrs_vec a, ahrs_vec b){ return m ? a : b; }
+static inline ahrs_mask ahrs_mask_and(ahrs_mask a, ahrs_mask b){ return a & b; }
+static inline ahrs_mask ahrs_mask_or(ahrs_mask a, ahrs_mask b){ return a | b; }
+static inline int ahrs_mask_all(ahrs_mask m){ return m != 0; }
+#endif
+
+// Reciprocal square root, lane-wise. With AHRS_RSQRT_HARDWARE the ISA's estimate refined by Newton-Raphson
+// steps where there is one (double precision before AVX-512 has none), otherwise exact: the bit trick
+// of AHRS_RSQRT_MAGIC does not pay off against vector square roots.
+static inline ahrs_vec ahrs_vec_rsqrt(ahrs_vec a){
+#if AHRS_RSQRT == AHRS_RSQRT_HARDWARE && defined(AHRS_VEC_RSQRT_NEWTON_STEPS)
+	const ahrs_vec half_a = ahrs_vec_mul(ahrs_vec_set1(0.5f), a);
+	const ahrs_vec three_halves = ahrs_vec_set1(1.5f);
+	ahrs_vec y = ahrs_vec_rsqrt_estimate(a);
+	for(int i = 0; i < AHRS_VEC_RSQRT_NEWTON_STEPS; i++)
+		y = ahrs_vec_mul(y, ahrs_vec_sub(three_halves, ahrs_vec_mul(half_a, ahrs_vec_mul(y, y))));
+	return y;
+#else
+	return ahrs_vec_div(ahrs_vec_set1(1.0f), ahrs_vec_sqrt(a));
+#endif
+}
+
+// Mask of lanes where all three components are zero (invalid sensor sample)
+static inline ahrs_mask ahrs_vec_all_zero3(ahrs_vec x, ahrs_vec y, ahrs_vec z){
+	return ahrs_mask_and(ahrs_mask_and(ahrs_vec_eq_zero(x), ahrs_vec_eq_zero(y)), ahrs_vec_eq_zero(z));
+}
+
+// Stages the last `remaining` (< AHRS_SIMD_WIDTH) samples of each bank input into zero padded lanes,
+// so a partial vector can run through the full-width kernel. Zero sensor samples take the invalid
+// branches and the padded state lanes absorb them.
+static inline void ahrs_bank_stage_tail(MA_PRECISION staged[][AHRS_SIMD_WIDTH], const MA_PRECISION** staged_inputs, const MA_PRECISION* const* inputs, size_t input_count, size_t offset, size_t remaining){
+	for(size_t k = 0; k < input_count; k++) {
+		for(size_t lane = 0; lane < AHRS_SIMD_WIDTH; lane++)
+			staged[k][lane] = lane < remaining ? inputs[k][offset + lane] : 0.0f;
+		staged_inputs[k] = staged[k];
+	}
+}
+
+#endif /* __AHRS_SIMD_H__ */
@@ -0,0 +1,125 @@
+//=====================================================================================================
+// ahrs_smooth.c
+//=====================================================================================================
+//
+// Forward-backward smoothing, see ahrs_smooth.h.
+//
+// Reversed, sample j of the backward pass goes from the attitude at sample j + 1 to the one at j:
+// it takes the negated gyro of sample j + 1, the rate over that interval, and the accelerometer and
+// magnetometer of sample j. Its quaternion is then the attitude at sample j, as the forward one is.
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "ahrs_smooth.h"
+#include <stdlib.h>
+
+// Batch update of one filter, IMU when mag.x == NULL
+typedef void (*AHRSSmoothBatch)(void* filter, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions);
+
+static void madgwick_smooth_batch(void* filter, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions){
+	if(mag.x != NULL) madgwick_ahrs_update_batch((MadgwickAHRS *) filter, gyro, accel, mag, count, quaternions);
+	else madgwick_ahrs_update_imu_batch((MadgwickAHRS *) filter, gyro, accel, count, quaternions);
+}
+
+static void mahony_smooth_batch(void* filter, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions){
+	if(mag.x != NULL) mahony_ahrs_update_batch((MahonyAHRS *) filter, gyro, accel, mag, count, quaternions);
+	else mahony_ahrs_update_imu_batch((MahonyAHRS *) filter, gyro, accel, count, quaternions);
+}
+
+static void eskf_smooth_batch(void* filter, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions){
+	if(mag.x != NULL) eskf_ahrs_update_batch((EskfAHRS *) filter, gyro, accel, mag, count, quaternions);
+	else eskf_ahrs_update_imu_batch((EskfAHRS *) filter, gyro, accel, count, quaternions);
+}
+
+//---------------------------------------------------------------------------------------------------
+// Backward pass of `backward`, the converged forward filter with its bias terms negated, fused into
+// the forward quaternions block by block from the end
+static int smooth_backward(void* backward, AHRSSmoothBatch batch, MA_PRECISION agreement, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions){
+	MA_PRECISION* samples = (MA_PRECISION *) malloc(AHRS_SMOOTH_BLOCK * (9 + 4) * sizeof(MA_PRECISION));
+	if(samples == NULL) return -1;
+	MA_PRECISION* block_quaternions = samples + 9 * AHRS_SMOOTH_BLOCK;
+	const int marg = mag.x != NULL;
+	const AHRSSensorArray none = { NULL, NULL, NULL, 0 };
+	// Agreement as the |dot product| of the two quaternions, cos(agreement / 2)
+	const MA_PRECISION agreement_dot = COS(0.5f * (agreement > 0.0f ? agreement : AHRS_SMOOTH_AGREEMENT));
+	int converged = 1;
+
+	for(size_t end = count; end > 0; ) {
+		const size_t start = end > AHRS_SMOOTH_BLOCK ? end - AHRS_SMOOTH_BLOCK : 0, n = end - start;
+		for(size_t k = 0; k < n; k++) {
+			const size_t j = end - 1 - k, g = (j + 1) * gyro.stride, a = j * accel.stride;
+			MA_PRECISION* s = samples + 9 * k;
+			// The last sample has no later interval: no rotation, corrections only
+			s[0] = j + 1 < count ? -gyro.x[g] : 0.0f;
+			s[1] = j + 1 < count ? -gyro.y[g] : 0.0f;
+			s[2] = j + 1 < count ? -gyro.z[g] : 0.0f;
+			s[3] = accel.x[a];
+			s[4] = accel.y[a];
+			s[5] = accel.z[a];
+			if(marg) {
+				const size_t m = j * mag.stride;
+				s[6] = mag.x[m];
+				s[7] = mag.y[m];
+				s[8] = mag.z[m];
+			}
+		}
+		batch(backward, ahrs_sensor_array_interleaved(samples, 9), ahrs_sensor_array_interleaved(samples + 3, 9),
+			marg ? ahrs_sensor_array_interleaved(samples + 6, 9) : none, n, block_quaternions);
+		for(size_t k = 0; k < n; k++) {
+			MA_PRECISION* q = quaternions + 4 * (end - 1 - k);
+			const MA_PRECISION* b = block_quaternions + 4 * k;
+			// Share of the forward pass: one half where the passes agree, 0 from where they do not
+			MA_PRECISION dot = q[0] * b[0] + q[1] * b[1] + q[2] * b[2] + q[3] * b[3];
+			dot = dot < 0.0f ? -dot : dot;
+			if(dot < agreement_dot) converged = 0;
+			MA_PRECISION forward = converged ? 0.5f * (dot - agreement_dot) / (1.0f - agreement_dot) : 0.0f;
+			ahrs_slerp(q, b, 1.0f - forward, q);
+		}
+		end = start;
+	}
+	free(samples);
+	return 0;
+}
+
+//====================================================================================================
+// Functions
+
+int madgwick_ahrs_smooth(const MadgwickAHRS* filter, MA_PRECISION agreement, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions){
+	if(filter == NULL || quaternions == NULL || count == 0) return -1;
+	MadgwickAHRS workspace = *filter;
+	madgwick_smooth_batch(&workspace, gyro, accel, mag, count, quaternions);
+	workspace.bias_x = -workspace.bias_x;
+	workspace.bias_y = -workspace.bias_y;
+	workspace.bias_z = -workspace.bias_z;
+	return smooth_backward(&workspace, madgwick_smooth_batch, agreement, gyro, accel, mag, count, quaternions);
+}
+
+int mahony_ahrs_smooth(const MahonyAHRS* filter, MA_PRECISION agreement, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions){
+	if(filter == NULL || quaternions == NULL || count == 0) return -1;
+	MahonyAHRS workspace = *filter;
+	mahony_smooth_batch(&workspace, gyro, accel, mag, count, quaternions);
+	workspace.integralFBx = -workspace.integralFBx;
+	workspace.integralFBy = -workspace.integralFBy;
+	workspace.integralFBz = -workspace.integralFBz;
+	return smooth_backward(&workspace, mahony_smooth_batch, agreement, gyro, accel, mag, count, quaternions);
+}
+
+int eskf_ahrs_smooth(const EskfAHRS* filter, MA_PRECISION agreement, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions){
+	if(filter == NULL || quaternions == NULL || count == 0) return -1;
+	EskfAHRS workspace = *filter;
+	eskf_smooth_batch(&workspace, gyro, accel, mag, count, quaternions);
+	workspace.bias_x = -workspace.bias_x;
+	workspace.bias_y = -workspace.bias_y;
+	workspace.bias_z = -workspace.bias_z;
+	// The bias error changes sign with the bias: so does its covariance with the attitude error
+	for(int i = 0; i < 3; i++) {
+		for(int j = 3; j < ESKF_STATES; j++) {
+			workspace.P[i * ESKF_STATES + j] = -workspace.P[i * ESKF_STATES + j];
+			workspace.P[j * ESKF_STATES + i] = -workspace.P[j * ESKF_STATES + i];
+		}
+	}
+	return smooth_backward(&workspace, eskf_smooth_batch, agreement, gyro, accel, mag, count, quaternions);
+}
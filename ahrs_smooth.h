@@ -0,0 +1,55 @@
+//=====================================================================================================
+// ahrs_smooth.h
+//=====================================================================================================
+//
+// Offline forward-backward smoothing of a recorded log, for analysis where the whole recording is
+// available: every quaternion is estimated from the samples before and after it, and the
+// convergence transient of the identity start is gone.
+//
+//   forward    the filter runs over the log as in the batch updates, writing `quaternions`
+//   backward   a copy of the converged filter runs from the last sample to the first on the
+//              time-reversed samples (negated gyro; its bias or integral term negated to match), so
+//              it is converged throughout, and its quaternion is fused with the forward one in place
+// The fusion is the slerp halfway between the passes where they agree. The forward pass starts cold:
+// its share drops as the passes diverge, to 0 where they differ by `agreement` rad, and stays 0 for
+// all earlier samples, so its convergence transient is replaced by the backward estimate however
+// long it lasts (minutes for Madgwick with the default beta).
+//
+// The forward pass streams through the log once. The backward pass reads it back to front in blocks
+// of AHRS_SMOOTH_BLOCK samples, copied reversed into one buffer that stays in cache and run through
+// the batch updates, so a memory mapped log of any size needs only that buffer besides the input
+// and output mappings. Both passes take the filter's fixed sample rate; timestamps are not used.
+// tools/ahrs_replay --smooth runs it on logs, bench/smooth_bench.c measures accuracy and samples/s.
+//
+//=====================================================================================================
+#ifndef __AHRS_SMOOTH_H__
+#define __AHRS_SMOOTH_H__
+
+#include "madgwick_ahrs.h"
+#include "mahony_ahrs.h"
+#include "eskf_ahrs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AHRS_SMOOTH_BLOCK 1024  // samples per backward block: 52 KB of samples and quaternions in float
+#define AHRS_SMOOTH_AGREEMENT 0.1f // rad, default difference where the forward pass is taken as unconverged
+
+//---------------------------------------------------------------------------------------------------
+// Function declarations
+
+// Smooths `count` samples with a copy of `filter` (sample rate, gains or noise model, and state: a
+// freshly initialised filter starts from the identity) and writes q0, q1, q2, q3 of every sample to
+// `quaternions` (4 * count elements). `filter` is not changed. mag.x == NULL runs the IMU updates,
+// agreement <= 0 takes AHRS_SMOOTH_AGREEMENT. Returns 0, or -1 for NULL arguments, count 0 or out of
+// memory.
+int madgwick_ahrs_smooth(const MadgwickAHRS* filter, MA_PRECISION agreement, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions);
+int mahony_ahrs_smooth(const MahonyAHRS* filter, MA_PRECISION agreement, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions);
+int eskf_ahrs_smooth(const EskfAHRS* filter, MA_PRECISION agreement, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AHRS_SMOOTH_H__ */
@@ -0,0 +1,173 @@
+//=====================================================================================================
+// ahrs_stats.c
+//=====================================================================================================
+//
+// Registry of the per-thread counter blocks of ahrs_stats.h. A thread registers its block on its
+// first update call or sample rate reset; when the thread exits its counts move to `retired` and
+// the block leaves the list.
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "ahrs_stats.h"
+#include <string.h>
+#if AHRS_STATS && AHRS_HAVE_FLEET
+#include <pthread.h>
+#endif
+
+static const char* const ahrs_stat_names[AHRS_STAT_COUNT] = {
+	"updates", "accel_invalid", "mag_fallback", "gap", "stale_timestamp", "rate_reset", "nan",
+};
+
+const char* ahrs_stats_name(AHRSStat stat){
+	return (unsigned) stat < AHRS_STAT_COUNT ? ahrs_stat_names[stat] : "";
+}
+
+uint64_t ahrs_stats_ticks_quantile(const AHRSStats* stats, double q){
+	uint64_t samples = 0;
+	for(int b = 0; b < AHRS_STATS_BUCKETS; b++) samples += stats->ticks[b];
+	if(samples == 0) return 0;
+	uint64_t rank = (uint64_t)(q * (double)(samples - 1)), seen = 0;
+	for(int b = 0; b < AHRS_STATS_BUCKETS; b++) {
+		seen += stats->ticks[b];
+		if(seen > rank) return ((uint64_t)2 << b) - 1;
+	}
+	return UINT64_MAX;
+}
+
+#if AHRS_STATS
+
+__thread AHRSStatsBlock ahrs_stats_block __attribute__((tls_model("initial-exec")));
+
+// Adds `from` to `to`, reading `from` with relaxed loads as its owner may be writing it
+static void ahrs_stats_add(AHRSStats* to, AHRSStats* from){
+	for(int i = 0; i < AHRS_STAT_COUNT; i++) to->count[i] += __atomic_load_n(&from->count[i], __ATOMIC_RELAXED);
+	for(int b = 0; b < AHRS_STATS_BUCKETS; b++) to->ticks[b] += __atomic_load_n(&from->ticks[b], __ATOMIC_RELAXED);
+	to->ticks_total += __atomic_load_n(&from->ticks_total, __ATOMIC_RELAXED);
+	double integral_max;
+	__atomic_load(&from->integral_max, &integral_max, __ATOMIC_RELAXED);
+	if(integral_max > to->integral_max) to->integral_max = integral_max;
+}
+
+static void ahrs_stats_clear(AHRSStats* stats){
+	for(int i = 0; i < AHRS_STAT_COUNT; i++) __atomic_store_n(&stats->count[i], 0, __ATOMIC_RELAXED);
+	for(int b = 0; b < AHRS_STATS_BUCKETS; b++) __atomic_store_n(&stats->ticks[b], 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->ticks_total, 0, __ATOMIC_RELAXED);
+	double zero = 0.0;
+	__atomic_store(&stats->integral_max, &zero, __ATOMIC_RELAXED);
+}
+
+#if AHRS_HAVE_FLEET
+
+typedef struct AHRSStatsNode {
+    AHRSStatsBlock* block;
+    struct AHRSStatsNode* next;
+} AHRSStatsNode;
+
+static pthread_mutex_t ahrs_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t ahrs_stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ahrs_stats_key;
+static AHRSStatsNode* ahrs_stats_live = NULL;
+static AHRSStats ahrs_stats_retired;
+
+// Thread exit: keep the counts, drop the block
+static void ahrs_stats_retire(void* argument){
+	AHRSStatsNode* node = (AHRSStatsNode *) argument;
+	pthread_mutex_lock(&ahrs_stats_lock);
+	ahrs_stats_add(&ahrs_stats_retired, &node->block->stats);
+	for(AHRSStatsNode** link = &ahrs_stats_live; *link != NULL; link = &(*link)->next) {
+		if(*link == node) {
+			*link = node->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ahrs_stats_lock);
+	free(node);
+}
+
+static void ahrs_stats_make_key(void){
+	pthread_key_create(&ahrs_stats_key, ahrs_stats_retire);
+}
+
+void ahrs_stats_register(void){
+	AHRSStatsNode* node = (AHRSStatsNode *) malloc(sizeof(AHRSStatsNode));
+	if(node == NULL) return; // counts stay in the block, registration is retried later
+	pthread_once(&ahrs_stats_once, ahrs_stats_make_key);
+	node->block = &ahrs_stats_block;
+	pthread_mutex_lock(&ahrs_stats_lock);
+	node->next = ahrs_stats_live;
+	ahrs_stats_live = node;
+	pthread_mutex_unlock(&ahrs_stats_lock);
+	pthread_setspecific(ahrs_stats_key, node);
+	ahrs_stats_block.registered = 1;
+}
+
+void ahrs_stats_snapshot(AHRSStats* stats){
+	if(stats == NULL) return;
+	memset(stats, 0, sizeof(AHRSStats));
+	pthread_mutex_lock(&ahrs_stats_lock);
+	ahrs_stats_add(stats, &ahrs_stats_retired);
+	for(AHRSStatsNode* node = ahrs_stats_live; node != NULL; node = node->next) ahrs_stats_add(stats, &node->block->stats);
+	pthread_mutex_unlock(&ahrs_stats_lock);
+}
+
+void ahrs_stats_reset(void){
+	pthread_mutex_lock(&ahrs_stats_lock);
+	ahrs_stats_clear(&ahrs_stats_retired);
+	for(AHRSStatsNode* node = ahrs_stats_live; node != NULL; node = node->next) ahrs_stats_clear(&node->block->stats);
+	pthread_mutex_unlock(&ahrs_stats_lock);
+}
+
+#else
+
+// Without threads there is the one block
+void ahrs_stats_register(void){
+	ahrs_stats_block.registered = 1;
+}
+
+void ahrs_stats_snapshot(AHRSStats* stats){
+	if(stats == NULL) return;
+	memset(stats, 0, sizeof(AHRSStats));
+	ahrs_stats_add(stats, &ahrs_stats_block.stats);
+}
+
+void ahrs_stats_reset(void){
+	ahrs_stats_clear(&ahrs_stats_block.stats);
+}
+
+#endif
+
+int ahrs_stats_enabled(void){
+	return 1;
+}
+
+const char* ahrs_stats_clock(void){
+#if defined(__x86_64__) || defined(__i386__)
+	return "tsc";
+#elif defined(__aarch64__)
+	return "cntvct";
+#else
+	return "ns";
+#endif
+}
+
+#else
+
+int ahrs_stats_enabled(void){
+	return 0;
+}
+
+const char* ahrs_stats_clock(void){
+	return "";
+}
+
+void ahrs_stats_snapshot(AHRSStats* stats){
+	if(stats != NULL) memset(stats, 0, sizeof(AHRSStats));
+}
+
+void ahrs_stats_reset(void){
+}
+
+#endif
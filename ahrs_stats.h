@@ -0,0 +1,165 @@
+//=====================================================================================================
+// ahrs_stats.h
+//=====================================================================================================
+//
+// Hot-path instrumentation of the filters, compiled in with AHRS_STATS (CMake option AHRS_STATS,
+// GCC or Clang). Every thread counts into its own block, so the filters never share a cache line for
+// it; ahrs_stats_snapshot sums the blocks of the live threads and of the threads that have exited.
+// Without AHRS_STATS the hooks below expand to nothing and the snapshot is all zeros.
+//
+// Counted: filter steps, the fallbacks on invalid samples, gaps and stale timestamps of the dt and
+// timestamped updates, sample rate resets, non-finite quaternions, the largest Mahony integral
+// feedback, and a log2 histogram of the time per sample of every update call in clock ticks
+// (ahrs_stats_clock: the TSC on x86, the virtual counter on AArch64, else nanoseconds). Batch and bank
+// calls add their average time per sample, weighted by the number of samples. The counts are exact;
+// the times are sampled, one update call in AHRS_STATS_PERIOD per thread, and scaled up.
+//
+// Covered are the Madgwick and Mahony filters and banks and the error-state Kalman filter
+// (eskf_ahrs.h: steps, invalid samples, rate resets and timing); the fixed-point filters are not
+// instrumented.
+//
+//=====================================================================================================
+#ifndef __AHRS_STATS_H__
+#define __AHRS_STATS_H__
+
+#include "arhs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    AHRS_STAT_UPDATES,          // filter steps, one per sample (banks: one per filter and sample); not gap propagations
+    AHRS_STAT_ACCEL_INVALID,    // steps with an all-zero accelerometer sample: gyro integration only
+    AHRS_STAT_MAG_FALLBACK,     // MARG steps with an all-zero magnetometer sample: IMU step instead
+    AHRS_STAT_GAP,              // dt or timestamp steps past max_dt: gyro propagation (AHRS_GAP_PROPAGATE) or clamped
+    AHRS_STAT_STALE_TIMESTAMP,  // timestamped samples not after the previous one, skipped
+    AHRS_STAT_RATE_RESET,       // *_update_sample_rate calls that reset the filter
+    AHRS_STAT_NAN,              // steps that left a non-finite quaternion
+    AHRS_STAT_COUNT
+} AHRSStat;
+
+#define AHRS_STATS_BUCKETS 32
+
+typedef struct {
+    uint64_t count[AHRS_STAT_COUNT];
+    uint64_t ticks[AHRS_STATS_BUCKETS]; // samples per bucket b: [2^b, 2^(b+1)) ticks per sample, b = 0 also 0 ticks
+    uint64_t ticks_total;               // sum over the update calls of their duration, estimated
+    double integral_max;                // largest |integral feedback| component of a Mahony filter, rad/s
+} AHRSStats;
+
+// 1 when the library was built with AHRS_STATS
+int ahrs_stats_enabled(void);
+
+// Name of the tick unit of the histogram: "tsc", "cntvct" or "ns"
+const char* ahrs_stats_clock(void);
+
+// Name of a counter, e.g. "accel_invalid"
+const char* ahrs_stats_name(AHRSStat stat);
+
+// Sum over all threads since the start or the last ahrs_stats_reset. A thread is included from its
+// first update call on; counts of threads that are updating meanwhile may be a few samples behind.
+void ahrs_stats_snapshot(AHRSStats* stats);
+
+// Zeroes the counts of every thread. Counts added concurrently by other threads may survive it.
+void ahrs_stats_reset(void);
+
+// Sample-weighted quantile q (0 .. 1) of the time per sample, as the upper end of its bucket in ticks
+uint64_t ahrs_stats_ticks_quantile(const AHRSStats* stats, double q);
+
+//---------------------------------------------------------------------------------------------------
+// Library internals: the hooks of the filter kernels
+
+#if AHRS_STATS
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif !defined(__aarch64__)
+#include <time.h>
+#endif
+
+typedef struct {
+    AHRSStats stats;
+    int registered;
+    unsigned countdown; // update calls until the next timed one
+} AHRSStatsBlock;
+
+// initial-exec: a plain segment-relative access, also in the shared library
+extern __thread AHRSStatsBlock ahrs_stats_block __attribute__((tls_model("initial-exec")));
+
+void ahrs_stats_register(void);
+
+// Single writer per block: relaxed stores so that ahrs_stats_snapshot may read them concurrently
+#define AHRS_STAT_ADD(STAT, N) __atomic_store_n(&ahrs_stats_block.stats.count[STAT], ahrs_stats_block.stats.count[STAT] + (uint64_t)(N), __ATOMIC_RELAXED)
+#define AHRS_STAT_IF(CONDITION, STAT) do { if(CONDITION) AHRS_STAT_ADD(STAT, 1); } while(0)
+// Off the update path, where the thread may not have registered yet
+#define AHRS_STAT_COLD(STAT) do { if(!ahrs_stats_block.registered) ahrs_stats_register(); AHRS_STAT_ADD(STAT, 1); } while(0)
+
+static inline void ahrs_stats_integral(const MA_PRECISION* integralFB){
+	double largest = ahrs_stats_block.stats.integral_max;
+	for(int i = 0; i < 3; i++) {
+		double v = integralFB[i] < 0 ? -(double) integralFB[i] : (double) integralFB[i];
+		if(v > largest) largest = v;
+	}
+	if(largest > ahrs_stats_block.stats.integral_max) __atomic_store(&ahrs_stats_block.stats.integral_max, &largest, __ATOMIC_RELAXED);
+}
+#define AHRS_STAT_INTEGRAL(INTEGRAL_FB) ahrs_stats_integral(INTEGRAL_FB)
+
+static inline uint64_t ahrs_stats_ticks(void){
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#elif defined(__aarch64__)
+	uint64_t ticks;
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+	return ticks;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+// A thread times one update call in AHRS_STATS_PERIOD and weights it by the period; reading the
+// clock twice costs more than a filter step on some machines (about 25 ns per read on virtualised
+// x86). The first call of a thread is timed.
+#ifndef AHRS_STATS_PERIOD
+#define AHRS_STATS_PERIOD 16
+#endif
+
+// 0: this call is not timed
+static inline uint64_t ahrs_stats_start(void){
+	if(ahrs_stats_block.countdown != 0) {
+		ahrs_stats_block.countdown--;
+		return 0;
+	}
+	ahrs_stats_block.countdown = AHRS_STATS_PERIOD - 1;
+	if(!ahrs_stats_block.registered) ahrs_stats_register();
+	return ahrs_stats_ticks() | 1;
+}
+
+static inline void ahrs_stats_time(uint64_t start, size_t samples){
+	if(start == 0 || samples == 0) return;
+	uint64_t ticks = ahrs_stats_ticks() - start;
+	uint64_t per_sample = samples == 1 ? ticks : ticks / samples;
+	int bucket = per_sample > 1 ? 63 - __builtin_clzll(per_sample) : 0;
+	if(bucket >= AHRS_STATS_BUCKETS) bucket = AHRS_STATS_BUCKETS - 1;
+	AHRSStats* stats = &ahrs_stats_block.stats;
+	__atomic_store_n(&stats->ticks[bucket], stats->ticks[bucket] + samples * AHRS_STATS_PERIOD, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->ticks_total, stats->ticks_total + ticks * AHRS_STATS_PERIOD, __ATOMIC_RELAXED);
+}
+#define AHRS_STATS_START(START) const uint64_t START = ahrs_stats_start()
+#define AHRS_STATS_STOP(START, SAMPLES) ahrs_stats_time(START, SAMPLES)
+
+#else
+#define AHRS_STAT_ADD(STAT, N) ((void) 0)
+#define AHRS_STAT_IF(CONDITION, STAT) ((void) 0)
+#define AHRS_STAT_COLD(STAT) ((void) 0)
+#define AHRS_STAT_INTEGRAL(INTEGRAL_FB) ((void) 0)
+#define AHRS_STATS_START(START) ((void) 0)
+#define AHRS_STATS_STOP(START, SAMPLES) ((void) 0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __AHRS_STATS_H__ */
@@ -1,7 +1,24 @@
 #ifndef __AHRS_H__
 #define __AHRS_H__
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "ahrs_rsqrt.h"
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+// 1: MA_PRECISION is double. Build-wide, every translation unit of the library must agree
+#ifndef MA_DOUBLE_PRECISION
 #define MA_DOUBLE_PRECISION 0
+#endif
+
+// 1: the filters and filter banks use the BETA / TWO_KP / TWO_KI constants and ignore the
+// per-instance and per-lane gains, so the gains fold into the kernels as compile-time constants
+#ifndef MA_FIXED_GAINS
+#define MA_FIXED_GAINS 0
+#endif
 
 #if defined(_WIN32)
 #define M_PI 3.141592653589793238462643383279502884197163993751
@@ -9,39 +26,342 @@
 
 #if MA_DOUBLE_PRECISION
 #define MA_PRECISION double
-
 #define ATAN2 atan2
 #define ASIN asin
-#define MAGIC_R 0x5fe6eb50c7b537a9
-#define SQRT sqrtf
+#define ACOS acos
+#define SQRT sqrt
+#define SIN sin
+#define COS cos
+#define RSQRT ahrs_rsqrt_d
 
 #else
 #define MA_PRECISION float
 #define ATAN2 atan2f
 #define ASIN asinf
+#define ACOS acosf
 #define SQRT sqrtf
-#define MAGIC_R 0x5f3759df
+#define SIN sinf
+#define COS cosf
+#define RSQRT ahrs_rsqrt_f
+#endif
+
+// Filter kernels are forced inline into their callers, so constant arguments (gains, IMU/MARG) fold into them
+#if defined(__GNUC__) || defined(__clang__)
+#define MA_INLINE static inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define MA_INLINE static __forceinline
+#else
+#define MA_INLINE static inline
 #endif
 
 // https://en.wikipedia.org/wiki/Conversion_between_quaternions_and_Euler_angles
-#define COMPUTE_EULER_ANGLE(WS) \
-	WS->yaw = ATAN2(2 * WS->q0 * WS->q3 + 2 * WS->q1 * WS->q2, 1 - 2 * WS->q2 * WS->q2 - 2 * WS->q3 * WS->q3); \
-	MA_PRECISION sinp = 2 * WS->q0 * WS->q2 - 2 * WS->q1 * WS->q3;\
-	if(sinp >= 1) WS->pitch = M_PI/2;\
-	else if(sinp <= -1) WS->pitch = -M_PI/2;\
-	else WS->pitch = ASIN(sinp);\
-	WS->roll = ATAN2(2 * WS->q0 * WS->q1 + 2 * WS->q2 * WS->q3, 1 -2 * WS->q1 * WS->q1 - 2 * WS->q2 * WS->q2)
-
-
-// See: http://en.wikipedia.org/wiki/Fast_inverse_square_root
-MA_PRECISION inv_sqrt(MA_PRECISION x){
-	MA_PRECISION halfx = 0.5f * x;
-	MA_PRECISION y = x;
-	long i = *(long *)&y;
-	i = MAGIC_R - (i >> 1);
-	y = *(MA_PRECISION *)&i;
-	y = y * (1.5f - (halfx * y * y));
-	return y;
+#define QUATERNION_TO_EULER(Q0, Q1, Q2, Q3, YAW, PITCH, ROLL) do { \
+	YAW = ATAN2(2 * (Q0) * (Q3) + 2 * (Q1) * (Q2), 1 - 2 * (Q2) * (Q2) - 2 * (Q3) * (Q3)); \
+	MA_PRECISION sinp = 2 * (Q0) * (Q2) - 2 * (Q1) * (Q3);\
+	if(sinp >= 1) PITCH = M_PI/2;\
+	else if(sinp <= -1) PITCH = -M_PI/2;\
+	else PITCH = ASIN(sinp);\
+	ROLL = ATAN2(2 * (Q0) * (Q1) + 2 * (Q2) * (Q3), 1 -2 * (Q1) * (Q1) - 2 * (Q2) * (Q2)); \
+} while(0)
+
+#define COMPUTE_EULER_ANGLE(WS) QUATERNION_TO_EULER(WS->q0, WS->q1, WS->q2, WS->q3, WS->yaw, WS->pitch, WS->roll)
+
+// Strided view over a stream of 3-axis sensor samples, consumed by the *_batch update functions.
+// Sample i is (x[i * stride], y[i * stride], z[i * stride]); stride is counted in MA_PRECISION elements.
+typedef struct {
+    const MA_PRECISION* x;
+    const MA_PRECISION* y;
+    const MA_PRECISION* z;
+    size_t stride;
+} AHRSSensorArray;
+
+// Interleaved samples: x, y, z adjacent, consecutive samples `stride` elements apart (3 for packed xyz, 9 for gyro/accel/mag records)
+static inline AHRSSensorArray ahrs_sensor_array_interleaved(const MA_PRECISION* xyz, size_t stride){
+	AHRSSensorArray array = { xyz, xyz + 1, xyz + 2, stride };
+	return array;
+}
+
+// Planar samples: one contiguous array per axis
+static inline AHRSSensorArray ahrs_sensor_array_planar(const MA_PRECISION* x, const MA_PRECISION* y, const MA_PRECISION* z){
+	AHRSSensorArray array = { x, y, z, 1 };
+	return array;
+}
+
+// Writable counterpart of AHRSSensorArray, for per-sample vector outputs (e.g. the linear
+// acceleration of the *_batch_linear updates)
+typedef struct {
+    MA_PRECISION* x;
+    MA_PRECISION* y;
+    MA_PRECISION* z;
+    size_t stride;
+} AHRSVectorArray;
+
+static inline AHRSVectorArray ahrs_vector_array_interleaved(MA_PRECISION* xyz, size_t stride){
+	AHRSVectorArray array = { xyz, xyz + 1, xyz + 2, stride };
+	return array;
+}
+
+static inline AHRSVectorArray ahrs_vector_array_planar(MA_PRECISION* x, MA_PRECISION* y, MA_PRECISION* z){
+	AHRSVectorArray array = { x, y, z, 1 };
+	return array;
+}
+
+// Linear sensor calibration of the *_batch_calibrated updates: corrected = matrix * (raw - offset).
+// Gyro: offset the static bias in rad/s, matrix the scale and misalignment; accelerometer: offset and
+// scale; magnetometer: offset the hard iron, matrix the soft iron correction.
+typedef struct {
+    MA_PRECISION matrix[9];     // row-major
+    MA_PRECISION offset[3];
+} AHRSSensorCalibration;
+
+typedef struct {
+    AHRSSensorCalibration gyro;
+    AHRSSensorCalibration accel;
+    AHRSSensorCalibration mag;
+} AHRSCalibration;
+
+// Identity matrices and zero offsets
+static inline void ahrs_calibration_identity(AHRSCalibration* calibration){
+	AHRSSensorCalibration* sensors[3] = { &calibration->gyro, &calibration->accel, &calibration->mag };
+	for(int s = 0; s < 3; s++) {
+		for(int i = 0; i < 9; i++) sensors[s]->matrix[i] = i % 4 == 0 ? 1.0f : 0.0f;
+		for(int i = 0; i < 3; i++) sensors[s]->offset[i] = 0.0f;
+	}
+}
+
+// Calibrates one sample in place. With `keep_zero` an all-zero sample, the filters' mark of a missing
+// accelerometer / magnetometer measurement, stays zero.
+MA_INLINE void ahrs_calibrate(const AHRSSensorCalibration* c, int keep_zero, MA_PRECISION* x, MA_PRECISION* y, MA_PRECISION* z){
+	if(keep_zero && (*x == 0.0f) && (*y == 0.0f) && (*z == 0.0f)) return;
+	MA_PRECISION dx = *x - c->offset[0], dy = *y - c->offset[1], dz = *z - c->offset[2];
+	*x = c->matrix[0] * dx + c->matrix[1] * dy + c->matrix[2] * dz;
+	*y = c->matrix[3] * dx + c->matrix[4] * dy + c->matrix[5] * dz;
+	*z = c->matrix[6] * dx + c->matrix[7] * dy + c->matrix[8] * dz;
+}
+
+// Decimated output of the *_batch_decimated updates: the filter runs at the input rate and writes a
+// quaternion only at the output points, e.g. 100 Hz for consumers of a 2 kHz IMU.
+//   fixed-rate updates     one output after every `factor` samples, counted across calls
+//   timestamped updates    outputs at the multiples of `period` ns, from the first one at or after
+//                          the filter's first sample: with `interpolate` the slerp of the quaternions
+//                          of the samples around the output time, else the quaternion of the last
+//                          sample at or before it. An output time is written once a later sample
+//                          arrives, so with interpolation too it never waits for more than one sample.
+typedef struct {
+    size_t factor;
+    size_t phase;           // samples since the last output
+    uint64_t period;        // ns
+    uint64_t next;          // next output time, 0 until the first sample
+    int interpolate;
+} AHRSDecimator;
+
+// Returns 0, or -1 for factor 0
+static inline int ahrs_decimator_init(AHRSDecimator* decimator, size_t factor){
+	if(decimator == NULL || factor == 0) return -1;
+	AHRSDecimator d = { factor, 0, 0, 0, 0 };
+	*decimator = d;
+	return 0;
+}
+
+// Returns 0, or -1 for period 0
+static inline int ahrs_decimator_init_period(AHRSDecimator* decimator, uint64_t period, int interpolate){
+	if(decimator == NULL || period == 0) return -1;
+	AHRSDecimator d = { 0, 0, period, 0, interpolate != 0 };
+	*decimator = d;
+	return 0;
+}
+
+// Most quaternions the next decimated update of `count` samples, timestamped first .. last, can write:
+// the size of its output arrays. Timestamps are ignored by fixed-rate decimators.
+static inline size_t ahrs_decimator_outputs(const AHRSDecimator* decimator, size_t count, uint64_t first_timestamp, uint64_t last_timestamp){
+	if(decimator->period == 0) return decimator->factor > 0 ? (decimator->phase + count) / decimator->factor : 0;
+	uint64_t next = decimator->next != 0 ? decimator->next : first_timestamp / decimator->period * decimator->period;
+	return last_timestamp >= next ? (size_t)((last_timestamp - next) / decimator->period) + 1 : 0;
+}
+
+// Aligned allocation for the structure-of-arrays filter banks; release with ahrs_aligned_free
+static inline void* ahrs_aligned_alloc(size_t alignment, size_t size){
+#if defined(_WIN32)
+	return _aligned_malloc(size, alignment);
+#else
+	void* memory = NULL;
+	if(posix_memalign(&memory, alignment, size) != 0) return NULL;
+	return memory;
+#endif
+}
+
+static inline void ahrs_aligned_free(void* memory){
+#if defined(_WIN32)
+	_aligned_free(memory);
+#else
+	free(memory);
+#endif
+}
+
+// Reciprocal square root, backend chosen by AHRS_RSQRT (see ahrs_rsqrt.h).
+// static inline so that every filter translation unit can include this header and still link together
+static inline MA_PRECISION inv_sqrt(MA_PRECISION x){
+	return RSQRT(x);
+}
+
+// Gap policies of the per-sample dt updates (*_dt, *_batch_timestamped), for sample intervals longer
+// than the filter's max_dt (AHRS_GAP_PERIODS sample periods unless set with *_set_gap_policy):
+//   AHRS_GAP_PROPAGATE  rotate by the gyro over the whole gap, without accelerometer / magnetometer
+//                       feedback: the feedback gains are tuned for short steps and would overshoot
+//   AHRS_GAP_CLAMP      integrate the sample normally with dt = max_dt. This loses the rotation over
+//                       the rest of the gap, so use it only for gaps known to be near-stationary:
+//                       on the moving trajectory of bench/jitter_bench.c it gives 114 / 48 deg rms
+//                       (Madgwick / Mahony), barely better than ignoring the timestamps (132 / 68),
+//                       against 1.4 / 1.1 deg with AHRS_GAP_PROPAGATE
+// Intervals <= 0 (repeated or out of order timestamps) leave the filter unchanged.
+#define AHRS_GAP_PROPAGATE 0
+#define AHRS_GAP_CLAMP 1
+#define AHRS_GAP_PERIODS 5
+
+// Multi-rate updates (*_predict, *_correct_accel, *_correct_mag, *_update_events): the gyro drives the
+// propagation at its own rate and each accelerometer or magnetometer sample applies its correction,
+// scaled by the interval since the previous sample of that sensor, at most AHRS_CORRECTION_MAX_DT s.
+#define AHRS_CORRECTION_MAX_DT 0.1f
+
+// Sensor sample of the event updates, timestamped in ns; gyro samples are rates over the interval
+// ending at their timestamp, as for the timestamped batch updates
+#define AHRS_SENSOR_GYRO 0
+#define AHRS_SENSOR_ACCEL 1
+#define AHRS_SENSOR_MAG 2
+
+typedef struct {
+    uint64_t timestamp;
+    uint32_t sensor;        // AHRS_SENSOR_*
+    MA_PRECISION x;
+    MA_PRECISION y;
+    MA_PRECISION z;
+} AHRSSensorEvent;
+
+// Interval a correction at `timestamp` stands for, s, with *last the time of the previous sample of its
+// sensor (valid when *has_last) updated; 0 for the first sample of a sensor and for stale timestamps
+MA_INLINE MA_PRECISION ahrs_correction_dt(uint64_t* last, int* has_last, uint64_t timestamp){
+	int64_t delta = (int64_t)(timestamp - *last);
+	if(*has_last && delta <= 0) return 0.0f;
+	MA_PRECISION dt = *has_last ? (MA_PRECISION) delta * (MA_PRECISION) 1e-9 : 0.0f;
+	*last = timestamp;
+	*has_last = 1;
+	return dt < AHRS_CORRECTION_MAX_DT ? dt : AHRS_CORRECTION_MAX_DT;
+}
+
+// Applies the gap policy to the interval *dt > 0 of a sample: 1 when the sample only propagates the
+// gyro (ahrs_gyro_propagate), else 0 with *dt the interval to integrate
+MA_INLINE int ahrs_gap_propagate_only(MA_PRECISION* dt, MA_PRECISION max_dt, int policy){
+	if(*dt <= max_dt) return 0;
+	if(policy == AHRS_GAP_CLAMP) {
+		*dt = max_dt;
+		return 0;
+	}
+	return 1;
+}
+
+// Rotates q by the body rate (gx, gy, gz) held for dt, q * exp((0, g) * dt / 2): exact for any dt,
+// unlike the first order integration of the filter steps
+MA_INLINE void ahrs_gyro_propagate(MA_PRECISION* q, MA_PRECISION dt, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz){
+	MA_PRECISION norm = SQRT(gx * gx + gy * gy + gz * gz);
+	MA_PRECISION c = COS(0.5f * norm * dt);
+	MA_PRECISION s = norm > 0.0f ? SIN(0.5f * norm * dt) / norm : 0.5f * dt;
+	MA_PRECISION r1 = s * gx, r2 = s * gy, r3 = s * gz;
+	MA_PRECISION q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	q[0] = q0 * c - q1 * r1 - q2 * r2 - q3 * r3;
+	q[1] = q0 * r1 + q1 * c + q2 * r3 - q3 * r2;
+	q[2] = q0 * r2 - q1 * r3 + q2 * c + q3 * r1;
+	q[3] = q0 * r3 + q1 * r2 - q2 * r1 + q3 * c;
+}
+
+// Linear acceleration in the earth frame: the accelerometer sample rotated from the sensor frame,
+// R(q) a, less the gravity it measures at rest, (0, 0, gravity) in the units of the sample
+MA_INLINE void ahrs_linear_acceleration(const MA_PRECISION* q, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az, MA_PRECISION gravity, MA_PRECISION* x, MA_PRECISION* y, MA_PRECISION* z){
+	MA_PRECISION q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	*x = ax * (1.0f - 2.0f * (q2 * q2 + q3 * q3)) + 2.0f * ay * (q1 * q2 - q0 * q3) + 2.0f * az * (q1 * q3 + q0 * q2);
+	*y = 2.0f * ax * (q1 * q2 + q0 * q3) + ay * (1.0f - 2.0f * (q1 * q1 + q3 * q3)) + 2.0f * az * (q2 * q3 - q0 * q1);
+	*z = 2.0f * ax * (q1 * q3 - q0 * q2) + 2.0f * ay * (q2 * q3 + q0 * q1) + az * (1.0f - 2.0f * (q1 * q1 + q2 * q2)) - gravity;
+}
+
+// Heading of a magnetometer sample in the earth frame, atan2(hy, hx) of h = R(q) m: 0 when q points
+// the sensor at magnetic north. Returns 0 with *valid cleared when the field has no horizontal part.
+MA_INLINE MA_PRECISION ahrs_heading(const MA_PRECISION* q, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz, int* valid){
+	MA_PRECISION q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	MA_PRECISION hx = mx * (q0 * q0 + q1 * q1 - q2 * q2 - q3 * q3) + 2.0f * my * (q1 * q2 - q0 * q3) + 2.0f * mz * (q1 * q3 + q0 * q2);
+	MA_PRECISION hy = 2.0f * mx * (q1 * q2 + q0 * q3) + my * (q0 * q0 - q1 * q1 + q2 * q2 - q3 * q3) + 2.0f * mz * (q2 * q3 - q0 * q1);
+	*valid = (hx != 0.0f) || (hy != 0.0f);
+	return *valid ? ATAN2(hy, hx) : 0.0f;
+}
+
+// Attitude from one sample, e.g. to start a filter near the truth instead of at the identity: roll
+// and pitch from the accelerometer (not all zero), yaw from the tilt-compensated magnetometer heading
+// with `marg`, else 0
+MA_INLINE void ahrs_align(MA_PRECISION* q, int marg, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz){
+	MA_PRECISION roll = ATAN2(ay, az), pitch = ATAN2(-ax, SQRT(ay * ay + az * az));
+	MA_PRECISION cr = COS(0.5f * roll), sr = SIN(0.5f * roll), cp = COS(0.5f * pitch), sp = SIN(0.5f * pitch);
+	q[0] = cr * cp;
+	q[1] = sr * cp;
+	q[2] = cr * sp;
+	q[3] = -sr * sp;
+	int valid = 0;
+	MA_PRECISION heading = marg ? ahrs_heading(q, mx, my, mz, &valid) : 0.0f;
+	if(valid) {
+		// q = (cos(yaw / 2), 0, 0, sin(yaw / 2)) * q with yaw = -heading
+		MA_PRECISION c = COS(0.5f * heading), s = -SIN(0.5f * heading);
+		MA_PRECISION q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+		q[0] = c * q0 - s * q3;
+		q[1] = c * q1 - s * q2;
+		q[2] = c * q2 + s * q1;
+		q[3] = c * q3 + s * q0;
+	}
+}
+
+// Spherical linear interpolation from a (t = 0) to b (t = 1) along the shorter arc; normalised linear
+// interpolation when they are close, as consecutive samples of a filter are
+MA_INLINE void ahrs_slerp(const MA_PRECISION* a, const MA_PRECISION* b, MA_PRECISION t, MA_PRECISION* out){
+	MA_PRECISION dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+	MA_PRECISION sign = dot < 0.0f ? -1.0f : 1.0f;
+	MA_PRECISION wa, wb;
+	dot *= sign;
+	if(dot > 0.9995f) {
+		wa = 1.0f - t;
+		wb = t;
+	} else {
+		MA_PRECISION theta = ACOS(dot), recipSin = 1.0f / SIN(theta);
+		wa = SIN((1.0f - t) * theta) * recipSin;
+		wb = SIN(t * theta) * recipSin;
+	}
+	wb *= sign;
+	MA_PRECISION q0 = wa * a[0] + wb * b[0], q1 = wa * a[1] + wb * b[1], q2 = wa * a[2] + wb * b[2], q3 = wa * a[3] + wb * b[3];
+	MA_PRECISION recipNorm = inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	out[0] = q0 * recipNorm;
+	out[1] = q1 * recipNorm;
+	out[2] = q2 * recipNorm;
+	out[3] = q3 * recipNorm;
+}
+
+// First output time of a timestamped decimated update whose first sample is at `timestamp`
+MA_INLINE uint64_t ahrs_decimator_start(AHRSDecimator* decimator, uint64_t timestamp){
+	if(decimator->next == 0) {
+		decimator->next = (timestamp / decimator->period + (timestamp % decimator->period != 0)) * decimator->period;
+		if(decimator->next == 0) decimator->next = decimator->period;
+	}
+	return decimator->next;
+}
+
+// Writes output `index` at `time`, between the quaternion `before` of the sample at `before_time` and
+// `q` of the sample `delta` ns later
+MA_INLINE void ahrs_decimator_output(const AHRSDecimator* decimator, uint64_t time, const MA_PRECISION* before, uint64_t before_time, const MA_PRECISION* q, int64_t delta, MA_PRECISION* quaternions, uint64_t* output_timestamps, size_t index){
+	if(quaternions != NULL) {
+		MA_PRECISION* out = quaternions + 4 * index;
+		if(decimator->interpolate && time > before_time) ahrs_slerp(before, q, (MA_PRECISION)(int64_t)(time - before_time) / (MA_PRECISION) delta, out);
+		else {
+			out[0] = before[0];
+			out[1] = before[1];
+			out[2] = before[2];
+			out[3] = before[3];
+		}
+	}
+	if(output_timestamps != NULL) output_timestamps[index] = time;
 }
 
 #endif
@@ -0,0 +1,322 @@
+//=====================================================================================================
+// ahrs_bench.c
+//=====================================================================================================
+//
+// Benchmark suite: every update entry point fed the synthetic trajectory of imu_trajectory.h, in
+// a few scenarios. For each entry point it reports ns/update (best of --repeat runs) and the RMS and
+// maximum orientation error against the ground truth after a settling period: the full attitude
+// error for the MARG updates, the tilt error for the IMU updates (heading is unobservable without
+// the magnetometer).
+//
+// Precision is that of the build (MA_DOUBLE_PRECISION); CMake builds ahrs_bench_float and
+// ahrs_bench_double, and the run_benchmarks target runs both.
+//
+// Usage: ahrs_bench [--scenario clean|bias|disturbance] [--rate HZ] [--seconds S] [--repeat N]
+//                   [--gyro-noise RAD_S] [--accel-noise G] [--mag-noise UNITS] [--gyro-bias RAD_S]
+//                   [--mag-disturbance UNITS] [--seed N]
+//
+//=====================================================================================================
+#include "madgwick_ahrs.h"
+#include "mahony_ahrs.h"
+#include "madgwick_ahrs_bank.h"
+#include "mahony_ahrs_bank.h"
+#include "ahrs_dispatch.h"
+#include "imu_trajectory.h"
+#include "bench_util.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BANK_FILTERS 64     // filters in the bank entry points, all fed the same stream
+#define SETTLE_SECONDS 2.0  // errors are taken after this long, at most a quarter of the run
+
+typedef struct {
+    const char* name;
+    int marg;   // 1: full attitude error, 0: tilt error
+    size_t filters_per_call;
+    // Runs `count` samples through a new filter and writes the quaternion after every sample
+    void (*run)(const MA_PRECISION* samples, size_t count, MA_PRECISION sample_rate, MA_PRECISION* quaternions);
+} BenchEntry;
+
+//---------------------------------------------------------------------------------------------------
+// Entry points
+
+#define RECORD IMU_TRAJECTORY_RECORD_SIZE
+
+static void store_quaternion(MA_PRECISION* out, MA_PRECISION q0, MA_PRECISION q1, MA_PRECISION q2, MA_PRECISION q3){
+	out[0] = q0;
+	out[1] = q1;
+	out[2] = q2;
+	out[3] = q3;
+}
+
+static void run_madgwick_update_imu(const MA_PRECISION* samples, size_t count, MA_PRECISION sample_rate, MA_PRECISION* quaternions){
+	MadgwickAHRS* filter = create_madgwick_ahrs(sample_rate);
+	for(size_t i = 0; i < count; i++) {
+		const MA_PRECISION* s = samples + i * RECORD;
+		madgwick_ahrs_update_imu(filter, s[0], s[1], s[2], s[3], s[4], s[5]);
+		store_quaternion(quaternions + 4 * i, filter->q0, filter->q1, filter->q2, filter->q3);
+	}
+	free_madgwick_ahrs(filter);
+}
+
+static void run_madgwick_update(const MA_PRECISION* samples, size_t count, MA_PRECISION sample_rate, MA_PRECISION* quaternions){
+	MadgwickAHRS* filter = create_madgwick_ahrs(sample_rate);
+	for(size_t i = 0; i < count; i++) {
+		const MA_PRECISION* s = samples + i * RECORD;
+		madgwick_ahrs_update(filter, s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7], s[8]);
+		store_quaternion(quaternions + 4 * i, filter->q0, filter->q1, filter->q2, filter->q3);
+	}
+	free_madgwick_ahrs(filter);
+}
+
+static void run_madgwick_update_imu_batch(const MA_PRECISION* samples, size_t count, MA_PRECISION sample_rate, MA_PRECISION* quaternions){
+	MadgwickAHRS* filter = create_madgwick_ahrs(sample_rate);
+	madgwick_ahrs_update_imu_batch(filter, ahrs_sensor_array_interleaved(samples, RECORD), ahrs_sensor_array_interleaved(samples + 3, RECORD), count, quaternions);
+	free_madgwick_ahrs(filter);
+}
+
+static void run_madgwick_update_batch(const MA_PRECISION* samples, size_t count, MA_PRECISION sample_rate, MA_PRECISION* quaternions){
+	MadgwickAHRS* filter = create_madgwick_ahrs(sample_rate);
+	madgwick_ahrs_update_batch(filter, ahrs_sensor_array_interleaved(samples, RECORD), ahrs_sensor_array_interleaved(samples + 3, RECORD),
+		ahrs_sensor_array_interleaved(samples + 6, RECORD), count, quaternions);
+	free_madgwick_ahrs(filter);
+}
+
+static void run_mahony_update_imu(const MA_PRECISION* samples, size_t count, MA_PRECISION sample_rate, MA_PRECISION* quaternions){
+	MahonyAHRS* filter = create_mahony_ahrs(sample_rate);
+	for(size_t i = 0; i < count; i++) {
+		const MA_PRECISION* s = samples + i * RECORD;
+		mahony_ahrs_update_imu(filter, s[0], s[1], s[2], s[3], s[4], s[5]);
+		store_quaternion(quaternions + 4 * i, filter->q0, filter->q1, filter->q2, filter->q3);
+	}
+	free_mahony_ahrs(filter);
+}
+
+static void run_mahony_update(const MA_PRECISION* samples, size_t count, MA_PRECISION sample_rate, MA_PRECISION* quaternions){
+	MahonyAHRS* filter = create_mahony_ahrs(sample_rate);
+	for(size_t i = 0; i < count; i++) {
+		const MA_PRECISION* s = samples + i * RECORD;
+		mahony_ahrs_update(filter, s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7], s[8]);
+		store_quaternion(quaternions + 4 * i, filter->q0, filter->q1, filter->q2, filter->q3);
+	}
+	free_mahony_ahrs(filter);
+}
+
+static void run_mahony_update_imu_batch(const MA_PRECISION* samples, size_t count, MA_PRECISION sample_rate, MA_PRECISION* quaternions){
+	MahonyAHRS* filter = create_mahony_ahrs(sample_rate);
+	mahony_ahrs_update_imu_batch(filter, ahrs_sensor_array_interleaved(samples, RECORD), ahrs_sensor_array_interleaved(samples + 3, RECORD), count, quaternions);
+	free_mahony_ahrs(filter);
+}
+
+static void run_mahony_update_batch(const MA_PRECISION* samples, size_t count, MA_PRECISION sample_rate, MA_PRECISION* quaternions){
+	MahonyAHRS* filter = create_mahony_ahrs(sample_rate);
+	mahony_ahrs_update_batch(filter, ahrs_sensor_array_interleaved(samples, RECORD), ahrs_sensor_array_interleaved(samples + 3, RECORD),
+		ahrs_sensor_array_interleaved(samples + 6, RECORD), count, quaternions);
+	free_mahony_ahrs(filter);
+}
+
+// The banks take planar per-tick inputs; every filter gets the same sample, copied in per tick.
+// The copy is part of the measured time, as it would be for a caller gathering device samples.
+static void fill_bank_inputs(MA_PRECISION (*inputs)[BANK_FILTERS], const MA_PRECISION* s){
+	for(int k = 0; k < RECORD; k++)
+		for(int f = 0; f < BANK_FILTERS; f++) inputs[k][f] = s[k];
+}
+
+static void run_bank(const MA_PRECISION* samples, size_t count, MA_PRECISION sample_rate, MA_PRECISION* quaternions, int madgwick, int marg){
+	MA_PRECISION inputs[RECORD][BANK_FILTERS];
+	MadgwickAHRSBank* madgwick_bank = madgwick ? create_madgwick_ahrs_bank(BANK_FILTERS, sample_rate) : NULL;
+	MahonyAHRSBank* mahony_bank = madgwick ? NULL : create_mahony_ahrs_bank(BANK_FILTERS, sample_rate);
+	for(size_t i = 0; i < count; i++) {
+		fill_bank_inputs(inputs, samples + i * RECORD);
+		if(madgwick) {
+			if(marg) madgwick_ahrs_bank_update(madgwick_bank, inputs[0], inputs[1], inputs[2], inputs[3], inputs[4], inputs[5], inputs[6], inputs[7], inputs[8]);
+			else madgwick_ahrs_bank_update_imu(madgwick_bank, inputs[0], inputs[1], inputs[2], inputs[3], inputs[4], inputs[5]);
+			store_quaternion(quaternions + 4 * i, madgwick_bank->q0[0], madgwick_bank->q1[0], madgwick_bank->q2[0], madgwick_bank->q3[0]);
+		} else {
+			if(marg) mahony_ahrs_bank_update(mahony_bank, inputs[0], inputs[1], inputs[2], inputs[3], inputs[4], inputs[5], inputs[6], inputs[7], inputs[8]);
+			else mahony_ahrs_bank_update_imu(mahony_bank, inputs[0], inputs[1], inputs[2], inputs[3], inputs[4], inputs[5]);
+			store_quaternion(quaternions + 4 * i, mahony_bank->q0[0], mahony_bank->q1[0], mahony_bank->q2[0], mahony_bank->q3[0]);
+		}
+	}
+	free_madgwick_ahrs_bank(madgwick_bank);
+	free_mahony_ahrs_bank(mahony_bank);
+}
+
+static void run_madgwick_bank_update_imu(const MA_PRECISION* samples, size_t count, MA_PRECISION sample_rate, MA_PRECISION* quaternions){
+	run_bank(samples, count, sample_rate, quaternions, 1, 0);
+}
+
+static void run_madgwick_bank_update(const MA_PRECISION* samples, size_t count, MA_PRECISION sample_rate, MA_PRECISION* quaternions){
+	run_bank(samples, count, sample_rate, quaternions, 1, 1);
+}
+
+static void run_mahony_bank_update_imu(const MA_PRECISION* samples, size_t count, MA_PRECISION sample_rate, MA_PRECISION* quaternions){
+	run_bank(samples, count, sample_rate, quaternions, 0, 0);
+}
+
+static void run_mahony_bank_update(const MA_PRECISION* samples, size_t count, MA_PRECISION sample_rate, MA_PRECISION* quaternions){
+	run_bank(samples, count, sample_rate, quaternions, 0, 1);
+}
+
+static const BenchEntry entries[] = {
+	{ "madgwick_ahrs_update_imu", 0, 1, run_madgwick_update_imu },
+	{ "madgwick_ahrs_update", 1, 1, run_madgwick_update },
+	{ "madgwick_ahrs_update_imu_batch", 0, 1, run_madgwick_update_imu_batch },
+	{ "madgwick_ahrs_update_batch", 1, 1, run_madgwick_update_batch },
+	{ "madgwick_ahrs_bank_update_imu", 0, BANK_FILTERS, run_madgwick_bank_update_imu },
+	{ "madgwick_ahrs_bank_update", 1, BANK_FILTERS, run_madgwick_bank_update },
+	{ "mahony_ahrs_update_imu", 0, 1, run_mahony_update_imu },
+	{ "mahony_ahrs_update", 1, 1, run_mahony_update },
+	{ "mahony_ahrs_update_imu_batch", 0, 1, run_mahony_update_imu_batch },
+	{ "mahony_ahrs_update_batch", 1, 1, run_mahony_update_batch },
+	{ "mahony_ahrs_bank_update_imu", 0, BANK_FILTERS, run_mahony_bank_update_imu },
+	{ "mahony_ahrs_bank_update", 1, BANK_FILTERS, run_mahony_bank_update },
+};
+
+//---------------------------------------------------------------------------------------------------
+// Scenarios
+
+typedef struct {
+    const char* name;
+    const char* description;
+} BenchScenario;
+
+static const BenchScenario scenarios[] = {
+	{ "clean", "sensor noise only" },
+	{ "bias", "constant gyro bias on every axis" },
+	{ "disturbance", "magnetic disturbance during the middle third of the run" },
+};
+
+typedef struct {
+    ImuTrajectoryConfig trajectory;
+    double gyro_bias;
+    double mag_disturbance;
+    const char* scenario;   // NULL: all
+    int repeat;
+} BenchOptions;
+
+static void scenario_config(const BenchOptions* options, const BenchScenario* scenario, ImuTrajectoryConfig* config){
+	*config = options->trajectory;
+	if(strcmp(scenario->name, "bias") == 0) {
+		config->gyro_bias[0] = options->gyro_bias;
+		config->gyro_bias[1] = -options->gyro_bias;
+		config->gyro_bias[2] = options->gyro_bias;
+	} else if(strcmp(scenario->name, "disturbance") == 0) {
+		double seconds = (double)config->count / config->sample_rate;
+		config->mag_disturbance[1] = options->mag_disturbance;
+		config->disturbance_start = seconds / 3.0;
+		config->disturbance_end = 2.0 * seconds / 3.0;
+	}
+}
+
+static void run_scenario(const BenchOptions* options, const BenchScenario* scenario){
+	ImuTrajectoryConfig config;
+	scenario_config(options, scenario, &config);
+	const size_t count = config.count;
+	MA_PRECISION* samples = (MA_PRECISION *) malloc(count * RECORD * sizeof(MA_PRECISION));
+	MA_PRECISION* quaternions = (MA_PRECISION *) malloc(count * 4 * sizeof(MA_PRECISION));
+	double* truth = (double *) malloc(count * 4 * sizeof(double));
+	if(samples == NULL || quaternions == NULL || truth == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	imu_trajectory_generate(&config, samples, truth);
+
+	double settle = SETTLE_SECONDS;
+	if(settle > 0.25 * (double)count / config.sample_rate) settle = 0.25 * (double)count / config.sample_rate;
+	const size_t first = (size_t)(settle * config.sample_rate);
+
+	printf("\nscenario %s: %s\n", scenario->name, scenario->description);
+	printf("%-32s %10s %12s %12s   %s\n", "entry point", "ns/update", "rms err deg", "max err deg", "error");
+	for(size_t e = 0; e < sizeof(entries) / sizeof(entries[0]); e++) {
+		const BenchEntry* entry = entries + e;
+		double best = INFINITY;
+		for(int r = 0; r < options->repeat; r++) {
+			double t0 = bench_now();
+			entry->run(samples, count, (MA_PRECISION) config.sample_rate, quaternions);
+			double seconds = bench_now() - t0;
+			if(seconds < best) best = seconds;
+		}
+		double sum = 0.0, max = 0.0;
+		for(size_t i = first; i < count; i++) {
+			const MA_PRECISION* q = quaternions + 4 * i;
+			double err = entry->marg ? imu_trajectory_attitude_error(truth + 4 * i, q[0], q[1], q[2], q[3])
+				: imu_trajectory_tilt_error(truth + 4 * i, q[0], q[1], q[2], q[3]);
+			sum += err * err;
+			if(err > max) max = err;
+		}
+		double rms = count > first ? sqrt(sum / (double)(count - first)) : 0.0;
+		printf("%-32s %10.2f %12.4f %12.4f   %s\n", entry->name, best * 1e9 / ((double)count * (double)entry->filters_per_call),
+			rms * 180.0 / M_PI, max * 180.0 / M_PI, entry->marg ? "attitude" : "tilt");
+	}
+	bench_sink = quaternions[4 * count - 1];
+	free(samples);
+	free(quaternions);
+	free(truth);
+}
+
+//---------------------------------------------------------------------------------------------------
+// Command line
+
+static void usage(const char* program){
+	fprintf(stderr, "usage: %s [--scenario clean|bias|disturbance] [--rate HZ] [--seconds S] [--repeat N]\n"
+		"       [--gyro-noise RAD_S] [--accel-noise G] [--mag-noise UNITS] [--gyro-bias RAD_S]\n"
+		"       [--mag-disturbance UNITS] [--seed N]\n", program);
+}
+
+int main(int argc, char** argv){
+	BenchOptions options;
+	double seconds = 60.0;
+	imu_trajectory_default_config(&options.trajectory);
+	options.gyro_bias = 0.02;
+	options.mag_disturbance = 0.5;
+	options.scenario = NULL;
+	options.repeat = 5;
+
+	for(int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		if(i + 1 >= argc) {
+			usage(argv[0]);
+			return 2;
+		}
+		const char* value = argv[++i];
+		if(strcmp(arg, "--scenario") == 0) options.scenario = value;
+		else if(strcmp(arg, "--rate") == 0) options.trajectory.sample_rate = atof(value);
+		else if(strcmp(arg, "--seconds") == 0) seconds = atof(value);
+		else if(strcmp(arg, "--repeat") == 0) options.repeat = atoi(value);
+		else if(strcmp(arg, "--gyro-noise") == 0) options.trajectory.gyro_noise = atof(value);
+		else if(strcmp(arg, "--accel-noise") == 0) options.trajectory.accel_noise = atof(value);
+		else if(strcmp(arg, "--mag-noise") == 0) options.trajectory.mag_noise = atof(value);
+		else if(strcmp(arg, "--gyro-bias") == 0) options.gyro_bias = atof(value);
+		else if(strcmp(arg, "--mag-disturbance") == 0) options.mag_disturbance = atof(value);
+		else if(strcmp(arg, "--seed") == 0) options.trajectory.seed = strtoull(value, NULL, 0);
+		else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if(options.trajectory.sample_rate <= 0 || seconds <= 0 || options.repeat < 1) {
+		usage(argv[0]);
+		return 2;
+	}
+	options.trajectory.count = (size_t)(seconds * options.trajectory.sample_rate);
+	if(options.trajectory.count == 0) options.trajectory.count = 1;
+
+	printf("precision %s, bank SIMD %s x %d, %zu samples at %g Hz, best of %d runs\n",
+		MA_DOUBLE_PRECISION ? "double" : "float", ahrs_bank_isa(), ahrs_bank_lanes(),
+		options.trajectory.count, options.trajectory.sample_rate, options.repeat);
+
+	int ran = 0;
+	for(size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++) {
+		if(options.scenario != NULL && strcmp(options.scenario, scenarios[s].name) != 0) continue;
+		run_scenario(&options, scenarios + s);
+		ran = 1;
+	}
+	if(!ran) {
+		usage(argv[0]);
+		return 2;
+	}
+	return 0;
+}
@@ -0,0 +1,143 @@
+//=====================================================================================================
+// bank_bench.c
+//=====================================================================================================
+//
+// Throughput of the structure-of-arrays filter banks against one scalar filter per device,
+// and the largest quaternion difference between the two.
+// Build: cc -O2 -march=native -I.. bank_bench.c ../madgwick_ahrs*.c ../mahony_ahrs*.c -lm
+//
+//=====================================================================================================
+#include "madgwick_ahrs_bank.h"
+#include "mahony_ahrs_bank.h"
+#include "ahrs_dispatch.h"
+#include "bench_util.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SAMPLE_RATE 200.0f
+#define FILTER_COUNT 1000 // deliberately not a multiple of the vector width
+#define TICK_COUNT 4096
+#define DISTINCT_TICKS 256
+
+// Per tick, planar inputs for every filter: inputs[tick][axis][filter]
+static MA_PRECISION* make_inputs(void){
+	MA_PRECISION* inputs = (MA_PRECISION *) malloc((size_t)DISTINCT_TICKS * 9 * FILTER_COUNT * sizeof(MA_PRECISION));
+	if(inputs == NULL) return NULL;
+	BenchRandom rng = { 0x853C49E6748FEA9BULL };
+	for(size_t t = 0; t < DISTINCT_TICKS; t++) {
+		MA_PRECISION* tick = inputs + t * 9 * FILTER_COUNT;
+		for(size_t f = 0; f < FILTER_COUNT; f++) {
+			double phase = 0.01 * (double)f + (double)t / SAMPLE_RATE;
+			tick[0 * FILTER_COUNT + f] = (MA_PRECISION)(0.5 * sin(phase) + 0.01 * bench_random_uniform(&rng));
+			tick[1 * FILTER_COUNT + f] = (MA_PRECISION)(0.3 * cos(1.3 * phase) + 0.01 * bench_random_uniform(&rng));
+			tick[2 * FILTER_COUNT + f] = (MA_PRECISION)(0.2 * sin(0.7 * phase) + 0.01 * bench_random_uniform(&rng));
+			tick[3 * FILTER_COUNT + f] = (MA_PRECISION)(0.1 * bench_random_uniform(&rng));
+			tick[4 * FILTER_COUNT + f] = (MA_PRECISION)(0.1 * bench_random_uniform(&rng));
+			tick[5 * FILTER_COUNT + f] = (MA_PRECISION)(1.0 + 0.1 * bench_random_uniform(&rng));
+			tick[6 * FILTER_COUNT + f] = (MA_PRECISION)(0.5 + 0.05 * bench_random_uniform(&rng));
+			tick[7 * FILTER_COUNT + f] = (MA_PRECISION)(0.05 * bench_random_uniform(&rng));
+			tick[8 * FILTER_COUNT + f] = (MA_PRECISION)(-0.8 + 0.05 * bench_random_uniform(&rng));
+			// Exercise the masked branches: dropped magnetometer and accelerometer samples
+			if((f + t) % 13 == 0) tick[6 * FILTER_COUNT + f] = tick[7 * FILTER_COUNT + f] = tick[8 * FILTER_COUNT + f] = 0.0f;
+			if((f + t) % 29 == 0) tick[3 * FILTER_COUNT + f] = tick[4 * FILTER_COUNT + f] = tick[5 * FILTER_COUNT + f] = 0.0f;
+		}
+	}
+	return inputs;
+}
+
+static double max_diff(const MA_PRECISION* q0, const MA_PRECISION* q1, const MA_PRECISION* q2, const MA_PRECISION* q3, size_t f, MA_PRECISION r0, MA_PRECISION r1, MA_PRECISION r2, MA_PRECISION r3, double d){
+	if(fabs(q0[f] - r0) > d) d = fabs(q0[f] - r0);
+	if(fabs(q1[f] - r1) > d) d = fabs(q1[f] - r1);
+	if(fabs(q2[f] - r2) > d) d = fabs(q2[f] - r2);
+	if(fabs(q3[f] - r3) > d) d = fabs(q3[f] - r3);
+	return d;
+}
+
+static void report(const char* name, double scalar_seconds, double bank_seconds, double diff, double tolerance){
+	double updates = (double)FILTER_COUNT * TICK_COUNT;
+	printf("%-24s %10.2f %10.2f %8.2fx   %-10g %s\n", name, updates / scalar_seconds * 1e-6, updates / bank_seconds * 1e-6,
+		scalar_seconds / bank_seconds, diff, diff <= tolerance ? "ok" : "FAIL");
+}
+
+#define TICK(t) (inputs + ((t) % DISTINCT_TICKS) * 9 * FILTER_COUNT)
+#define AXIS(tick, k) ((tick) + (k) * FILTER_COUNT)
+
+int main(void){
+	MA_PRECISION* inputs = make_inputs();
+	if(inputs == NULL) return 1;
+	double t0, scalar_seconds, bank_seconds, diff;
+	int failed = 0;
+
+	printf("%d filters x %d samples, isa %s (%d lanes), Mfilter-samples/s\n", FILTER_COUNT, TICK_COUNT, ahrs_bank_isa(), ahrs_bank_lanes());
+	printf("%-24s %10s %10s %9s   %-10s\n", "entry point", "scalar", "bank", "speedup", "max |dq|");
+
+	for(int marg = 1; marg >= 0; marg--) {
+		MadgwickAHRS* filters[FILTER_COUNT];
+		for(size_t f = 0; f < FILTER_COUNT; f++) filters[f] = create_madgwick_ahrs(SAMPLE_RATE);
+		MadgwickAHRSBank* bank = create_madgwick_ahrs_bank(FILTER_COUNT, SAMPLE_RATE);
+
+		t0 = bench_now();
+		for(size_t t = 0; t < TICK_COUNT; t++) {
+			const MA_PRECISION* tick = TICK(t);
+			for(size_t f = 0; f < FILTER_COUNT; f++) {
+				if(marg) madgwick_ahrs_update(filters[f], AXIS(tick, 0)[f], AXIS(tick, 1)[f], AXIS(tick, 2)[f], AXIS(tick, 3)[f], AXIS(tick, 4)[f], AXIS(tick, 5)[f], AXIS(tick, 6)[f], AXIS(tick, 7)[f], AXIS(tick, 8)[f]);
+				else madgwick_ahrs_update_imu(filters[f], AXIS(tick, 0)[f], AXIS(tick, 1)[f], AXIS(tick, 2)[f], AXIS(tick, 3)[f], AXIS(tick, 4)[f], AXIS(tick, 5)[f]);
+			}
+		}
+		scalar_seconds = bench_now() - t0;
+
+		t0 = bench_now();
+		for(size_t t = 0; t < TICK_COUNT; t++) {
+			const MA_PRECISION* tick = TICK(t);
+			if(marg) madgwick_ahrs_bank_update(bank, AXIS(tick, 0), AXIS(tick, 1), AXIS(tick, 2), AXIS(tick, 3), AXIS(tick, 4), AXIS(tick, 5), AXIS(tick, 6), AXIS(tick, 7), AXIS(tick, 8));
+			else madgwick_ahrs_bank_update_imu(bank, AXIS(tick, 0), AXIS(tick, 1), AXIS(tick, 2), AXIS(tick, 3), AXIS(tick, 4), AXIS(tick, 5));
+		}
+		bank_seconds = bench_now() - t0;
+
+		diff = 0.0;
+		for(size_t f = 0; f < FILTER_COUNT; f++) {
+			diff = max_diff(bank->q0, bank->q1, bank->q2, bank->q3, f, filters[f]->q0, filters[f]->q1, filters[f]->q2, filters[f]->q3, diff);
+			free_madgwick_ahrs(filters[f]);
+		}
+		report(marg ? "madgwick_ahrs_update" : "madgwick_ahrs_update_imu", scalar_seconds, bank_seconds, diff, MADGWICK_AHRS_BANK_TOLERANCE);
+		failed |= !(diff <= MADGWICK_AHRS_BANK_TOLERANCE);
+		free_madgwick_ahrs_bank(bank);
+	}
+
+	for(int marg = 1; marg >= 0; marg--) {
+		MahonyAHRS* filters[FILTER_COUNT];
+		for(size_t f = 0; f < FILTER_COUNT; f++) filters[f] = create_mahony_ahrs(SAMPLE_RATE);
+		MahonyAHRSBank* bank = create_mahony_ahrs_bank(FILTER_COUNT, SAMPLE_RATE);
+
+		t0 = bench_now();
+		for(size_t t = 0; t < TICK_COUNT; t++) {
+			const MA_PRECISION* tick = TICK(t);
+			for(size_t f = 0; f < FILTER_COUNT; f++) {
+				if(marg) mahony_ahrs_update(filters[f], AXIS(tick, 0)[f], AXIS(tick, 1)[f], AXIS(tick, 2)[f], AXIS(tick, 3)[f], AXIS(tick, 4)[f], AXIS(tick, 5)[f], AXIS(tick, 6)[f], AXIS(tick, 7)[f], AXIS(tick, 8)[f]);
+				else mahony_ahrs_update_imu(filters[f], AXIS(tick, 0)[f], AXIS(tick, 1)[f], AXIS(tick, 2)[f], AXIS(tick, 3)[f], AXIS(tick, 4)[f], AXIS(tick, 5)[f]);
+			}
+		}
+		scalar_seconds = bench_now() - t0;
+
+		t0 = bench_now();
+		for(size_t t = 0; t < TICK_COUNT; t++) {
+			const MA_PRECISION* tick = TICK(t);
+			if(marg) mahony_ahrs_bank_update(bank, AXIS(tick, 0), AXIS(tick, 1), AXIS(tick, 2), AXIS(tick, 3), AXIS(tick, 4), AXIS(tick, 5), AXIS(tick, 6), AXIS(tick, 7), AXIS(tick, 8));
+			else mahony_ahrs_bank_update_imu(bank, AXIS(tick, 0), AXIS(tick, 1), AXIS(tick, 2), AXIS(tick, 3), AXIS(tick, 4), AXIS(tick, 5));
+		}
+		bank_seconds = bench_now() - t0;
+
+		diff = 0.0;
+		for(size_t f = 0; f < FILTER_COUNT; f++) {
+			diff = max_diff(bank->q0, bank->q1, bank->q2, bank->q3, f, filters[f]->q0, filters[f]->q1, filters[f]->q2, filters[f]->q3, diff);
+			free_mahony_ahrs(filters[f]);
+		}
+		report(marg ? "mahony_ahrs_update" : "mahony_ahrs_update_imu", scalar_seconds, bank_seconds, diff, MAHONY_AHRS_BANK_TOLERANCE);
+		failed |= !(diff <= MAHONY_AHRS_BANK_TOLERANCE);
+		free_mahony_ahrs_bank(bank);
+	}
+
+	free(inputs);
+	return failed;
+}
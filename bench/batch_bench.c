@@ -0,0 +1,156 @@
+//=====================================================================================================
+// batch_bench.c
+//=====================================================================================================
+//
+// Throughput of the batched update functions against the equivalent per-sample call loop.
+// Build with -DMA_FIXED_GAINS=1 to compare against gains folded in as constants.
+// Build: cc -O2 -I.. batch_bench.c ../madgwick_ahrs.c ../mahony_ahrs.c -lm
+//
+//=====================================================================================================
+#include "madgwick_ahrs.h"
+#include "mahony_ahrs.h"
+#include "bench_util.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SAMPLE_RATE 1000.0f
+#define SAMPLE_COUNT (1 << 20)
+#define RECORD_SIZE 9 // gx gy gz ax ay az mx my mz
+
+// Slowly rotating sensor with noisy gravity and magnetic field readings
+static MA_PRECISION* make_samples(size_t count){
+	MA_PRECISION* samples = (MA_PRECISION *) malloc(count * RECORD_SIZE * sizeof(MA_PRECISION));
+	if(samples == NULL) return NULL;
+	BenchRandom rng = { 0x9E3779B97F4A7C15ULL };
+	for(size_t i = 0; i < count; i++) {
+		MA_PRECISION* s = samples + i * RECORD_SIZE;
+		double t = (double)i / SAMPLE_RATE;
+		s[0] = (MA_PRECISION)(0.3 * sin(0.7 * t) + 0.01 * bench_random_uniform(&rng));
+		s[1] = (MA_PRECISION)(0.2 * cos(0.5 * t) + 0.01 * bench_random_uniform(&rng));
+		s[2] = (MA_PRECISION)(0.1 * sin(0.3 * t) + 0.01 * bench_random_uniform(&rng));
+		s[3] = (MA_PRECISION)(0.05 * bench_random_uniform(&rng));
+		s[4] = (MA_PRECISION)(0.05 * bench_random_uniform(&rng));
+		s[5] = (MA_PRECISION)(1.0 + 0.05 * bench_random_uniform(&rng));
+		s[6] = (MA_PRECISION)(0.5 + 0.02 * bench_random_uniform(&rng));
+		s[7] = (MA_PRECISION)(0.02 * bench_random_uniform(&rng));
+		s[8] = (MA_PRECISION)(-0.8 + 0.02 * bench_random_uniform(&rng));
+	}
+	return samples;
+}
+
+static void report(const char* name, double loop_seconds, double batch_seconds, double max_diff){
+	printf("%-24s %10.2f %10.2f %8.2fx   %g\n", name,
+		SAMPLE_COUNT / loop_seconds * 1e-6, SAMPLE_COUNT / batch_seconds * 1e-6,
+		loop_seconds / batch_seconds, max_diff);
+}
+
+static double quaternion_diff(MA_PRECISION a0, MA_PRECISION a1, MA_PRECISION a2, MA_PRECISION a3, MA_PRECISION b0, MA_PRECISION b1, MA_PRECISION b2, MA_PRECISION b3){
+	double d = fabs(a0 - b0);
+	if(fabs(a1 - b1) > d) d = fabs(a1 - b1);
+	if(fabs(a2 - b2) > d) d = fabs(a2 - b2);
+	if(fabs(a3 - b3) > d) d = fabs(a3 - b3);
+	return d;
+}
+
+int main(void){
+	MA_PRECISION* samples = make_samples(SAMPLE_COUNT);
+	MA_PRECISION* quaternions = (MA_PRECISION *) malloc(SAMPLE_COUNT * 4 * sizeof(MA_PRECISION));
+	if(samples == NULL || quaternions == NULL) return 1;
+	AHRSSensorArray gyro = ahrs_sensor_array_interleaved(samples, RECORD_SIZE);
+	AHRSSensorArray accel = ahrs_sensor_array_interleaved(samples + 3, RECORD_SIZE);
+	AHRSSensorArray mag = ahrs_sensor_array_interleaved(samples + 6, RECORD_SIZE);
+	double t0, loop_seconds, batch_seconds;
+
+	printf("%d samples, Msamples/s\n", SAMPLE_COUNT);
+	printf("%-24s %10s %10s %9s   %s\n", "entry point", "per-call", "batch", "speedup", "max |dq|");
+
+	// Madgwick
+	{
+		MadgwickAHRS* loop = create_madgwick_ahrs(SAMPLE_RATE);
+		MadgwickAHRS* batch = create_madgwick_ahrs(SAMPLE_RATE);
+		t0 = bench_now();
+		for(size_t i = 0; i < SAMPLE_COUNT; i++) {
+			const MA_PRECISION* s = samples + i * RECORD_SIZE;
+			madgwick_ahrs_update(loop, s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7], s[8]);
+		}
+		loop_seconds = bench_now() - t0;
+		t0 = bench_now();
+		madgwick_ahrs_update_batch(batch, gyro, accel, mag, SAMPLE_COUNT, quaternions);
+		batch_seconds = bench_now() - t0;
+		report("madgwick_ahrs_update", loop_seconds, batch_seconds, quaternion_diff(loop->q0, loop->q1, loop->q2, loop->q3, batch->q0, batch->q1, batch->q2, batch->q3));
+		free_madgwick_ahrs(loop);
+		free_madgwick_ahrs(batch);
+
+		loop = create_madgwick_ahrs(SAMPLE_RATE);
+		batch = create_madgwick_ahrs(SAMPLE_RATE);
+		t0 = bench_now();
+		for(size_t i = 0; i < SAMPLE_COUNT; i++) {
+			const MA_PRECISION* s = samples + i * RECORD_SIZE;
+			madgwick_ahrs_update_imu(loop, s[0], s[1], s[2], s[3], s[4], s[5]);
+		}
+		loop_seconds = bench_now() - t0;
+		t0 = bench_now();
+		madgwick_ahrs_update_imu_batch(batch, gyro, accel, SAMPLE_COUNT, quaternions);
+		batch_seconds = bench_now() - t0;
+		report("madgwick_ahrs_update_imu", loop_seconds, batch_seconds, quaternion_diff(loop->q0, loop->q1, loop->q2, loop->q3, batch->q0, batch->q1, batch->q2, batch->q3));
+		free_madgwick_ahrs(loop);
+		free_madgwick_ahrs(batch);
+	}
+
+	// Mahony
+	{
+		MahonyAHRS* loop = create_mahony_ahrs(SAMPLE_RATE);
+		MahonyAHRS* batch = create_mahony_ahrs(SAMPLE_RATE);
+		t0 = bench_now();
+		for(size_t i = 0; i < SAMPLE_COUNT; i++) {
+			const MA_PRECISION* s = samples + i * RECORD_SIZE;
+			mahony_ahrs_update(loop, s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7], s[8]);
+		}
+		loop_seconds = bench_now() - t0;
+		t0 = bench_now();
+		mahony_ahrs_update_batch(batch, gyro, accel, mag, SAMPLE_COUNT, quaternions);
+		batch_seconds = bench_now() - t0;
+		report("mahony_ahrs_update", loop_seconds, batch_seconds, quaternion_diff(loop->q0, loop->q1, loop->q2, loop->q3, batch->q0, batch->q1, batch->q2, batch->q3));
+		free_mahony_ahrs(loop);
+		free_mahony_ahrs(batch);
+
+		// Integral feedback disabled: the batch runs the two_ki == 0 specialisation
+		loop = create_mahony_ahrs(SAMPLE_RATE);
+		batch = create_mahony_ahrs(SAMPLE_RATE);
+		mahony_ahrs_set_gains(loop, TWO_KP, 0.0f);
+		mahony_ahrs_set_gains(batch, TWO_KP, 0.0f);
+		t0 = bench_now();
+		for(size_t i = 0; i < SAMPLE_COUNT; i++) {
+			const MA_PRECISION* s = samples + i * RECORD_SIZE;
+			mahony_ahrs_update(loop, s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7], s[8]);
+		}
+		loop_seconds = bench_now() - t0;
+		t0 = bench_now();
+		mahony_ahrs_update_batch(batch, gyro, accel, mag, SAMPLE_COUNT, quaternions);
+		batch_seconds = bench_now() - t0;
+		report("mahony_ahrs_update Ki=0", loop_seconds, batch_seconds, quaternion_diff(loop->q0, loop->q1, loop->q2, loop->q3, batch->q0, batch->q1, batch->q2, batch->q3));
+		free_mahony_ahrs(loop);
+		free_mahony_ahrs(batch);
+
+		loop = create_mahony_ahrs(SAMPLE_RATE);
+		batch = create_mahony_ahrs(SAMPLE_RATE);
+		t0 = bench_now();
+		for(size_t i = 0; i < SAMPLE_COUNT; i++) {
+			const MA_PRECISION* s = samples + i * RECORD_SIZE;
+			mahony_ahrs_update_imu(loop, s[0], s[1], s[2], s[3], s[4], s[5]);
+		}
+		loop_seconds = bench_now() - t0;
+		t0 = bench_now();
+		mahony_ahrs_update_imu_batch(batch, gyro, accel, SAMPLE_COUNT, quaternions);
+		batch_seconds = bench_now() - t0;
+		report("mahony_ahrs_update_imu", loop_seconds, batch_seconds, quaternion_diff(loop->q0, loop->q1, loop->q2, loop->q3, batch->q0, batch->q1, batch->q2, batch->q3));
+		free_mahony_ahrs(loop);
+		free_mahony_ahrs(batch);
+	}
+
+	bench_sink = quaternions[SAMPLE_COUNT * 4 - 1];
+	free(samples);
+	free(quaternions);
+	return 0;
+}
@@ -0,0 +1,54 @@
+//=====================================================================================================
+// bench_util.h
+//=====================================================================================================
+//
+// Small helpers shared by the benchmark programs: a monotonic clock and a deterministic
+// random number generator, so that every run sees the same input data.
+//
+//=====================================================================================================
+#ifndef __BENCH_UTIL_H__
+#define __BENCH_UTIL_H__
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Monotonic wall clock in seconds
+static inline double bench_now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Time stamp counter where the CPU has one (x86 TSC, ticks at a constant reference rate), else 0
+static inline uint64_t bench_cycles(void){
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+// xorshift64* generator, seeded explicitly so runs are reproducible
+typedef struct {
+    uint64_t state;
+} BenchRandom;
+
+static inline uint64_t bench_random_next(BenchRandom* rng){
+	rng->state ^= rng->state >> 12;
+	rng->state ^= rng->state << 25;
+	rng->state ^= rng->state >> 27;
+	return rng->state * 0x2545F4914F6CDD1DULL;
+}
+
+// Uniform in [-1, 1)
+static inline double bench_random_uniform(BenchRandom* rng){
+	return (double)(bench_random_next(rng) >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+}
+
+// Keeps the optimiser from discarding benchmark results
+static volatile double bench_sink;
+
+#endif /* __BENCH_UTIL_H__ */
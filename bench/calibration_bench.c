@@ -0,0 +1,215 @@
+//=====================================================================================================
+// calibration_bench.c
+//=====================================================================================================
+//
+// Sensor calibration fused into the batch updates (*_batch_calibrated) against a separate calibration
+// pass, and the Madgwick gyro bias estimator, on a synthetic MARG run (imu_trajectory.h, 200 Hz,
+// --seconds, default 30 minutes) whose sensors read through known distortions:
+//   gyro   scale errors and a bias of about 0.9 deg/s that the calibration does not know
+//   accel  scale, misalignment and offset
+//   mag    hard iron offset and soft iron matrix
+// The calibration inverts the distortions exactly, so what is left is the unknown gyro bias.
+//   two-pass / fused   ns per sample of calibrate-then-batch against the fused batch, and the largest
+//                      quaternion difference between them (0: same arithmetic)
+//   rms / tail deg     attitude error against the truth after 10 s, and over the last tenth
+//   bias               the Madgwick bias estimate averaged over the last tenth against the true
+//                      residual gyro bias; fails (exit 1) beyond BIAS_TOLERANCE on any axis
+// Build: cc -O2 -I.. calibration_bench.c imu_trajectory.c ../*.c -lm
+//
+//=====================================================================================================
+#include "madgwick_ahrs.h"
+#include "mahony_ahrs.h"
+#include "imu_trajectory.h"
+#include "bench_util.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLE_RATE 200
+#define SETTLE 10.0 // s before errors count
+#define ZETA_ESTIMATE 0.05f
+#define BIAS_TOLERANCE 1e-3 // rad/s, per axis
+
+static const double gyro_bias[3] = { 0.012, -0.01, 0.006 };
+static const double gyro_scale[9] = { 1.01, 0.0, 0.0, 0.0, 0.985, 0.0, 0.0, 0.0, 1.02 };
+static const double accel_scale[9] = { 1.02, 0.01, 0.0, -0.01, 0.98, 0.005, 0.0, 0.0, 1.01 };
+static const double accel_offset[3] = { 0.03, -0.02, 0.05 };
+static const double mag_soft_iron[9] = { 1.1, 0.05, 0.0, 0.05, 0.9, 0.02, 0.0, 0.02, 1.05 };
+static const double mag_hard_iron[3] = { 0.3, -0.2, 0.15 };
+
+// raw = distortion * v + offset, in place on one 3-axis sample
+static void distort(MA_PRECISION* v, const double* distortion, const double* offset){
+	double x = v[0], y = v[1], z = v[2];
+	for(int r = 0; r < 3; r++) v[r] = (MA_PRECISION)(distortion[3 * r] * x + distortion[3 * r + 1] * y + distortion[3 * r + 2] * z + (offset != NULL ? offset[r] : 0.0));
+}
+
+static void invert(const double* m, MA_PRECISION* inverse){
+	double det = m[0] * (m[4] * m[8] - m[5] * m[7]) - m[1] * (m[3] * m[8] - m[5] * m[6]) + m[2] * (m[3] * m[7] - m[4] * m[6]);
+	inverse[0] = (MA_PRECISION)((m[4] * m[8] - m[5] * m[7]) / det);
+	inverse[1] = (MA_PRECISION)((m[2] * m[7] - m[1] * m[8]) / det);
+	inverse[2] = (MA_PRECISION)((m[1] * m[5] - m[2] * m[4]) / det);
+	inverse[3] = (MA_PRECISION)((m[5] * m[6] - m[3] * m[8]) / det);
+	inverse[4] = (MA_PRECISION)((m[0] * m[8] - m[2] * m[6]) / det);
+	inverse[5] = (MA_PRECISION)((m[2] * m[3] - m[0] * m[5]) / det);
+	inverse[6] = (MA_PRECISION)((m[3] * m[7] - m[4] * m[6]) / det);
+	inverse[7] = (MA_PRECISION)((m[1] * m[6] - m[0] * m[7]) / det);
+	inverse[8] = (MA_PRECISION)((m[0] * m[4] - m[1] * m[3]) / det);
+}
+
+static void set_offset(AHRSSensorCalibration* c, const double* offset){
+	for(int i = 0; i < 3; i++) c->offset[i] = (MA_PRECISION) offset[i];
+}
+
+// rms and last-tenth rms attitude error, deg
+static void attitude_error(const double* truth, const MA_PRECISION* q, size_t count, double* rms, double* tail_rms){
+	size_t first = (size_t)(SETTLE * SAMPLE_RATE), tail = count - count / 10, n = 0, n_tail = 0;
+	double sum = 0.0, sum_tail = 0.0;
+	for(size_t i = first; i < count; i++) {
+		double e = imu_trajectory_attitude_error(truth + 4 * i, q[4 * i], q[4 * i + 1], q[4 * i + 2], q[4 * i + 3]) * 180.0 / M_PI;
+		sum += e * e;
+		n++;
+		if(i >= tail) {
+			sum_tail += e * e;
+			n_tail++;
+		}
+	}
+	*rms = sqrt(sum / (double) n);
+	*tail_rms = sqrt(sum_tail / (double) n_tail);
+}
+
+static double largest_difference(const MA_PRECISION* a, const MA_PRECISION* b, size_t count){
+	double largest = 0.0;
+	for(size_t i = 0; i < 4 * count; i++) if(fabs((double) a[i] - (double) b[i]) > largest) largest = fabs((double) a[i] - (double) b[i]);
+	return largest;
+}
+
+int main(int argc, char** argv){
+	double seconds = 1800.0;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) seconds = atof(argv[++i]);
+		else {
+			fprintf(stderr, "usage: %s [--seconds S]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(!(seconds > 2.0 * SETTLE)) return 2;
+
+	ImuTrajectoryConfig config;
+	imu_trajectory_default_config(&config);
+	config.sample_rate = SAMPLE_RATE;
+	config.count = (size_t)(seconds * SAMPLE_RATE);
+	const size_t count = config.count;
+	MA_PRECISION* raw = (MA_PRECISION *) malloc(count * IMU_TRAJECTORY_RECORD_SIZE * sizeof(MA_PRECISION));
+	MA_PRECISION* calibrated = (MA_PRECISION *) malloc(count * IMU_TRAJECTORY_RECORD_SIZE * sizeof(MA_PRECISION));
+	double* truth = (double *) malloc(count * 4 * sizeof(double));
+	MA_PRECISION* q_two_pass = (MA_PRECISION *) malloc(count * 4 * sizeof(MA_PRECISION));
+	MA_PRECISION* q_fused = (MA_PRECISION *) malloc(count * 4 * sizeof(MA_PRECISION));
+	if(raw == NULL || calibrated == NULL || truth == NULL || q_two_pass == NULL || q_fused == NULL) return 1;
+	if(imu_trajectory_generate(&config, raw, truth) != 0) return 1;
+
+	// The sensors read through the distortions; the gyro bias is added here too, unknown to the calibration
+	for(size_t i = 0; i < count; i++) {
+		MA_PRECISION* sample = raw + i * IMU_TRAJECTORY_RECORD_SIZE;
+		distort(sample, gyro_scale, gyro_bias);
+		distort(sample + 3, accel_scale, accel_offset);
+		distort(sample + 6, mag_soft_iron, mag_hard_iron);
+	}
+	AHRSCalibration calibration;
+	ahrs_calibration_identity(&calibration);
+	invert(gyro_scale, calibration.gyro.matrix);
+	invert(accel_scale, calibration.accel.matrix);
+	set_offset(&calibration.accel, accel_offset);
+	invert(mag_soft_iron, calibration.mag.matrix);
+	set_offset(&calibration.mag, mag_hard_iron);
+
+	AHRSSensorArray gyro = ahrs_sensor_array_interleaved(raw, IMU_TRAJECTORY_RECORD_SIZE);
+	AHRSSensorArray accel = ahrs_sensor_array_interleaved(raw + 3, IMU_TRAJECTORY_RECORD_SIZE);
+	AHRSSensorArray mag = ahrs_sensor_array_interleaved(raw + 6, IMU_TRAJECTORY_RECORD_SIZE);
+	AHRSSensorArray gyro_calibrated = ahrs_sensor_array_interleaved(calibrated, IMU_TRAJECTORY_RECORD_SIZE);
+	AHRSSensorArray accel_calibrated = ahrs_sensor_array_interleaved(calibrated + 3, IMU_TRAJECTORY_RECORD_SIZE);
+	AHRSSensorArray mag_calibrated = ahrs_sensor_array_interleaved(calibrated + 6, IMU_TRAJECTORY_RECORD_SIZE);
+
+	printf("%zu samples, %.0f s at %d Hz, MARG updates\n", count, seconds, SAMPLE_RATE);
+	printf("%-24s %12s %12s %12s %10s %10s\n", "", "two-pass ns", "fused ns", "max |dq|", "rms deg", "tail deg");
+	for(int filter = 0; filter < 2; filter++) {
+		MadgwickAHRS madgwick[2];
+		MahonyAHRS mahony[2];
+		double two_pass, fused;
+		for(int k = 0; k < 2; k++) {
+			madgwick_ahrs_init(&madgwick[k], SAMPLE_RATE);
+			mahony_ahrs_init(&mahony[k], SAMPLE_RATE);
+		}
+
+		double t0 = bench_now();
+		for(size_t i = 0; i < count; i++) {
+			const MA_PRECISION* in = raw + i * IMU_TRAJECTORY_RECORD_SIZE;
+			MA_PRECISION* out = calibrated + i * IMU_TRAJECTORY_RECORD_SIZE;
+			memcpy(out, in, IMU_TRAJECTORY_RECORD_SIZE * sizeof(MA_PRECISION));
+			ahrs_calibrate(&calibration.gyro, 0, &out[0], &out[1], &out[2]);
+			ahrs_calibrate(&calibration.accel, 1, &out[3], &out[4], &out[5]);
+			ahrs_calibrate(&calibration.mag, 1, &out[6], &out[7], &out[8]);
+		}
+		if(filter == 0) madgwick_ahrs_update_batch(&madgwick[0], gyro_calibrated, accel_calibrated, mag_calibrated, count, q_two_pass);
+		else mahony_ahrs_update_batch(&mahony[0], gyro_calibrated, accel_calibrated, mag_calibrated, count, q_two_pass);
+		two_pass = bench_now() - t0;
+
+		t0 = bench_now();
+		if(filter == 0) madgwick_ahrs_update_batch_calibrated(&madgwick[1], &calibration, gyro, accel, mag, count, q_fused);
+		else mahony_ahrs_update_batch_calibrated(&mahony[1], &calibration, gyro, accel, mag, count, q_fused);
+		fused = bench_now() - t0;
+
+		double rms, tail;
+		attitude_error(truth, q_fused, count, &rms, &tail);
+		printf("%-24s %12.2f %12.2f %12g %10.3f %10.3f\n", filter == 0 ? "madgwick calibrated" : "mahony calibrated",
+			two_pass * 1e9 / (double) count, fused * 1e9 / (double) count, largest_difference(q_two_pass, q_fused, count), rms, tail);
+	}
+
+	// Accuracy without calibration, and with the bias estimator on the remaining gyro bias
+	MadgwickAHRS workspace;
+	double rms, tail;
+	madgwick_ahrs_init(&workspace, SAMPLE_RATE);
+	madgwick_ahrs_update_batch(&workspace, gyro, accel, mag, count, q_fused);
+	attitude_error(truth, q_fused, count, &rms, &tail);
+	printf("%-24s %12s %12s %12s %10.3f %10.3f\n", "madgwick raw", "", "", "", rms, tail);
+	madgwick_ahrs_init(&workspace, SAMPLE_RATE);
+	madgwick_ahrs_set_bias_gain(&workspace, ZETA_ESTIMATE);
+	const size_t tail_first = count - count / 10;
+	double t0 = bench_now();
+	madgwick_ahrs_update_batch_calibrated(&workspace, &calibration, gyro, accel, mag, tail_first, q_fused);
+	double fused = bench_now() - t0;
+	// The last tenth one sample at a time, averaging the bias estimate
+	double bias[3] = { 0.0, 0.0, 0.0 };
+	for(size_t i = tail_first; i < count; i++) {
+		const size_t g = i * gyro.stride, a = i * accel.stride, m = i * mag.stride;
+		AHRSSensorArray gyro_i = { gyro.x + g, gyro.y + g, gyro.z + g, gyro.stride };
+		AHRSSensorArray accel_i = { accel.x + a, accel.y + a, accel.z + a, accel.stride };
+		AHRSSensorArray mag_i = { mag.x + m, mag.y + m, mag.z + m, mag.stride };
+		madgwick_ahrs_update_batch_calibrated(&workspace, &calibration, gyro_i, accel_i, mag_i, 1, q_fused + 4 * i);
+		bias[0] += (double) workspace.bias_x;
+		bias[1] += (double) workspace.bias_y;
+		bias[2] += (double) workspace.bias_z;
+	}
+	attitude_error(truth, q_fused, count, &rms, &tail);
+	printf("%-24s %12s %12.2f %12s %10.3f %10.3f\n", "madgwick zeta", "", fused * 1e9 / (double) tail_first, "", rms, tail);
+
+	// The calibration scales the gyro after the bias, so the residual bias it leaves is gyro_scale^-1 * gyro_bias
+	int failed = 0;
+	printf("\n%-6s %12s %12s %12s   zeta = %g, last tenth averaged, tolerance %g rad/s\n", "axis", "true rad/s", "estimate", "error", (double) ZETA_ESTIMATE, BIAS_TOLERANCE);
+	for(int r = 0; r < 3; r++) {
+		double expected = 0.0;
+		for(int c = 0; c < 3; c++) expected += (double) calibration.gyro.matrix[3 * r + c] * gyro_bias[c];
+		double estimate = bias[r] / (double)(count - tail_first);
+		int ok = fabs(estimate - expected) <= BIAS_TOLERANCE;
+		printf("%-6c %12.5f %12.5f %12.5f %s\n", 'x' + r, expected, estimate, estimate - expected, ok ? "" : "FAIL");
+		if(!ok) failed = 1;
+	}
+	printf("%s\n", failed ? "bias estimate: FAIL" : "bias estimate: ok");
+
+	free(raw);
+	free(calibrated);
+	free(truth);
+	free(q_two_pass);
+	free(q_fused);
+	return failed;
+}
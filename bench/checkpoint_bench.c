@@ -0,0 +1,129 @@
+//=====================================================================================================
+// checkpoint_bench.c
+//=====================================================================================================
+//
+// Checkpoints (ahrs_checkpoint.h) of a fleet: time to save and restore a Mahony bank and an array of
+// Mahony workspaces (as a pool holds them), and a check that a filter restored mid-run carries on
+// exactly where the original left off, against a fresh filter that has to reconverge.
+// Build: cc -O2 -I.. checkpoint_bench.c ../*.c -lm
+//
+//=====================================================================================================
+#include "ahrs_checkpoint.h"
+#include "bench_util.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SAMPLE_RATE 200.0f
+#define FILTER_COUNT 10000
+#define WARMUP_TICKS 2000
+#define CHECK_TICKS 200
+#define REPEATS 200
+
+// Tick t of filter i: a slow tilt about x and a yaw rate that differs per filter
+static void bench_sample(size_t i, size_t t, MA_PRECISION* g, MA_PRECISION* a){
+	double angle = 0.3 * sin(0.002 * (double) t + 0.001 * (double) i);
+	g[0] = (MA_PRECISION)(0.0006 * cos(0.002 * (double) t + 0.001 * (double) i) * SAMPLE_RATE);
+	g[1] = 0.0f;
+	g[2] = (MA_PRECISION)(0.01 * (double)(i % 13));
+	a[0] = 0.0f;
+	a[1] = (MA_PRECISION) sin(angle);
+	a[2] = (MA_PRECISION) cos(angle);
+}
+
+static void bench_tick(MahonyAHRSBank* bank, MahonyAHRS* workspaces, size_t t, MA_PRECISION* in){
+	MA_PRECISION* gx = in;
+	MA_PRECISION* gy = in + 1 * FILTER_COUNT;
+	MA_PRECISION* gz = in + 2 * FILTER_COUNT;
+	MA_PRECISION* ax = in + 3 * FILTER_COUNT;
+	MA_PRECISION* ay = in + 4 * FILTER_COUNT;
+	MA_PRECISION* az = in + 5 * FILTER_COUNT;
+	for(size_t i = 0; i < FILTER_COUNT; i++) {
+		MA_PRECISION g[3], a[3];
+		bench_sample(i, t, g, a);
+		gx[i] = g[0]; gy[i] = g[1]; gz[i] = g[2];
+		ax[i] = a[0]; ay[i] = a[1]; az[i] = a[2];
+		if(workspaces != NULL) mahony_ahrs_update_imu(&workspaces[i], g[0], g[1], g[2], a[0], a[1], a[2]);
+	}
+	if(bank != NULL) mahony_ahrs_bank_update_imu(bank, gx, gy, gz, ax, ay, az);
+}
+
+static double bank_difference(const MahonyAHRSBank* a, const MahonyAHRSBank* b){
+	double largest = 0.0;
+	for(size_t i = 0; i < a->count; i++) {
+		double d = fabs(a->q0[i] - b->q0[i]) + fabs(a->q1[i] - b->q1[i]) + fabs(a->q2[i] - b->q2[i]) + fabs(a->q3[i] - b->q3[i]);
+		if(d > largest) largest = d;
+	}
+	return largest;
+}
+
+static double workspace_difference(const MahonyAHRS* a, const MahonyAHRS* b){
+	double largest = 0.0;
+	for(size_t i = 0; i < FILTER_COUNT; i++) {
+		double d = fabs(a[i].q0 - b[i].q0) + fabs(a[i].q1 - b[i].q1) + fabs(a[i].q2 - b[i].q2) + fabs(a[i].q3 - b[i].q3);
+		if(d > largest) largest = d;
+	}
+	return largest;
+}
+
+int main(void){
+	MahonyAHRSBank* bank = create_mahony_ahrs_bank(FILTER_COUNT, SAMPLE_RATE);
+	MahonyAHRSBank* restored = create_mahony_ahrs_bank(FILTER_COUNT, SAMPLE_RATE);
+	MahonyAHRSBank* fresh = create_mahony_ahrs_bank(FILTER_COUNT, SAMPLE_RATE);
+	MahonyAHRS* workspaces = (MahonyAHRS *) malloc(3 * FILTER_COUNT * sizeof(MahonyAHRS));
+	MA_PRECISION* in = (MA_PRECISION *) malloc(6 * FILTER_COUNT * sizeof(MA_PRECISION));
+	const size_t bank_size = mahony_ahrs_bank_checkpoint_size(FILTER_COUNT);
+	const size_t workspace_size = mahony_ahrs_checkpoint_size(FILTER_COUNT);
+	unsigned char* bank_buffer = (unsigned char *) malloc(bank_size);
+	unsigned char* workspace_buffer = (unsigned char *) malloc(workspace_size);
+	if(bank == NULL || restored == NULL || fresh == NULL || workspaces == NULL || in == NULL || bank_buffer == NULL || workspace_buffer == NULL) return 1;
+	MahonyAHRS* workspaces_restored = workspaces + FILTER_COUNT;
+	MahonyAHRS* workspaces_fresh = workspaces + 2 * FILTER_COUNT;
+	for(size_t i = 0; i < 3 * FILTER_COUNT; i++) mahony_ahrs_init(&workspaces[i], SAMPLE_RATE);
+
+	for(size_t t = 0; t < WARMUP_TICKS; t++) bench_tick(bank, workspaces, t, in);
+
+	// Save and restore timings, repeated over the same state
+	double t0 = bench_now();
+	for(int r = 0; r < REPEATS; r++) bench_sink += (double) mahony_ahrs_bank_checkpoint(bank, bank_buffer, bank_size);
+	double bank_save = (bench_now() - t0) / REPEATS;
+	t0 = bench_now();
+	for(int r = 0; r < REPEATS; r++) if(mahony_ahrs_bank_restore(restored, bank_buffer, bank_size) != 0) return 1;
+	double bank_load = (bench_now() - t0) / REPEATS;
+	t0 = bench_now();
+	for(int r = 0; r < REPEATS; r++) bench_sink += (double) mahony_ahrs_checkpoint(workspaces, FILTER_COUNT, workspace_buffer, workspace_size);
+	double workspace_save = (bench_now() - t0) / REPEATS;
+	t0 = bench_now();
+	for(int r = 0; r < REPEATS; r++) if(mahony_ahrs_restore(workspaces_restored, FILTER_COUNT, workspace_buffer, workspace_size) != 0) return 1;
+	double workspace_load = (bench_now() - t0) / REPEATS;
+
+	// A damaged checkpoint must be refused
+	bank_buffer[bank_size / 2] ^= 1;
+	int damaged = mahony_ahrs_bank_restore(fresh, bank_buffer, bank_size);
+	bank_buffer[bank_size / 2] ^= 1;
+
+	// Carry on: the restored filters must follow the originals exactly
+	for(size_t t = WARMUP_TICKS; t < WARMUP_TICKS + CHECK_TICKS; t++) {
+		bench_tick(bank, workspaces, t, in);
+		bench_tick(restored, workspaces_restored, t, in);
+		bench_tick(fresh, workspaces_fresh, t, in);
+	}
+
+	printf("%d Mahony filters, %d ticks before the checkpoint, %d after\n", FILTER_COUNT, WARMUP_TICKS, CHECK_TICKS);
+	printf("%-12s %10s %10s %10s %10s\n", "", "bytes", "save us", "restore us", "GB/s");
+	printf("%-12s %10zu %10.1f %10.1f %10.2f\n", "bank", bank_size, bank_save * 1e6, bank_load * 1e6, bank_size / bank_save * 1e-9);
+	printf("%-12s %10zu %10.1f %10.1f %10.2f\n", "workspaces", workspace_size, workspace_save * 1e6, workspace_load * 1e6, workspace_size / workspace_save * 1e-9);
+	printf("damaged checkpoint refused: %s\n", damaged != 0 ? "yes" : "NO");
+	printf("largest quaternion difference %d ticks on: restored bank %g, workspaces %g; fresh bank %g, workspaces %g\n", CHECK_TICKS,
+		bank_difference(bank, restored), workspace_difference(workspaces, workspaces_restored),
+		bank_difference(bank, fresh), workspace_difference(workspaces, workspaces_fresh));
+
+	free_mahony_ahrs_bank(bank);
+	free_mahony_ahrs_bank(restored);
+	free_mahony_ahrs_bank(fresh);
+	free(workspaces);
+	free(in);
+	free(bank_buffer);
+	free(workspace_buffer);
+	return 0;
+}
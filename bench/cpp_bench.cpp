@@ -0,0 +1,132 @@
+//=====================================================================================================
+// cpp_bench.cpp
+//=====================================================================================================
+//
+// ahrs::Filter<T, Algorithm> against the C API: throughput, and the largest quaternion difference to
+// the C filter fed the same samples. For T = MA_PRECISION that is 0, unless the compiler contracts
+// the two builds into FMAs differently (-march with FMA), hence CPP_BENCH_TOLERANCE. A double filter
+// runs alongside as the reference for the float one.
+// Build: c++ -O2 -I.. cpp_bench.cpp ../madgwick_ahrs.c ../mahony_ahrs.c -lm
+//
+//=====================================================================================================
+#include "ahrs.hpp"
+#include "bench_util.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#define SAMPLE_RATE 1000.0f
+#define SAMPLE_COUNT (1 << 20)
+#define RECORD_SIZE 9 // gx gy gz ax ay az mx my mz
+#define CPP_BENCH_TOLERANCE 1e-5
+
+// Integral feedback disabled at compile time
+struct MahonyNoIntegral : ahrs::Mahony {
+	static constexpr double two_ki = 0.0;
+};
+
+// Same trajectory as batch_bench.c, in any precision
+template<typename T> static std::vector<T> make_samples(size_t count){
+	std::vector<T> samples(count * RECORD_SIZE);
+	BenchRandom rng = { 0x9E3779B97F4A7C15ULL };
+	for(size_t i = 0; i < count; i++) {
+		T* s = &samples[i * RECORD_SIZE];
+		double t = (double)i / SAMPLE_RATE;
+		s[0] = (T)(0.3 * sin(0.7 * t) + 0.01 * bench_random_uniform(&rng));
+		s[1] = (T)(0.2 * cos(0.5 * t) + 0.01 * bench_random_uniform(&rng));
+		s[2] = (T)(0.1 * sin(0.3 * t) + 0.01 * bench_random_uniform(&rng));
+		s[3] = (T)(0.05 * bench_random_uniform(&rng));
+		s[4] = (T)(0.05 * bench_random_uniform(&rng));
+		s[5] = (T)(1.0 + 0.05 * bench_random_uniform(&rng));
+		s[6] = (T)(0.5 + 0.02 * bench_random_uniform(&rng));
+		s[7] = (T)(0.02 * bench_random_uniform(&rng));
+		s[8] = (T)(-0.8 + 0.02 * bench_random_uniform(&rng));
+	}
+	return samples;
+}
+
+template<typename A, typename B> static double quaternion_diff(const A& a, const B& b){
+	double d = fabs((double)a.q0 - (double)b.q0);
+	if(fabs((double)a.q1 - (double)b.q1) > d) d = fabs((double)a.q1 - (double)b.q1);
+	if(fabs((double)a.q2 - (double)b.q2) > d) d = fabs((double)a.q2 - (double)b.q2);
+	if(fabs((double)a.q3 - (double)b.q3) > d) d = fabs((double)a.q3 - (double)b.q3);
+	return d;
+}
+
+static void report(const char* name, double seconds, double diff){
+	printf("%-34s %10.2f   %g\n", name, seconds * 1e9 / SAMPLE_COUNT, diff);
+}
+
+// Per-sample and batched MARG updates of a Filter<T, Algorithm>, compared against the C filter `reference`
+template<typename T, typename Algorithm, typename Reference>
+static int run(const char* name, const std::vector<T>& samples, const Reference* reference, double tolerance){
+	char label[64];
+	ahrs::Filter<T, Algorithm> loop(SAMPLE_RATE), batch(SAMPLE_RATE);
+	std::vector<T> quaternions(4 * (size_t)SAMPLE_COUNT);
+
+	double t0 = bench_now();
+	for(size_t i = 0; i < SAMPLE_COUNT; i++) {
+		const T* s = &samples[i * RECORD_SIZE];
+		loop.update(s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7], s[8]);
+	}
+	double loop_seconds = bench_now() - t0;
+
+	t0 = bench_now();
+	batch.update_batch(ahrs::SensorArray<T>::interleaved(&samples[0], RECORD_SIZE), ahrs::SensorArray<T>::interleaved(&samples[3], RECORD_SIZE),
+		ahrs::SensorArray<T>::interleaved(&samples[6], RECORD_SIZE), SAMPLE_COUNT, &quaternions[0]);
+	double batch_seconds = bench_now() - t0;
+	bench_sink = (double)quaternions[4 * (size_t)SAMPLE_COUNT - 1];
+
+	double loop_diff = quaternion_diff(loop.quaternion(), *reference);
+	double batch_diff = quaternion_diff(batch.quaternion(), *reference);
+	snprintf(label, sizeof(label), "%s update", name);
+	report(label, loop_seconds, loop_diff);
+	snprintf(label, sizeof(label), "%s update_batch", name);
+	report(label, batch_seconds, batch_diff);
+	return loop_diff <= tolerance && batch_diff <= tolerance;
+}
+
+int main(void){
+	std::vector<MA_PRECISION> samples = make_samples<MA_PRECISION>(SAMPLE_COUNT);
+	std::vector<double> samples_double = make_samples<double>(SAMPLE_COUNT);
+	int ok = 1;
+
+	printf("%d samples\n", SAMPLE_COUNT);
+	printf("%-34s %10s   %s\n", "entry point", "ns/update", "max |dq| vs C");
+
+	// C filters, the reference for every row
+	MadgwickAHRS* madgwick = create_madgwick_ahrs(SAMPLE_RATE);
+	MahonyAHRS* mahony = create_mahony_ahrs(SAMPLE_RATE);
+	MahonyAHRS* mahony_no_integral = create_mahony_ahrs(SAMPLE_RATE);
+	if(madgwick == NULL || mahony == NULL || mahony_no_integral == NULL) return 1;
+	mahony_ahrs_set_gains(mahony_no_integral, TWO_KP, 0.0f);
+	double t0 = bench_now();
+	for(size_t i = 0; i < SAMPLE_COUNT; i++) {
+		const MA_PRECISION* s = &samples[i * RECORD_SIZE];
+		madgwick_ahrs_update(madgwick, s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7], s[8]);
+	}
+	report("C madgwick_ahrs_update", bench_now() - t0, 0.0);
+	t0 = bench_now();
+	for(size_t i = 0; i < SAMPLE_COUNT; i++) {
+		const MA_PRECISION* s = &samples[i * RECORD_SIZE];
+		mahony_ahrs_update(mahony, s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7], s[8]);
+		mahony_ahrs_update(mahony_no_integral, s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7], s[8]);
+	}
+	report("C mahony_ahrs_update (x2)", bench_now() - t0, 0.0);
+
+	// Same precision as the C build
+	ok &= run<MA_PRECISION, ahrs::Madgwick>("Madgwick", samples, madgwick, CPP_BENCH_TOLERANCE);
+	ok &= run<MA_PRECISION, ahrs::Mahony>("Mahony", samples, mahony, CPP_BENCH_TOLERANCE);
+	ok &= run<MA_PRECISION, MahonyNoIntegral>("Mahony Ki=0", samples, mahony_no_integral, CPP_BENCH_TOLERANCE);
+
+	// Double precision reference in the same binary, informational
+	run<double, ahrs::Madgwick>("Madgwick<double>", samples_double, madgwick, 1.0);
+	run<double, ahrs::Mahony>("Mahony<double>", samples_double, mahony, 1.0);
+
+	free_madgwick_ahrs(madgwick);
+	free_mahony_ahrs(mahony);
+	free_mahony_ahrs(mahony_no_integral);
+	if(!ok) printf("FAILED: C++ filter differs from the C API\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,204 @@
+//=====================================================================================================
+// decimate_bench.c
+//=====================================================================================================
+//
+// Decimated output (AHRSDecimator, arhs.h) for consumers that want orientation at a fraction of the
+// IMU rate, on synthetic MARG data (imu_trajectory.h).
+//
+// Fixed rate: a 2 kHz stream consumed at 100 Hz as Euler angles, Madgwick and Mahony:
+//   every sample   *_update_batch writing every quaternion, converted to Euler angles, of which the
+//                  consumer keeps one in 20
+//   decimated      *_update_batch_decimated with factor 20, only those quaternions written and converted
+// ns per input sample, output bytes, and the largest difference between the two outputs (0: the
+// decimated run keeps exactly the quaternions the consumer would).
+//
+// Timestamped: a 200 Hz stream consumed at 60 Hz, output times between samples, Madgwick:
+//   hold / slerp   *_update_batch_timestamped_decimated without and with interpolation
+// ns per input sample, RMS attitude error at the output times against the true orientation (next to
+// the filter's own error at the sample times), and the judder: RMS difference between the rotation
+// from one output to the next and the true one. Held outputs step by three or four samples, so their
+// motion is uneven; the filter's own error, which leads the truth by about half a sample, dominates
+// the attitude error either way.
+// Build: cc -O2 -I.. decimate_bench.c imu_trajectory.c ../*.c -lm
+//
+//=====================================================================================================
+#include "madgwick_ahrs.h"
+#include "mahony_ahrs.h"
+#include "ahrs_quaternion.h"
+#include "imu_trajectory.h"
+#include "bench_util.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define FAST_RATE 2000
+#define FAST_FACTOR 20          // 100 Hz out
+#define FAST_SECONDS 600
+#define SLOW_RATE 200
+#define SLOW_PERIOD 16666667    // ns, 60 Hz out
+#define SLOW_SECONDS 600
+#define SETTLE 10.0             // s before errors count
+#define REPEATS 3
+
+static double largest_difference(const MA_PRECISION* a, const MA_PRECISION* b, size_t count){
+	double largest = 0.0;
+	for(size_t i = 0; i < count; i++) if(fabs((double) a[i] - (double) b[i]) > largest) largest = fabs((double) a[i] - (double) b[i]);
+	return largest;
+}
+
+static void fixed_rate(void){
+	ImuTrajectoryConfig config;
+	imu_trajectory_default_config(&config);
+	config.sample_rate = FAST_RATE;
+	config.count = (size_t) FAST_SECONDS * FAST_RATE;
+	const size_t count = config.count, outputs = count / FAST_FACTOR;
+	MA_PRECISION* samples = (MA_PRECISION *) malloc(count * IMU_TRAJECTORY_RECORD_SIZE * sizeof(MA_PRECISION));
+	MA_PRECISION* quaternions = (MA_PRECISION *) malloc(count * 4 * sizeof(MA_PRECISION));
+	MA_PRECISION* euler = (MA_PRECISION *) malloc(count * 3 * sizeof(MA_PRECISION));
+	MA_PRECISION* kept = (MA_PRECISION *) malloc(outputs * 3 * sizeof(MA_PRECISION));
+	MA_PRECISION* decimated = (MA_PRECISION *) malloc(outputs * 4 * sizeof(MA_PRECISION));
+	MA_PRECISION* decimated_euler = (MA_PRECISION *) malloc(outputs * 3 * sizeof(MA_PRECISION));
+	if(samples == NULL || quaternions == NULL || euler == NULL || kept == NULL || decimated == NULL || decimated_euler == NULL) exit(1);
+	if(imu_trajectory_generate(&config, samples, NULL) != 0) exit(1);
+	AHRSSensorArray gyro = ahrs_sensor_array_interleaved(samples, IMU_TRAJECTORY_RECORD_SIZE);
+	AHRSSensorArray accel = ahrs_sensor_array_interleaved(samples + 3, IMU_TRAJECTORY_RECORD_SIZE);
+	AHRSSensorArray mag = ahrs_sensor_array_interleaved(samples + 6, IMU_TRAJECTORY_RECORD_SIZE);
+
+	printf("%zu samples at %d Hz, one output in %d\n", count, FAST_RATE, FAST_FACTOR);
+	printf("%-24s %10s %12s %12s\n", "", "ns", "output MB", "max diff");
+	for(int filter = 0; filter < 2; filter++) {
+		double full = 1e30, thin = 1e30;
+		size_t written = 0;
+		for(int r = 0; r < REPEATS; r++) {
+			MadgwickAHRS madgwick;
+			MahonyAHRS mahony;
+			madgwick_ahrs_init(&madgwick, FAST_RATE);
+			mahony_ahrs_init(&mahony, FAST_RATE);
+			double t0 = bench_now();
+			if(filter == 0) madgwick_ahrs_update_batch(&madgwick, gyro, accel, mag, count, quaternions);
+			else mahony_ahrs_update_batch(&mahony, gyro, accel, mag, count, quaternions);
+			ahrs_quaternion_to_euler_batch(quaternions, count, euler);
+			for(size_t i = 0; i < outputs; i++) {
+				const MA_PRECISION* angles = euler + 3 * (i * FAST_FACTOR + FAST_FACTOR - 1);
+				kept[3 * i] = angles[0];
+				kept[3 * i + 1] = angles[1];
+				kept[3 * i + 2] = angles[2];
+			}
+			double elapsed = bench_now() - t0;
+			if(elapsed < full) full = elapsed;
+
+			AHRSDecimator decimator;
+			ahrs_decimator_init(&decimator, FAST_FACTOR);
+			madgwick_ahrs_init(&madgwick, FAST_RATE);
+			mahony_ahrs_init(&mahony, FAST_RATE);
+			t0 = bench_now();
+			if(filter == 0) written = madgwick_ahrs_update_batch_decimated(&madgwick, &decimator, gyro, accel, mag, count, decimated);
+			else written = mahony_ahrs_update_batch_decimated(&mahony, &decimator, gyro, accel, mag, count, decimated);
+			ahrs_quaternion_to_euler_batch(decimated, written, decimated_euler);
+			elapsed = bench_now() - t0;
+			if(elapsed < thin) thin = elapsed;
+		}
+		const char* name = filter == 0 ? "madgwick" : "mahony";
+		printf("%-9s %-14s %10.2f %12.1f %12s\n", name, "every sample", full * 1e9 / (double) count, (double) count * 7 * sizeof(MA_PRECISION) * 1e-6, "");
+		printf("%-9s %-14s %10.2f %12.1f %12g\n", name, "decimated", thin * 1e9 / (double) count, (double) written * 7 * sizeof(MA_PRECISION) * 1e-6,
+			written == outputs ? largest_difference(kept, decimated_euler, 3 * outputs) : -1.0);
+	}
+
+	free(samples);
+	free(quaternions);
+	free(euler);
+	free(kept);
+	free(decimated);
+	free(decimated_euler);
+}
+
+static void timestamped(void){
+	ImuTrajectoryConfig config;
+	imu_trajectory_default_config(&config);
+	config.sample_rate = SLOW_RATE;
+	config.count = (size_t) SLOW_SECONDS * SLOW_RATE;
+	const size_t count = config.count;
+	const uint64_t sample_period = 1000000000ull / SLOW_RATE;
+	MA_PRECISION* samples = (MA_PRECISION *) malloc(count * IMU_TRAJECTORY_RECORD_SIZE * sizeof(MA_PRECISION));
+	double* truth = (double *) malloc(count * 4 * sizeof(double));
+	uint64_t* timestamps = (uint64_t *) malloc(count * sizeof(uint64_t));
+	MA_PRECISION* quaternions = (MA_PRECISION *) malloc(count * 4 * sizeof(MA_PRECISION));
+	if(samples == NULL || truth == NULL || timestamps == NULL || quaternions == NULL) exit(1);
+	if(imu_trajectory_generate(&config, samples, truth) != 0) exit(1);
+	for(size_t i = 0; i < count; i++) timestamps[i] = (i + 1) * sample_period;
+	AHRSSensorArray gyro = ahrs_sensor_array_interleaved(samples, IMU_TRAJECTORY_RECORD_SIZE);
+	AHRSSensorArray accel = ahrs_sensor_array_interleaved(samples + 3, IMU_TRAJECTORY_RECORD_SIZE);
+	AHRSSensorArray mag = ahrs_sensor_array_interleaved(samples + 6, IMU_TRAJECTORY_RECORD_SIZE);
+	AHRSDecimator decimator;
+	ahrs_decimator_init_period(&decimator, SLOW_PERIOD, 0);
+	const size_t capacity = ahrs_decimator_outputs(&decimator, count, timestamps[0], timestamps[count - 1]);
+	MA_PRECISION* outputs = (MA_PRECISION *) malloc(capacity * 4 * sizeof(MA_PRECISION));
+	uint64_t* output_timestamps = (uint64_t *) malloc(capacity * sizeof(uint64_t));
+	if(outputs == NULL || output_timestamps == NULL) exit(1);
+
+	// The filter's own error at the sample times
+	MadgwickAHRS workspace;
+	madgwick_ahrs_init(&workspace, SLOW_RATE);
+	madgwick_ahrs_update_batch_timestamped(&workspace, timestamps, 1, gyro, accel, mag, count, quaternions);
+	double sum = 0.0;
+	size_t n = 0;
+	for(size_t i = (size_t)(SETTLE * SLOW_RATE); i < count; i++, n++) {
+		double e = imu_trajectory_attitude_error(truth + 4 * i, quaternions[4 * i], quaternions[4 * i + 1], quaternions[4 * i + 2], quaternions[4 * i + 3]) * 180.0 / M_PI;
+		sum += e * e;
+	}
+	printf("\n%zu samples at %d Hz, outputs every %.3f ms\n", count, SLOW_RATE, SLOW_PERIOD * 1e-6);
+	printf("%-24s %10s %12s %12s %12s\n", "", "ns", "outputs", "rms deg", "judder deg");
+	printf("%-24s %10s %12zu %12.4f\n", "madgwick at samples", "", count, sqrt(sum / (double) n));
+
+	for(int interpolate = 0; interpolate < 2; interpolate++) {
+		ahrs_decimator_init_period(&decimator, SLOW_PERIOD, interpolate);
+		madgwick_ahrs_init(&workspace, SLOW_RATE);
+		double t0 = bench_now();
+		size_t written = madgwick_ahrs_update_batch_timestamped_decimated(&workspace, &decimator, timestamps, 1, gyro, accel, mag, count, outputs, output_timestamps);
+		double elapsed = bench_now() - t0;
+
+		// Truth at an output time: slerp of the true quaternions of the samples around it, exact
+		// enough at 200 Hz for this smooth trajectory
+		double judder = 0.0, previous_exact[4] = { 0.0 }, previous_output[4] = { 0.0 };
+		sum = 0.0;
+		n = 0;
+		for(size_t k = 0; k < written; k++) {
+			size_t i = (size_t)(output_timestamps[k] / sample_period) - 1;
+			if(i + 1 >= count) break;
+			MA_PRECISION a[4], b[4], t[4];
+			for(int j = 0; j < 4; j++) {
+				a[j] = (MA_PRECISION) truth[4 * i + j];
+				b[j] = (MA_PRECISION) truth[4 * i + 4 + j];
+			}
+			ahrs_slerp(a, b, (MA_PRECISION)(output_timestamps[k] - timestamps[i]) / (MA_PRECISION) sample_period, t);
+			double exact[4] = { t[0], t[1], t[2], t[3] };
+			double output[4] = { outputs[4 * k], outputs[4 * k + 1], outputs[4 * k + 2], outputs[4 * k + 3] };
+			if((double) output_timestamps[k] * 1e-9 >= SETTLE) {
+				double e = imu_trajectory_attitude_error(exact, output[0], output[1], output[2], output[3]) * 180.0 / M_PI;
+				double step = imu_trajectory_attitude_error(previous_output, output[0], output[1], output[2], output[3]);
+				double true_step = imu_trajectory_attitude_error(previous_exact, exact[0], exact[1], exact[2], exact[3]);
+				sum += e * e;
+				judder += (step - true_step) * (step - true_step) * (180.0 / M_PI) * (180.0 / M_PI);
+				n++;
+			}
+			for(int j = 0; j < 4; j++) {
+				previous_exact[j] = exact[j];
+				previous_output[j] = output[j];
+			}
+		}
+		printf("%-24s %10.2f %12zu %12.4f %12.4f\n", interpolate ? "madgwick slerp" : "madgwick hold", elapsed * 1e9 / (double) count, written, sqrt(sum / (double) n), sqrt(judder / (double) n));
+	}
+
+	free(samples);
+	free(truth);
+	free(timestamps);
+	free(quaternions);
+	free(outputs);
+	free(output_timestamps);
+}
+
+int main(void){
+	fixed_rate();
+	timestamped();
+	return 0;
+}
@@ -0,0 +1,177 @@
+//=====================================================================================================
+// downstream_bench.c
+//=====================================================================================================
+//
+// Post-processing of the filter output (ahrs_quaternion.h) on a synthetic 1 kHz MARG recording
+// (imu_trajectory.h, --samples, default 2^20): earth frame linear acceleration, rotations, rotation
+// matrices and Euler angles.
+//   kernels      ns/sample over stored quaternions: per-sample scalar code on the interleaved batch
+//                output, as consumers write it, against the planar SIMD kernels
+//   end to end   filter plus linear acceleration: batch update then the scalar loop, batch update
+//                then the planar kernel (after splitting the quaternions), and the fused
+//                *_update_batch_linear with no quaternion output
+//   difference   largest component difference of the kernel and the fused update against the scalar
+//                ahrs_linear_acceleration, and of a rotation there and back against the input
+// Build: cc -O2 -I.. downstream_bench.c imu_trajectory.c ../*.c -lm
+//
+//=====================================================================================================
+#include "madgwick_ahrs.h"
+#include "mahony_ahrs.h"
+#include "ahrs_quaternion.h"
+#include "ahrs_dispatch.h"
+#include "imu_trajectory.h"
+#include "bench_util.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLE_RATE 1000
+#define REPEATS 5
+#define GRAVITY 1.0f // the trajectory's accelerometer is in g
+
+typedef struct {
+    size_t count;
+    AHRSSensorArray gyro;
+    AHRSSensorArray accel;
+    AHRSSensorArray mag;
+    MA_PRECISION* ax;           // planar copy of the accelerometer
+    MA_PRECISION* ay;
+    MA_PRECISION* az;
+    MA_PRECISION* quaternions;  // interleaved, from the batch update
+    MA_PRECISION* q[4];         // planar
+    MA_PRECISION* out[3];
+    MA_PRECISION* reference[3]; // scalar linear acceleration
+    MA_PRECISION* matrix;
+    MA_PRECISION* euler;
+} DownstreamBench;
+
+static void report(const char* name, double seconds, size_t count){
+	printf("%-46s %8.2f ns\n", name, seconds / (double) count * 1e9);
+}
+
+// Per-sample scalar linear acceleration over the interleaved quaternions
+static void scalar_linear(DownstreamBench* b, MA_PRECISION** out){
+	for(size_t i = 0; i < b->count; i++) {
+		const size_t a = i * b->accel.stride;
+		ahrs_linear_acceleration(b->quaternions + 4 * i, b->accel.x[a], b->accel.y[a], b->accel.z[a], GRAVITY, &out[0][i], &out[1][i], &out[2][i]);
+	}
+}
+
+static double max_difference(MA_PRECISION* const* a, MA_PRECISION* const* b, size_t count){
+	double max = 0.0;
+	for(int k = 0; k < 3; k++)
+		for(size_t i = 0; i < count; i++)
+			if(fabs((double) a[k][i] - (double) b[k][i]) > max) max = fabs((double) a[k][i] - (double) b[k][i]);
+	return max;
+}
+
+// Best of REPEATS runs of STATEMENT, in seconds
+#define TIME(SECONDS, STATEMENT) do { \
+	SECONDS = 1e30; \
+	for(int repeat = 0; repeat < REPEATS; repeat++) { \
+		double t0 = bench_now(); \
+		STATEMENT; \
+		double t = bench_now() - t0; \
+		if(t < SECONDS) SECONDS = t; \
+	} \
+} while(0)
+
+int main(int argc, char** argv){
+	size_t count = (size_t) 1 << 20;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "--samples") == 0 && i + 1 < argc) count = (size_t) atol(argv[++i]);
+		else {
+			fprintf(stderr, "usage: %s [--samples N]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(count == 0) return 2;
+
+	ImuTrajectoryConfig config;
+	imu_trajectory_default_config(&config);
+	config.sample_rate = SAMPLE_RATE;
+	config.count = count;
+	MA_PRECISION* samples = (MA_PRECISION *) malloc(count * IMU_TRAJECTORY_RECORD_SIZE * sizeof(MA_PRECISION));
+	MA_PRECISION* planes = (MA_PRECISION *) malloc(count * 29 * sizeof(MA_PRECISION));
+	if(samples == NULL || planes == NULL) return 1;
+	if(imu_trajectory_generate(&config, samples, NULL) != 0) return 1;
+
+	DownstreamBench b;
+	b.count = count;
+	b.gyro = ahrs_sensor_array_interleaved(samples, IMU_TRAJECTORY_RECORD_SIZE);
+	b.accel = ahrs_sensor_array_interleaved(samples + 3, IMU_TRAJECTORY_RECORD_SIZE);
+	b.mag = ahrs_sensor_array_interleaved(samples + 6, IMU_TRAJECTORY_RECORD_SIZE);
+	b.ax = planes;
+	b.ay = planes + count;
+	b.az = planes + 2 * count;
+	b.quaternions = planes + 3 * count;
+	for(int k = 0; k < 4; k++) b.q[k] = planes + (size_t)(7 + k) * count;
+	for(int k = 0; k < 3; k++) b.out[k] = planes + (size_t)(11 + k) * count;
+	for(int k = 0; k < 3; k++) b.reference[k] = planes + (size_t)(14 + k) * count;
+	b.matrix = planes + 17 * count;
+	b.euler = planes + 26 * count;
+	for(size_t i = 0; i < count; i++) {
+		b.ax[i] = b.accel.x[i * b.accel.stride];
+		b.ay[i] = b.accel.y[i * b.accel.stride];
+		b.az[i] = b.accel.z[i * b.accel.stride];
+	}
+
+	MadgwickAHRS madgwick;
+	MahonyAHRS mahony;
+	double seconds, difference;
+	printf("%zu samples at %d Hz, MARG, kernels with %s (%d lanes)\n", count, SAMPLE_RATE, ahrs_bank_isa(), ahrs_bank_lanes());
+
+	printf("\nend to end, filter + linear acceleration\n");
+	for(int f = 0; f < 2; f++) {
+		const char* name = f == 0 ? "madgwick" : "mahony";
+		char label[64];
+#define FILTER_BATCH() do { \
+			if(f == 0) { madgwick_ahrs_init(&madgwick, SAMPLE_RATE); madgwick_ahrs_update_batch(&madgwick, b.gyro, b.accel, b.mag, count, b.quaternions); } \
+			else { mahony_ahrs_init(&mahony, SAMPLE_RATE); mahony_ahrs_update_batch(&mahony, b.gyro, b.accel, b.mag, count, b.quaternions); } \
+		} while(0)
+		TIME(seconds, FILTER_BATCH(); scalar_linear(&b, b.reference));
+		snprintf(label, sizeof(label), "%s batch + scalar loop", name);
+		report(label, seconds, count);
+		TIME(seconds, FILTER_BATCH(); ahrs_quaternion_to_planar(b.quaternions, count, b.q[0], b.q[1], b.q[2], b.q[3]);
+			ahrs_quaternion_linear_acceleration(b.q[0], b.q[1], b.q[2], b.q[3], b.ax, b.ay, b.az, GRAVITY, count, b.out[0], b.out[1], b.out[2]));
+		snprintf(label, sizeof(label), "%s batch + planar kernel", name);
+		report(label, seconds, count);
+		AHRSVectorArray linear = ahrs_vector_array_planar(b.out[0], b.out[1], b.out[2]);
+		TIME(seconds, if(f == 0) { madgwick_ahrs_init(&madgwick, SAMPLE_RATE); madgwick_ahrs_update_batch_linear(&madgwick, b.gyro, b.accel, b.mag, count, NULL, GRAVITY, linear); }
+			else { mahony_ahrs_init(&mahony, SAMPLE_RATE); mahony_ahrs_update_batch_linear(&mahony, b.gyro, b.accel, b.mag, count, NULL, GRAVITY, linear); });
+		snprintf(label, sizeof(label), "%s_ahrs_update_batch_linear", name);
+		report(label, seconds, count);
+		difference = max_difference(b.out, b.reference, count);
+		printf("%-46s %8.1e\n", "  fused against scalar, max difference", difference);
+#undef FILTER_BATCH
+	}
+
+	// Kernels over the Mahony quaternions of the last run
+	printf("\nkernels over stored quaternions\n");
+	TIME(seconds, scalar_linear(&b, b.reference));
+	report("linear acceleration, scalar loop", seconds, count);
+	ahrs_quaternion_to_planar(b.quaternions, count, b.q[0], b.q[1], b.q[2], b.q[3]);
+	TIME(seconds, ahrs_quaternion_linear_acceleration(b.q[0], b.q[1], b.q[2], b.q[3], b.ax, b.ay, b.az, GRAVITY, count, b.out[0], b.out[1], b.out[2]));
+	report("ahrs_quaternion_linear_acceleration", seconds, count);
+	difference = max_difference(b.out, b.reference, count);
+	printf("%-46s %8.1e\n", "  kernel against scalar, max difference", difference);
+	TIME(seconds, ahrs_quaternion_rotate(b.q[0], b.q[1], b.q[2], b.q[3], b.ax, b.ay, b.az, count, b.out[0], b.out[1], b.out[2]));
+	report("ahrs_quaternion_rotate", seconds, count);
+	TIME(seconds, ahrs_quaternion_rotate_inverse(b.q[0], b.q[1], b.q[2], b.q[3], b.out[0], b.out[1], b.out[2], count, b.reference[0], b.reference[1], b.reference[2]));
+	report("ahrs_quaternion_rotate_inverse", seconds, count);
+	MA_PRECISION* accel_planes[3] = { b.ax, b.ay, b.az };
+	difference = max_difference(b.reference, accel_planes, count);
+	printf("%-46s %8.1e\n", "  rotated there and back, max difference", difference);
+	TIME(seconds, ahrs_quaternion_to_matrix(b.q[0], b.q[1], b.q[2], b.q[3], count, b.matrix));
+	report("ahrs_quaternion_to_matrix", seconds, count);
+	TIME(seconds, ahrs_quaternion_to_euler_batch(b.quaternions, count, b.matrix));
+	report("ahrs_quaternion_to_euler_batch", seconds, count);
+	TIME(seconds, ahrs_quaternion_to_euler_planar(b.q[0], b.q[1], b.q[2], b.q[3], count, b.euler, b.euler + count, b.euler + 2 * count));
+	report("ahrs_quaternion_to_euler_planar", seconds, count);
+
+	bench_sink = b.out[0][count - 1] + b.matrix[count - 1] + b.euler[count - 1];
+	free(samples);
+	free(planes);
+	return 0;
+}
@@ -0,0 +1,116 @@
+//=====================================================================================================
+// eskf_bench.c
+//=====================================================================================================
+//
+// Speed and accuracy of the error-state Kalman filter (eskf_ahrs.h) next to the Madgwick and Mahony
+// filters, MARG batch updates on a synthetic 200 Hz trajectory (imu_trajectory.h, --seconds, default
+// 10 minutes) in three conditions:
+//   clean          sensor noise only
+//   disturbed      a magnetic disturbance of 0.6 earth fields, horizontal, over 30 s mid-run
+//   gyro bias      about 0.8 deg/s of constant gyro bias
+// The table gives the ns per update and the attitude error against the truth after 10 s, rms and
+// largest, and for the ESKF the magnetometer samples its gate rejected.
+// Build: cc -O2 -I.. eskf_bench.c imu_trajectory.c ../*.c -lm
+//
+//=====================================================================================================
+#include "madgwick_ahrs.h"
+#include "mahony_ahrs.h"
+#include "eskf_ahrs.h"
+#include "imu_trajectory.h"
+#include "bench_util.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLE_RATE 200
+#define SETTLE 10.0 // s before errors count
+#define FILTERS 4
+
+static const char* filter_names[FILTERS] = { "madgwick", "mahony", "eskf", "eskf bias" };
+
+static void attitude_error(const double* truth, const MA_PRECISION* q, size_t count, double* rms, double* largest){
+	size_t first = (size_t)(SETTLE * SAMPLE_RATE), n = 0;
+	double sum = 0.0;
+	*largest = 0.0;
+	for(size_t i = first; i < count; i++) {
+		double e = imu_trajectory_attitude_error(truth + 4 * i, q[4 * i], q[4 * i + 1], q[4 * i + 2], q[4 * i + 3]) * 180.0 / M_PI;
+		sum += e * e;
+		n++;
+		if(e > *largest) *largest = e;
+	}
+	*rms = sqrt(sum / (double) n);
+}
+
+// Runs filter `f` over the samples, returns the seconds taken
+static double run(int f, const MA_PRECISION* samples, size_t count, MA_PRECISION* quaternions, uint32_t* mag_rejected){
+	AHRSSensorArray gyro = ahrs_sensor_array_interleaved(samples, IMU_TRAJECTORY_RECORD_SIZE);
+	AHRSSensorArray accel = ahrs_sensor_array_interleaved(samples + 3, IMU_TRAJECTORY_RECORD_SIZE);
+	AHRSSensorArray mag = ahrs_sensor_array_interleaved(samples + 6, IMU_TRAJECTORY_RECORD_SIZE);
+	MadgwickAHRS madgwick;
+	MahonyAHRS mahony;
+	EskfAHRS eskf;
+	madgwick_ahrs_init(&madgwick, SAMPLE_RATE);
+	mahony_ahrs_init(&mahony, SAMPLE_RATE);
+	eskf_ahrs_init(&eskf, SAMPLE_RATE, f == 3);
+	double t0 = bench_now();
+	if(f == 0) madgwick_ahrs_update_batch(&madgwick, gyro, accel, mag, count, quaternions);
+	else if(f == 1) mahony_ahrs_update_batch(&mahony, gyro, accel, mag, count, quaternions);
+	else eskf_ahrs_update_batch(&eskf, gyro, accel, mag, count, quaternions);
+	double elapsed = bench_now() - t0;
+	*mag_rejected = eskf.mag_rejected;
+	return elapsed;
+}
+
+int main(int argc, char** argv){
+	double seconds = 600.0;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) seconds = atof(argv[++i]);
+		else {
+			fprintf(stderr, "usage: %s [--seconds S]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(!(seconds > 2.0 * SETTLE + 30.0)) return 2;
+
+	const size_t count = (size_t)(seconds * SAMPLE_RATE);
+	MA_PRECISION* samples = (MA_PRECISION *) malloc(count * IMU_TRAJECTORY_RECORD_SIZE * sizeof(MA_PRECISION));
+	double* truth = (double *) malloc(count * 4 * sizeof(double));
+	MA_PRECISION* quaternions = (MA_PRECISION *) malloc(count * 4 * sizeof(MA_PRECISION));
+	if(samples == NULL || truth == NULL || quaternions == NULL) return 1;
+
+	printf("%zu samples, %.0f s at %d Hz, MARG batch updates\n", count, seconds, SAMPLE_RATE);
+	printf("%-12s %-12s %10s %10s %10s %12s\n", "", "", "ns/update", "rms deg", "max deg", "mag rejected");
+	for(int condition = 0; condition < 3; condition++) {
+		ImuTrajectoryConfig config;
+		imu_trajectory_default_config(&config);
+		config.sample_rate = SAMPLE_RATE;
+		config.count = count;
+		if(condition == 1) {
+			config.mag_disturbance[0] = 0.3;
+			config.mag_disturbance[1] = 0.52;
+			config.disturbance_start = 0.5 * seconds - 15.0;
+			config.disturbance_end = 0.5 * seconds + 15.0;
+		} else if(condition == 2) {
+			config.gyro_bias[0] = 0.01;
+			config.gyro_bias[1] = -0.008;
+			config.gyro_bias[2] = 0.006;
+		}
+		if(imu_trajectory_generate(&config, samples, truth) != 0) return 1;
+		const char* condition_name = condition == 0 ? "clean" : condition == 1 ? "disturbed" : "gyro bias";
+		for(int f = 0; f < FILTERS; f++) {
+			uint32_t mag_rejected;
+			double elapsed = run(f, samples, count, quaternions, &mag_rejected);
+			double rms, largest;
+			attitude_error(truth, quaternions, count, &rms, &largest);
+			printf("%-12s %-12s %10.2f %10.3f %10.3f", condition_name, filter_names[f], elapsed * 1e9 / (double) count, rms, largest);
+			if(f >= 2) printf(" %12u", mag_rejected);
+			printf("\n");
+		}
+	}
+
+	free(samples);
+	free(truth);
+	free(quaternions);
+	return 0;
+}
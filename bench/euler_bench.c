@@ -0,0 +1,101 @@
+//=====================================================================================================
+// euler_bench.c
+//=====================================================================================================
+//
+// Per-update cost of the filters with lazy Euler angles, against reading the angles after every
+// update (the cost every update used to pay) and at a 10x decimated output rate.
+// Build: cc -O2 -I.. euler_bench.c ../madgwick_ahrs.c ../mahony_ahrs.c ../ahrs_quaternion.c -lm
+//
+//=====================================================================================================
+#include "madgwick_ahrs.h"
+#include "mahony_ahrs.h"
+#include "ahrs_quaternion.h"
+#include "bench_util.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SAMPLE_RATE 1000.0f
+#define SAMPLE_COUNT (1 << 20)
+#define RECORD_SIZE 9 // gx gy gz ax ay az mx my mz
+#define OUTPUT_DECIMATION 10
+
+static MA_PRECISION* make_samples(size_t count){
+	MA_PRECISION* samples = (MA_PRECISION *) malloc(count * RECORD_SIZE * sizeof(MA_PRECISION));
+	if(samples == NULL) return NULL;
+	BenchRandom rng = { 0x2545F4914F6CDD1DULL };
+	for(size_t i = 0; i < count; i++) {
+		MA_PRECISION* s = samples + i * RECORD_SIZE;
+		double t = (double)i / SAMPLE_RATE;
+		s[0] = (MA_PRECISION)(0.8 * sin(0.7 * t) + 0.01 * bench_random_uniform(&rng));
+		s[1] = (MA_PRECISION)(0.6 * cos(0.5 * t) + 0.01 * bench_random_uniform(&rng));
+		s[2] = (MA_PRECISION)(0.4 * sin(0.3 * t) + 0.01 * bench_random_uniform(&rng));
+		s[3] = (MA_PRECISION)(0.05 * bench_random_uniform(&rng));
+		s[4] = (MA_PRECISION)(0.05 * bench_random_uniform(&rng));
+		s[5] = (MA_PRECISION)(1.0 + 0.05 * bench_random_uniform(&rng));
+		s[6] = (MA_PRECISION)(0.5 + 0.02 * bench_random_uniform(&rng));
+		s[7] = (MA_PRECISION)(0.02 * bench_random_uniform(&rng));
+		s[8] = (MA_PRECISION)(-0.8 + 0.02 * bench_random_uniform(&rng));
+	}
+	return samples;
+}
+
+static void report(const char* name, double seconds, uint64_t cycles, double baseline_seconds){
+	printf("%-42s %8.1f ns %8.1f cycles %7.2fx\n", name, seconds / SAMPLE_COUNT * 1e9, (double)cycles / SAMPLE_COUNT, baseline_seconds / seconds);
+}
+
+// Runs UPDATE over all samples, reading the Euler angles every EVERY updates (0: never)
+#define RUN(NAME, TYPE, CREATE, UPDATE, GET_EULER, FREE, EVERY, BASELINE) do { \
+	TYPE* ws = CREATE(SAMPLE_RATE); \
+	MA_PRECISION yaw = 0.0f, pitch = 0.0f, roll = 0.0f, sum = 0.0f; \
+	double t0 = bench_now(); \
+	uint64_t c0 = bench_cycles(); \
+	for(size_t i = 0; i < SAMPLE_COUNT; i++) { \
+		const MA_PRECISION* s = samples + i * RECORD_SIZE; \
+		UPDATE(ws, s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7], s[8]); \
+		if((EVERY) != 0 && i % (EVERY) == 0) { \
+			GET_EULER(ws, &yaw, &pitch, &roll); \
+			sum += yaw + pitch + roll; \
+		} \
+	} \
+	uint64_t cycles = bench_cycles() - c0; \
+	double seconds = bench_now() - t0; \
+	if((EVERY) == 0) BASELINE = seconds; \
+	report(NAME, seconds, cycles, BASELINE); \
+	bench_sink = sum + ws->q0; \
+	FREE(ws); \
+} while(0)
+
+int main(void){
+	MA_PRECISION* samples = make_samples(SAMPLE_COUNT);
+	MA_PRECISION* quaternions = (MA_PRECISION *) malloc(SAMPLE_COUNT * 4 * sizeof(MA_PRECISION));
+	MA_PRECISION* euler = (MA_PRECISION *) malloc(SAMPLE_COUNT * 3 * sizeof(MA_PRECISION));
+	if(samples == NULL || quaternions == NULL || euler == NULL) return 1;
+	double baseline = 0.0;
+
+	printf("%d updates, per update (cycles are TSC ticks), relative to quaternion-only\n", SAMPLE_COUNT);
+	RUN("madgwick_ahrs_update, quaternion only", MadgwickAHRS, create_madgwick_ahrs, madgwick_ahrs_update, madgwick_ahrs_get_euler, free_madgwick_ahrs, 0, baseline);
+	RUN("madgwick_ahrs_update, euler every update", MadgwickAHRS, create_madgwick_ahrs, madgwick_ahrs_update, madgwick_ahrs_get_euler, free_madgwick_ahrs, 1, baseline);
+	RUN("madgwick_ahrs_update, euler every 10th", MadgwickAHRS, create_madgwick_ahrs, madgwick_ahrs_update, madgwick_ahrs_get_euler, free_madgwick_ahrs, OUTPUT_DECIMATION, baseline);
+	RUN("mahony_ahrs_update, quaternion only", MahonyAHRS, create_mahony_ahrs, mahony_ahrs_update, mahony_ahrs_get_euler, free_mahony_ahrs, 0, baseline);
+	RUN("mahony_ahrs_update, euler every update", MahonyAHRS, create_mahony_ahrs, mahony_ahrs_update, mahony_ahrs_get_euler, free_mahony_ahrs, 1, baseline);
+	RUN("mahony_ahrs_update, euler every 10th", MahonyAHRS, create_mahony_ahrs, mahony_ahrs_update, mahony_ahrs_get_euler, free_mahony_ahrs, OUTPUT_DECIMATION, baseline);
+
+	// Offline conversion of a whole quaternion stream
+	MadgwickAHRS* ws = create_madgwick_ahrs(SAMPLE_RATE);
+	madgwick_ahrs_update_batch(ws, ahrs_sensor_array_interleaved(samples, RECORD_SIZE), ahrs_sensor_array_interleaved(samples + 3, RECORD_SIZE),
+		ahrs_sensor_array_interleaved(samples + 6, RECORD_SIZE), SAMPLE_COUNT, quaternions);
+	double t0 = bench_now();
+	uint64_t c0 = bench_cycles();
+	ahrs_quaternion_to_euler_batch(quaternions, SAMPLE_COUNT, euler);
+	uint64_t cycles = bench_cycles() - c0;
+	double seconds = bench_now() - t0;
+	printf("%-42s %8.1f ns %8.1f cycles\n", "ahrs_quaternion_to_euler_batch", seconds / SAMPLE_COUNT * 1e9, (double)cycles / SAMPLE_COUNT);
+	bench_sink = euler[SAMPLE_COUNT * 3 - 1];
+
+	free_madgwick_ahrs(ws);
+	free(samples);
+	free(quaternions);
+	free(euler);
+	return 0;
+}
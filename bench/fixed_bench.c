@@ -0,0 +1,224 @@
+//=====================================================================================================
+// fixed_bench.c
+//=====================================================================================================
+//
+// The fixed-point filters (madgwick_ahrs_fixed.h, mahony_ahrs_fixed.h) against the floating point
+// ones on a long synthetic run (imu_trajectory.h, 200 Hz, --seconds, default one hour).
+//
+// The trajectory is quantised as a sensor would deliver it: gyro to Q_RATE rad/s, accelerometer to
+// 16384 counts per g, magnetometer to 4096 counts per earth field. The float filters get the same
+// quantised readings, so the differences are those of the arithmetic. Per filter and update:
+//   rms / max deg      attitude error against the truth after 10 s (tilt error for the IMU updates)
+//   last 10% rms       the same over the last tenth of the run, to show any slow drift
+//   vs float max deg   largest angle between the fixed and the float quaternion
+//   ns/sample          batch update
+// A gyro-only run (accelerometer and magnetometer zero, pure integration) shows the drift of the
+// integration itself, and the integer rsqrt is checked against a long double reference.
+// Build: cc -O2 -I.. fixed_bench.c imu_trajectory.c ../*.c -lm
+//
+//=====================================================================================================
+#include "madgwick_ahrs.h"
+#include "mahony_ahrs.h"
+#include "madgwick_ahrs_fixed.h"
+#include "mahony_ahrs_fixed.h"
+#include "imu_trajectory.h"
+#include "bench_util.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLE_RATE 200
+#define SETTLE 10.0         // s before errors count
+#define ACCEL_SCALE 16384.0 // counts per g
+#define MAG_SCALE 4096.0    // counts per earth field
+
+typedef struct {
+    size_t count;
+    int32_t* fixed;         // IMU_TRAJECTORY_RECORD_SIZE per sample
+    MA_PRECISION* samples;  // the same readings in float
+    double* truth;
+    MA_PRECISION* q_float;
+    int32_t* q_fixed;
+} FixedStream;
+
+enum { MADGWICK_IMU, MADGWICK_MARG, MAHONY_IMU, MAHONY_MARG };
+static const char* names[] = { "madgwick imu", "madgwick marg", "mahony imu", "mahony marg" };
+
+static double run_float(FixedStream* s, int filter, int gyro_only){
+	AHRSSensorArray gyro = ahrs_sensor_array_interleaved(s->samples, IMU_TRAJECTORY_RECORD_SIZE);
+	AHRSSensorArray accel = ahrs_sensor_array_interleaved(s->samples + 3, IMU_TRAJECTORY_RECORD_SIZE);
+	AHRSSensorArray mag = ahrs_sensor_array_interleaved(s->samples + 6, IMU_TRAJECTORY_RECORD_SIZE);
+	static const MA_PRECISION zero[3] = { 0.0f, 0.0f, 0.0f };
+	if(gyro_only) accel = mag = ahrs_sensor_array_interleaved(zero, 0);
+	double t0;
+	if(filter <= MADGWICK_MARG) {
+		MadgwickAHRS* workspace = create_madgwick_ahrs(SAMPLE_RATE);
+		if(workspace == NULL) exit(1);
+		t0 = bench_now();
+		if(filter == MADGWICK_IMU) madgwick_ahrs_update_imu_batch(workspace, gyro, accel, s->count, s->q_float);
+		else madgwick_ahrs_update_batch(workspace, gyro, accel, mag, s->count, s->q_float);
+		t0 = bench_now() - t0;
+		free_madgwick_ahrs(workspace);
+	} else {
+		MahonyAHRS* workspace = create_mahony_ahrs(SAMPLE_RATE);
+		if(workspace == NULL) exit(1);
+		t0 = bench_now();
+		if(filter == MAHONY_IMU) mahony_ahrs_update_imu_batch(workspace, gyro, accel, s->count, s->q_float);
+		else mahony_ahrs_update_batch(workspace, gyro, accel, mag, s->count, s->q_float);
+		t0 = bench_now() - t0;
+		free_mahony_ahrs(workspace);
+	}
+	return t0;
+}
+
+static double run_fixed(FixedStream* s, int filter, int gyro_only){
+	AHRSFixedSensorArray gyro = ahrs_fixed_sensor_array_interleaved(s->fixed, IMU_TRAJECTORY_RECORD_SIZE);
+	AHRSFixedSensorArray accel = ahrs_fixed_sensor_array_interleaved(s->fixed + 3, IMU_TRAJECTORY_RECORD_SIZE);
+	AHRSFixedSensorArray mag = ahrs_fixed_sensor_array_interleaved(s->fixed + 6, IMU_TRAJECTORY_RECORD_SIZE);
+	static const int32_t zero[3] = { 0, 0, 0 };
+	if(gyro_only) accel = mag = ahrs_fixed_sensor_array_interleaved(zero, 0);
+	double t0;
+	if(filter <= MADGWICK_MARG) {
+		MadgwickAHRSFixed* workspace = create_madgwick_ahrs_fixed(SAMPLE_RATE);
+		if(workspace == NULL) exit(1);
+		t0 = bench_now();
+		if(filter == MADGWICK_IMU) madgwick_ahrs_fixed_update_imu_batch(workspace, gyro, accel, s->count, s->q_fixed);
+		else madgwick_ahrs_fixed_update_batch(workspace, gyro, accel, mag, s->count, s->q_fixed);
+		t0 = bench_now() - t0;
+		free_madgwick_ahrs_fixed(workspace);
+	} else {
+		MahonyAHRSFixed* workspace = create_mahony_ahrs_fixed(SAMPLE_RATE);
+		if(workspace == NULL) exit(1);
+		t0 = bench_now();
+		if(filter == MAHONY_IMU) mahony_ahrs_fixed_update_imu_batch(workspace, gyro, accel, s->count, s->q_fixed);
+		else mahony_ahrs_fixed_update_batch(workspace, gyro, accel, mag, s->count, s->q_fixed);
+		t0 = bench_now() - t0;
+		free_mahony_ahrs_fixed(workspace);
+	}
+	return t0;
+}
+
+typedef struct {
+    double rms;
+    double max;
+    double tail_rms;
+} ErrorStats;
+
+static double error_at(const FixedStream* s, size_t i, const double* q, int tilt){
+	const double* truth = s->truth + 4 * i;
+	double e = tilt ? imu_trajectory_tilt_error(truth, q[0], q[1], q[2], q[3]) : imu_trajectory_attitude_error(truth, q[0], q[1], q[2], q[3]);
+	return e * 180.0 / M_PI;
+}
+
+static ErrorStats error_stats(const FixedStream* s, int fixed, int tilt){
+	ErrorStats stats = { 0.0, 0.0, 0.0 };
+	size_t first = (size_t)(SETTLE * SAMPLE_RATE), tail = s->count - s->count / 10, n = 0, n_tail = 0;
+	for(size_t i = first; i < s->count; i++) {
+		double q[4];
+		for(int k = 0; k < 4; k++) q[k] = fixed ? s->q_fixed[4 * i + k] / (double)(1 << AHRS_FIXED_Q_UNIT) : (double) s->q_float[4 * i + k];
+		double e = error_at(s, i, q, tilt);
+		stats.rms += e * e;
+		if(e > stats.max) stats.max = e;
+		n++;
+		if(i >= tail) {
+			stats.tail_rms += e * e;
+			n_tail++;
+		}
+	}
+	stats.rms = sqrt(stats.rms / (double)n);
+	stats.tail_rms = sqrt(stats.tail_rms / (double)n_tail);
+	return stats;
+}
+
+// Largest angle between the fixed and the float quaternion, deg
+static double divergence(const FixedStream* s){
+	double largest = 0.0;
+	for(size_t i = 0; i < s->count; i++) {
+		double dot = 0.0;
+		for(int k = 0; k < 4; k++) dot += s->q_fixed[4 * i + k] / (double)(1 << AHRS_FIXED_Q_UNIT) * (double) s->q_float[4 * i + k];
+		dot = fabs(dot) > 1.0 ? 1.0 : fabs(dot);
+		double angle = 2.0 * acos(dot) * 180.0 / M_PI;
+		if(angle > largest) largest = angle;
+	}
+	return largest;
+}
+
+static void rsqrt_accuracy(void){
+	BenchRandom rng = { 0xA0761D6478BD642FULL };
+	double rms = 0.0, max = 0.0;
+	const size_t n = 1 << 20;
+	for(size_t i = 0; i < n; i++) {
+		uint64_t x = bench_random_next(&rng) >> (bench_random_next(&rng) % 64);
+		if(x == 0) x = 1;
+		int exponent;
+		uint32_t y = ahrs_fixed_rsqrt(x, &exponent);
+		long double r = ldexpl((long double) y, -exponent);
+		double e = (double) fabsl(r * sqrtl((long double) x) - 1.0L);
+		rms += e * e;
+		if(e > max) max = e;
+	}
+	printf("integer rsqrt over 2^20 inputs in [1, 2^64): rms relative error %.2e, max %.2e (2^%.1f)\n", sqrt(rms / (double) n), max, log2(max));
+}
+
+int main(int argc, char** argv){
+	double seconds = 3600.0;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) seconds = atof(argv[++i]);
+		else {
+			fprintf(stderr, "usage: %s [--seconds S]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(!(seconds > 2.0 * SETTLE)) return 2;
+
+	ImuTrajectoryConfig config;
+	imu_trajectory_default_config(&config);
+	config.sample_rate = SAMPLE_RATE;
+	config.count = (size_t)(seconds * SAMPLE_RATE);
+	FixedStream s;
+	s.count = config.count;
+	s.fixed = (int32_t *) malloc(s.count * IMU_TRAJECTORY_RECORD_SIZE * sizeof(int32_t));
+	s.samples = (MA_PRECISION *) malloc(s.count * IMU_TRAJECTORY_RECORD_SIZE * sizeof(MA_PRECISION));
+	s.truth = (double *) malloc(s.count * 4 * sizeof(double));
+	s.q_float = (MA_PRECISION *) malloc(s.count * 4 * sizeof(MA_PRECISION));
+	s.q_fixed = (int32_t *) malloc(s.count * 4 * sizeof(int32_t));
+	if(s.fixed == NULL || s.samples == NULL || s.truth == NULL || s.q_float == NULL || s.q_fixed == NULL
+		|| imu_trajectory_generate(&config, s.samples, s.truth) != 0) return 1;
+
+	const double scale[3] = { (double)(1 << AHRS_FIXED_Q_RATE), ACCEL_SCALE, MAG_SCALE };
+	for(size_t i = 0; i < s.count * IMU_TRAJECTORY_RECORD_SIZE; i++) {
+		double unit = scale[(i % IMU_TRAJECTORY_RECORD_SIZE) / 3];
+		s.fixed[i] = (int32_t) lround((double) s.samples[i] * unit);
+		s.samples[i] = (MA_PRECISION)(s.fixed[i] / unit);
+	}
+
+	printf("%zu samples, %.0f s at %d Hz\n", s.count, seconds, SAMPLE_RATE);
+	printf("%-16s %-6s %9s %9s %14s %16s %10s\n", "filter", "path", "rms deg", "max deg", "last 10% rms", "vs float max deg", "ns/sample");
+	for(int filter = MADGWICK_IMU; filter <= MAHONY_MARG; filter++) {
+		int tilt = filter == MADGWICK_IMU || filter == MAHONY_IMU;
+		double t_float = run_float(&s, filter, 0), t_fixed = run_fixed(&s, filter, 0);
+		ErrorStats e_float = error_stats(&s, 0, tilt), e_fixed = error_stats(&s, 1, tilt);
+		printf("%-16s %-6s %9.3f %9.3f %14.3f %16s %10.1f\n", names[filter], "float", e_float.rms, e_float.max, e_float.tail_rms, "", t_float * 1e9 / (double) s.count);
+		printf("%-16s %-6s %9.3f %9.3f %14.3f %16.4f %10.1f\n", "", "fixed", e_fixed.rms, e_fixed.max, e_fixed.tail_rms, divergence(&s), t_fixed * 1e9 / (double) s.count);
+	}
+
+	// Gyro only: the error at the end is the drift of the integration (and of the gyro noise)
+	run_float(&s, MAHONY_IMU, 1);
+	run_fixed(&s, MAHONY_IMU, 1);
+	double end_float[4], end_fixed[4];
+	for(int k = 0; k < 4; k++) {
+		end_float[k] = s.q_float[4 * (s.count - 1) + k];
+		end_fixed[k] = s.q_fixed[4 * (s.count - 1) + k] / (double)(1 << AHRS_FIXED_Q_UNIT);
+	}
+	printf("gyro only, error after %.0f s: float %.3f deg, fixed %.3f deg, fixed vs float %.4f deg\n", seconds,
+		error_at(&s, s.count - 1, end_float, 0), error_at(&s, s.count - 1, end_fixed, 0), divergence(&s));
+	rsqrt_accuracy();
+
+	free(s.q_fixed);
+	free(s.q_float);
+	free(s.truth);
+	free(s.samples);
+	free(s.fixed);
+	return 0;
+}
@@ -0,0 +1,157 @@
+//=====================================================================================================
+// fleet_bench.c
+//=====================================================================================================
+//
+// Scaling of the multi-threaded fleet (ahrs_fleet.h) from 1 to N workers on a mixed fleet: a tenth
+// of the devices sample at 1 kHz, the rest at 50 Hz, half Madgwick and half Mahony, all with
+// magnetometer. The fast devices are the first ones added, so splitting the fleet by device count
+// would leave one worker with most of the work. Every step delivers 10 ms of samples to every
+// device. Reports throughput, speedup and parallel efficiency against one worker, and the imbalance
+// (busiest worker's samples / mean) after a warm-up second and ahrs_fleet_rebalance.
+// Build: cc -O2 -I.. fleet_bench.c imu_trajectory.c ../*.c -lm -lpthread
+//
+// Usage: fleet_bench [--devices N] [--workers MAX]   (MAX defaults to the online CPUs)
+//
+//=====================================================================================================
+#include "ahrs_fleet.h"
+#include "imu_trajectory.h"
+#include "bench_util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define STEP 0.01           // s of samples per ahrs_fleet_update
+#define WARMUP_STEPS 100
+#define TIMED_STEPS 300
+#define STREAM_RATE 1000.0  // Hz, of the shared sample stream, also the fast device rate
+#define SLOW_RATE 50.0
+#define STREAM_LENGTH ((size_t)(STREAM_RATE * STEP * (WARMUP_STEPS + TIMED_STEPS)) + 2048)
+#define MAX_STEP_SAMPLES 10 // STREAM_RATE * STEP
+
+typedef struct {
+    size_t device_count;
+    const MA_PRECISION* stream;     // STREAM_LENGTH packed gyro/accel/mag records
+    AHRSFleetInput* inputs;
+    MA_PRECISION* quaternions;      // 4 * MAX_STEP_SAMPLES per device
+} FleetBench;
+
+static double device_rate(const FleetBench* bench, size_t d){
+	return d < bench->device_count / 10 ? STREAM_RATE : SLOW_RATE;
+}
+
+// Samples of device d in `step`: slow devices are spread over the steps by a per-device phase
+static size_t step_samples(const FleetBench* bench, size_t d, size_t step){
+	double phase = (double)(d % 97) / 97.0;
+	double rate = device_rate(bench, d) * STEP;
+	return (size_t)((double)(step + 1) * rate + phase) - (size_t)((double)step * rate + phase);
+}
+
+static uint64_t fill_inputs(FleetBench* bench, size_t step){
+	uint64_t samples = 0;
+	for(size_t d = 0; d < bench->device_count; d++) {
+		AHRSFleetInput* in = &bench->inputs[d];
+		size_t count = step_samples(bench, d, step);
+		// Each device reads its own window of the stream, where its previous step ended
+		size_t position = d % 2048 + (size_t)((double)step * device_rate(bench, d) * STEP);
+		const MA_PRECISION* record = bench->stream + position * IMU_TRAJECTORY_RECORD_SIZE;
+		in->gyro = ahrs_sensor_array_interleaved(record, IMU_TRAJECTORY_RECORD_SIZE);
+		in->accel = ahrs_sensor_array_interleaved(record + 3, IMU_TRAJECTORY_RECORD_SIZE);
+		in->mag = ahrs_sensor_array_interleaved(record + 6, IMU_TRAJECTORY_RECORD_SIZE);
+		in->count = count;
+		in->quaternions = bench->quaternions + d * 4 * MAX_STEP_SAMPLES;
+		samples += count;
+	}
+	return samples;
+}
+
+// Seconds spent in ahrs_fleet_update over the timed steps; *imbalance receives the busiest
+// worker's samples over the mean
+static double run(FleetBench* bench, size_t workers, uint64_t* samples, double* imbalance){
+	AHRSFleet* fleet = create_ahrs_fleet(workers);
+	if(fleet == NULL) return -1.0;
+	for(size_t d = 0; d < bench->device_count; d++)
+		if(ahrs_fleet_add_device(fleet, d % 2 ? AHRS_FLEET_MAHONY : AHRS_FLEET_MADGWICK, (MA_PRECISION) device_rate(bench, d)) == AHRS_FLEET_INVALID) {
+			free_ahrs_fleet(fleet);
+			return -1.0;
+		}
+
+	for(size_t step = 0; step < WARMUP_STEPS; step++) {
+		fill_inputs(bench, step);
+		if(ahrs_fleet_update(fleet, bench->inputs) != 0) {
+			free_ahrs_fleet(fleet);
+			return -1.0;
+		}
+	}
+	ahrs_fleet_rebalance(fleet);
+
+	double seconds = 0.0;
+	*samples = 0;
+	for(size_t step = WARMUP_STEPS; step < WARMUP_STEPS + TIMED_STEPS; step++) {
+		*samples += fill_inputs(bench, step);
+		double t0 = bench_now();
+		int failed = ahrs_fleet_update(fleet, bench->inputs);
+		seconds += bench_now() - t0;
+		if(failed) {
+			free_ahrs_fleet(fleet);
+			return -1.0;
+		}
+	}
+
+	uint64_t busiest = 0, total = 0;
+	for(size_t w = 0; w < workers; w++) {
+		uint64_t s = ahrs_fleet_worker_samples(fleet, w);
+		total += s;
+		if(s > busiest) busiest = s;
+	}
+	*imbalance = total > 0 ? (double)busiest * (double)workers / (double)total : 0.0;
+	bench_sink = bench->quaternions[0];
+	free_ahrs_fleet(fleet);
+	return seconds;
+}
+
+int main(int argc, char** argv){
+	FleetBench bench = { 4096, NULL, NULL, NULL };
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t max_workers = cpus > 0 ? (size_t) cpus : 1;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "--devices") == 0 && i + 1 < argc) bench.device_count = strtoul(argv[++i], NULL, 10);
+		else if(strcmp(argv[i], "--workers") == 0 && i + 1 < argc) max_workers = strtoul(argv[++i], NULL, 10);
+		else {
+			fprintf(stderr, "usage: %s [--devices N] [--workers MAX]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(bench.device_count == 0 || max_workers == 0) return 2;
+
+	ImuTrajectoryConfig config;
+	imu_trajectory_default_config(&config);
+	config.sample_rate = STREAM_RATE;
+	config.count = STREAM_LENGTH;
+	MA_PRECISION* stream = (MA_PRECISION *) malloc(STREAM_LENGTH * IMU_TRAJECTORY_RECORD_SIZE * sizeof(MA_PRECISION));
+	bench.inputs = (AHRSFleetInput *) malloc(bench.device_count * sizeof(AHRSFleetInput));
+	bench.quaternions = (MA_PRECISION *) malloc(bench.device_count * 4 * MAX_STEP_SAMPLES * sizeof(MA_PRECISION));
+	if(stream == NULL || bench.inputs == NULL || bench.quaternions == NULL || imu_trajectory_generate(&config, stream, NULL) != 0) return 1;
+	bench.stream = stream;
+
+	printf("%zu devices (%zu at %.0f Hz, %zu at %.0f Hz), %d steps of %.0f ms, %ld online CPUs\n",
+		bench.device_count, bench.device_count / 10, STREAM_RATE, bench.device_count - bench.device_count / 10, SLOW_RATE,
+		TIMED_STEPS, STEP * 1e3, cpus);
+	printf("%8s %12s %12s %9s %11s %10s\n", "workers", "Msamples/s", "us/step", "speedup", "efficiency", "imbalance");
+	double base = 0.0;
+	for(size_t workers = 1; workers <= max_workers; workers = workers < max_workers && 2 * workers > max_workers ? max_workers : 2 * workers) {
+		uint64_t samples;
+		double imbalance;
+		double seconds = run(&bench, workers, &samples, &imbalance);
+		if(seconds < 0.0) return 1;
+		if(workers == 1) base = seconds;
+		printf("%8zu %12.2f %12.1f %8.2fx %10.0f%% %10.3f\n", workers, (double)samples / seconds * 1e-6, seconds / TIMED_STEPS * 1e6,
+			base / seconds, base / seconds / (double)workers * 100.0, imbalance);
+		if(workers == max_workers) break;
+	}
+
+	free(bench.quaternions);
+	free(bench.inputs);
+	free(stream);
+	return 0;
+}
@@ -0,0 +1,131 @@
+//=====================================================================================================
+// imu_trajectory.c
+//=====================================================================================================
+//
+// Synthetic IMU trajectory generator, see imu_trajectory.h.
+//
+//=====================================================================================================
+#include "imu_trajectory.h"
+#include "bench_util.h"
+#include <math.h>
+
+void imu_trajectory_default_config(ImuTrajectoryConfig* config){
+	config->sample_rate = 200.0;
+	config->count = 200 * 60;
+	config->rotation_rate = 1.5;
+	config->gyro_noise = 0.005;
+	config->gyro_bias[0] = 0.0;
+	config->gyro_bias[1] = 0.0;
+	config->gyro_bias[2] = 0.0;
+	config->accel_noise = 0.01;
+	config->mag_noise = 0.01;
+	config->mag_inclination = 60.0 * M_PI / 180.0;
+	config->mag_disturbance[0] = 0.0;
+	config->mag_disturbance[1] = 0.0;
+	config->mag_disturbance[2] = 0.0;
+	config->disturbance_start = 0.0;
+	config->disturbance_end = 0.0;
+	config->seed = 0x9E3779B97F4A7C15ULL;
+}
+
+// Standard normal deviate, Box-Muller
+static double gaussian(BenchRandom* rng){
+	double u1 = ((double)(bench_random_next(rng) >> 11) + 1.0) * (1.0 / 9007199254740992.0); // (0, 1]
+	double u2 = (double)(bench_random_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+	return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+// Earth frame vector v in the sensor frame of q: R(q)^T v
+static void earth_to_sensor(const double* q, const double* v, double* out){
+	double q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	out[0] = (1 - 2 * (q2 * q2 + q3 * q3)) * v[0] + 2 * (q1 * q2 + q0 * q3) * v[1] + 2 * (q1 * q3 - q0 * q2) * v[2];
+	out[1] = 2 * (q1 * q2 - q0 * q3) * v[0] + (1 - 2 * (q1 * q1 + q3 * q3)) * v[1] + 2 * (q2 * q3 + q0 * q1) * v[2];
+	out[2] = 2 * (q1 * q3 + q0 * q2) * v[0] + 2 * (q2 * q3 - q0 * q1) * v[1] + (1 - 2 * (q1 * q1 + q2 * q2)) * v[2];
+}
+
+// Body frame angular rate of the trajectory at time t
+static void angular_rate(const ImuTrajectoryConfig* config, double t, double* w){
+	w[0] = config->rotation_rate * sin(2.0 * M_PI * 0.11 * t + 0.3);
+	w[1] = config->rotation_rate * 0.8 * sin(2.0 * M_PI * 0.07 * t + 1.7);
+	w[2] = config->rotation_rate * 0.6 * sin(2.0 * M_PI * 0.05 * t + 2.9);
+}
+
+int imu_trajectory_generate(const ImuTrajectoryConfig* config, MA_PRECISION* samples, double* truth){
+	if(config == NULL || config->sample_rate <= 0) return -1;
+	const double dt = 1.0 / config->sample_rate;
+	const double gravity[3] = { 0.0, 0.0, 1.0 };
+	const double field[3] = { cos(config->mag_inclination), 0.0, -sin(config->mag_inclination) };
+	double q[4] = { 1.0, 0.0, 0.0, 0.0 };
+	BenchRandom rng = { config->seed };
+
+	for(size_t i = 0; i < config->count; i++) {
+		double t = (double)i * dt;
+		double w[3], a[3], m[3], earth_field[3];
+
+		// Rotate by the rate at the middle of the sample period: q = q * exp(w * dt / 2)
+		angular_rate(config, t + 0.5 * dt, w);
+		double rate = sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+		if(rate > 0) {
+			double half_angle = 0.5 * rate * dt;
+			double s = sin(half_angle) / rate;
+			double d0 = cos(half_angle), d1 = w[0] * s, d2 = w[1] * s, d3 = w[2] * s;
+			double p0 = q[0] * d0 - q[1] * d1 - q[2] * d2 - q[3] * d3;
+			double p1 = q[0] * d1 + q[1] * d0 + q[2] * d3 - q[3] * d2;
+			double p2 = q[0] * d2 - q[1] * d3 + q[2] * d0 + q[3] * d1;
+			double p3 = q[0] * d3 + q[1] * d2 - q[2] * d1 + q[3] * d0;
+			double norm = sqrt(p0 * p0 + p1 * p1 + p2 * p2 + p3 * p3);
+			q[0] = p0 / norm;
+			q[1] = p1 / norm;
+			q[2] = p2 / norm;
+			q[3] = p3 / norm;
+		}
+		if(truth != NULL) {
+			truth[4 * i + 0] = q[0];
+			truth[4 * i + 1] = q[1];
+			truth[4 * i + 2] = q[2];
+			truth[4 * i + 3] = q[3];
+		}
+
+		// Readings at the end of the sample period. The noise is drawn even when samples is NULL,
+		// so truth does not depend on it
+		earth_field[0] = field[0];
+		earth_field[1] = field[1];
+		earth_field[2] = field[2];
+		if(t + dt > config->disturbance_start && t + dt <= config->disturbance_end) {
+			earth_field[0] += config->mag_disturbance[0];
+			earth_field[1] += config->mag_disturbance[1];
+			earth_field[2] += config->mag_disturbance[2];
+		}
+		earth_to_sensor(q, gravity, a);
+		earth_to_sensor(q, earth_field, m);
+		double reading[IMU_TRAJECTORY_RECORD_SIZE];
+		for(int k = 0; k < 3; k++) {
+			reading[k] = w[k] + config->gyro_bias[k] + config->gyro_noise * gaussian(&rng);
+			reading[3 + k] = a[k] + config->accel_noise * gaussian(&rng);
+			reading[6 + k] = m[k] + config->mag_noise * gaussian(&rng);
+		}
+		if(samples != NULL) {
+			for(int k = 0; k < IMU_TRAJECTORY_RECORD_SIZE; k++)
+				samples[IMU_TRAJECTORY_RECORD_SIZE * i + k] = (MA_PRECISION) reading[k];
+		}
+	}
+	return 0;
+}
+
+double imu_trajectory_attitude_error(const double* truth, double q0, double q1, double q2, double q3){
+	double norm = sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	double dot = fabs(truth[0] * q0 + truth[1] * q1 + truth[2] * q2 + truth[3] * q3) / norm;
+	return 2.0 * acos(dot < 1.0 ? dot : 1.0);
+}
+
+double imu_trajectory_tilt_error(const double* truth, double q0, double q1, double q2, double q3){
+	const double gravity[3] = { 0.0, 0.0, 1.0 };
+	const double q[4] = { q0, q1, q2, q3 };
+	double a[3], b[3];
+	earth_to_sensor(truth, gravity, a);
+	earth_to_sensor(q, gravity, b);
+	double cx = a[1] * b[2] - a[2] * b[1];
+	double cy = a[2] * b[0] - a[0] * b[2];
+	double cz = a[0] * b[1] - a[1] * b[0];
+	return atan2(sqrt(cx * cx + cy * cy + cz * cz), a[0] * b[0] + a[1] * b[1] + a[2] * b[2]);
+}
@@ -0,0 +1,54 @@
+//=====================================================================================================
+// imu_trajectory.h
+//=====================================================================================================
+//
+// Deterministic synthetic IMU streams from a known orientation trajectory, for benchmarks that
+// measure accuracy as well as speed.
+//
+// The sensor turns with a smooth body frame angular rate made of incommensurate sinusoids. The true
+// quaternion is propagated exactly with that rate, held constant over each sample period, and the
+// sensor readings are derived from it:
+//   gyro  = angular rate + gyro_bias + noise                       (rad/s)
+//   accel = gravity rotated into the sensor frame + noise          (g, sensor at rest)
+//   mag   = (earth field + disturbance) in the sensor frame + noise (earth field has norm 1)
+// The quaternion follows the convention of the filters: sensor frame relative to earth frame, with
+// gravity along +z and the earth field in the x-z plane. Same config and seed, same stream.
+//
+//=====================================================================================================
+#ifndef __IMU_TRAJECTORY_H__
+#define __IMU_TRAJECTORY_H__
+
+#include "arhs.h"
+
+#define IMU_TRAJECTORY_RECORD_SIZE 9 // gx gy gz ax ay az mx my mz
+
+typedef struct {
+    double sample_rate;         // Hz
+    size_t count;               // number of samples
+    double rotation_rate;       // peak angular rate of the trajectory, rad/s
+    double gyro_noise;          // standard deviation, rad/s
+    double gyro_bias[3];        // constant offset, rad/s
+    double accel_noise;         // standard deviation, g
+    double mag_noise;           // standard deviation, earth field units
+    double mag_inclination;     // dip of the earth field below the horizon, rad
+    double mag_disturbance[3];  // earth frame field added between disturbance_start and disturbance_end
+    double disturbance_start;   // s
+    double disturbance_end;     // s
+    uint64_t seed;
+} ImuTrajectoryConfig;
+
+// Moderate motion and noise of a consumer MEMS IMU at 200 Hz for 60 s, no bias, no disturbance
+void imu_trajectory_default_config(ImuTrajectoryConfig* config);
+
+// Fills `samples` (IMU_TRAJECTORY_RECORD_SIZE * count elements) and `truth` (q0..q3 after each
+// sample, 4 * count elements). Either may be NULL. Returns 0, or -1 for an invalid config.
+int imu_trajectory_generate(const ImuTrajectoryConfig* config, MA_PRECISION* samples, double* truth);
+
+// Rotation angle between the true and an estimated quaternion, rad
+double imu_trajectory_attitude_error(const double* truth, double q0, double q1, double q2, double q3);
+
+// Angle between the true and the estimated gravity direction in the sensor frame, rad. Ignores
+// heading, which the IMU-only updates cannot observe.
+double imu_trajectory_tilt_error(const double* truth, double q0, double q1, double q2, double q3);
+
+#endif /* __IMU_TRAJECTORY_H__ */
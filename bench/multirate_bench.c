@@ -0,0 +1,162 @@
+//=====================================================================================================
+// multirate_bench.c
+//=====================================================================================================
+//
+// Multi-rate fusion of a gyro at 1 kHz, an accelerometer at 200 Hz and a magnetometer at 50 Hz,
+// taken from a 1 kHz synthetic MARG trajectory (imu_trajectory.h, --seconds, default 10 minutes):
+//   hold           *_update at the gyro rate with the latest accelerometer and magnetometer samples
+//                  repeated in between, so every stale reading corrects the attitude again
+//   predict        *_predict for every gyro sample, *_correct_accel / *_correct_mag when their
+//                  sensor delivers, with the nominal sensor intervals
+//   events         *_update_events on the merged, timestamped stream
+// and the table gives the ns per gyro sample and the attitude error against the truth after 10 s
+// (rms and largest). predict and events differ only in the first sample of each sensor, which the
+// events take as the start of its intervals.
+// Build: cc -O2 -I.. multirate_bench.c imu_trajectory.c ../*.c -lm
+//
+//=====================================================================================================
+#include "madgwick_ahrs.h"
+#include "mahony_ahrs.h"
+#include "imu_trajectory.h"
+#include "bench_util.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GYRO_RATE 1000
+#define ACCEL_STEP 5        // gyro samples per accelerometer sample, 200 Hz
+#define MAG_STEP 20         // gyro samples per magnetometer sample, 50 Hz
+#define PERIOD_NS 1000000ull
+#define SETTLE 10.0         // s before errors count
+
+#define STORE_QUATERNION(q, w) do { (q)[0] = (w).q0; (q)[1] = (w).q1; (q)[2] = (w).q2; (q)[3] = (w).q3; } while(0)
+
+static void attitude_error(const double* truth, const MA_PRECISION* q, size_t count, double* rms, double* largest){
+	size_t first = (size_t)(SETTLE * GYRO_RATE), n = 0;
+	double sum = 0.0;
+	*largest = 0.0;
+	for(size_t i = first; i < count; i++) {
+		double e = imu_trajectory_attitude_error(truth + 4 * i, q[4 * i], q[4 * i + 1], q[4 * i + 2], q[4 * i + 3]) * 180.0 / M_PI;
+		sum += e * e;
+		n++;
+		if(e > *largest) *largest = e;
+	}
+	*rms = sqrt(sum / (double) n);
+}
+
+static void report(const char* name, double seconds, size_t count, const double* truth, const MA_PRECISION* q){
+	double rms, largest;
+	attitude_error(truth, q, count, &rms, &largest);
+	printf("%-18s %10.2f %10.3f %10.3f\n", name, seconds * 1e9 / (double) count, rms, largest);
+}
+
+int main(int argc, char** argv){
+	double seconds = 600.0;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) seconds = atof(argv[++i]);
+		else {
+			fprintf(stderr, "usage: %s [--seconds S]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(!(seconds > 2.0 * SETTLE)) return 2;
+
+	ImuTrajectoryConfig config;
+	imu_trajectory_default_config(&config);
+	config.sample_rate = GYRO_RATE;
+	config.count = (size_t)(seconds * GYRO_RATE);
+	const size_t count = config.count;
+	const size_t event_capacity = count + count / ACCEL_STEP + count / MAG_STEP + 2;
+	MA_PRECISION* samples = (MA_PRECISION *) malloc(count * IMU_TRAJECTORY_RECORD_SIZE * sizeof(MA_PRECISION));
+	double* truth = (double *) malloc(count * 4 * sizeof(double));
+	AHRSSensorEvent* events = (AHRSSensorEvent *) malloc(event_capacity * sizeof(AHRSSensorEvent));
+	size_t* gyro_event = (size_t *) malloc(count * sizeof(size_t));
+	MA_PRECISION* q = (MA_PRECISION *) malloc(count * 4 * sizeof(MA_PRECISION));
+	MA_PRECISION* q_events = (MA_PRECISION *) malloc(event_capacity * 4 * sizeof(MA_PRECISION));
+	if(samples == NULL || truth == NULL || events == NULL || gyro_event == NULL || q == NULL || q_events == NULL) return 1;
+	if(imu_trajectory_generate(&config, samples, truth) != 0) return 1;
+
+	// Merged stream: sample i closes at (i + 1) ms, the gyro event first
+	size_t event_count = 0;
+	for(size_t i = 0; i < count; i++) {
+		const MA_PRECISION* s = samples + i * IMU_TRAJECTORY_RECORD_SIZE;
+		uint64_t timestamp = (uint64_t)(i + 1) * PERIOD_NS;
+		gyro_event[i] = event_count;
+		events[event_count++] = (AHRSSensorEvent){ timestamp, AHRS_SENSOR_GYRO, s[0], s[1], s[2] };
+		if(i % ACCEL_STEP == 0) events[event_count++] = (AHRSSensorEvent){ timestamp, AHRS_SENSOR_ACCEL, s[3], s[4], s[5] };
+		if(i % MAG_STEP == 0) events[event_count++] = (AHRSSensorEvent){ timestamp, AHRS_SENSOR_MAG, s[6], s[7], s[8] };
+	}
+
+	const MA_PRECISION dt = 1.0f / (MA_PRECISION) GYRO_RATE;
+	const MA_PRECISION accel_dt = (MA_PRECISION) ACCEL_STEP * dt, mag_dt = (MA_PRECISION) MAG_STEP * dt;
+	printf("%zu gyro samples, %.0f s: gyro %d Hz, accelerometer %d Hz, magnetometer %d Hz, %zu events\n",
+		count, seconds, GYRO_RATE, GYRO_RATE / ACCEL_STEP, GYRO_RATE / MAG_STEP, event_count);
+	printf("%-18s %10s %10s %10s\n", "", "ns/gyro", "rms deg", "max deg");
+	for(int filter = 0; filter < 2; filter++) {
+		MadgwickAHRS madgwick;
+		MahonyAHRS mahony;
+		char name[32];
+		const char* prefix = filter == 0 ? "madgwick" : "mahony";
+
+		madgwick_ahrs_init(&madgwick, GYRO_RATE);
+		mahony_ahrs_init(&mahony, GYRO_RATE);
+		double t0 = bench_now();
+		for(size_t i = 0; i < count; i++) {
+			const MA_PRECISION* s = samples + i * IMU_TRAJECTORY_RECORD_SIZE;
+			const MA_PRECISION* a = samples + (i - i % ACCEL_STEP) * IMU_TRAJECTORY_RECORD_SIZE + 3;
+			const MA_PRECISION* m = samples + (i - i % MAG_STEP) * IMU_TRAJECTORY_RECORD_SIZE + 6;
+			if(filter == 0) {
+				madgwick_ahrs_update(&madgwick, s[0], s[1], s[2], a[0], a[1], a[2], m[0], m[1], m[2]);
+				STORE_QUATERNION(q + 4 * i, madgwick);
+			} else {
+				mahony_ahrs_update(&mahony, s[0], s[1], s[2], a[0], a[1], a[2], m[0], m[1], m[2]);
+				STORE_QUATERNION(q + 4 * i, mahony);
+			}
+		}
+		snprintf(name, sizeof(name), "%s hold", prefix);
+		report(name, bench_now() - t0, count, truth, q);
+
+		madgwick_ahrs_init(&madgwick, GYRO_RATE);
+		mahony_ahrs_init(&mahony, GYRO_RATE);
+		t0 = bench_now();
+		for(size_t i = 0; i < count; i++) {
+			const MA_PRECISION* s = samples + i * IMU_TRAJECTORY_RECORD_SIZE;
+			if(filter == 0) {
+				madgwick_ahrs_predict(&madgwick, dt, s[0], s[1], s[2]);
+				if(i % ACCEL_STEP == 0) madgwick_ahrs_correct_accel(&madgwick, accel_dt, s[3], s[4], s[5]);
+				if(i % MAG_STEP == 0) madgwick_ahrs_correct_mag(&madgwick, mag_dt, s[6], s[7], s[8]);
+				STORE_QUATERNION(q + 4 * i, madgwick);
+			} else {
+				mahony_ahrs_predict(&mahony, dt, s[0], s[1], s[2]);
+				if(i % ACCEL_STEP == 0) mahony_ahrs_correct_accel(&mahony, accel_dt, s[3], s[4], s[5]);
+				if(i % MAG_STEP == 0) mahony_ahrs_correct_mag(&mahony, mag_dt, s[6], s[7], s[8]);
+				STORE_QUATERNION(q + 4 * i, mahony);
+			}
+		}
+		snprintf(name, sizeof(name), "%s predict", prefix);
+		report(name, bench_now() - t0, count, truth, q);
+
+		madgwick_ahrs_init(&madgwick, GYRO_RATE);
+		mahony_ahrs_init(&mahony, GYRO_RATE);
+		t0 = bench_now();
+		if(filter == 0) madgwick_ahrs_update_events(&madgwick, events, event_count, q_events);
+		else mahony_ahrs_update_events(&mahony, events, event_count, q_events);
+		double elapsed = bench_now() - t0;
+		// The quaternion after the last event of each gyro sample
+		for(size_t i = 0; i < count; i++) {
+			size_t last = i + 1 < count ? gyro_event[i + 1] - 1 : event_count - 1;
+			memcpy(q + 4 * i, q_events + 4 * last, 4 * sizeof(MA_PRECISION));
+		}
+		snprintf(name, sizeof(name), "%s events", prefix);
+		report(name, elapsed, count, truth, q);
+	}
+
+	free(samples);
+	free(truth);
+	free(events);
+	free(gyro_event);
+	free(q);
+	free(q_events);
+	return 0;
+}
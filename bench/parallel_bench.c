@@ -0,0 +1,135 @@
+//=====================================================================================================
+// parallel_bench.c
+//=====================================================================================================
+//
+// Chunked parallel processing of one long stream (ahrs_parallel.h) against the sequential batch
+// update on a synthetic 1 kHz MARG recording (imu_trajectory.h, --seconds, default 10 minutes).
+//   divergence   maximum and rms angle between the parallel and the sequential quaternions, for
+//                warm-ups of 0 to 120 s with the most threads
+//   speedup      throughput and speedup against the sequential update for 1, 2, 4, .. threads,
+//                with a 30 s warm-up
+// Build: cc -O2 -I.. parallel_bench.c imu_trajectory.c ../*.c -lm -lpthread
+//
+// Usage: parallel_bench [--seconds S] [--threads MAX]   (MAX defaults to the online CPUs, at least 4)
+//
+//=====================================================================================================
+#include "ahrs_parallel.h"
+#include "imu_trajectory.h"
+#include "bench_util.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SAMPLE_RATE 1000
+#define SPEEDUP_WARMUP 30.0 // s
+
+static const double warmups[] = { 0.0, 5.0, 30.0, 120.0 };
+
+typedef struct {
+    AHRSSensorArray gyro;
+    AHRSSensorArray accel;
+    AHRSSensorArray mag;
+    size_t count;
+} ParallelStream;
+
+// Sequential (threads 0) or parallel run of filter f from a fresh filter, returns the seconds taken
+static double run(int f, const ParallelStream* stream, size_t threads, size_t warmup, MA_PRECISION* quaternions){
+	MadgwickAHRS madgwick;
+	MahonyAHRS mahony;
+	madgwick_ahrs_init(&madgwick, SAMPLE_RATE);
+	mahony_ahrs_init(&mahony, SAMPLE_RATE);
+	double t0 = bench_now();
+	if(threads == 0) {
+		if(f == 0) madgwick_ahrs_update_batch(&madgwick, stream->gyro, stream->accel, stream->mag, stream->count, quaternions);
+		else mahony_ahrs_update_batch(&mahony, stream->gyro, stream->accel, stream->mag, stream->count, quaternions);
+	} else if(f == 0) {
+		if(madgwick_ahrs_update_batch_parallel(&madgwick, threads, warmup, stream->gyro, stream->accel, stream->mag, stream->count, quaternions) != 0) exit(1);
+	} else {
+		if(mahony_ahrs_update_batch_parallel(&mahony, threads, warmup, stream->gyro, stream->accel, stream->mag, stream->count, quaternions) != 0) exit(1);
+	}
+	return bench_now() - t0;
+}
+
+// Maximum and rms angle in deg between the quaternions of a and b
+static void divergence(const MA_PRECISION* a, const MA_PRECISION* b, size_t count, double* max, double* rms){
+	double sum = 0.0;
+	*max = 0.0;
+	for(size_t i = 0; i < count; i++) {
+		const MA_PRECISION* p = a + 4 * i;
+		const MA_PRECISION* q = b + 4 * i;
+		double dot = fabs((double) p[0] * q[0] + (double) p[1] * q[1] + (double) p[2] * q[2] + (double) p[3] * q[3]);
+		double e = 2.0 * acos(dot < 1.0 ? dot : 1.0) * 180.0 / M_PI;
+		if(e > *max) *max = e;
+		sum += e * e;
+	}
+	*rms = sqrt(sum / (double) count);
+}
+
+int main(int argc, char** argv){
+	double seconds = 600.0;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t max_threads = cpus > 4 ? (size_t) cpus : 4;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) seconds = atof(argv[++i]);
+		else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc) max_threads = (size_t) atol(argv[++i]);
+		else {
+			fprintf(stderr, "usage: %s [--seconds S] [--threads MAX]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(!(seconds > 0.0) || max_threads == 0) return 2;
+
+	ImuTrajectoryConfig config;
+	imu_trajectory_default_config(&config);
+	config.sample_rate = SAMPLE_RATE;
+	config.count = (size_t)(seconds * SAMPLE_RATE);
+	const size_t count = config.count;
+	MA_PRECISION* samples = (MA_PRECISION *) malloc(count * IMU_TRAJECTORY_RECORD_SIZE * sizeof(MA_PRECISION));
+	MA_PRECISION* sequential = (MA_PRECISION *) malloc(count * 4 * sizeof(MA_PRECISION));
+	MA_PRECISION* parallel = (MA_PRECISION *) malloc(count * 4 * sizeof(MA_PRECISION));
+	if(samples == NULL || sequential == NULL || parallel == NULL) return 1;
+	if(imu_trajectory_generate(&config, samples, NULL) != 0) return 1;
+	ParallelStream stream;
+	stream.gyro = ahrs_sensor_array_interleaved(samples, IMU_TRAJECTORY_RECORD_SIZE);
+	stream.accel = ahrs_sensor_array_interleaved(samples + 3, IMU_TRAJECTORY_RECORD_SIZE);
+	stream.mag = ahrs_sensor_array_interleaved(samples + 6, IMU_TRAJECTORY_RECORD_SIZE);
+	stream.count = count;
+
+	printf("%zu samples, %.0f s at %d Hz, MARG, %ld online CPUs\n", count, seconds, SAMPLE_RATE, cpus);
+	for(int f = 0; f < 2; f++) {
+		const char* name = f == 0 ? "madgwick" : "mahony";
+		double sequential_seconds = 1e30;
+		for(int repeat = 0; repeat < 3; repeat++) {
+			double t = run(f, &stream, 0, 0, sequential);
+			if(t < sequential_seconds) sequential_seconds = t;
+		}
+
+		printf("\n%s, %zu threads: divergence from the sequential update\n", name, max_threads);
+		printf("%10s %12s %12s\n", "warm-up s", "max deg", "rms deg");
+		for(size_t w = 0; w < sizeof(warmups) / sizeof(warmups[0]); w++) {
+			double max, rms;
+			run(f, &stream, max_threads, (size_t)(warmups[w] * SAMPLE_RATE), parallel);
+			divergence(sequential, parallel, count, &max, &rms);
+			printf("%10.0f %12.4f %12.4f\n", warmups[w], max, rms);
+		}
+
+		printf("\n%s, %.0f s warm-up: speedup (sequential %.2f Msamples/s)\n", name, SPEEDUP_WARMUP, (double) count / sequential_seconds * 1e-6);
+		printf("%8s %14s %10s %12s\n", "threads", "Msamples/s", "speedup", "efficiency");
+		for(size_t threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+			double best = 1e30;
+			for(int repeat = 0; repeat < 3; repeat++) {
+				double t = run(f, &stream, threads, (size_t)(SPEEDUP_WARMUP * SAMPLE_RATE), parallel);
+				if(t < best) best = t;
+			}
+			printf("%8zu %14.2f %10.2f %12.2f\n", threads, (double) count / best * 1e-6, sequential_seconds / best, sequential_seconds / best / (double) threads);
+			if(threads == max_threads) break;
+		}
+	}
+
+	free(samples);
+	free(sequential);
+	free(parallel);
+	return 0;
+}
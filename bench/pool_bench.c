@@ -0,0 +1,99 @@
+//=====================================================================================================
+// pool_bench.c
+//=====================================================================================================
+//
+// Workspace pools (ahrs_pool.h) against one malloc per filter, for a fleet of devices that connect
+// and disconnect:
+//   churn    ns per disconnect + connect pair (free_* + create_* against release + acquire)
+//   update   ns per filter per tick for one update of every live filter, after the churn has left
+//            the malloc'd workspaces scattered through the heap between other allocations
+// Build: cc -O2 -I.. pool_bench.c ../*.c -lm
+//
+//=====================================================================================================
+#include "ahrs_pool.h"
+#include "bench_util.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SAMPLE_RATE 200.0f
+#define FILTER_COUNT 20000
+#define CHURN_COUNT 1000000
+#define TICK_COUNT 200
+
+int main(void){
+	MadgwickAHRS** filters = (MadgwickAHRS **) malloc(FILTER_COUNT * sizeof(MadgwickAHRS *));
+	void** clutter = (void **) calloc(FILTER_COUNT, sizeof(void *));
+	AHRSHandle* handles = (AHRSHandle *) malloc(FILTER_COUNT * sizeof(AHRSHandle));
+	MadgwickAHRSPool* pool = create_madgwick_ahrs_pool(FILTER_COUNT);
+	if(filters == NULL || clutter == NULL || handles == NULL || pool == NULL) return 1;
+	BenchRandom rng = { 0x9E3779B97F4A7C15ULL };
+	double t0, malloc_churn, pool_churn, malloc_update, pool_update;
+
+	for(size_t i = 0; i < FILTER_COUNT; i++) {
+		filters[i] = create_madgwick_ahrs(SAMPLE_RATE);
+		handles[i] = madgwick_ahrs_pool_acquire(pool, SAMPLE_RATE);
+		if(filters[i] == NULL || handles[i] == AHRS_HANDLE_INVALID) return 1;
+	}
+
+	// Disconnect a random device and connect a new one in its place; the application's own
+	// allocations of varying size land in between
+	t0 = bench_now();
+	for(size_t i = 0; i < CHURN_COUNT; i++) {
+		size_t device = bench_random_next(&rng) % FILTER_COUNT;
+		free_madgwick_ahrs(filters[device]);
+		free(clutter[device]);
+		clutter[device] = malloc(16 + bench_random_next(&rng) % 240);
+		filters[device] = create_madgwick_ahrs(SAMPLE_RATE);
+		if(filters[device] == NULL) return 1;
+	}
+	malloc_churn = bench_now() - t0;
+	rng.state = 0x9E3779B97F4A7C15ULL;
+	t0 = bench_now();
+	for(size_t i = 0; i < CHURN_COUNT; i++) {
+		size_t device = bench_random_next(&rng) % FILTER_COUNT;
+		bench_random_next(&rng);
+		madgwick_ahrs_pool_release(pool, handles[device]);
+		handles[device] = madgwick_ahrs_pool_acquire(pool, SAMPLE_RATE);
+	}
+	pool_churn = bench_now() - t0;
+
+	// One tick updates every device, the malloc'd ones in device order as an application would
+	t0 = bench_now();
+	for(size_t t = 0; t < TICK_COUNT; t++) {
+		MA_PRECISION g = 0.01f * (MA_PRECISION)(t % 7);
+		for(size_t i = 0; i < FILTER_COUNT; i++) madgwick_ahrs_update_imu(filters[i], g, 0.02f, -g, 0.0f, 0.1f, 1.0f);
+	}
+	malloc_update = bench_now() - t0;
+	t0 = bench_now();
+	for(size_t t = 0; t < TICK_COUNT; t++) {
+		MA_PRECISION g = 0.01f * (MA_PRECISION)(t % 7);
+		for(size_t i = 0; i < pool->count; i++) madgwick_ahrs_update_imu(&pool->filters[i], g, 0.02f, -g, 0.0f, 0.1f, 1.0f);
+	}
+	pool_update = bench_now() - t0;
+
+	double largest = 0.0; // same devices reset in the same order, so both hold the same states
+	for(size_t i = 0; i < FILTER_COUNT; i++) {
+		const MadgwickAHRS* a = filters[i];
+		const MadgwickAHRS* b = madgwick_ahrs_pool_get(pool, handles[i]);
+		double d = fabs(a->q0 - b->q0) + fabs(a->q1 - b->q1) + fabs(a->q2 - b->q2) + fabs(a->q3 - b->q3);
+		if(d > largest) largest = d;
+	}
+	bench_sink = largest;
+
+	printf("%d filters, %d disconnect + connect pairs, %d ticks\n", FILTER_COUNT, CHURN_COUNT, TICK_COUNT);
+	printf("%-10s %14s %18s\n", "", "churn ns/pair", "update ns/filter");
+	printf("%-10s %14.1f %18.2f\n", "malloc", malloc_churn * 1e9 / CHURN_COUNT, malloc_update * 1e9 / ((double)TICK_COUNT * FILTER_COUNT));
+	printf("%-10s %14.1f %18.2f\n", "pool", pool_churn * 1e9 / CHURN_COUNT, pool_update * 1e9 / ((double)TICK_COUNT * FILTER_COUNT));
+	printf("largest quaternion difference: %g\n", largest);
+
+	for(size_t i = 0; i < FILTER_COUNT; i++) {
+		free_madgwick_ahrs(filters[i]);
+		free(clutter[i]);
+	}
+	free_madgwick_ahrs_pool(pool);
+	free(handles);
+	free(clutter);
+	free(filters);
+	return 0;
+}
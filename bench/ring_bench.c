@@ -0,0 +1,216 @@
+//=====================================================================================================
+// ring_bench.c
+//=====================================================================================================
+//
+// Latency from sample push to quaternion publish through the lock-free hand-off of ahrs_ring.h,
+// against a mutex and condition variable protected queue (the usual hand-off it replaces).
+//
+// A producer thread pushes one sample every --interval microseconds, stamping each with the time of
+// the push; a consumer thread drains whatever has arrived into the Madgwick batch update and
+// publishes the quaternion through the seqlock; a reader thread polls the seqlock throughout. A
+// sample's latency is the time at which the quaternion including it was published, minus its push
+// time. Reports p50 / p99 / p99.9 / max over --samples samples, and the reads the reader completed.
+// With a single CPU the threads yield instead of spinning and the latencies are scheduler quanta.
+// Build: cc -O2 -I.. ring_bench.c imu_trajectory.c ../*.c -lm -lpthread
+//
+//=====================================================================================================
+#include "ahrs_ring.h"
+#include "imu_trajectory.h"
+#include "bench_util.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RING_CAPACITY 1024
+#define DISTINCT_SAMPLES 4096
+
+typedef struct {
+    size_t count;
+    double interval;            // s between pushes
+    int yield;                  // single CPU: yield instead of spinning
+    AHRSRingSample* samples;    // DISTINCT_SAMPLES, pushed round robin
+    double* push_time;          // per sample, written by the producer before the push
+    double* latency;            // per sample, written by the consumer
+    AHRSQuaternionSeqlock* seqlock;
+    atomic_int done;
+    uint64_t reads;
+
+    // Hand-off under test
+    int locked;
+    AHRSSampleRing* ring;
+    pthread_mutex_t lock;       // locked hand-off: queue of RING_CAPACITY samples
+    pthread_cond_t not_empty;
+    AHRSRingSample* queue;
+    size_t queue_head;
+    size_t queue_tail;
+} RingBench;
+
+static void relax(const RingBench* bench){
+	if(bench->yield) sched_yield();
+#if defined(__x86_64__) || defined(__i386__)
+	else __builtin_ia32_pause();
+#endif
+}
+
+static void* producer(void* argument){
+	RingBench* bench = (RingBench *) argument;
+	double next = bench_now();
+	for(size_t i = 0; i < bench->count; i++) {
+		while(bench_now() < next) relax(bench);
+		next += bench->interval;
+		AHRSRingSample sample = bench->samples[i % DISTINCT_SAMPLES];
+		sample.timestamp = i;
+		bench->push_time[i] = bench_now();
+		if(bench->locked) {
+			pthread_mutex_lock(&bench->lock);
+			while(bench->queue_head - bench->queue_tail == RING_CAPACITY) { // full: wait for the consumer
+				pthread_mutex_unlock(&bench->lock);
+				relax(bench);
+				pthread_mutex_lock(&bench->lock);
+			}
+			bench->queue[bench->queue_head++ % RING_CAPACITY] = sample;
+			pthread_cond_signal(&bench->not_empty);
+			pthread_mutex_unlock(&bench->lock);
+		} else {
+			while(ahrs_ring_push(bench->ring, &sample, 1) == 0) relax(bench);
+		}
+	}
+	return NULL;
+}
+
+// Locked hand-off: copy everything queued out under the lock, filter outside it
+static size_t drain_locked(RingBench* bench, MadgwickAHRS* filter, AHRSRingSample* buffer){
+	pthread_mutex_lock(&bench->lock);
+	while(bench->queue_head == bench->queue_tail) pthread_cond_wait(&bench->not_empty, &bench->lock);
+	size_t count = bench->queue_head - bench->queue_tail;
+	for(size_t i = 0; i < count; i++) buffer[i] = bench->queue[(bench->queue_tail + i) % RING_CAPACITY];
+	bench->queue_tail += count;
+	pthread_mutex_unlock(&bench->lock);
+
+	madgwick_ahrs_update_batch(filter, ahrs_sensor_array_interleaved(buffer->gyro, AHRS_RING_SAMPLE_STRIDE),
+		ahrs_sensor_array_interleaved(buffer->accel, AHRS_RING_SAMPLE_STRIDE), ahrs_sensor_array_interleaved(buffer->mag, AHRS_RING_SAMPLE_STRIDE), count, NULL);
+	AHRSOrientation orientation = { filter->q0, filter->q1, filter->q2, filter->q3, buffer[count - 1].timestamp };
+	ahrs_seqlock_publish(bench->seqlock, &orientation);
+	return count;
+}
+
+static void* consumer(void* argument){
+	RingBench* bench = (RingBench *) argument;
+	MadgwickAHRS* filter = create_madgwick_ahrs(1000.0f);
+	AHRSRingSample* buffer = (AHRSRingSample *) malloc(RING_CAPACITY * sizeof(AHRSRingSample));
+	if(filter == NULL || buffer == NULL) exit(1);
+	for(size_t consumed = 0; consumed < bench->count;) {
+		size_t n = bench->locked ? drain_locked(bench, filter, buffer) : ahrs_ring_drain_madgwick(bench->ring, filter, bench->seqlock);
+		if(n == 0) {
+			relax(bench);
+			continue;
+		}
+		double now = bench_now();
+		for(size_t i = consumed; i < consumed + n; i++) bench->latency[i] = now - bench->push_time[i];
+		consumed += n;
+	}
+	atomic_store(&bench->done, 1);
+	free(buffer);
+	free_madgwick_ahrs(filter);
+	return NULL;
+}
+
+static void* reader(void* argument){
+	RingBench* bench = (RingBench *) argument;
+	AHRSOrientation orientation;
+	uint64_t reads = 0;
+	while(!atomic_load_explicit(&bench->done, memory_order_relaxed)) {
+		ahrs_seqlock_read(bench->seqlock, &orientation);
+		bench_sink = orientation.q0;
+		reads++;
+		if(bench->yield) sched_yield();
+	}
+	bench->reads = reads;
+	return NULL;
+}
+
+static int compare_double(const void* a, const void* b){
+	double x = *(const double *) a, y = *(const double *) b;
+	return x < y ? -1 : x > y;
+}
+
+static int run(RingBench* bench, const char* name){
+	pthread_t threads[3];
+	atomic_store(&bench->done, 0);
+	bench->queue_head = bench->queue_tail = 0;
+	bench->ring = create_ahrs_sample_ring(RING_CAPACITY);
+	if(bench->ring == NULL) return -1;
+	double t0 = bench_now();
+	pthread_create(&threads[0], NULL, consumer, bench);
+	pthread_create(&threads[1], NULL, reader, bench);
+	pthread_create(&threads[2], NULL, producer, bench);
+	for(int i = 0; i < 3; i++) pthread_join(threads[i], NULL);
+	double seconds = bench_now() - t0;
+	free_ahrs_sample_ring(bench->ring);
+
+	qsort(bench->latency, bench->count, sizeof(double), compare_double);
+#define PERCENTILE(P) (bench->latency[(size_t)((P) * (double)(bench->count - 1))] * 1e6)
+	printf("%-16s %10.2f %10.2f %10.2f %10.2f %14.2f\n", name, PERCENTILE(0.5), PERCENTILE(0.99), PERCENTILE(0.999),
+		bench->latency[bench->count - 1] * 1e6, (double)bench->reads / seconds * 1e-6);
+#undef PERCENTILE
+	return 0;
+}
+
+int main(int argc, char** argv){
+	RingBench bench;
+	memset(&bench, 0, sizeof(bench));
+	bench.count = 200000;
+	bench.interval = 20e-6;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "--samples") == 0 && i + 1 < argc) bench.count = strtoul(argv[++i], NULL, 10);
+		else if(strcmp(argv[i], "--interval") == 0 && i + 1 < argc) bench.interval = atof(argv[++i]) * 1e-6;
+		else {
+			fprintf(stderr, "usage: %s [--samples N] [--interval US]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(bench.count == 0) return 2;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	bench.yield = cpus < 3; // producer, consumer and reader each need a CPU to spin
+
+	ImuTrajectoryConfig config;
+	imu_trajectory_default_config(&config);
+	config.sample_rate = 1000.0;
+	config.count = DISTINCT_SAMPLES;
+	MA_PRECISION* stream = (MA_PRECISION *) malloc(DISTINCT_SAMPLES * IMU_TRAJECTORY_RECORD_SIZE * sizeof(MA_PRECISION));
+	bench.samples = (AHRSRingSample *) malloc(DISTINCT_SAMPLES * sizeof(AHRSRingSample));
+	bench.push_time = (double *) malloc(bench.count * sizeof(double));
+	bench.latency = (double *) malloc(bench.count * sizeof(double));
+	bench.queue = (AHRSRingSample *) malloc(RING_CAPACITY * sizeof(AHRSRingSample));
+	bench.seqlock = create_ahrs_quaternion_seqlock();
+	if(stream == NULL || bench.samples == NULL || bench.push_time == NULL || bench.latency == NULL || bench.queue == NULL
+		|| bench.seqlock == NULL || imu_trajectory_generate(&config, stream, NULL) != 0) return 1;
+	for(size_t i = 0; i < DISTINCT_SAMPLES; i++) {
+		memcpy(bench.samples[i].gyro, stream + i * IMU_TRAJECTORY_RECORD_SIZE, 3 * sizeof(MA_PRECISION));
+		memcpy(bench.samples[i].accel, stream + i * IMU_TRAJECTORY_RECORD_SIZE + 3, 3 * sizeof(MA_PRECISION));
+		memcpy(bench.samples[i].mag, stream + i * IMU_TRAJECTORY_RECORD_SIZE + 6, 3 * sizeof(MA_PRECISION));
+	}
+	pthread_mutex_init(&bench.lock, NULL);
+	pthread_cond_init(&bench.not_empty, NULL);
+
+	printf("%zu samples, one every %.1f us, %ld online CPUs%s\n", bench.count, bench.interval * 1e6, cpus, bench.yield ? " (yielding)" : "");
+	printf("%-16s %10s %10s %10s %10s %14s\n", "push -> publish", "p50 us", "p99 us", "p99.9 us", "max us", "Mreads/s");
+	bench.locked = 0;
+	if(run(&bench, "spsc ring") != 0) return 1;
+	bench.locked = 1;
+	if(run(&bench, "mutex queue") != 0) return 1;
+
+	pthread_cond_destroy(&bench.not_empty);
+	pthread_mutex_destroy(&bench.lock);
+	free_ahrs_quaternion_seqlock(bench.seqlock);
+	free(bench.queue);
+	free(bench.latency);
+	free(bench.push_time);
+	free(bench.samples);
+	free(stream);
+	return 0;
+}
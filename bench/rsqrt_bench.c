@@ -0,0 +1,81 @@
+//=====================================================================================================
+// rsqrt_bench.c
+//=====================================================================================================
+//
+// Speed and accuracy of the reciprocal square root backends of ahrs_rsqrt.h, both precisions:
+// throughput (independent calls), latency (each call depends on the previous result), and the RMS
+// and largest relative error against a long double reference, over inputs spread log-uniformly across
+// [1e-4, 1e4] (the squared norms the filters normalise). The backend inv_sqrt uses in this build is
+// marked. ahrs_bench built with -DAHRS_RSQRT=... shows the effect on the filters.
+// Build: cc -O2 -I.. rsqrt_bench.c -lm
+//
+//=====================================================================================================
+#include "arhs.h"
+#include "bench_util.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define INPUT_COUNT (1 << 16)
+#define PASSES 64
+
+static float inputs_f[INPUT_COUNT];
+static double inputs_d[INPUT_COUNT];
+
+static void make_inputs(void){
+	BenchRandom rng = { 0xD1B54A32D192ED03ULL };
+	for(size_t i = 0; i < INPUT_COUNT; i++) {
+		double x = pow(10.0, 4.0 * bench_random_uniform(&rng));
+		inputs_d[i] = x;
+		inputs_f[i] = (float) x;
+	}
+}
+
+static void report(const char* name, int selected, double throughput, double latency, double rms, double max){
+	printf("%-10s %c %12.3f %12.3f %12.3g %12.3g\n", name, selected ? '*' : ' ', throughput, latency, rms, max);
+}
+
+// One row of the table for backend FN in precision TYPE; INPUTS holds INPUT_COUNT samples
+#define RUN(NAME, BACKEND, FN, TYPE, INPUTS, SELECTED) do { \
+	double t0, throughput, latency, sum = 0.0, max = 0.0; \
+	TYPE acc = 0, acc1 = 0, acc2 = 0, acc3 = 0; /* independent sums, so the additions do not bound the loop */ \
+	t0 = bench_now(); \
+	for(int p = 0; p < PASSES; p++) \
+		for(size_t i = 0; i < INPUT_COUNT; i += 4) { \
+			acc += FN(INPUTS[i]); \
+			acc1 += FN(INPUTS[i + 1]); \
+			acc2 += FN(INPUTS[i + 2]); \
+			acc3 += FN(INPUTS[i + 3]); \
+		} \
+	throughput = (bench_now() - t0) * 1e9 / ((double)PASSES * INPUT_COUNT); \
+	bench_sink = (double) (acc + acc1 + acc2 + acc3); \
+	acc = 0; \
+	t0 = bench_now(); \
+	for(int p = 0; p < PASSES; p++) \
+		for(size_t i = 0; i < INPUT_COUNT; i++) acc = FN(INPUTS[i] + acc * (TYPE)1e-30); \
+	latency = (bench_now() - t0) * 1e9 / ((double)PASSES * INPUT_COUNT); \
+	bench_sink = (double) acc; \
+	for(size_t i = 0; i < INPUT_COUNT; i++) { \
+		long double exact = 1.0L / sqrtl((long double) INPUTS[i]); \
+		double err = (double) fabsl(((long double) FN(INPUTS[i]) - exact) / exact); \
+		sum += err * err; \
+		if(err > max) max = err; \
+	} \
+	report(NAME, (SELECTED) && AHRS_RSQRT == BACKEND, throughput, latency, sqrt(sum / INPUT_COUNT), max); \
+} while(0)
+
+int main(void){
+	make_inputs();
+	printf("%d inputs x %d passes, * = inv_sqrt in this build\n", INPUT_COUNT, PASSES);
+	printf("%-12s %12s %12s %12s %12s\n", "backend", "ns (thrpt)", "ns (latency)", "rms rel err", "max rel err");
+
+	printf("float\n");
+	RUN("exact", AHRS_RSQRT_EXACT, ahrs_rsqrt_exact_f, float, inputs_f, !MA_DOUBLE_PRECISION);
+	RUN("hardware", AHRS_RSQRT_HARDWARE, ahrs_rsqrt_hardware_f, float, inputs_f, !MA_DOUBLE_PRECISION);
+	RUN("magic", AHRS_RSQRT_MAGIC, ahrs_rsqrt_magic_f, float, inputs_f, !MA_DOUBLE_PRECISION);
+	printf("double\n");
+	RUN("exact", AHRS_RSQRT_EXACT, ahrs_rsqrt_exact_d, double, inputs_d, MA_DOUBLE_PRECISION);
+	RUN("hardware", AHRS_RSQRT_HARDWARE, ahrs_rsqrt_hardware_d, double, inputs_d, MA_DOUBLE_PRECISION);
+	RUN("magic", AHRS_RSQRT_MAGIC, ahrs_rsqrt_magic_d, double, inputs_d, MA_DOUBLE_PRECISION);
+	return 0;
+}
@@ -0,0 +1,113 @@
+//=====================================================================================================
+// smooth_bench.c
+//=====================================================================================================
+//
+// Offline forward-backward smoothing (ahrs_smooth.h) against the causal batch update on a synthetic
+// 200 Hz MARG recording (imu_trajectory.h, --seconds, default 30 minutes) with a constant gyro bias.
+// The Madgwick and Mahony filters start 90 deg off in yaw and 20 deg in roll, as from the identity on
+// a device that is not level and north; the ESKF aligns itself on the first sample.
+//   Msamples/s     throughput of the causal pass and of the smoother (two passes and the fusion)
+//   start / rest   rms attitude error over the first 30 s, and over the rest of the recording
+// Build: cc -O2 -I.. smooth_bench.c imu_trajectory.c ../*.c -lm
+//
+//=====================================================================================================
+#include "ahrs_smooth.h"
+#include "imu_trajectory.h"
+#include "bench_util.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLE_RATE 200
+#define START 30.0 // s of the start window
+
+// rms attitude error in deg over samples [first, last)
+static double rms_error(const double* truth, const MA_PRECISION* q, size_t first, size_t last){
+	double sum = 0.0;
+	for(size_t i = first; i < last; i++) {
+		double e = imu_trajectory_attitude_error(truth + 4 * i, q[4 * i], q[4 * i + 1], q[4 * i + 2], q[4 * i + 3]) * 180.0 / M_PI;
+		sum += e * e;
+	}
+	return sqrt(sum / (double)(last - first));
+}
+
+// Initial error of the gain filters: yaw 90 deg, then roll 20 deg
+static void misalign(MA_PRECISION* q0, MA_PRECISION* q1, MA_PRECISION* q2, MA_PRECISION* q3){
+	const double cy = cos(M_PI / 4.0), sy = sin(M_PI / 4.0), cr = cos(M_PI / 18.0), sr = sin(M_PI / 18.0);
+	*q0 = (MA_PRECISION)(cy * cr);
+	*q1 = (MA_PRECISION)(cy * sr);
+	*q2 = (MA_PRECISION)(sy * sr);
+	*q3 = (MA_PRECISION)(sy * cr);
+}
+
+int main(int argc, char** argv){
+	double seconds = 1800.0;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) seconds = atof(argv[++i]);
+		else {
+			fprintf(stderr, "usage: %s [--seconds S]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(!(seconds > 2.0 * START)) return 2;
+
+	ImuTrajectoryConfig config;
+	imu_trajectory_default_config(&config);
+	config.sample_rate = SAMPLE_RATE;
+	config.count = (size_t)(seconds * SAMPLE_RATE);
+	config.gyro_bias[0] = 0.004;
+	config.gyro_bias[1] = -0.003;
+	config.gyro_bias[2] = 0.002;
+	const size_t count = config.count, start = (size_t)(START * SAMPLE_RATE);
+	MA_PRECISION* samples = (MA_PRECISION *) malloc(count * IMU_TRAJECTORY_RECORD_SIZE * sizeof(MA_PRECISION));
+	double* truth = (double *) malloc(count * 4 * sizeof(double));
+	MA_PRECISION* causal = (MA_PRECISION *) malloc(count * 4 * sizeof(MA_PRECISION));
+	MA_PRECISION* smoothed = (MA_PRECISION *) malloc(count * 4 * sizeof(MA_PRECISION));
+	if(samples == NULL || truth == NULL || causal == NULL || smoothed == NULL) return 1;
+	if(imu_trajectory_generate(&config, samples, truth) != 0) return 1;
+	AHRSSensorArray gyro = ahrs_sensor_array_interleaved(samples, IMU_TRAJECTORY_RECORD_SIZE);
+	AHRSSensorArray accel = ahrs_sensor_array_interleaved(samples + 3, IMU_TRAJECTORY_RECORD_SIZE);
+	AHRSSensorArray mag = ahrs_sensor_array_interleaved(samples + 6, IMU_TRAJECTORY_RECORD_SIZE);
+
+	printf("%zu samples, %.0f s at %d Hz, MARG\n", count, seconds, SAMPLE_RATE);
+	printf("%-10s %14s %14s %12s %12s %12s %12s\n", "", "causal Ms/s", "smooth Ms/s", "causal start", "smooth start", "causal rest", "smooth rest");
+	for(int f = 0; f < 3; f++) {
+		MadgwickAHRS madgwick;
+		MahonyAHRS mahony;
+		EskfAHRS eskf;
+		madgwick_ahrs_init(&madgwick, SAMPLE_RATE);
+		mahony_ahrs_init(&mahony, SAMPLE_RATE);
+		eskf_ahrs_init(&eskf, SAMPLE_RATE, 1);
+		misalign(&madgwick.q0, &madgwick.q1, &madgwick.q2, &madgwick.q3);
+		misalign(&mahony.q0, &mahony.q1, &mahony.q2, &mahony.q3);
+		MadgwickAHRS madgwick_causal = madgwick;
+		MahonyAHRS mahony_causal = mahony;
+		EskfAHRS eskf_causal = eskf;
+
+		double t0 = bench_now();
+		if(f == 0) madgwick_ahrs_update_batch(&madgwick_causal, gyro, accel, mag, count, causal);
+		else if(f == 1) mahony_ahrs_update_batch(&mahony_causal, gyro, accel, mag, count, causal);
+		else eskf_ahrs_update_batch(&eskf_causal, gyro, accel, mag, count, causal);
+		double causal_seconds = bench_now() - t0;
+
+		t0 = bench_now();
+		int result;
+		if(f == 0) result = madgwick_ahrs_smooth(&madgwick, 0.0f, gyro, accel, mag, count, smoothed);
+		else if(f == 1) result = mahony_ahrs_smooth(&mahony, 0.0f, gyro, accel, mag, count, smoothed);
+		else result = eskf_ahrs_smooth(&eskf, 0.0f, gyro, accel, mag, count, smoothed);
+		double smooth_seconds = bench_now() - t0;
+		if(result != 0) return 1;
+
+		printf("%-10s %14.2f %14.2f %12.3f %12.3f %12.3f %12.3f\n", f == 0 ? "madgwick" : f == 1 ? "mahony" : "eskf bias",
+			(double) count / causal_seconds * 1e-6, (double) count / smooth_seconds * 1e-6,
+			rms_error(truth, causal, 0, start), rms_error(truth, smoothed, 0, start),
+			rms_error(truth, causal, start, count), rms_error(truth, smoothed, start, count));
+	}
+
+	free(samples);
+	free(truth);
+	free(causal);
+	free(smoothed);
+	return 0;
+}
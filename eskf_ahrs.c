@@ -0,0 +1,456 @@
+//=====================================================================================================
+// eskf_ahrs.c
+//=====================================================================================================
+//
+// Error-state Kalman filter, see eskf_ahrs.h.
+//
+// The error is defined in the sensor frame, q_true = q * (1, dtheta / 2), so with the gyro rate
+// w = g - bias and R the rotation of q:
+//   predict        dtheta' = (I - [w dt]x) dtheta - dt dbias
+//   accelerometer  a = R^T (0, 0, 1) + [R^T (0, 0, 1)]x dtheta
+//   heading        -atan2(hy, hx) of h = R m, the yaw error (R dtheta)_z = row 3 of R . dtheta
+// The covariance is propagated by its 3x3 blocks; the accelerometer update inverts a 3x3 innovation
+// covariance, the heading update is scalar. After each correction the error is moved into the
+// quaternion and bias and the covariance kept symmetric.
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "eskf_ahrs.h"
+#include "ahrs_stats.h"
+#include <stdlib.h>
+#include <math.h>
+
+#define P_AT(P, R, C) (P)[(R) * ESKF_STATES + (C)]
+#define ESKF_MIN_VARIANCE 1e-12f
+
+// Filter state the kernels work on, a local copy of the workspace's
+typedef struct {
+    MA_PRECISION q[4];
+    MA_PRECISION bias[3];
+    MA_PRECISION P[ESKF_STATES * ESKF_STATES];
+    int aligned;
+    uint32_t accel_rejected;
+    uint32_t mag_rejected;
+} EskfState;
+
+// Noise model for one sample period
+typedef struct {
+    MA_PRECISION dt;
+    MA_PRECISION attitude_variance;     // gyro noise over dt, rad^2
+    MA_PRECISION bias_variance;         // bias random walk over dt, (rad/s)^2
+    MA_PRECISION accel_variance;
+    MA_PRECISION heading_variance;
+    MA_PRECISION accel_gate;
+    MA_PRECISION mag_gate;
+} EskfModel;
+
+//---------------------------------------------------------------------------------------------------
+// Variable definitions
+
+static void eskf_reset(EskfAHRS* workspace){
+	workspace->q0 = 1.0f;
+	workspace->q1 = 0.0f;
+	workspace->q2 = 0.0f;
+	workspace->q3 = 0.0f;
+	workspace->bias_x = 0.0f;
+	workspace->bias_y = 0.0f;
+	workspace->bias_z = 0.0f;
+	for(int i = 0; i < ESKF_STATES * ESKF_STATES; i++) workspace->P[i] = 0.0f;
+	for(int i = 0; i < 3; i++) {
+		P_AT(workspace->P, i, i) = ESKF_INITIAL_ATTITUDE * ESKF_INITIAL_ATTITUDE;
+		P_AT(workspace->P, i + 3, i + 3) = ESKF_INITIAL_BIAS * ESKF_INITIAL_BIAS;
+	}
+	workspace->aligned = 0;
+	workspace->euler_dirty = 1;
+}
+
+int eskf_ahrs_init(EskfAHRS* workspace, MA_PRECISION sample_rate, int estimate_bias){
+	if(workspace == NULL || sample_rate <= 0) return -1;
+	workspace->sample_rate = sample_rate;
+	workspace->gyro_noise = ESKF_GYRO_NOISE;
+	workspace->bias_noise = ESKF_BIAS_NOISE;
+	workspace->accel_noise = ESKF_ACCEL_NOISE;
+	workspace->heading_noise = ESKF_HEADING_NOISE;
+	workspace->accel_gate = ESKF_ACCEL_GATE;
+	workspace->mag_gate = ESKF_MAG_GATE;
+	workspace->estimate_bias = estimate_bias != 0;
+	workspace->accel_rejected = 0;
+	workspace->mag_rejected = 0;
+	eskf_reset(workspace);
+	workspace->yaw = 0.0f;
+	workspace->pitch = 0.0f;
+	workspace->roll = 0.0f;
+	workspace->euler_dirty = 0;
+	return 0;
+}
+
+EskfAHRS* create_eskf_ahrs(MA_PRECISION sample_rate, int estimate_bias){
+	if(sample_rate <= 0) return NULL;
+	EskfAHRS* workspace = (EskfAHRS *) malloc(sizeof(EskfAHRS));
+	if(workspace == NULL) return NULL;
+	eskf_ahrs_init(workspace, sample_rate, estimate_bias);
+	return workspace;
+}
+
+void free_eskf_ahrs(EskfAHRS* workspace){
+	free(workspace);
+}
+
+void eskf_ahrs_update_sample_rate(EskfAHRS* workspace, MA_PRECISION sample_rate){
+	if(workspace == NULL) return;
+	if(sample_rate <= 0) return;
+	if(sample_rate != workspace->sample_rate) {
+		workspace->sample_rate = sample_rate;
+		eskf_reset(workspace);
+		AHRS_STAT_COLD(AHRS_STAT_RATE_RESET);
+	}
+}
+
+void eskf_ahrs_set_noise(EskfAHRS* workspace, MA_PRECISION gyro_noise, MA_PRECISION bias_noise, MA_PRECISION accel_noise, MA_PRECISION heading_noise){
+	if(workspace == NULL) return;
+	if(gyro_noise < 0 || bias_noise < 0 || !(accel_noise > 0) || !(heading_noise > 0)) return;
+	workspace->gyro_noise = gyro_noise;
+	workspace->bias_noise = bias_noise;
+	workspace->accel_noise = accel_noise;
+	workspace->heading_noise = heading_noise;
+}
+
+void eskf_ahrs_set_gates(EskfAHRS* workspace, MA_PRECISION accel_gate, MA_PRECISION mag_gate){
+	if(workspace == NULL) return;
+	if(accel_gate < 0 || mag_gate < 0) return;
+	workspace->accel_gate = accel_gate;
+	workspace->mag_gate = mag_gate;
+}
+
+void eskf_ahrs_get_euler(EskfAHRS* workspace, MA_PRECISION* yaw, MA_PRECISION* pitch, MA_PRECISION* roll){
+	if(workspace == NULL) return;
+	if(workspace->euler_dirty) {
+		COMPUTE_EULER_ANGLE(workspace);
+		workspace->euler_dirty = 0;
+	}
+	if(yaw != NULL) *yaw = workspace->yaw;
+	if(pitch != NULL) *pitch = workspace->pitch;
+	if(roll != NULL) *roll = workspace->roll;
+}
+
+static void eskf_load(const EskfAHRS* workspace, EskfState* s){
+	s->q[0] = workspace->q0;
+	s->q[1] = workspace->q1;
+	s->q[2] = workspace->q2;
+	s->q[3] = workspace->q3;
+	s->bias[0] = workspace->bias_x;
+	s->bias[1] = workspace->bias_y;
+	s->bias[2] = workspace->bias_z;
+	for(int i = 0; i < ESKF_STATES * ESKF_STATES; i++) s->P[i] = workspace->P[i];
+	s->aligned = workspace->aligned;
+	s->accel_rejected = workspace->accel_rejected;
+	s->mag_rejected = workspace->mag_rejected;
+}
+
+static void eskf_store(EskfAHRS* workspace, const EskfState* s){
+	workspace->q0 = s->q[0];
+	workspace->q1 = s->q[1];
+	workspace->q2 = s->q[2];
+	workspace->q3 = s->q[3];
+	workspace->bias_x = s->bias[0];
+	workspace->bias_y = s->bias[1];
+	workspace->bias_z = s->bias[2];
+	for(int i = 0; i < ESKF_STATES * ESKF_STATES; i++) workspace->P[i] = s->P[i];
+	workspace->aligned = s->aligned;
+	workspace->accel_rejected = s->accel_rejected;
+	workspace->mag_rejected = s->mag_rejected;
+	workspace->euler_dirty = 1;
+}
+
+static void eskf_model(const EskfAHRS* workspace, EskfModel* model){
+	model->dt = 1.0f / workspace->sample_rate;
+	model->attitude_variance = workspace->gyro_noise * workspace->gyro_noise * model->dt;
+	model->bias_variance = workspace->bias_noise * workspace->bias_noise * model->dt;
+	model->accel_variance = workspace->accel_noise * workspace->accel_noise;
+	model->heading_variance = workspace->heading_noise * workspace->heading_noise;
+	model->accel_gate = workspace->accel_gate;
+	model->mag_gate = workspace->mag_gate;
+}
+
+//====================================================================================================
+// Filter kernels
+//
+// `n` is the number of error states, 3 or 6, passed as a constant by the callers so that every loop
+// below has a fixed trip count and unrolls.
+
+// Gravity direction in the sensor frame, R^T (0, 0, 1): row 3 of R
+MA_INLINE void eskf_gravity(const MA_PRECISION* q, MA_PRECISION* v){
+	v[0] = 2.0f * (q[1] * q[3] - q[0] * q[2]);
+	v[1] = 2.0f * (q[0] * q[1] + q[2] * q[3]);
+	v[2] = q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3];
+}
+
+// q = q * (1, dtheta / 2), normalised
+MA_INLINE void eskf_rotate(MA_PRECISION* q, MA_PRECISION dx, MA_PRECISION dy, MA_PRECISION dz){
+	MA_PRECISION q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	q0 += 0.5f * (-q[1] * dx - q[2] * dy - q[3] * dz);
+	q1 += 0.5f * (q[0] * dx + q[2] * dz - q[3] * dy);
+	q2 += 0.5f * (q[0] * dy - q[1] * dz + q[3] * dx);
+	q3 += 0.5f * (q[0] * dz + q[1] * dy - q[2] * dx);
+	MA_PRECISION recipNorm = inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	q[0] = q0 * recipNorm;
+	q[1] = q1 * recipNorm;
+	q[2] = q2 * recipNorm;
+	q[3] = q3 * recipNorm;
+}
+
+// P = P - K PHt^T, mirrored to stay symmetric, then the error state dx moved into q and bias
+MA_INLINE void eskf_inject(EskfState* s, int n, int m, const MA_PRECISION* K, const MA_PRECISION* PHt, const MA_PRECISION* dx){
+	for(int i = 0; i < n; i++) {
+		for(int j = i; j < n; j++) {
+			MA_PRECISION sum = 0.0f;
+			for(int k = 0; k < m; k++) sum += K[i * m + k] * PHt[j * m + k];
+			MA_PRECISION p = 0.5f * (P_AT(s->P, i, j) + P_AT(s->P, j, i)) - sum;
+			if(i == j && p < ESKF_MIN_VARIANCE) p = ESKF_MIN_VARIANCE;
+			P_AT(s->P, i, j) = p;
+			P_AT(s->P, j, i) = p;
+		}
+	}
+	eskf_rotate(s->q, dx[0], dx[1], dx[2]);
+	if(n == 6) {
+		s->bias[0] += dx[3];
+		s->bias[1] += dx[4];
+		s->bias[2] += dx[5];
+	}
+}
+
+//---------------------------------------------------------------------------------------------------
+// Prediction: first order quaternion integration, as in the other filters, and P = F P F^T + Q with
+// F = [A, -dt I; 0, I], A = I - [w dt]x, done by blocks:
+//   Ptt = A Ptt A^T - dt (A Ptb + (A Ptb)^T) + dt^2 Pbb + Qt,  Ptb = A Ptb - dt Pbb,  Pbb = Pbb + Qb
+MA_INLINE void eskf_predict(EskfState* s, const EskfModel* model, int n, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz){
+	const MA_PRECISION dt = model->dt;
+	if(n == 6) {
+		gx -= s->bias[0];
+		gy -= s->bias[1];
+		gz -= s->bias[2];
+	}
+	MA_PRECISION* q = s->q;
+	MA_PRECISION qDot1 = 0.5f * (-q[1] * gx - q[2] * gy - q[3] * gz);
+	MA_PRECISION qDot2 = 0.5f * (q[0] * gx + q[2] * gz - q[3] * gy);
+	MA_PRECISION qDot3 = 0.5f * (q[0] * gy - q[1] * gz + q[3] * gx);
+	MA_PRECISION qDot4 = 0.5f * (q[0] * gz + q[1] * gy - q[2] * gx);
+	MA_PRECISION q0 = q[0] + qDot1 * dt, q1 = q[1] + qDot2 * dt, q2 = q[2] + qDot3 * dt, q3 = q[3] + qDot4 * dt;
+	MA_PRECISION recipNorm = inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	q[0] = q0 * recipNorm;
+	q[1] = q1 * recipNorm;
+	q[2] = q2 * recipNorm;
+	q[3] = q3 * recipNorm;
+
+	const MA_PRECISION wx = gx * dt, wy = gy * dt, wz = gz * dt;
+	const MA_PRECISION A[9] = { 1.0f, wz, -wy, -wz, 1.0f, wx, wy, -wx, 1.0f };
+	MA_PRECISION AP[9], Ptt[9];
+	for(int i = 0; i < 3; i++)
+		for(int j = 0; j < 3; j++)
+			AP[i * 3 + j] = A[i * 3] * P_AT(s->P, 0, j) + A[i * 3 + 1] * P_AT(s->P, 1, j) + A[i * 3 + 2] * P_AT(s->P, 2, j);
+	for(int i = 0; i < 3; i++)
+		for(int j = i; j < 3; j++)
+			Ptt[i * 3 + j] = AP[i * 3] * A[j * 3] + AP[i * 3 + 1] * A[j * 3 + 1] + AP[i * 3 + 2] * A[j * 3 + 2];
+	if(n == 6) {
+		MA_PRECISION APtb[9];
+		for(int i = 0; i < 3; i++)
+			for(int j = 0; j < 3; j++)
+				APtb[i * 3 + j] = A[i * 3] * P_AT(s->P, 0, j + 3) + A[i * 3 + 1] * P_AT(s->P, 1, j + 3) + A[i * 3 + 2] * P_AT(s->P, 2, j + 3);
+		for(int i = 0; i < 3; i++)
+			for(int j = i; j < 3; j++)
+				Ptt[i * 3 + j] += dt * (dt * P_AT(s->P, i + 3, j + 3) - APtb[i * 3 + j] - APtb[j * 3 + i]);
+		for(int i = 0; i < 3; i++) {
+			for(int j = 0; j < 3; j++) {
+				MA_PRECISION p = APtb[i * 3 + j] - dt * P_AT(s->P, i + 3, j + 3);
+				P_AT(s->P, i, j + 3) = p;
+				P_AT(s->P, j + 3, i) = p;
+			}
+			P_AT(s->P, i + 3, i + 3) += model->bias_variance;
+		}
+	}
+	for(int i = 0; i < 3; i++) {
+		for(int j = i; j < 3; j++) {
+			P_AT(s->P, i, j) = Ptt[i * 3 + j];
+			P_AT(s->P, j, i) = Ptt[i * 3 + j];
+		}
+		P_AT(s->P, i, i) += model->attitude_variance;
+	}
+}
+
+//---------------------------------------------------------------------------------------------------
+// Accelerometer correction, H = [[v]x, 0] with v the predicted gravity direction
+MA_INLINE void eskf_correct_accel(EskfState* s, const EskfModel* model, int n, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az){
+	MA_PRECISION recipNorm = inv_sqrt(ax * ax + ay * ay + az * az);
+	MA_PRECISION v[3];
+	eskf_gravity(s->q, v);
+	const MA_PRECISION r[3] = { ax * recipNorm - v[0], ay * recipNorm - v[1], az * recipNorm - v[2] };
+	const MA_PRECISION H[9] = { 0.0f, -v[2], v[1], v[2], 0.0f, -v[0], -v[1], v[0], 0.0f };
+
+	// PHt = P H^T (n x 3), S = H PHt + R
+	MA_PRECISION PHt[ESKF_STATES * 3], S[9];
+	for(int i = 0; i < n; i++)
+		for(int j = 0; j < 3; j++)
+			PHt[i * 3 + j] = P_AT(s->P, i, 0) * H[j * 3] + P_AT(s->P, i, 1) * H[j * 3 + 1] + P_AT(s->P, i, 2) * H[j * 3 + 2];
+	for(int i = 0; i < 3; i++)
+		for(int j = 0; j < 3; j++)
+			S[i * 3 + j] = H[i * 3] * PHt[j] + H[i * 3 + 1] * PHt[3 + j] + H[i * 3 + 2] * PHt[6 + j] + (i == j ? model->accel_variance : 0.0f);
+
+	// S^-1 by cofactors
+	MA_PRECISION C[9] = {
+		S[4] * S[8] - S[5] * S[7], S[2] * S[7] - S[1] * S[8], S[1] * S[5] - S[2] * S[4],
+		S[5] * S[6] - S[3] * S[8], S[0] * S[8] - S[2] * S[6], S[2] * S[3] - S[0] * S[5],
+		S[3] * S[7] - S[4] * S[6], S[1] * S[6] - S[0] * S[7], S[0] * S[4] - S[1] * S[3] };
+	MA_PRECISION det = S[0] * C[0] + S[1] * C[3] + S[2] * C[6];
+	if(!(det > 0.0f)) return;
+	MA_PRECISION recipDet = 1.0f / det;
+	for(int i = 0; i < 9; i++) C[i] *= recipDet;
+
+	MA_PRECISION Sr[3];
+	for(int i = 0; i < 3; i++) Sr[i] = C[i * 3] * r[0] + C[i * 3 + 1] * r[1] + C[i * 3 + 2] * r[2];
+	if(model->accel_gate > 0.0f && r[0] * Sr[0] + r[1] * Sr[1] + r[2] * Sr[2] > model->accel_gate) {
+		s->accel_rejected++;
+		return;
+	}
+
+	// K = PHt S^-1, dx = K r = PHt S^-1 r
+	MA_PRECISION K[ESKF_STATES * 3], dx[ESKF_STATES];
+	for(int i = 0; i < n; i++) {
+		for(int j = 0; j < 3; j++) K[i * 3 + j] = PHt[i * 3] * C[j] + PHt[i * 3 + 1] * C[3 + j] + PHt[i * 3 + 2] * C[6 + j];
+		dx[i] = PHt[i * 3] * Sr[0] + PHt[i * 3 + 1] * Sr[1] + PHt[i * 3 + 2] * Sr[2];
+	}
+	eskf_inject(s, n, 3, K, PHt, dx);
+}
+
+//---------------------------------------------------------------------------------------------------
+// Magnetometer heading correction, scalar with H = [v^T, 0]
+MA_INLINE void eskf_correct_heading(EskfState* s, const EskfModel* model, int n, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz){
+	int valid;
+	MA_PRECISION r = -ahrs_heading(s->q, mx, my, mz, &valid);
+	if(!valid) return;
+	MA_PRECISION v[3];
+	eskf_gravity(s->q, v);
+
+	MA_PRECISION PHt[ESKF_STATES], K[ESKF_STATES], dx[ESKF_STATES];
+	for(int i = 0; i < n; i++) PHt[i] = P_AT(s->P, i, 0) * v[0] + P_AT(s->P, i, 1) * v[1] + P_AT(s->P, i, 2) * v[2];
+	MA_PRECISION S = v[0] * PHt[0] + v[1] * PHt[1] + v[2] * PHt[2] + model->heading_variance;
+	if(model->mag_gate > 0.0f && r * r > model->mag_gate * S) {
+		s->mag_rejected++;
+		return;
+	}
+	MA_PRECISION recipS = 1.0f / S;
+	for(int i = 0; i < n; i++) {
+		K[i] = PHt[i] * recipS;
+		dx[i] = K[i] * r;
+	}
+	eskf_inject(s, n, 1, K, PHt, dx);
+}
+
+//---------------------------------------------------------------------------------------------------
+// One sample: predict, then align or correct. Zero accelerometer / magnetometer samples are skipped.
+MA_INLINE void eskf_step(EskfState* s, const EskfModel* model, int n, int marg, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz){
+	AHRS_STAT_ADD(AHRS_STAT_UPDATES, 1);
+	eskf_predict(s, model, n, gx, gy, gz);
+	int accel_valid = !((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f));
+	int mag_valid = marg && !((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f));
+	AHRS_STAT_IF(!accel_valid, AHRS_STAT_ACCEL_INVALID);
+	AHRS_STAT_IF(marg && !mag_valid, AHRS_STAT_MAG_FALLBACK);
+	if(!s->aligned) {
+		if(accel_valid) {
+			ahrs_align(s->q, mag_valid, ax, ay, az, mx, my, mz);
+			s->aligned = 1;
+		}
+		return;
+	}
+	if(accel_valid) eskf_correct_accel(s, model, n, ax, ay, az);
+	if(mag_valid) eskf_correct_heading(s, model, n, mx, my, mz);
+}
+
+//====================================================================================================
+// Batch loops, specialised by the number of states and IMU / MARG
+
+MA_INLINE void eskf_batch_run(EskfState* s, const EskfModel* model, int n, int marg, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions)
+{
+	size_t g = 0, a = 0, m = 0;
+	for(size_t i = 0; i < count; i++, g += gyro.stride, a += accel.stride) {
+		MA_PRECISION mx = 0.0f, my = 0.0f, mz = 0.0f;
+		if(marg) {
+			mx = mag.x[m];
+			my = mag.y[m];
+			mz = mag.z[m];
+			m += mag.stride;
+		}
+		eskf_step(s, model, n, marg, gyro.x[g], gyro.y[g], gyro.z[g], accel.x[a], accel.y[a], accel.z[a], mx, my, mz);
+		if(quaternions != NULL) {
+			quaternions[0] = s->q[0];
+			quaternions[1] = s->q[1];
+			quaternions[2] = s->q[2];
+			quaternions[3] = s->q[3];
+			quaternions += 4;
+		}
+	}
+}
+
+static void eskf_batch(EskfAHRS* workspace, int marg, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions)
+{
+	EskfState s;
+	EskfModel model;
+	eskf_load(workspace, &s);
+	eskf_model(workspace, &model);
+	if(workspace->estimate_bias) {
+		if(marg) eskf_batch_run(&s, &model, 6, 1, gyro, accel, mag, count, quaternions);
+		else eskf_batch_run(&s, &model, 6, 0, gyro, accel, mag, count, quaternions);
+	} else {
+		if(marg) eskf_batch_run(&s, &model, 3, 1, gyro, accel, mag, count, quaternions);
+		else eskf_batch_run(&s, &model, 3, 0, gyro, accel, mag, count, quaternions);
+	}
+	eskf_store(workspace, &s);
+}
+
+//====================================================================================================
+// Functions
+
+void eskf_ahrs_update_imu(EskfAHRS* workspace, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az)
+{
+	AHRS_STATS_START(start);
+	EskfState s;
+	EskfModel model;
+	eskf_load(workspace, &s);
+	eskf_model(workspace, &model);
+	if(workspace->estimate_bias) eskf_step(&s, &model, 6, 0, gx, gy, gz, ax, ay, az, 0.0f, 0.0f, 0.0f);
+	else eskf_step(&s, &model, 3, 0, gx, gy, gz, ax, ay, az, 0.0f, 0.0f, 0.0f);
+	eskf_store(workspace, &s);
+	AHRS_STATS_STOP(start, 1);
+}
+
+void eskf_ahrs_update(EskfAHRS* workspace, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz)
+{
+	AHRS_STATS_START(start);
+	EskfState s;
+	EskfModel model;
+	eskf_load(workspace, &s);
+	eskf_model(workspace, &model);
+	if(workspace->estimate_bias) eskf_step(&s, &model, 6, 1, gx, gy, gz, ax, ay, az, mx, my, mz);
+	else eskf_step(&s, &model, 3, 1, gx, gy, gz, ax, ay, az, mx, my, mz);
+	eskf_store(workspace, &s);
+	AHRS_STATS_STOP(start, 1);
+}
+
+void eskf_ahrs_update_imu_batch(EskfAHRS* workspace, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions)
+{
+	if(workspace == NULL || count == 0) return;
+	AHRS_STATS_START(start);
+	AHRSSensorArray none = { NULL, NULL, NULL, 0 };
+	eskf_batch(workspace, 0, gyro, accel, none, count, quaternions);
+	AHRS_STATS_STOP(start, count);
+}
+
+void eskf_ahrs_update_batch(EskfAHRS* workspace, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions)
+{
+	if(workspace == NULL || count == 0) return;
+	AHRS_STATS_START(start);
+	eskf_batch(workspace, 1, gyro, accel, mag, count, quaternions);
+	AHRS_STATS_STOP(start, count);
+}
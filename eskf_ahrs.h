@@ -0,0 +1,116 @@
+//=====================================================================================================
+// eskf_ahrs.h
+//=====================================================================================================
+//
+// Error-state Kalman filter AHRS, for when the fixed gains of Madgwick and Mahony are not enough
+// (magnetic disturbances, gyro bias). The nominal state is the quaternion and the gyro bias; the
+// filter keeps the covariance of the small error around it, 3 attitude angles in the sensor frame
+// and, with bias estimation, 3 bias components:
+//   predict        the gyro, less the bias, rotates the quaternion; the covariance is propagated
+//                  with gyro noise and bias random walk
+//   accelerometer  the normalised sample measures the gravity direction, which corrects roll and pitch
+//   magnetometer   the tilt-compensated heading corrects yaw only, so a disturbed field cannot tilt
+//                  the estimate
+// Each correction passes a chi-square test of its innovation first: samples off by more than the
+// gate (e.g. a magnetic disturbance, linear acceleration) are rejected and counted. The first sample
+// with an accelerometer reading aligns the filter directly from accelerometer and magnetometer.
+//
+// The matrices are fixed size, ESKF_STATES square, inside the workspace: no allocation after create,
+// and the kernels are specialised for 3 and 6 states so the compiler unrolls the 3x3 blocks.
+// bench/eskf_bench.c compares speed and accuracy with the Madgwick and Mahony filters.
+//
+//=====================================================================================================
+#ifndef __ESKF_AHRS_H__
+#define __ESKF_AHRS_H__
+
+#include "arhs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ESKF_STATES 6       // attitude error, gyro bias error
+
+typedef struct {
+    MA_PRECISION sample_rate;
+    MA_PRECISION q0;
+    MA_PRECISION q1;
+    MA_PRECISION q2;
+    MA_PRECISION q3;
+    // Gyro bias estimate in rad/s, subtracted from every gyro sample
+    MA_PRECISION bias_x;
+    MA_PRECISION bias_y;
+    MA_PRECISION bias_z;
+    // Error covariance, row-major: attitude (rad), then bias (rad/s) when estimated
+    MA_PRECISION P[ESKF_STATES * ESKF_STATES];
+
+    // Noise model, ESKF_* defaults unless changed with eskf_ahrs_set_noise
+    MA_PRECISION gyro_noise;    // rad/s/sqrt(Hz)
+    MA_PRECISION bias_noise;    // bias random walk, rad/s/sqrt(s)
+    MA_PRECISION accel_noise;   // of the normalised accelerometer sample
+    MA_PRECISION heading_noise; // rad
+    // Chi-square thresholds of the innovation tests, 0: no test. ESKF_*_GATE unless changed with eskf_ahrs_set_gates
+    MA_PRECISION accel_gate;    // 3 degrees of freedom
+    MA_PRECISION mag_gate;      // 1 degree of freedom
+    int estimate_bias;          // 6 states, else 3 and the bias stays as set
+    int aligned;                // 0 until the first accelerometer sample
+    uint32_t accel_rejected;    // samples rejected by the gates
+    uint32_t mag_rejected;
+
+    // Result variables, computed on demand by eskf_ahrs_get_euler
+    MA_PRECISION yaw;
+    MA_PRECISION pitch;
+    MA_PRECISION roll;
+    int euler_dirty;    // quaternion changed since yaw/pitch/roll were last computed
+} EskfAHRS;
+//----------------------------------------------------------------------------------------------------
+// Variable declaration
+#define ESKF_GYRO_NOISE 0.001f      // MEMS gyro noise density, with margin for the first order integration
+#define ESKF_BIAS_NOISE 0.0001f
+#define ESKF_ACCEL_NOISE 0.05f      // about 3 deg, leaves room for small linear accelerations
+#define ESKF_HEADING_NOISE 0.05f
+#define ESKF_ACCEL_GATE 16.27f      // 99.9 % of chi-square, 3 degrees of freedom
+#define ESKF_MAG_GATE 10.83f        // 99.9 % of chi-square, 1 degree of freedom
+#define ESKF_INITIAL_ATTITUDE 0.1f  // standard deviation after alignment, rad
+#define ESKF_INITIAL_BIAS 0.02f     // rad/s
+
+EskfAHRS* create_eskf_ahrs(MA_PRECISION sample_rate, int estimate_bias); // NULL for sample_rate <= 0 or out of memory
+void free_eskf_ahrs(EskfAHRS* workspace);
+
+// Initialises a workspace the caller allocated as create_eskf_ahrs does.
+// Returns 0, or -1 for sample_rate <= 0.
+int eskf_ahrs_init(EskfAHRS* workspace, MA_PRECISION sample_rate, int estimate_bias);
+
+//---------------------------------------------------------------------------------------------------
+// Function declarations
+
+// Resets the filter, to be aligned again, when the rate changes
+void eskf_ahrs_update_sample_rate(EskfAHRS* workspace, MA_PRECISION sample_rate);
+
+// Changes the noise model without resetting the state. Ignored unless the accelerometer and heading
+// noise are > 0 and the others >= 0.
+void eskf_ahrs_set_noise(EskfAHRS* workspace, MA_PRECISION gyro_noise, MA_PRECISION bias_noise, MA_PRECISION accel_noise, MA_PRECISION heading_noise);
+
+// Chi-square thresholds of the accelerometer and magnetometer innovation tests, 0 accepts every sample
+void eskf_ahrs_set_gates(EskfAHRS* workspace, MA_PRECISION accel_gate, MA_PRECISION mag_gate);
+
+// Euler angles of the current quaternion, computed when it changed since the last call. Any of the
+// output pointers may be NULL.
+void eskf_ahrs_get_euler(EskfAHRS* workspace, MA_PRECISION* yaw, MA_PRECISION* pitch, MA_PRECISION* roll);
+
+void eskf_ahrs_update_imu(EskfAHRS* workspace, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az);
+
+void eskf_ahrs_update(EskfAHRS* workspace, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz);
+
+//---------------------------------------------------------------------------------------------------
+// Batched updates, as for the other filters: equivalent to calling the per-sample update in a loop.
+// When `quaternions` is not NULL it receives q0, q1, q2, q3 of every sample (4 * count elements).
+void eskf_ahrs_update_imu_batch(EskfAHRS* workspace, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions);
+
+void eskf_ahrs_update_batch(EskfAHRS* workspace, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ESKF_AHRS_H__ */
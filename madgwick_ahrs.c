@@ -14,20 +14,53 @@
 //=====================================================================================================// Header files
 
 #include "madgwick_ahrs.h"
+#include "ahrs_stats.h"
 #include <stdlib.h>
 #include <math.h>
 
 //---------------------------------------------------------------------------------------------------
 // Variable definitions
-MadgwickAHRS* create_madgwick_ahrs(MA_PRECISION sample_rate){
-	if(sample_rate <= 0) return NULL;
-	MadgwickAHRS* workspace = (MadgwickAHRS *) malloc(sizeof(MadgwickAHRS));
+#if MA_FIXED_GAINS
+#define MADGWICK_BETA(WS) BETA
+#define MADGWICK_ZETA(WS) ZETA
+#else
+#define MADGWICK_BETA(WS) ((WS)->beta)
+#define MADGWICK_ZETA(WS) ((WS)->zeta)
+#endif
+
+int madgwick_ahrs_init(MadgwickAHRS* workspace, MA_PRECISION sample_rate){
+	if(workspace == NULL || sample_rate <= 0) return -1;
 	workspace->sample_rate = sample_rate;
+	workspace->beta = BETA;
+	workspace->zeta = ZETA;
 	// quaternion of sensor frame relative to auxiliary frame
 	workspace->q0 = 1.0f;
 	workspace->q1 = 0.0f;
 	workspace->q2 = 0.0f;
 	workspace->q3 = 0.0f;
+	workspace->bias_x = 0.0f;
+	workspace->bias_y = 0.0f;
+	workspace->bias_z = 0.0f;
+	workspace->max_dt = 0.0f;
+	workspace->gap_policy = AHRS_GAP_PROPAGATE;
+	workspace->has_timestamp = 0;
+	workspace->timestamp = 0;
+	workspace->accel_timestamp = 0;
+	workspace->mag_timestamp = 0;
+	workspace->has_accel_timestamp = 0;
+	workspace->has_mag_timestamp = 0;
+	workspace->yaw = 0.0f;
+	workspace->pitch = 0.0f;
+	workspace->roll = 0.0f;
+	workspace->euler_dirty = 0;
+	return 0;
+}
+
+MadgwickAHRS* create_madgwick_ahrs(MA_PRECISION sample_rate){
+	if(sample_rate <= 0) return NULL;
+	MadgwickAHRS* workspace = (MadgwickAHRS *) malloc(sizeof(MadgwickAHRS));
+	if(workspace == NULL) return NULL;
+	madgwick_ahrs_init(workspace, sample_rate);
 	return workspace;
 }
 
@@ -40,32 +73,82 @@ void madgwick_ahrs_update_sample_rate(MadgwickAHRS* workspace, MA_PRECISION samp
 		workspace->q1 = 0.0f;
 		workspace->q2 = 0.0f;
 		workspace->q3 = 0.0f;
+		workspace->bias_x = 0.0f;
+		workspace->bias_y = 0.0f;
+		workspace->bias_z = 0.0f;
+		workspace->euler_dirty = 1;
+		AHRS_STAT_COLD(AHRS_STAT_RATE_RESET);
 	}
 }
 
+void madgwick_ahrs_set_gain(MadgwickAHRS* workspace, MA_PRECISION beta) {
+	if(workspace == NULL) return;
+	if(beta < 0) return;
+	workspace->beta = beta;
+}
+
+void madgwick_ahrs_set_bias_gain(MadgwickAHRS* workspace, MA_PRECISION zeta) {
+	if(workspace == NULL) return;
+	if(zeta < 0) return;
+	workspace->zeta = zeta;
+}
+
+void madgwick_ahrs_set_gap_policy(MadgwickAHRS* workspace, int policy, MA_PRECISION max_dt) {
+	if(workspace == NULL) return;
+	if(policy != AHRS_GAP_PROPAGATE && policy != AHRS_GAP_CLAMP) return;
+	if(max_dt < 0) return;
+	workspace->gap_policy = policy;
+	workspace->max_dt = max_dt;
+}
+
 void free_madgwick_ahrs(MadgwickAHRS* workspace){
 	free(workspace);
 }
 
+void madgwick_ahrs_get_euler(MadgwickAHRS* workspace, MA_PRECISION* yaw, MA_PRECISION* pitch, MA_PRECISION* roll){
+	if(workspace == NULL) return;
+	if(workspace->euler_dirty) {
+		COMPUTE_EULER_ANGLE(workspace);
+		workspace->euler_dirty = 0;
+	}
+	if(yaw != NULL) *yaw = workspace->yaw;
+	if(pitch != NULL) *pitch = workspace->pitch;
+	if(roll != NULL) *roll = workspace->roll;
+}
+
 //====================================================================================================
-// Functions
+// Filter kernels
+//
+// The kernels work on local copies of the quaternion and gyro bias and take the sample period rather
+// than the sample rate, so the batch loops keep the state in registers and hoist the reciprocal out of
+// the loop. The gains are arguments so that constant ones (MA_FIXED_GAINS) fold into the inlined
+// kernel; with zeta == 0 the bias estimation block disappears. The bias estimated on a step is
+// removed from the gyro from the next sample on.
 
 //---------------------------------------------------------------------------------------------------
-// IMU algorithm update
-
-void madgwick_ahrs_update_imu(MadgwickAHRS* workspace, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az)
+// IMU algorithm step
+MA_INLINE void madgwick_imu_step(MA_PRECISION* q, MA_PRECISION* bias, MA_PRECISION dt, MA_PRECISION beta, MA_PRECISION zeta, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az)
 {
+	MA_PRECISION q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
 	// temp vars
 	MA_PRECISION recipNorm;
 	MA_PRECISION s0, s1, s2, s3;
 	MA_PRECISION qDot1, qDot2, qDot3, qDot4;
 	MA_PRECISION _2q0, _2q1, _2q2, _2q3, _4q0, _4q1, _4q2 ,_8q1, _8q2, q0q0, q1q1, q2q2, q3q3;
 
+	// Remove the gyro bias estimate
+	gx -= bias[0];
+	gy -= bias[1];
+	gz -= bias[2];
+
 	// Rate of change of quaternion from gyroscope
-	qDot1 = 0.5f * (-workspace->q1 * gx - workspace->q2 * gy - workspace->q3 * gz);
-	qDot2 = 0.5f * (workspace->q0 * gx + workspace->q2 * gz - workspace->q3 * gy);
-	qDot3 = 0.5f * (workspace->q0 * gy - workspace->q1 * gz + workspace->q3 * gx);
-	qDot4 = 0.5f * (workspace->q0 * gz + workspace->q1 * gy - workspace->q2 * gx);
+	qDot1 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+	qDot2 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+	qDot3 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+	qDot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+
+	AHRS_STAT_ADD(AHRS_STAT_UPDATES, 1);
+	AHRS_STAT_IF((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f), AHRS_STAT_ACCEL_INVALID);
 
 	// Compute feedback only if accelerometer measurement valid (avoids NaN in accelerometer normalisation)
 	if(!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f))) {
@@ -77,58 +160,71 @@ void madgwick_ahrs_update_imu(MadgwickAHRS* workspace, MA_PRECISION gx, MA_PRECI
 		az *= recipNorm;   
 
 		// Auxiliary variables to avoid repeated arithmetic
-		_2q0 = 2.0f * workspace->q0;
-		_2q1 = 2.0f * workspace->q1;
-		_2q2 = 2.0f * workspace->q2;
-		_2q3 = 2.0f * workspace->q3;
-		_4q0 = 4.0f * workspace->q0;
-		_4q1 = 4.0f * workspace->q1;
-		_4q2 = 4.0f * workspace->q2;
-		_8q1 = 8.0f * workspace->q1;
-		_8q2 = 8.0f * workspace->q2;
-		q0q0 = workspace->q0 * workspace->q0;
-		q1q1 = workspace->q1 * workspace->q1;
-		q2q2 = workspace->q2 * workspace->q2;
-		q3q3 = workspace->q3 * workspace->q3;
+		_2q0 = 2.0f * q0;
+		_2q1 = 2.0f * q1;
+		_2q2 = 2.0f * q2;
+		_2q3 = 2.0f * q3;
+		_4q0 = 4.0f * q0;
+		_4q1 = 4.0f * q1;
+		_4q2 = 4.0f * q2;
+		_8q1 = 8.0f * q1;
+		_8q2 = 8.0f * q2;
+		q0q0 = q0 * q0;
+		q1q1 = q1 * q1;
+		q2q2 = q2 * q2;
+		q3q3 = q3 * q3;
 
 		// Gradient decent algorithm corrective step
 		s0 = _4q0 * q2q2 + _2q2 * ax + _4q0 * q1q1 - _2q1 * ay;
-		s1 = _4q1 * q3q3 - _2q3 * ax + 4.0f * q0q0 * workspace->q1 - _2q0 * ay - _4q1 + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az;
-		s2 = 4.0f * q0q0 * workspace->q2 + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay - _4q2 + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az;
-		s3 = 4.0f * q1q1 * workspace->q3 - _2q1 * ax + 4.0f * q2q2 * workspace->q3 - _2q2 * ay;
-		recipNorm = inv_sqrt(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3); // normalise step magnitude
+		s1 = _4q1 * q3q3 - _2q3 * ax + 4.0f * q0q0 * q1 - _2q0 * ay - _4q1 + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az;
+		s2 = 4.0f * q0q0 * q2 + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay - _4q2 + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az;
+		s3 = 4.0f * q1q1 * q3 - _2q1 * ax + 4.0f * q2q2 * q3 - _2q2 * ay;
+
+		// Gyro bias drift: the gyro error 2 q* (x) s of the unnormalised gradient, integrated by zeta
+		if(zeta > 0.0f) {
+			bias[0] += zeta * 2.0f * (q0 * s1 - q1 * s0 - q2 * s3 + q3 * s2) * dt;
+			bias[1] += zeta * 2.0f * (q0 * s2 + q1 * s3 - q2 * s0 - q3 * s1) * dt;
+			bias[2] += zeta * 2.0f * (q0 * s3 - q1 * s2 + q2 * s1 - q3 * s0) * dt;
+		}
+
+		recipNorm = s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3;
+		recipNorm = recipNorm > 0.0f ? inv_sqrt(recipNorm) : 0.0f; // normalise step magnitude, a zero gradient gives no feedback
 		s0 *= recipNorm;
 		s1 *= recipNorm;
 		s2 *= recipNorm;
 		s3 *= recipNorm;
 
 		// Apply feedback step
-		qDot1 -= BETA * s0;
-		qDot2 -= BETA * s1;
-		qDot3 -= BETA * s2;
-		qDot4 -= BETA * s3;
+		qDot1 -= beta * s0;
+		qDot2 -= beta * s1;
+		qDot3 -= beta * s2;
+		qDot4 -= beta * s3;
 	}
 
 	// Integrate rate of change of quaternion to yield quaternion
-	workspace->q0 += qDot1 * (1.0f / workspace->sample_rate);
-	workspace->q1 += qDot2 * (1.0f / workspace->sample_rate);
-	workspace->q2 += qDot3 * (1.0f / workspace->sample_rate);
-	workspace->q3 += qDot4 * (1.0f / workspace->sample_rate);
+	q0 += qDot1 * dt;
+	q1 += qDot2 * dt;
+	q2 += qDot3 * dt;
+	q3 += qDot4 * dt;
 
 	// Normalise quaternion
-	recipNorm = inv_sqrt(workspace->q0 * workspace->q0 + workspace->q1 * workspace->q1 + workspace->q2 * workspace->q2 + workspace->q3 * workspace->q3);
-	workspace->q0 *= recipNorm;
-	workspace->q1 *= recipNorm;
-	workspace->q2 *= recipNorm;
-	workspace->q3 *= recipNorm;
-
-	COMPUTE_EULER_ANGLE(workspace);
+	recipNorm = inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	q0 *= recipNorm;
+	q1 *= recipNorm;
+	q2 *= recipNorm;
+	q3 *= recipNorm;
+	AHRS_STAT_IF(q0 != q0, AHRS_STAT_NAN);
+	q[0] = q0;
+	q[1] = q1;
+	q[2] = q2;
+	q[3] = q3;
 }
 
 //---------------------------------------------------------------------------------------------------
-// AHRS algorithm update
-void madgwick_ahrs_update(MadgwickAHRS* workspace, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz)
+// AHRS algorithm step
+MA_INLINE void madgwick_step(MA_PRECISION* q, MA_PRECISION* bias, MA_PRECISION dt, MA_PRECISION beta, MA_PRECISION zeta, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz)
 {
+	MA_PRECISION q0, q1, q2, q3;
 	MA_PRECISION recipNorm;
 	MA_PRECISION s0, s1, s2, s3;
 	MA_PRECISION qDot1, qDot2, qDot3, qDot4;
@@ -138,15 +234,28 @@ void madgwick_ahrs_update(MadgwickAHRS* workspace, MA_PRECISION gx, MA_PRECISION
 	// Use IMU algorithm if magnetometer measurement invalid (avoids NaN in magnetometer normalisation)
 	if ((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f))
 	{
-		madgwick_ahrs_update_imu(workspace, gx, gy, gz, ax, ay, az);
+		AHRS_STAT_ADD(AHRS_STAT_MAG_FALLBACK, 1);
+		madgwick_imu_step(q, bias, dt, beta, zeta, gx, gy, gz, ax, ay, az);
 		return;
 	}
+	q0 = q[0];
+	q1 = q[1];
+	q2 = q[2];
+	q3 = q[3];
+
+	// Remove the gyro bias estimate
+	gx -= bias[0];
+	gy -= bias[1];
+	gz -= bias[2];
 
     // Rate of change of quaternion from gyroscope
-	qDot1 = 0.5f * (-workspace->q1 * gx - workspace->q2 * gy - workspace->q3 * gz);
-	qDot2 = 0.5f * (workspace->q0 * gx + workspace->q2 * gz - workspace->q3 * gy);
-	qDot3 = 0.5f * (workspace->q0 * gy - workspace->q1 * gz + workspace->q3 * gx);
-	qDot4 = 0.5f * (workspace->q0 * gz + workspace->q1 * gy - workspace->q2 * gx);
+	qDot1 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+	qDot2 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+	qDot3 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+	qDot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+
+	AHRS_STAT_ADD(AHRS_STAT_UPDATES, 1);
+	AHRS_STAT_IF((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f), AHRS_STAT_ACCEL_INVALID);
 
 	// Compute feedback only if accelerometer measurement valid (avoids NaN in accelerometer normalisation)
 	if(!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f))) {
@@ -163,66 +272,710 @@ void madgwick_ahrs_update(MadgwickAHRS* workspace, MA_PRECISION gx, MA_PRECISION
 		mz *= recipNorm;
 
 		// Auxiliary variables to avoid repeated arithmetic
-		_2q0mx = 2.0f * workspace->q0 * mx;
-		_2q0my = 2.0f * workspace->q0 * my;
-		_2q0mz = 2.0f * workspace->q0 * mz;
-		_2q1mx = 2.0f * workspace->q1 * mx;
-		_2q0 = 2.0f * workspace->q0;
-		_2q1 = 2.0f * workspace->q1;
-		_2q2 = 2.0f * workspace->q2;
-		_2q3 = 2.0f * workspace->q3;
-		_2q0q2 = 2.0f * workspace->q0 * workspace->q2;
-		_2q2q3 = 2.0f * workspace->q2 * workspace->q3;
-		q0q0 = workspace->q0 * workspace->q0;
-		q0q1 = workspace->q0 * workspace->q1;
-		q0q2 = workspace->q0 * workspace->q2;
-		q0q3 = workspace->q0 * workspace->q3;
-		q1q1 = workspace->q1 * workspace->q1;
-		q1q2 = workspace->q1 * workspace->q2;
-		q1q3 = workspace->q1 * workspace->q3;
-		q2q2 = workspace->q2 * workspace->q2;
-		q2q3 = workspace->q2 * workspace->q3;
-		q3q3 = workspace->q3 * workspace->q3;
+		_2q0mx = 2.0f * q0 * mx;
+		_2q0my = 2.0f * q0 * my;
+		_2q0mz = 2.0f * q0 * mz;
+		_2q1mx = 2.0f * q1 * mx;
+		_2q0 = 2.0f * q0;
+		_2q1 = 2.0f * q1;
+		_2q2 = 2.0f * q2;
+		_2q3 = 2.0f * q3;
+		_2q0q2 = 2.0f * q0 * q2;
+		_2q2q3 = 2.0f * q2 * q3;
+		q0q0 = q0 * q0;
+		q0q1 = q0 * q1;
+		q0q2 = q0 * q2;
+		q0q3 = q0 * q3;
+		q1q1 = q1 * q1;
+		q1q2 = q1 * q2;
+		q1q3 = q1 * q3;
+		q2q2 = q2 * q2;
+		q2q3 = q2 * q3;
+		q3q3 = q3 * q3;
 
         // Reference direction of Earth's magnetic field
-		hx = mx * q0q0 - _2q0my * workspace->q3 + _2q0mz * workspace->q2 + mx * q1q1 + _2q1 * my * workspace->q2 + _2q1 * mz * workspace->q3 - mx * q2q2 - mx * q3q3;
-		hy = _2q0mx * workspace->q3 + my * q0q0 - _2q0mz * workspace->q1 + _2q1mx * workspace->q2 - my * q1q1 + my * q2q2 + _2q2 * mz * workspace->q3 - my * q3q3;
+		hx = mx * q0q0 - _2q0my * q3 + _2q0mz * q2 + mx * q1q1 + _2q1 * my * q2 + _2q1 * mz * q3 - mx * q2q2 - mx * q3q3;
+		hy = _2q0mx * q3 + my * q0q0 - _2q0mz * q1 + _2q1mx * q2 - my * q1q1 + my * q2q2 + _2q2 * mz * q3 - my * q3q3;
 		_2bx = SQRT(hx * hx + hy * hy);
-		_2bz = -_2q0mx * workspace->q2 + _2q0my * workspace->q1 + mz * q0q0 + _2q1mx * workspace->q3 - mz * q1q1 + _2q2 * my * workspace->q3 - mz * q2q2 + mz * q3q3;
+		_2bz = -_2q0mx * q2 + _2q0my * q1 + mz * q0q0 + _2q1mx * q3 - mz * q1q1 + _2q2 * my * q3 - mz * q2q2 + mz * q3q3;
 		_4bx = 2.0f * _2bx;
 		_4bz = 2.0f * _2bz;
 
         // Gradient decent algorithm corrective step
-		s0 = -_2q2 * (2.0f * q1q3 - _2q0q2 - ax) + _2q1 * (2.0f * q0q1 + _2q2q3 - ay) - _2bz * workspace->q2 * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (-_2bx * workspace->q3 + _2bz * workspace->q1) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + _2bx * workspace->q2 * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
-		s1 = _2q3 * (2.0f * q1q3 - _2q0q2 - ax) + _2q0 * (2.0f * q0q1 + _2q2q3 - ay) - 4.0f * workspace->q1 * (1 - 2.0f * q1q1 - 2.0f * q2q2 - az) + _2bz * workspace->q3 * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (_2bx * workspace->q2 + _2bz * workspace->q0) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + (_2bx * workspace->q3 - _4bz * workspace->q1) * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
-		s2 = -_2q0 * (2.0f * q1q3 - _2q0q2 - ax) + _2q3 * (2.0f * q0q1 + _2q2q3 - ay) - 4.0f * workspace->q2 * (1 - 2.0f * q1q1 - 2.0f * q2q2 - az) + (-_4bx * workspace->q2 - _2bz * workspace->q0) * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (_2bx * workspace->q1 + _2bz * workspace->q3) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + (_2bx * workspace->q0 - _4bz * workspace->q2) * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
-		s3 = _2q1 * (2.0f * q1q3 - _2q0q2 - ax) + _2q2 * (2.0f * q0q1 + _2q2q3 - ay) + (-_4bx * workspace->q3 + _2bz * workspace->q1) * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (-_2bx * workspace->q0 + _2bz * workspace->q2) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + _2bx * workspace->q1 * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
-		recipNorm = inv_sqrt(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3); // normalise step magnitude
+		s0 = -_2q2 * (2.0f * q1q3 - _2q0q2 - ax) + _2q1 * (2.0f * q0q1 + _2q2q3 - ay) - _2bz * q2 * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (-_2bx * q3 + _2bz * q1) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + _2bx * q2 * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+		s1 = _2q3 * (2.0f * q1q3 - _2q0q2 - ax) + _2q0 * (2.0f * q0q1 + _2q2q3 - ay) - 4.0f * q1 * (1 - 2.0f * q1q1 - 2.0f * q2q2 - az) + _2bz * q3 * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (_2bx * q2 + _2bz * q0) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + (_2bx * q3 - _4bz * q1) * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+		s2 = -_2q0 * (2.0f * q1q3 - _2q0q2 - ax) + _2q3 * (2.0f * q0q1 + _2q2q3 - ay) - 4.0f * q2 * (1 - 2.0f * q1q1 - 2.0f * q2q2 - az) + (-_4bx * q2 - _2bz * q0) * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (_2bx * q1 + _2bz * q3) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + (_2bx * q0 - _4bz * q2) * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+		s3 = _2q1 * (2.0f * q1q3 - _2q0q2 - ax) + _2q2 * (2.0f * q0q1 + _2q2q3 - ay) + (-_4bx * q3 + _2bz * q1) * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (-_2bx * q0 + _2bz * q2) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + _2bx * q1 * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+
+		// Gyro bias drift: the gyro error 2 q* (x) s of the unnormalised gradient, integrated by zeta
+		if(zeta > 0.0f) {
+			bias[0] += zeta * 2.0f * (q0 * s1 - q1 * s0 - q2 * s3 + q3 * s2) * dt;
+			bias[1] += zeta * 2.0f * (q0 * s2 + q1 * s3 - q2 * s0 - q3 * s1) * dt;
+			bias[2] += zeta * 2.0f * (q0 * s3 - q1 * s2 + q2 * s1 - q3 * s0) * dt;
+		}
+
+		recipNorm = s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3;
+		recipNorm = recipNorm > 0.0f ? inv_sqrt(recipNorm) : 0.0f; // normalise step magnitude, a zero gradient gives no feedback
 		s0 *= recipNorm;
 		s1 *= recipNorm;
 		s2 *= recipNorm;
 		s3 *= recipNorm;
 
 		// Apply feedback step
-		qDot1 -= BETA * s0;
-		qDot2 -= BETA * s1;
-		qDot3 -= BETA * s2;
-		qDot4 -= BETA * s3;
+		qDot1 -= beta * s0;
+		qDot2 -= beta * s1;
+		qDot3 -= beta * s2;
+		qDot4 -= beta * s3;
 	}
 
 	// Integrate rate of change of quaternion to yield quaternion
-	workspace->q0 += qDot1 * (1.0f / workspace->sample_rate);
-	workspace->q1 += qDot2 * (1.0f / workspace->sample_rate);
-	workspace->q2 += qDot3 * (1.0f / workspace->sample_rate);
-	workspace->q3 += qDot4 * (1.0f / workspace->sample_rate);
+	q0 += qDot1 * dt;
+	q1 += qDot2 * dt;
+	q2 += qDot3 * dt;
+	q3 += qDot4 * dt;
 
 	// Normalise quaternion
-	recipNorm = inv_sqrt(workspace->q0 * workspace->q0 + workspace->q1 * workspace->q1 + workspace->q2 * workspace->q2 + workspace->q3 * workspace->q3);
-	workspace->q0 *= recipNorm;
-	workspace->q1 *= recipNorm;
-	workspace->q2 *= recipNorm;
-	workspace->q3 *= recipNorm;
+	recipNorm = inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	q0 *= recipNorm;
+	q1 *= recipNorm;
+	q2 *= recipNorm;
+	q3 *= recipNorm;
+	AHRS_STAT_IF(q0 != q0, AHRS_STAT_NAN);
+	q[0] = q0;
+	q[1] = q1;
+	q[2] = q2;
+	q[3] = q3;
+}
+
+//---------------------------------------------------------------------------------------------------
+// Split steps of the multi-rate updates: the gyro term and the two halves of the gradient of the
+// objective function, each normalised on its own and applied over the interval of its sensor
+
+// Gyro propagation, the steps without feedback
+MA_INLINE void madgwick_predict(MA_PRECISION* q, const MA_PRECISION* bias, MA_PRECISION dt, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz)
+{
+	MA_PRECISION q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	MA_PRECISION recipNorm;
+	MA_PRECISION qDot1, qDot2, qDot3, qDot4;
+
+	gx -= bias[0];
+	gy -= bias[1];
+	gz -= bias[2];
+	AHRS_STAT_ADD(AHRS_STAT_UPDATES, 1);
+
+	qDot1 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+	qDot2 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+	qDot3 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+	qDot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+	q0 += qDot1 * dt;
+	q1 += qDot2 * dt;
+	q2 += qDot3 * dt;
+	q3 += qDot4 * dt;
 
-	COMPUTE_EULER_ANGLE(workspace);
+	recipNorm = inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	q[0] = q0 * recipNorm;
+	q[1] = q1 * recipNorm;
+	q[2] = q2 * recipNorm;
+	q[3] = q3 * recipNorm;
+	AHRS_STAT_IF(q[0] != q[0], AHRS_STAT_NAN);
 }
 
+// Applies the gradient s over dt: bias drift from s, then q -= beta * s * dt with s normalised
+MA_INLINE void madgwick_feedback(MA_PRECISION* q, MA_PRECISION* bias, MA_PRECISION dt, MA_PRECISION beta, MA_PRECISION zeta, MA_PRECISION s0, MA_PRECISION s1, MA_PRECISION s2, MA_PRECISION s3)
+{
+	MA_PRECISION q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	MA_PRECISION recipNorm = s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3;
+	if(!(recipNorm > 0.0f)) return;
+
+	if(zeta > 0.0f) {
+		bias[0] += zeta * 2.0f * (q0 * s1 - q1 * s0 - q2 * s3 + q3 * s2) * dt;
+		bias[1] += zeta * 2.0f * (q0 * s2 + q1 * s3 - q2 * s0 - q3 * s1) * dt;
+		bias[2] += zeta * 2.0f * (q0 * s3 - q1 * s2 + q2 * s1 - q3 * s0) * dt;
+	}
+
+	recipNorm = inv_sqrt(recipNorm);
+	s0 *= recipNorm;
+	s1 *= recipNorm;
+	s2 *= recipNorm;
+	s3 *= recipNorm;
+
+	q0 -= beta * s0 * dt;
+	q1 -= beta * s1 * dt;
+	q2 -= beta * s2 * dt;
+	q3 -= beta * s3 * dt;
+	recipNorm = inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	q[0] = q0 * recipNorm;
+	q[1] = q1 * recipNorm;
+	q[2] = q2 * recipNorm;
+	q[3] = q3 * recipNorm;
+}
+
+// Accelerometer correction: the gravity half of the gradient
+MA_INLINE void madgwick_correct_accel(MA_PRECISION* q, MA_PRECISION* bias, MA_PRECISION dt, MA_PRECISION beta, MA_PRECISION zeta, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az)
+{
+	MA_PRECISION q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	MA_PRECISION recipNorm;
+	MA_PRECISION _2q0, _2q1, _2q2, _2q3, _4q0, _4q1, _4q2 ,_8q1, _8q2, q0q0, q1q1, q2q2, q3q3;
+
+	AHRS_STAT_IF((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f), AHRS_STAT_ACCEL_INVALID);
+	if((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f)) return;
+
+	recipNorm = inv_sqrt(ax * ax + ay * ay + az * az);
+	ax *= recipNorm;
+	ay *= recipNorm;
+	az *= recipNorm;
+
+	_2q0 = 2.0f * q0;
+	_2q1 = 2.0f * q1;
+	_2q2 = 2.0f * q2;
+	_2q3 = 2.0f * q3;
+	_4q0 = 4.0f * q0;
+	_4q1 = 4.0f * q1;
+	_4q2 = 4.0f * q2;
+	_8q1 = 8.0f * q1;
+	_8q2 = 8.0f * q2;
+	q0q0 = q0 * q0;
+	q1q1 = q1 * q1;
+	q2q2 = q2 * q2;
+	q3q3 = q3 * q3;
+
+	madgwick_feedback(q, bias, dt, beta, zeta,
+		_4q0 * q2q2 + _2q2 * ax + _4q0 * q1q1 - _2q1 * ay,
+		_4q1 * q3q3 - _2q3 * ax + 4.0f * q0q0 * q1 - _2q0 * ay - _4q1 + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az,
+		4.0f * q0q0 * q2 + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay - _4q2 + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az,
+		4.0f * q1q1 * q3 - _2q1 * ax + 4.0f * q2q2 * q3 - _2q2 * ay);
+}
+
+// Magnetometer correction: the earth field half of the gradient
+MA_INLINE void madgwick_correct_mag(MA_PRECISION* q, MA_PRECISION* bias, MA_PRECISION dt, MA_PRECISION beta, MA_PRECISION zeta, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz)
+{
+	MA_PRECISION q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	MA_PRECISION recipNorm;
+	MA_PRECISION hx, hy, fx, fy, fz;
+	MA_PRECISION _2q0mx, _2q0my, _2q0mz, _2q1mx, _2bx, _2bz, _4bx, _4bz, _2q1, _2q2, q0q0, q0q1, q0q2, q0q3, q1q1, q1q2, q1q3, q2q2, q2q3, q3q3;
+
+	AHRS_STAT_IF((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f), AHRS_STAT_MAG_FALLBACK);
+	if((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f)) return;
+
+	recipNorm = inv_sqrt(mx * mx + my * my + mz * mz);
+	mx *= recipNorm;
+	my *= recipNorm;
+	mz *= recipNorm;
+
+	_2q0mx = 2.0f * q0 * mx;
+	_2q0my = 2.0f * q0 * my;
+	_2q0mz = 2.0f * q0 * mz;
+	_2q1mx = 2.0f * q1 * mx;
+	_2q1 = 2.0f * q1;
+	_2q2 = 2.0f * q2;
+	q0q0 = q0 * q0;
+	q0q1 = q0 * q1;
+	q0q2 = q0 * q2;
+	q0q3 = q0 * q3;
+	q1q1 = q1 * q1;
+	q1q2 = q1 * q2;
+	q1q3 = q1 * q3;
+	q2q2 = q2 * q2;
+	q2q3 = q2 * q3;
+	q3q3 = q3 * q3;
+
+	// Reference direction of Earth's magnetic field
+	hx = mx * q0q0 - _2q0my * q3 + _2q0mz * q2 + mx * q1q1 + _2q1 * my * q2 + _2q1 * mz * q3 - mx * q2q2 - mx * q3q3;
+	hy = _2q0mx * q3 + my * q0q0 - _2q0mz * q1 + _2q1mx * q2 - my * q1q1 + my * q2q2 + _2q2 * mz * q3 - my * q3q3;
+	_2bx = SQRT(hx * hx + hy * hy);
+	_2bz = -_2q0mx * q2 + _2q0my * q1 + mz * q0q0 + _2q1mx * q3 - mz * q1q1 + _2q2 * my * q3 - mz * q2q2 + mz * q3q3;
+	_4bx = 2.0f * _2bx;
+	_4bz = 2.0f * _2bz;
+
+	// Objective function of the field and its gradient
+	fx = _2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx;
+	fy = _2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my;
+	fz = _2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz;
+	madgwick_feedback(q, bias, dt, beta, zeta,
+		-_2bz * q2 * fx + (-_2bx * q3 + _2bz * q1) * fy + _2bx * q2 * fz,
+		_2bz * q3 * fx + (_2bx * q2 + _2bz * q0) * fy + (_2bx * q3 - _4bz * q1) * fz,
+		(-_4bx * q2 - _2bz * q0) * fx + (_2bx * q1 + _2bz * q3) * fy + (_2bx * q0 - _4bz * q2) * fz,
+		(-_4bx * q3 + _2bz * q1) * fx + (-_2bx * q0 + _2bz * q2) * fy + _2bx * q1 * fz);
+}
+
+//---------------------------------------------------------------------------------------------------
+// Batch loop, `marg` constant per call site. Instantiated with a literal zeta of zero when bias
+// estimation is off and with a NULL calibration, decimator and linear acceleration output for the
+// plain batches, so those specialisations run without the blocks. Returns the quaternions written.
+MA_INLINE size_t madgwick_batch_run(MA_PRECISION* q, MA_PRECISION* bias, MA_PRECISION dt, MA_PRECISION beta, MA_PRECISION zeta, const AHRSCalibration* calibration, AHRSDecimator* decimator, int marg, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions, const AHRSVectorArray* linear, MA_PRECISION gravity)
+{
+	size_t g = 0, a = 0, m = 0, l = 0, written = 0;
+	const size_t factor = decimator != NULL ? decimator->factor : 1;
+	size_t phase = decimator != NULL ? decimator->phase : 0;
+	for(size_t i = 0; i < count; i++, g += gyro.stride, a += accel.stride, m += mag.stride) {
+		MA_PRECISION gx = gyro.x[g], gy = gyro.y[g], gz = gyro.z[g];
+		MA_PRECISION ax = accel.x[a], ay = accel.y[a], az = accel.z[a];
+		MA_PRECISION mx = 0.0f, my = 0.0f, mz = 0.0f;
+		if(marg) {
+			mx = mag.x[m];
+			my = mag.y[m];
+			mz = mag.z[m];
+		}
+		if(calibration != NULL) {
+			ahrs_calibrate(&calibration->gyro, 0, &gx, &gy, &gz);
+			ahrs_calibrate(&calibration->accel, 1, &ax, &ay, &az);
+			if(marg) ahrs_calibrate(&calibration->mag, 1, &mx, &my, &mz);
+		}
+		if(marg) madgwick_step(q, bias, dt, beta, zeta, gx, gy, gz, ax, ay, az, mx, my, mz);
+		else madgwick_imu_step(q, bias, dt, beta, zeta, gx, gy, gz, ax, ay, az);
+		if(linear != NULL) {
+			ahrs_linear_acceleration(q, ax, ay, az, gravity, &linear->x[l], &linear->y[l], &linear->z[l]);
+			l += linear->stride;
+		}
+		if(decimator != NULL) {
+			if(++phase < factor) continue;
+			phase = 0;
+		}
+		if(quaternions != NULL) {
+			quaternions[0] = q[0];
+			quaternions[1] = q[1];
+			quaternions[2] = q[2];
+			quaternions[3] = q[3];
+			quaternions += 4;
+			written++;
+		}
+	}
+	if(decimator != NULL) decimator->phase = phase;
+	return written;
+}
+
+MA_INLINE size_t madgwick_batch(MadgwickAHRS* workspace, const AHRSCalibration* calibration, AHRSDecimator* decimator, int marg, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions, const AHRSVectorArray* linear, MA_PRECISION gravity)
+{
+	const MA_PRECISION dt = 1.0f / workspace->sample_rate;
+	const MA_PRECISION beta = MADGWICK_BETA(workspace);
+	const MA_PRECISION zeta = MADGWICK_ZETA(workspace);
+	MA_PRECISION q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	MA_PRECISION bias[3] = { workspace->bias_x, workspace->bias_y, workspace->bias_z };
+
+	size_t written;
+	if(zeta > 0.0f) written = madgwick_batch_run(q, bias, dt, beta, zeta, calibration, decimator, marg, gyro, accel, mag, count, quaternions, linear, gravity);
+	else written = madgwick_batch_run(q, bias, dt, beta, 0.0f, calibration, decimator, marg, gyro, accel, mag, count, quaternions, linear, gravity);
+
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+	workspace->bias_x = bias[0];
+	workspace->bias_y = bias[1];
+	workspace->bias_z = bias[2];
+
+	workspace->euler_dirty = 1;
+	return written;
+}
+
+//====================================================================================================
+// Functions
+
+//---------------------------------------------------------------------------------------------------
+// IMU algorithm update
+void madgwick_ahrs_update_imu(MadgwickAHRS* workspace, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az)
+{
+	AHRS_STATS_START(start);
+	MA_PRECISION q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	MA_PRECISION bias[3] = { workspace->bias_x, workspace->bias_y, workspace->bias_z };
+	madgwick_imu_step(q, bias, 1.0f / workspace->sample_rate, MADGWICK_BETA(workspace), MADGWICK_ZETA(workspace), gx, gy, gz, ax, ay, az);
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+	workspace->bias_x = bias[0];
+	workspace->bias_y = bias[1];
+	workspace->bias_z = bias[2];
+
+	workspace->euler_dirty = 1;
+	AHRS_STATS_STOP(start, 1);
+}
+
+//---------------------------------------------------------------------------------------------------
+// AHRS algorithm update
+void madgwick_ahrs_update(MadgwickAHRS* workspace, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz)
+{
+	AHRS_STATS_START(start);
+	MA_PRECISION q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	MA_PRECISION bias[3] = { workspace->bias_x, workspace->bias_y, workspace->bias_z };
+	madgwick_step(q, bias, 1.0f / workspace->sample_rate, MADGWICK_BETA(workspace), MADGWICK_ZETA(workspace), gx, gy, gz, ax, ay, az, mx, my, mz);
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+	workspace->bias_x = bias[0];
+	workspace->bias_y = bias[1];
+	workspace->bias_z = bias[2];
+
+	workspace->euler_dirty = 1;
+	AHRS_STATS_STOP(start, 1);
+}
+
+//---------------------------------------------------------------------------------------------------
+// Batched IMU algorithm update
+void madgwick_ahrs_update_imu_batch(MadgwickAHRS* workspace, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions)
+{
+	if(workspace == NULL || count == 0) return;
+	AHRS_STATS_START(start);
+	AHRSSensorArray none = { NULL, NULL, NULL, 0 };
+	madgwick_batch(workspace, NULL, NULL, 0, gyro, accel, none, count, quaternions, NULL, 0.0f);
+	AHRS_STATS_STOP(start, count);
+}
+
+//---------------------------------------------------------------------------------------------------
+// Batched AHRS algorithm update
+void madgwick_ahrs_update_batch(MadgwickAHRS* workspace, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions)
+{
+	if(workspace == NULL || count == 0) return;
+	AHRS_STATS_START(start);
+	madgwick_batch(workspace, NULL, NULL, 1, gyro, accel, mag, count, quaternions, NULL, 0.0f);
+	AHRS_STATS_STOP(start, count);
+}
+
+//---------------------------------------------------------------------------------------------------
+// Batched updates with calibration. The loop reads a local copy of the calibration, which the
+// quaternion stores cannot alias.
+void madgwick_ahrs_update_imu_batch_calibrated(MadgwickAHRS* workspace, const AHRSCalibration* calibration, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions)
+{
+	if(workspace == NULL || count == 0) return;
+	if(calibration == NULL) {
+		madgwick_ahrs_update_imu_batch(workspace, gyro, accel, count, quaternions);
+		return;
+	}
+	AHRS_STATS_START(start);
+	const AHRSCalibration local = *calibration;
+	AHRSSensorArray none = { NULL, NULL, NULL, 0 };
+	madgwick_batch(workspace, &local, NULL, 0, gyro, accel, none, count, quaternions, NULL, 0.0f);
+	AHRS_STATS_STOP(start, count);
+}
+
+void madgwick_ahrs_update_batch_calibrated(MadgwickAHRS* workspace, const AHRSCalibration* calibration, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions)
+{
+	if(workspace == NULL || count == 0) return;
+	if(calibration == NULL) {
+		madgwick_ahrs_update_batch(workspace, gyro, accel, mag, count, quaternions);
+		return;
+	}
+	AHRS_STATS_START(start);
+	const AHRSCalibration local = *calibration;
+	madgwick_batch(workspace, &local, NULL, 1, gyro, accel, mag, count, quaternions, NULL, 0.0f);
+	AHRS_STATS_STOP(start, count);
+}
+
+//---------------------------------------------------------------------------------------------------
+// Decimated batched updates
+size_t madgwick_ahrs_update_imu_batch_decimated(MadgwickAHRS* workspace, AHRSDecimator* decimator, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions)
+{
+	if(workspace == NULL || decimator == NULL || decimator->factor == 0 || count == 0) return 0;
+	AHRS_STATS_START(start);
+	AHRSSensorArray none = { NULL, NULL, NULL, 0 };
+	size_t written = madgwick_batch(workspace, NULL, decimator, 0, gyro, accel, none, count, quaternions, NULL, 0.0f);
+	AHRS_STATS_STOP(start, count);
+	return written;
+}
+
+size_t madgwick_ahrs_update_batch_decimated(MadgwickAHRS* workspace, AHRSDecimator* decimator, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions)
+{
+	if(workspace == NULL || decimator == NULL || decimator->factor == 0 || count == 0) return 0;
+	AHRS_STATS_START(start);
+	size_t written = madgwick_batch(workspace, NULL, decimator, 1, gyro, accel, mag, count, quaternions, NULL, 0.0f);
+	AHRS_STATS_STOP(start, count);
+	return written;
+}
+
+//---------------------------------------------------------------------------------------------------
+// Batched updates with the linear acceleration computed while the quaternion is in registers
+void madgwick_ahrs_update_imu_batch_linear(MadgwickAHRS* workspace, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions, MA_PRECISION gravity, AHRSVectorArray linear)
+{
+	if(workspace == NULL || linear.x == NULL || count == 0) return;
+	AHRS_STATS_START(start);
+	AHRSSensorArray none = { NULL, NULL, NULL, 0 };
+	madgwick_batch(workspace, NULL, NULL, 0, gyro, accel, none, count, quaternions, &linear, gravity);
+	AHRS_STATS_STOP(start, count);
+}
+
+void madgwick_ahrs_update_batch_linear(MadgwickAHRS* workspace, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions, MA_PRECISION gravity, AHRSVectorArray linear)
+{
+	if(workspace == NULL || linear.x == NULL || count == 0) return;
+	AHRS_STATS_START(start);
+	madgwick_batch(workspace, NULL, NULL, 1, gyro, accel, mag, count, quaternions, &linear, gravity);
+	AHRS_STATS_STOP(start, count);
+}
+
+//====================================================================================================
+// Per-sample dt updates
+
+static MA_PRECISION madgwick_max_dt(const MadgwickAHRS* workspace){
+	return workspace->max_dt > 0.0f ? workspace->max_dt : AHRS_GAP_PERIODS / workspace->sample_rate;
+}
+
+//---------------------------------------------------------------------------------------------------
+// IMU algorithm update over dt
+void madgwick_ahrs_update_imu_dt(MadgwickAHRS* workspace, MA_PRECISION dt, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az)
+{
+	if(workspace == NULL || !(dt > 0.0f)) return;
+	AHRS_STATS_START(start);
+	MA_PRECISION q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	MA_PRECISION bias[3] = { workspace->bias_x, workspace->bias_y, workspace->bias_z };
+	const MA_PRECISION max_dt = madgwick_max_dt(workspace);
+	AHRS_STAT_IF(dt > max_dt, AHRS_STAT_GAP);
+	if(ahrs_gap_propagate_only(&dt, max_dt, workspace->gap_policy)) ahrs_gyro_propagate(q, dt, gx - bias[0], gy - bias[1], gz - bias[2]);
+	else madgwick_imu_step(q, bias, dt, MADGWICK_BETA(workspace), MADGWICK_ZETA(workspace), gx, gy, gz, ax, ay, az);
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+	workspace->bias_x = bias[0];
+	workspace->bias_y = bias[1];
+	workspace->bias_z = bias[2];
+
+	workspace->euler_dirty = 1;
+	AHRS_STATS_STOP(start, 1);
+}
+
+//---------------------------------------------------------------------------------------------------
+// AHRS algorithm update over dt
+void madgwick_ahrs_update_dt(MadgwickAHRS* workspace, MA_PRECISION dt, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz)
+{
+	if(workspace == NULL || !(dt > 0.0f)) return;
+	AHRS_STATS_START(start);
+	MA_PRECISION q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	MA_PRECISION bias[3] = { workspace->bias_x, workspace->bias_y, workspace->bias_z };
+	const MA_PRECISION max_dt = madgwick_max_dt(workspace);
+	AHRS_STAT_IF(dt > max_dt, AHRS_STAT_GAP);
+	if(ahrs_gap_propagate_only(&dt, max_dt, workspace->gap_policy)) ahrs_gyro_propagate(q, dt, gx - bias[0], gy - bias[1], gz - bias[2]);
+	else madgwick_step(q, bias, dt, MADGWICK_BETA(workspace), MADGWICK_ZETA(workspace), gx, gy, gz, ax, ay, az, mx, my, mz);
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+	workspace->bias_x = bias[0];
+	workspace->bias_y = bias[1];
+	workspace->bias_z = bias[2];
+
+	workspace->euler_dirty = 1;
+	AHRS_STATS_STOP(start, 1);
+}
+
+//---------------------------------------------------------------------------------------------------
+// Batched timestamped update, `marg` constant per call site so the unused branch folds away, and a
+// literal NULL decimator for the plain batches. Intervals are integer differences scaled by 1e-9: no
+// division per sample. Returns the quaternions written.
+MA_INLINE size_t madgwick_timestamped_run(MadgwickAHRS* workspace, AHRSDecimator* decimator, const uint64_t* timestamps, size_t timestamp_stride, int marg, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions, uint64_t* output_timestamps)
+{
+	const MA_PRECISION beta = MADGWICK_BETA(workspace);
+	const MA_PRECISION zeta = MADGWICK_ZETA(workspace);
+	const MA_PRECISION max_dt = madgwick_max_dt(workspace);
+	const int policy = workspace->gap_policy;
+	MA_PRECISION q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	MA_PRECISION bias[3] = { workspace->bias_x, workspace->bias_y, workspace->bias_z };
+	uint64_t previous = workspace->has_timestamp ? workspace->timestamp : timestamps[0] - (uint64_t)(1e9 / workspace->sample_rate);
+	size_t t = 0, g = 0, a = 0, m = 0, written = 0;
+	uint64_t next = 0;
+	if(decimator != NULL) next = ahrs_decimator_start(decimator, timestamps[0]);
+
+	for(size_t i = 0; i < count; i++, t += timestamp_stride, g += gyro.stride, a += accel.stride, m += mag.stride) {
+		int64_t delta = (int64_t)(timestamps[t] - previous);
+		AHRS_STAT_IF(delta <= 0, AHRS_STAT_STALE_TIMESTAMP);
+		if(delta > 0) {
+			const MA_PRECISION before[4] = { q[0], q[1], q[2], q[3] };
+			const uint64_t before_time = previous;
+			previous = timestamps[t];
+			MA_PRECISION dt = (MA_PRECISION) delta * (MA_PRECISION) 1e-9;
+			AHRS_STAT_IF(dt > max_dt, AHRS_STAT_GAP);
+			if(ahrs_gap_propagate_only(&dt, max_dt, policy)) ahrs_gyro_propagate(q, dt, gyro.x[g] - bias[0], gyro.y[g] - bias[1], gyro.z[g] - bias[2]);
+			else if(marg) madgwick_step(q, bias, dt, beta, zeta, gyro.x[g], gyro.y[g], gyro.z[g], accel.x[a], accel.y[a], accel.z[a], mag.x[m], mag.y[m], mag.z[m]);
+			else madgwick_imu_step(q, bias, dt, beta, zeta, gyro.x[g], gyro.y[g], gyro.z[g], accel.x[a], accel.y[a], accel.z[a]);
+			if(decimator != NULL) {
+				for(; next < previous; next += decimator->period) {
+					ahrs_decimator_output(decimator, next, before, before_time, q, delta, quaternions, output_timestamps, written);
+					written++;
+				}
+			}
+		}
+		if(decimator != NULL) continue;
+		if(quaternions != NULL) {
+			quaternions[0] = q[0];
+			quaternions[1] = q[1];
+			quaternions[2] = q[2];
+			quaternions[3] = q[3];
+			quaternions += 4;
+		}
+	}
+
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+	workspace->bias_x = bias[0];
+	workspace->bias_y = bias[1];
+	workspace->bias_z = bias[2];
+	workspace->timestamp = previous;
+	workspace->has_timestamp = 1;
+	if(decimator != NULL) decimator->next = next;
+
+	workspace->euler_dirty = 1;
+	return written;
+}
+
+void madgwick_ahrs_update_imu_batch_timestamped(MadgwickAHRS* workspace, const uint64_t* timestamps, size_t timestamp_stride, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions)
+{
+	if(workspace == NULL || timestamps == NULL || count == 0) return;
+	AHRS_STATS_START(start);
+	AHRSSensorArray none = { NULL, NULL, NULL, 0 };
+	madgwick_timestamped_run(workspace, NULL, timestamps, timestamp_stride, 0, gyro, accel, none, count, quaternions, NULL);
+	AHRS_STATS_STOP(start, count);
+}
+
+void madgwick_ahrs_update_batch_timestamped(MadgwickAHRS* workspace, const uint64_t* timestamps, size_t timestamp_stride, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions)
+{
+	if(workspace == NULL || timestamps == NULL || count == 0) return;
+	AHRS_STATS_START(start);
+	madgwick_timestamped_run(workspace, NULL, timestamps, timestamp_stride, 1, gyro, accel, mag, count, quaternions, NULL);
+	AHRS_STATS_STOP(start, count);
+}
+
+size_t madgwick_ahrs_update_imu_batch_timestamped_decimated(MadgwickAHRS* workspace, AHRSDecimator* decimator, const uint64_t* timestamps, size_t timestamp_stride, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions, uint64_t* output_timestamps)
+{
+	if(workspace == NULL || decimator == NULL || decimator->period == 0 || timestamps == NULL || count == 0) return 0;
+	AHRS_STATS_START(start);
+	AHRSSensorArray none = { NULL, NULL, NULL, 0 };
+	size_t written = madgwick_timestamped_run(workspace, decimator, timestamps, timestamp_stride, 0, gyro, accel, none, count, quaternions, output_timestamps);
+	AHRS_STATS_STOP(start, count);
+	return written;
+}
+
+size_t madgwick_ahrs_update_batch_timestamped_decimated(MadgwickAHRS* workspace, AHRSDecimator* decimator, const uint64_t* timestamps, size_t timestamp_stride, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions, uint64_t* output_timestamps)
+{
+	if(workspace == NULL || decimator == NULL || decimator->period == 0 || timestamps == NULL || count == 0) return 0;
+	AHRS_STATS_START(start);
+	size_t written = madgwick_timestamped_run(workspace, decimator, timestamps, timestamp_stride, 1, gyro, accel, mag, count, quaternions, output_timestamps);
+	AHRS_STATS_STOP(start, count);
+	return written;
+}
+
+//====================================================================================================
+// Multi-rate updates
+
+void madgwick_ahrs_predict(MadgwickAHRS* workspace, MA_PRECISION dt, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz)
+{
+	if(workspace == NULL || !(dt > 0.0f)) return;
+	AHRS_STATS_START(start);
+	MA_PRECISION q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	const MA_PRECISION bias[3] = { workspace->bias_x, workspace->bias_y, workspace->bias_z };
+	const MA_PRECISION max_dt = madgwick_max_dt(workspace);
+	AHRS_STAT_IF(dt > max_dt, AHRS_STAT_GAP);
+	if(ahrs_gap_propagate_only(&dt, max_dt, workspace->gap_policy)) ahrs_gyro_propagate(q, dt, gx - bias[0], gy - bias[1], gz - bias[2]);
+	else madgwick_predict(q, bias, dt, gx, gy, gz);
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+
+	workspace->euler_dirty = 1;
+	AHRS_STATS_STOP(start, 1);
+}
+
+void madgwick_ahrs_correct_accel(MadgwickAHRS* workspace, MA_PRECISION dt, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az)
+{
+	if(workspace == NULL || !(dt > 0.0f)) return;
+	AHRS_STATS_START(start);
+	MA_PRECISION q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	MA_PRECISION bias[3] = { workspace->bias_x, workspace->bias_y, workspace->bias_z };
+	madgwick_correct_accel(q, bias, dt < AHRS_CORRECTION_MAX_DT ? dt : AHRS_CORRECTION_MAX_DT, MADGWICK_BETA(workspace), MADGWICK_ZETA(workspace), ax, ay, az);
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+	workspace->bias_x = bias[0];
+	workspace->bias_y = bias[1];
+	workspace->bias_z = bias[2];
+
+	workspace->euler_dirty = 1;
+	AHRS_STATS_STOP(start, 1);
+}
+
+void madgwick_ahrs_correct_mag(MadgwickAHRS* workspace, MA_PRECISION dt, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz)
+{
+	if(workspace == NULL || !(dt > 0.0f)) return;
+	AHRS_STATS_START(start);
+	MA_PRECISION q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	MA_PRECISION bias[3] = { workspace->bias_x, workspace->bias_y, workspace->bias_z };
+	madgwick_correct_mag(q, bias, dt < AHRS_CORRECTION_MAX_DT ? dt : AHRS_CORRECTION_MAX_DT, MADGWICK_BETA(workspace), MADGWICK_ZETA(workspace), mx, my, mz);
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+	workspace->bias_x = bias[0];
+	workspace->bias_y = bias[1];
+	workspace->bias_z = bias[2];
+
+	workspace->euler_dirty = 1;
+	AHRS_STATS_STOP(start, 1);
+}
+
+void madgwick_ahrs_update_events(MadgwickAHRS* workspace, const AHRSSensorEvent* events, size_t count, MA_PRECISION* quaternions)
+{
+	if(workspace == NULL || events == NULL || count == 0) return;
+	AHRS_STATS_START(start);
+	const MA_PRECISION beta = MADGWICK_BETA(workspace);
+	const MA_PRECISION zeta = MADGWICK_ZETA(workspace);
+	const MA_PRECISION max_dt = madgwick_max_dt(workspace);
+	const int policy = workspace->gap_policy;
+	MA_PRECISION q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	MA_PRECISION bias[3] = { workspace->bias_x, workspace->bias_y, workspace->bias_z };
+	const uint64_t period = (uint64_t)(1e9 / workspace->sample_rate);
+	uint64_t previous = workspace->timestamp;
+	int has_timestamp = workspace->has_timestamp;
+	uint64_t accel_timestamp = workspace->accel_timestamp, mag_timestamp = workspace->mag_timestamp;
+	int has_accel_timestamp = workspace->has_accel_timestamp, has_mag_timestamp = workspace->has_mag_timestamp;
+
+	for(size_t i = 0; i < count; i++) {
+		const AHRSSensorEvent* e = &events[i];
+		if(e->sensor == AHRS_SENSOR_GYRO) {
+			if(!has_timestamp) {
+				previous = e->timestamp - period;
+				has_timestamp = 1;
+			}
+			int64_t delta = (int64_t)(e->timestamp - previous);
+			AHRS_STAT_IF(delta <= 0, AHRS_STAT_STALE_TIMESTAMP);
+			if(delta > 0) {
+				previous = e->timestamp;
+				MA_PRECISION dt = (MA_PRECISION) delta * (MA_PRECISION) 1e-9;
+				AHRS_STAT_IF(dt > max_dt, AHRS_STAT_GAP);
+				if(ahrs_gap_propagate_only(&dt, max_dt, policy)) ahrs_gyro_propagate(q, dt, e->x - bias[0], e->y - bias[1], e->z - bias[2]);
+				else madgwick_predict(q, bias, dt, e->x, e->y, e->z);
+			}
+		} else if(e->sensor == AHRS_SENSOR_ACCEL) {
+			MA_PRECISION dt = ahrs_correction_dt(&accel_timestamp, &has_accel_timestamp, e->timestamp);
+			if(dt > 0.0f) madgwick_correct_accel(q, bias, dt, beta, zeta, e->x, e->y, e->z);
+		} else if(e->sensor == AHRS_SENSOR_MAG) {
+			MA_PRECISION dt = ahrs_correction_dt(&mag_timestamp, &has_mag_timestamp, e->timestamp);
+			if(dt > 0.0f) madgwick_correct_mag(q, bias, dt, beta, zeta, e->x, e->y, e->z);
+		}
+		if(quaternions != NULL) {
+			quaternions[0] = q[0];
+			quaternions[1] = q[1];
+			quaternions[2] = q[2];
+			quaternions[3] = q[3];
+			quaternions += 4;
+		}
+	}
+
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+	workspace->bias_x = bias[0];
+	workspace->bias_y = bias[1];
+	workspace->bias_z = bias[2];
+	workspace->timestamp = previous;
+	workspace->has_timestamp = has_timestamp;
+	workspace->accel_timestamp = accel_timestamp;
+	workspace->mag_timestamp = mag_timestamp;
+	workspace->has_accel_timestamp = has_accel_timestamp;
+	workspace->has_mag_timestamp = has_mag_timestamp;
+
+	workspace->euler_dirty = 1;
+	AHRS_STATS_STOP(start, count);
+}
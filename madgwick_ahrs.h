@@ -17,31 +17,153 @@
 
 #include "arhs.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct {
     MA_PRECISION sample_rate;
+    MA_PRECISION beta;  // gradient descent step gain, BETA unless changed with madgwick_ahrs_set_gain
+    MA_PRECISION zeta;  // gyro bias drift gain, ZETA unless changed with madgwick_ahrs_set_bias_gain
     MA_PRECISION q0;
     MA_PRECISION q1;
     MA_PRECISION q2;
     MA_PRECISION q3;
+    // Gyro bias estimate in rad/s, subtracted from every gyro sample
+    MA_PRECISION bias_x;
+    MA_PRECISION bias_y;
+    MA_PRECISION bias_z;
+
+    // Per-sample dt updates, see AHRS_GAP_* in arhs.h
+    MA_PRECISION max_dt;    // longest interval integrated normally, 0: AHRS_GAP_PERIODS sample periods
+    int gap_policy;         // AHRS_GAP_PROPAGATE unless changed with madgwick_ahrs_set_gap_policy
+    int has_timestamp;      // timestamp is the last sample of a timestamped update
+    uint64_t timestamp;     // ns
+    uint64_t accel_timestamp;   // ns of the last accelerometer / magnetometer event
+    uint64_t mag_timestamp;
+    int has_accel_timestamp;    // accel_timestamp / mag_timestamp are set
+    int has_mag_timestamp;
     
-    // Result variables
+    // Result variables, computed on demand by madgwick_ahrs_get_euler
     MA_PRECISION yaw;
     MA_PRECISION pitch;
     MA_PRECISION roll;
+    int euler_dirty;    // quaternion changed since yaw/pitch/roll were last computed
 } MadgwickAHRS;
 //----------------------------------------------------------------------------------------------------
 // Variable declaration
-#define BETA 0.033f   // 2 * proportional gain
+#define BETA 0.033f   // 2 * proportional gain, default of MadgwickAHRS.beta
+#define ZETA 0.0f     // gyro bias drift gain, default of MadgwickAHRS.zeta: no bias estimation
 
-MadgwickAHRS* create_madgwick_ahrs(MA_PRECISION sample_rate);
+MadgwickAHRS* create_madgwick_ahrs(MA_PRECISION sample_rate); // NULL for sample_rate <= 0 or out of memory
 void free_madgwick_ahrs(MadgwickAHRS* workspace);
 
+// Initialises a workspace the caller allocated (e.g. a pool slot) as create_madgwick_ahrs does.
+// Returns 0, or -1 for sample_rate <= 0.
+int madgwick_ahrs_init(MadgwickAHRS* workspace, MA_PRECISION sample_rate);
+
 //---------------------------------------------------------------------------------------------------
 // Function declarations
 void madgwick_ahrs_update_sample_rate(MadgwickAHRS* workspace, MA_PRECISION sample_rate);
 
+// Changes the gain of this filter without resetting its state, e.g. a high beta while converging and
+// a low one in steady state. Ignored by the kernels when built with MA_FIXED_GAINS.
+void madgwick_ahrs_set_gain(MadgwickAHRS* workspace, MA_PRECISION beta);
+
+// Online gyro bias estimation: every step with a valid accelerometer sample integrates the gyro error
+// of the unnormalised gradient, 2 q* (x) grad f, by `zeta` into bias_x .. bias_z. 0 freezes the
+// estimate. Ignored by the kernels when built with MA_FIXED_GAINS (ZETA).
+void madgwick_ahrs_set_bias_gain(MadgwickAHRS* workspace, MA_PRECISION zeta);
+
+// Gap handling of the per-sample dt updates: intervals longer than `max_dt` seconds (0: AHRS_GAP_PERIODS
+// sample periods) are handled by `policy`, see AHRS_GAP_* in arhs.h. Keeps the state.
+void madgwick_ahrs_set_gap_policy(MadgwickAHRS* workspace, int policy, MA_PRECISION max_dt);
+
+// Euler angles of the current quaternion. The updates only maintain the quaternion, the angles are
+// computed here when it changed since the last call. Any of the output pointers may be NULL.
+void madgwick_ahrs_get_euler(MadgwickAHRS* workspace, MA_PRECISION* yaw, MA_PRECISION* pitch, MA_PRECISION* roll);
+
 void madgwick_ahrs_update_imu(MadgwickAHRS* workspace, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az);
 
 void madgwick_ahrs_update(MadgwickAHRS* workspace, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz);
 
+//---------------------------------------------------------------------------------------------------
+// Batched updates: run `count` consecutive samples through the filter in one call.
+// Equivalent to calling the per-sample update in a loop. When `quaternions` is not NULL it receives
+// q0, q1, q2, q3 of every sample (4 * count elements).
+void madgwick_ahrs_update_imu_batch(MadgwickAHRS* workspace, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions);
+
+void madgwick_ahrs_update_batch(MadgwickAHRS* workspace, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions);
+
+// Batched updates with the sensor calibration (arhs.h) applied to every sample inside the loop, in
+// one pass over the raw samples. NULL `calibration`: as the plain batch updates.
+void madgwick_ahrs_update_imu_batch_calibrated(MadgwickAHRS* workspace, const AHRSCalibration* calibration, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions);
+
+void madgwick_ahrs_update_batch_calibrated(MadgwickAHRS* workspace, const AHRSCalibration* calibration, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions);
+
+// Decimated batched updates (AHRSDecimator, arhs.h): every sample goes through the filter, but only
+// every decimator->factor-th quaternion is written to `quaternions`. Returns the quaternions written,
+// at most ahrs_decimator_outputs(decimator, count, 0, 0).
+size_t madgwick_ahrs_update_imu_batch_decimated(MadgwickAHRS* workspace, AHRSDecimator* decimator, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions);
+
+size_t madgwick_ahrs_update_batch_decimated(MadgwickAHRS* workspace, AHRSDecimator* decimator, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions);
+
+// Batched updates that also write the earth frame linear acceleration of every sample to `linear`,
+// ahrs_linear_acceleration (arhs.h) of the updated quaternion, without the quaternion making a trip
+// through memory; `quaternions` may be NULL. `gravity` is 1 for samples in g, 9.80665 in m/s^2.
+// For quaternions already written, ahrs_quaternion.h has the same kernel over arrays.
+void madgwick_ahrs_update_imu_batch_linear(MadgwickAHRS* workspace, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions, MA_PRECISION gravity, AHRSVectorArray linear);
+
+void madgwick_ahrs_update_batch_linear(MadgwickAHRS* workspace, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions, MA_PRECISION gravity, AHRSVectorArray linear);
+
+//---------------------------------------------------------------------------------------------------
+// Per-sample dt updates, for jittery or dropped samples: each sample is integrated over its own
+// interval instead of 1 / sample_rate, with the gap policy for long ones, and nothing is reset.
+// sample_rate only sets the default max_dt and the interval of the first timestamped sample.
+
+// `dt`: seconds since the previous sample
+void madgwick_ahrs_update_imu_dt(MadgwickAHRS* workspace, MA_PRECISION dt, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az);
+
+void madgwick_ahrs_update_dt(MadgwickAHRS* workspace, MA_PRECISION dt, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz);
+
+// Batched updates with a timestamp in ns per sample, timestamps[i * timestamp_stride] (the stride
+// counts uint64_t elements, e.g. sizeof(record) / 8 for timestamps inside records). Intervals are
+// differences to the previous sample, across calls too; as the batch updates otherwise.
+void madgwick_ahrs_update_imu_batch_timestamped(MadgwickAHRS* workspace, const uint64_t* timestamps, size_t timestamp_stride, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions);
+
+void madgwick_ahrs_update_batch_timestamped(MadgwickAHRS* workspace, const uint64_t* timestamps, size_t timestamp_stride, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions);
+
+// Decimated timestamped updates: the quaternions at the output times of a period decimator (arhs.h),
+// with their times in `output_timestamps` unless NULL. Returns the quaternions written, at most
+// ahrs_decimator_outputs(decimator, count, first timestamp, last timestamp).
+size_t madgwick_ahrs_update_imu_batch_timestamped_decimated(MadgwickAHRS* workspace, AHRSDecimator* decimator, const uint64_t* timestamps, size_t timestamp_stride, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions, uint64_t* output_timestamps);
+
+size_t madgwick_ahrs_update_batch_timestamped_decimated(MadgwickAHRS* workspace, AHRSDecimator* decimator, const uint64_t* timestamps, size_t timestamp_stride, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions, uint64_t* output_timestamps);
+
+//---------------------------------------------------------------------------------------------------
+// Multi-rate updates, for sensors sampled at different rates (e.g. gyro 1 kHz, accelerometer 200 Hz,
+// magnetometer 50 Hz): the gyro propagates the quaternion at its rate and each accelerometer or
+// magnetometer sample corrects it through its own half of the gradient. Each correction is
+// normalised on its own and applied with beta over `dt`, the interval since the previous sample of
+// its sensor (at most AHRS_CORRECTION_MAX_DT), so the feedback per second does not depend on the
+// rates. Zero accelerometer / magnetometer samples are ignored, dt <= 0 does nothing.
+
+// Gyro-only step over dt seconds, with the gap policy for long intervals
+void madgwick_ahrs_predict(MadgwickAHRS* workspace, MA_PRECISION dt, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz);
+
+void madgwick_ahrs_correct_accel(MadgwickAHRS* workspace, MA_PRECISION dt, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az);
+
+void madgwick_ahrs_correct_mag(MadgwickAHRS* workspace, MA_PRECISION dt, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz);
+
+// Runs `count` sensor events (arhs.h) in timestamp order: gyro events predict over the interval since
+// the previous gyro sample (shared with the timestamped updates), accelerometer and magnetometer events
+// correct over the interval since the previous sample of their sensor; the first sample of each only
+// sets its time. Stale events are dropped. When `quaternions` is not NULL it receives the quaternion
+// after every event (4 * count elements).
+void madgwick_ahrs_update_events(MadgwickAHRS* workspace, const AHRSSensorEvent* events, size_t count, MA_PRECISION* quaternions);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* __MADGWICK_AHRS_H__ */
\ No newline at end of file
@@ -0,0 +1,93 @@
+//=====================================================================================================
+// madgwick_ahrs_bank.c
+//=====================================================================================================
+//
+// Structure-of-arrays bank of Madgwick filters, see madgwick_ahrs_bank.h.
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "madgwick_ahrs_bank.h"
+#include "ahrs_simd.h"
+#include <stdlib.h>
+
+//---------------------------------------------------------------------------------------------------
+// Variable definitions
+static void madgwick_bank_reset(MadgwickAHRSBank* bank, size_t index, MA_PRECISION sample_rate){
+	bank->sample_rate[index] = sample_rate;
+	bank->sample_period[index] = 1.0f / sample_rate;
+	// quaternion of sensor frame relative to auxiliary frame
+	bank->q0[index] = 1.0f;
+	bank->q1[index] = 0.0f;
+	bank->q2[index] = 0.0f;
+	bank->q3[index] = 0.0f;
+}
+
+MadgwickAHRSBank* create_madgwick_ahrs_bank(size_t count, MA_PRECISION sample_rate){
+	if(count == 0 || sample_rate <= 0) return NULL;
+	MadgwickAHRSBank* bank = (MadgwickAHRSBank *) malloc(sizeof(MadgwickAHRSBank));
+	if(bank == NULL) return NULL;
+	bank->count = count;
+	bank->capacity = (count + AHRS_BANK_PADDING - 1) / AHRS_BANK_PADDING * AHRS_BANK_PADDING;
+
+	// One aligned block, carved into the state arrays
+	MA_PRECISION* memory = (MA_PRECISION *) ahrs_aligned_alloc(AHRS_BANK_ALIGNMENT, 7 * bank->capacity * sizeof(MA_PRECISION));
+	if(memory == NULL) {
+		free(bank);
+		return NULL;
+	}
+	bank->sample_rate = memory;
+	bank->sample_period = memory + 1 * bank->capacity;
+	bank->q0 = memory + 2 * bank->capacity;
+	bank->q1 = memory + 3 * bank->capacity;
+	bank->q2 = memory + 4 * bank->capacity;
+	bank->q3 = memory + 5 * bank->capacity;
+	bank->beta = memory + 6 * bank->capacity;
+
+	// Padding lanes are initialised too: they run through the kernel with zero samples
+	for(size_t i = 0; i < bank->capacity; i++) {
+		madgwick_bank_reset(bank, i, sample_rate);
+		bank->beta[i] = BETA;
+	}
+	return bank;
+}
+
+void madgwick_ahrs_bank_update_sample_rate(MadgwickAHRSBank* bank, size_t index, MA_PRECISION sample_rate){
+	if(bank == NULL || index >= bank->count) return;
+	if(sample_rate <= 0) return;
+	if(sample_rate != bank->sample_rate[index]) {// Reset the parameters when sample rates are different;
+		madgwick_bank_reset(bank, index, sample_rate);
+	}
+}
+
+void madgwick_ahrs_bank_set_gain(MadgwickAHRSBank* bank, size_t index, MA_PRECISION beta){
+	if(bank == NULL || index >= bank->count) return;
+	if(beta < 0) return;
+	bank->beta[index] = beta;
+}
+
+void madgwick_ahrs_bank_reset(MadgwickAHRSBank* bank, size_t index, MA_PRECISION sample_rate){
+	if(bank == NULL || index >= bank->capacity) return;
+	if(sample_rate <= 0) return;
+	madgwick_bank_reset(bank, index, sample_rate);
+	bank->beta[index] = BETA;
+}
+
+void madgwick_ahrs_bank_move(MadgwickAHRSBank* bank, size_t from, size_t to){
+	if(bank == NULL || from >= bank->capacity || to >= bank->capacity) return;
+	bank->sample_rate[to] = bank->sample_rate[from];
+	bank->sample_period[to] = bank->sample_period[from];
+	bank->q0[to] = bank->q0[from];
+	bank->q1[to] = bank->q1[from];
+	bank->q2[to] = bank->q2[from];
+	bank->q3[to] = bank->q3[from];
+	bank->beta[to] = bank->beta[from];
+}
+
+void free_madgwick_ahrs_bank(MadgwickAHRSBank* bank){
+	if(bank == NULL) return;
+	ahrs_aligned_free(bank->sample_rate);
+	free(bank);
+}
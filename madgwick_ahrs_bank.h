@@ -0,0 +1,73 @@
+//=====================================================================================================
+// madgwick_ahrs_bank.h
+//=====================================================================================================
+//
+// Bank of independent Madgwick filters stored as structure-of-arrays and stepped in lockstep,
+// ahrs_bank_lanes() filters per instruction (see ahrs_dispatch.h).
+//
+// Each update advances every filter by one sample: element i of each input array belongs to filter i.
+// The invalid accelerometer / magnetometer branches of madgwick_ahrs_update become per-lane masks.
+// The bank normalises with ahrs_vec_rsqrt (AHRS_RSQRT); quaternions stay within
+// MADGWICK_AHRS_BANK_TOLERANCE of madgwick_ahrs_update fed with the same samples
+// (measured by bench/bank_bench.c).
+//
+//=====================================================================================================
+#ifndef __MADGWICK_AHRS_BANK_H__
+#define __MADGWICK_AHRS_BANK_H__
+
+#include "madgwick_ahrs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Largest per-component quaternion difference against the scalar filter. With the exact backend
+// only the rounding of the vector code differs (about 2e-6 in float, 1e-14 in double), so a lane
+// masking or tail error shows; the refined hardware estimate measures up to about 2e-5 and the magic
+// one about 3e-3, which the loose bound covers.
+#if AHRS_RSQRT == AHRS_RSQRT_EXACT
+#define MADGWICK_AHRS_BANK_TOLERANCE 1e-5f
+#else
+#define MADGWICK_AHRS_BANK_TOLERANCE 5e-3f
+#endif
+
+typedef struct {
+    size_t count;       // number of filters; a pool (ahrs_pool.h) moves it within 0 .. capacity
+    size_t capacity;    // count padded to AHRS_BANK_PADDING lanes
+    MA_PRECISION* sample_rate;
+    MA_PRECISION* sample_period; // 1 / sample_rate, kept in sync by the bank functions
+    MA_PRECISION* q0;
+    MA_PRECISION* q1;
+    MA_PRECISION* q2;
+    MA_PRECISION* q3;
+    MA_PRECISION* beta;         // per-filter gain, BETA unless changed with madgwick_ahrs_bank_set_gain
+} MadgwickAHRSBank;
+
+MadgwickAHRSBank* create_madgwick_ahrs_bank(size_t count, MA_PRECISION sample_rate);
+void free_madgwick_ahrs_bank(MadgwickAHRSBank* bank);
+
+//---------------------------------------------------------------------------------------------------
+// Function declarations
+
+// Same semantics as madgwick_ahrs_update_sample_rate, for filter `index`
+void madgwick_ahrs_bank_update_sample_rate(MadgwickAHRSBank* bank, size_t index, MA_PRECISION sample_rate);
+
+// Same semantics as madgwick_ahrs_set_gain, for filter `index`
+void madgwick_ahrs_bank_set_gain(MadgwickAHRSBank* bank, size_t index, MA_PRECISION beta);
+
+// Resets filter `index` (< capacity) to a new filter at `sample_rate`, default gains included
+void madgwick_ahrs_bank_reset(MadgwickAHRSBank* bank, size_t index, MA_PRECISION sample_rate);
+
+// Copies the state of filter `from` over filter `to` (both < capacity), e.g. to keep the live
+// filters of a pool in lanes 0 .. count - 1
+void madgwick_ahrs_bank_move(MadgwickAHRSBank* bank, size_t from, size_t to);
+
+void madgwick_ahrs_bank_update_imu(MadgwickAHRSBank* bank, const MA_PRECISION* gx, const MA_PRECISION* gy, const MA_PRECISION* gz, const MA_PRECISION* ax, const MA_PRECISION* ay, const MA_PRECISION* az);
+
+void madgwick_ahrs_bank_update(MadgwickAHRSBank* bank, const MA_PRECISION* gx, const MA_PRECISION* gy, const MA_PRECISION* gz, const MA_PRECISION* ax, const MA_PRECISION* ay, const MA_PRECISION* az, const MA_PRECISION* mx, const MA_PRECISION* my, const MA_PRECISION* mz);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MADGWICK_AHRS_BANK_H__ */
@@ -0,0 +1,208 @@
+//=====================================================================================================
+// madgwick_ahrs_bank_kernel.c
+//=====================================================================================================
+//
+// Update kernels of the Madgwick filter bank, see madgwick_ahrs_bank.h. With runtime dispatch this file
+// is compiled once per instruction set and ahrs_dispatch.c picks the variant (see ahrs_simd.h).
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "madgwick_ahrs_bank.h"
+#include "ahrs_simd.h"
+#include "ahrs_stats.h"
+
+#define MADGWICK_BANK_INPUTS 9 // gx gy gz ax ay az mx my mz
+
+// Gains of the AHRS_SIMD_WIDTH filters at `index`; BETA in every lane with MA_FIXED_GAINS
+#if MA_FIXED_GAINS
+#define MADGWICK_BANK_BETA(BANK, INDEX) ahrs_vec_set1(BETA)
+#else
+#define MADGWICK_BANK_BETA(BANK, INDEX) ahrs_vec_load((BANK)->beta + (INDEX))
+#endif
+
+//====================================================================================================
+// Filter kernel
+//
+// Steps the AHRS_SIMD_WIDTH filters starting at `index`, reading their samples from in[k] + offset.
+// Mirrors madgwick_step / madgwick_imu_step in madgwick_ahrs.c; `marg` is a compile-time constant
+// at every call site.
+
+static inline void madgwick_bank_step(MadgwickAHRSBank* bank, size_t index, const MA_PRECISION* const* in, size_t offset, int marg)
+{
+	const ahrs_vec zero = ahrs_vec_set1(0.0f);
+	const ahrs_vec one = ahrs_vec_set1(1.0f);
+	const ahrs_vec half = ahrs_vec_set1(0.5f);
+	const ahrs_vec two = ahrs_vec_set1(2.0f);
+	const ahrs_vec four = ahrs_vec_set1(4.0f);
+	ahrs_vec q0 = ahrs_vec_load(bank->q0 + index);
+	ahrs_vec q1 = ahrs_vec_load(bank->q1 + index);
+	ahrs_vec q2 = ahrs_vec_load(bank->q2 + index);
+	ahrs_vec q3 = ahrs_vec_load(bank->q3 + index);
+	ahrs_vec dt = ahrs_vec_load(bank->sample_period + index);
+	ahrs_vec gx = ahrs_vec_loadu(in[0] + offset);
+	ahrs_vec gy = ahrs_vec_loadu(in[1] + offset);
+	ahrs_vec gz = ahrs_vec_loadu(in[2] + offset);
+	ahrs_vec ax = ahrs_vec_loadu(in[3] + offset);
+	ahrs_vec ay = ahrs_vec_loadu(in[4] + offset);
+	ahrs_vec az = ahrs_vec_loadu(in[5] + offset);
+	ahrs_vec recipNorm;
+	ahrs_vec s0, s1, s2, s3;
+	ahrs_vec qDot1, qDot2, qDot3, qDot4;
+
+	// Rate of change of quaternion from gyroscope
+	qDot1 = ahrs_vec_mul(half, ahrs_vec_sub(ahrs_vec_sub(ahrs_vec_mul(ahrs_vec_sub(zero, q1), gx), ahrs_vec_mul(q2, gy)), ahrs_vec_mul(q3, gz)));
+	qDot2 = ahrs_vec_mul(half, ahrs_vec_sub(ahrs_vec_add(ahrs_vec_mul(q0, gx), ahrs_vec_mul(q2, gz)), ahrs_vec_mul(q3, gy)));
+	qDot3 = ahrs_vec_mul(half, ahrs_vec_add(ahrs_vec_sub(ahrs_vec_mul(q0, gy), ahrs_vec_mul(q1, gz)), ahrs_vec_mul(q3, gx)));
+	qDot4 = ahrs_vec_mul(half, ahrs_vec_sub(ahrs_vec_add(ahrs_vec_mul(q0, gz), ahrs_vec_mul(q1, gy)), ahrs_vec_mul(q2, gx)));
+
+	// Lanes with an all-zero accelerometer sample get no feedback (avoids NaN in accelerometer normalisation)
+	ahrs_mask accel_invalid = ahrs_vec_all_zero3(ax, ay, az);
+
+	// Normalise accelerometer measurement
+	recipNorm = ahrs_vec_rsqrt(ahrs_vec_select(accel_invalid, one, ahrs_vec_add(ahrs_vec_add(ahrs_vec_mul(ax, ax), ahrs_vec_mul(ay, ay)), ahrs_vec_mul(az, az))));
+	ax = ahrs_vec_mul(ax, recipNorm);
+	ay = ahrs_vec_mul(ay, recipNorm);
+	az = ahrs_vec_mul(az, recipNorm);
+
+	// Auxiliary variables to avoid repeated arithmetic
+	ahrs_vec _2q0 = ahrs_vec_mul(two, q0);
+	ahrs_vec _2q1 = ahrs_vec_mul(two, q1);
+	ahrs_vec _2q2 = ahrs_vec_mul(two, q2);
+	ahrs_vec _2q3 = ahrs_vec_mul(two, q3);
+	ahrs_vec q0q0 = ahrs_vec_mul(q0, q0);
+	ahrs_vec q1q1 = ahrs_vec_mul(q1, q1);
+	ahrs_vec q2q2 = ahrs_vec_mul(q2, q2);
+	ahrs_vec q3q3 = ahrs_vec_mul(q3, q3);
+
+	if(marg) {
+		ahrs_vec mx = ahrs_vec_loadu(in[6] + offset);
+		ahrs_vec my = ahrs_vec_loadu(in[7] + offset);
+		ahrs_vec mz = ahrs_vec_loadu(in[8] + offset);
+
+		// Normalise magnetometer measurement. Lanes with an all-zero sample stay zero, which zeroes the
+		// magnetic field terms of the gradient and reduces them to the IMU update, as madgwick_ahrs_update does.
+		ahrs_mask mag_invalid = ahrs_vec_all_zero3(mx, my, mz);
+		recipNorm = ahrs_vec_rsqrt(ahrs_vec_select(mag_invalid, one, ahrs_vec_add(ahrs_vec_add(ahrs_vec_mul(mx, mx), ahrs_vec_mul(my, my)), ahrs_vec_mul(mz, mz))));
+		mx = ahrs_vec_mul(mx, recipNorm);
+		my = ahrs_vec_mul(my, recipNorm);
+		mz = ahrs_vec_mul(mz, recipNorm);
+
+		// Auxiliary variables to avoid repeated arithmetic
+		ahrs_vec _2q0mx = ahrs_vec_mul(ahrs_vec_mul(two, q0), mx);
+		ahrs_vec _2q0my = ahrs_vec_mul(ahrs_vec_mul(two, q0), my);
+		ahrs_vec _2q0mz = ahrs_vec_mul(ahrs_vec_mul(two, q0), mz);
+		ahrs_vec _2q1mx = ahrs_vec_mul(ahrs_vec_mul(two, q1), mx);
+		ahrs_vec _2q0q2 = ahrs_vec_mul(ahrs_vec_mul(two, q0), q2);
+		ahrs_vec _2q2q3 = ahrs_vec_mul(ahrs_vec_mul(two, q2), q3);
+		ahrs_vec q0q1 = ahrs_vec_mul(q0, q1);
+		ahrs_vec q0q2 = ahrs_vec_mul(q0, q2);
+		ahrs_vec q0q3 = ahrs_vec_mul(q0, q3);
+		ahrs_vec q1q2 = ahrs_vec_mul(q1, q2);
+		ahrs_vec q1q3 = ahrs_vec_mul(q1, q3);
+		ahrs_vec q2q3 = ahrs_vec_mul(q2, q3);
+
+		// Reference direction of Earth's magnetic field
+		ahrs_vec hx = ahrs_vec_sub(ahrs_vec_sub(ahrs_vec_add(ahrs_vec_add(ahrs_vec_add(ahrs_vec_add(ahrs_vec_sub(ahrs_vec_mul(mx, q0q0), ahrs_vec_mul(_2q0my, q3)), ahrs_vec_mul(_2q0mz, q2)), ahrs_vec_mul(mx, q1q1)), ahrs_vec_mul(ahrs_vec_mul(_2q1, my), q2)), ahrs_vec_mul(ahrs_vec_mul(_2q1, mz), q3)), ahrs_vec_mul(mx, q2q2)), ahrs_vec_mul(mx, q3q3));
+		ahrs_vec hy = ahrs_vec_sub(ahrs_vec_add(ahrs_vec_add(ahrs_vec_sub(ahrs_vec_add(ahrs_vec_sub(ahrs_vec_add(ahrs_vec_mul(_2q0mx, q3), ahrs_vec_mul(my, q0q0)), ahrs_vec_mul(_2q0mz, q1)), ahrs_vec_mul(_2q1mx, q2)), ahrs_vec_mul(my, q1q1)), ahrs_vec_mul(my, q2q2)), ahrs_vec_mul(ahrs_vec_mul(_2q2, mz), q3)), ahrs_vec_mul(my, q3q3));
+		ahrs_vec _2bx = ahrs_vec_sqrt(ahrs_vec_add(ahrs_vec_mul(hx, hx), ahrs_vec_mul(hy, hy)));
+		ahrs_vec _2bz = ahrs_vec_add(ahrs_vec_sub(ahrs_vec_add(ahrs_vec_sub(ahrs_vec_add(ahrs_vec_add(ahrs_vec_add(ahrs_vec_mul(ahrs_vec_sub(zero, _2q0mx), q2), ahrs_vec_mul(_2q0my, q1)), ahrs_vec_mul(mz, q0q0)), ahrs_vec_mul(_2q1mx, q3)), ahrs_vec_mul(mz, q1q1)), ahrs_vec_mul(ahrs_vec_mul(_2q2, my), q3)), ahrs_vec_mul(mz, q2q2)), ahrs_vec_mul(mz, q3q3));
+		ahrs_vec _4bx = ahrs_vec_mul(two, _2bx);
+		ahrs_vec _4bz = ahrs_vec_mul(two, _2bz);
+
+		// Objective function residuals for gravity and magnetic field
+		ahrs_vec f1 = ahrs_vec_sub(ahrs_vec_sub(ahrs_vec_mul(two, q1q3), _2q0q2), ax);
+		ahrs_vec f2 = ahrs_vec_sub(ahrs_vec_add(ahrs_vec_mul(two, q0q1), _2q2q3), ay);
+		ahrs_vec f3 = ahrs_vec_sub(ahrs_vec_sub(ahrs_vec_sub(one, ahrs_vec_mul(two, q1q1)), ahrs_vec_mul(two, q2q2)), az);
+		ahrs_vec f4 = ahrs_vec_sub(ahrs_vec_add(ahrs_vec_mul(_2bx, ahrs_vec_sub(ahrs_vec_sub(half, q2q2), q3q3)), ahrs_vec_mul(_2bz, ahrs_vec_sub(q1q3, q0q2))), mx);
+		ahrs_vec f5 = ahrs_vec_sub(ahrs_vec_add(ahrs_vec_mul(_2bx, ahrs_vec_sub(q1q2, q0q3)), ahrs_vec_mul(_2bz, ahrs_vec_add(q0q1, q2q3))), my);
+		ahrs_vec f6 = ahrs_vec_sub(ahrs_vec_add(ahrs_vec_mul(_2bx, ahrs_vec_add(q0q2, q1q3)), ahrs_vec_mul(_2bz, ahrs_vec_sub(ahrs_vec_sub(half, q1q1), q2q2))), mz);
+
+		// Gradient decent algorithm corrective step
+		s0 = ahrs_vec_add(ahrs_vec_add(ahrs_vec_sub(ahrs_vec_add(ahrs_vec_mul(ahrs_vec_sub(zero, _2q2), f1), ahrs_vec_mul(_2q1, f2)), ahrs_vec_mul(ahrs_vec_mul(_2bz, q2), f4)), ahrs_vec_mul(ahrs_vec_add(ahrs_vec_mul(ahrs_vec_sub(zero, _2bx), q3), ahrs_vec_mul(_2bz, q1)), f5)), ahrs_vec_mul(ahrs_vec_mul(_2bx, q2), f6));
+		s1 = ahrs_vec_add(ahrs_vec_add(ahrs_vec_add(ahrs_vec_sub(ahrs_vec_add(ahrs_vec_mul(_2q3, f1), ahrs_vec_mul(_2q0, f2)), ahrs_vec_mul(ahrs_vec_mul(four, q1), f3)), ahrs_vec_mul(ahrs_vec_mul(_2bz, q3), f4)), ahrs_vec_mul(ahrs_vec_add(ahrs_vec_mul(_2bx, q2), ahrs_vec_mul(_2bz, q0)), f5)), ahrs_vec_mul(ahrs_vec_sub(ahrs_vec_mul(_2bx, q3), ahrs_vec_mul(_4bz, q1)), f6));
+		s2 = ahrs_vec_add(ahrs_vec_add(ahrs_vec_add(ahrs_vec_sub(ahrs_vec_add(ahrs_vec_mul(ahrs_vec_sub(zero, _2q0), f1), ahrs_vec_mul(_2q3, f2)), ahrs_vec_mul(ahrs_vec_mul(four, q2), f3)), ahrs_vec_mul(ahrs_vec_sub(ahrs_vec_mul(ahrs_vec_sub(zero, _4bx), q2), ahrs_vec_mul(_2bz, q0)), f4)), ahrs_vec_mul(ahrs_vec_add(ahrs_vec_mul(_2bx, q1), ahrs_vec_mul(_2bz, q3)), f5)), ahrs_vec_mul(ahrs_vec_sub(ahrs_vec_mul(_2bx, q0), ahrs_vec_mul(_4bz, q2)), f6));
+		s3 = ahrs_vec_add(ahrs_vec_add(ahrs_vec_add(ahrs_vec_add(ahrs_vec_mul(_2q1, f1), ahrs_vec_mul(_2q2, f2)), ahrs_vec_mul(ahrs_vec_add(ahrs_vec_mul(ahrs_vec_sub(zero, _4bx), q3), ahrs_vec_mul(_2bz, q1)), f4)), ahrs_vec_mul(ahrs_vec_add(ahrs_vec_mul(ahrs_vec_sub(zero, _2bx), q0), ahrs_vec_mul(_2bz, q2)), f5)), ahrs_vec_mul(ahrs_vec_mul(_2bx, q1), f6));
+	} else {
+		ahrs_vec _4q0 = ahrs_vec_mul(four, q0);
+		ahrs_vec _4q1 = ahrs_vec_mul(four, q1);
+		ahrs_vec _4q2 = ahrs_vec_mul(four, q2);
+		ahrs_vec _8q1 = ahrs_vec_mul(two, _4q1);
+		ahrs_vec _8q2 = ahrs_vec_mul(two, _4q2);
+
+		// Gradient decent algorithm corrective step
+		s0 = ahrs_vec_sub(ahrs_vec_add(ahrs_vec_add(ahrs_vec_mul(_4q0, q2q2), ahrs_vec_mul(_2q2, ax)), ahrs_vec_mul(_4q0, q1q1)), ahrs_vec_mul(_2q1, ay));
+		s1 = ahrs_vec_add(ahrs_vec_add(ahrs_vec_add(ahrs_vec_sub(ahrs_vec_sub(ahrs_vec_add(ahrs_vec_sub(ahrs_vec_mul(_4q1, q3q3), ahrs_vec_mul(_2q3, ax)), ahrs_vec_mul(ahrs_vec_mul(four, q0q0), q1)), ahrs_vec_mul(_2q0, ay)), _4q1), ahrs_vec_mul(_8q1, q1q1)), ahrs_vec_mul(_8q1, q2q2)), ahrs_vec_mul(_4q1, az));
+		s2 = ahrs_vec_add(ahrs_vec_add(ahrs_vec_add(ahrs_vec_sub(ahrs_vec_sub(ahrs_vec_add(ahrs_vec_add(ahrs_vec_mul(ahrs_vec_mul(four, q0q0), q2), ahrs_vec_mul(_2q0, ax)), ahrs_vec_mul(_4q2, q3q3)), ahrs_vec_mul(_2q3, ay)), _4q2), ahrs_vec_mul(_8q2, q1q1)), ahrs_vec_mul(_8q2, q2q2)), ahrs_vec_mul(_4q2, az));
+		s3 = ahrs_vec_sub(ahrs_vec_add(ahrs_vec_sub(ahrs_vec_mul(ahrs_vec_mul(four, q1q1), q3), ahrs_vec_mul(_2q1, ax)), ahrs_vec_mul(ahrs_vec_mul(four, q2q2), q3)), ahrs_vec_mul(_2q2, ay));
+	}
+
+	// Normalise step magnitude; a zero gradient (or an invalid lane) must not divide by zero
+	ahrs_vec norm = ahrs_vec_add(ahrs_vec_add(ahrs_vec_add(ahrs_vec_mul(s0, s0), ahrs_vec_mul(s1, s1)), ahrs_vec_mul(s2, s2)), ahrs_vec_mul(s3, s3));
+	ahrs_mask no_feedback = ahrs_mask_or(accel_invalid, ahrs_vec_eq_zero(norm));
+	recipNorm = ahrs_vec_rsqrt(ahrs_vec_select(no_feedback, one, norm));
+	const ahrs_vec beta = ahrs_vec_select(no_feedback, zero, ahrs_vec_mul(MADGWICK_BANK_BETA(bank, index), recipNorm));
+
+	// Apply feedback step
+	qDot1 = ahrs_vec_sub(qDot1, ahrs_vec_mul(beta, s0));
+	qDot2 = ahrs_vec_sub(qDot2, ahrs_vec_mul(beta, s1));
+	qDot3 = ahrs_vec_sub(qDot3, ahrs_vec_mul(beta, s2));
+	qDot4 = ahrs_vec_sub(qDot4, ahrs_vec_mul(beta, s3));
+
+	// Integrate rate of change of quaternion to yield quaternion
+	q0 = ahrs_vec_add(q0, ahrs_vec_mul(qDot1, dt));
+	q1 = ahrs_vec_add(q1, ahrs_vec_mul(qDot2, dt));
+	q2 = ahrs_vec_add(q2, ahrs_vec_mul(qDot3, dt));
+	q3 = ahrs_vec_add(q3, ahrs_vec_mul(qDot4, dt));
+
+	// Normalise quaternion
+	recipNorm = ahrs_vec_rsqrt(ahrs_vec_add(ahrs_vec_add(ahrs_vec_add(ahrs_vec_mul(q0, q0), ahrs_vec_mul(q1, q1)), ahrs_vec_mul(q2, q2)), ahrs_vec_mul(q3, q3)));
+	ahrs_vec_store(bank->q0 + index, ahrs_vec_mul(q0, recipNorm));
+	ahrs_vec_store(bank->q1 + index, ahrs_vec_mul(q1, recipNorm));
+	ahrs_vec_store(bank->q2 + index, ahrs_vec_mul(q2, recipNorm));
+	ahrs_vec_store(bank->q3 + index, ahrs_vec_mul(q3, recipNorm));
+}
+
+// Runs the kernel over all filters, staging the last partial vector through zero padded buffers
+static inline void madgwick_bank_run(MadgwickAHRSBank* bank, const MA_PRECISION* const* in, int marg)
+{
+	const size_t inputs = marg ? MADGWICK_BANK_INPUTS : 6;
+	size_t i = 0;
+	for(; i + AHRS_SIMD_WIDTH <= bank->count; i += AHRS_SIMD_WIDTH)
+		madgwick_bank_step(bank, i, in, i, marg);
+	if(i < bank->count) {
+		MA_PRECISION staged[MADGWICK_BANK_INPUTS][AHRS_SIMD_WIDTH];
+		const MA_PRECISION* staged_in[MADGWICK_BANK_INPUTS];
+		ahrs_bank_stage_tail(staged, staged_in, in, inputs, i, bank->count - i);
+		madgwick_bank_step(bank, i, staged_in, 0, marg);
+	}
+}
+
+//====================================================================================================
+// Functions
+
+//---------------------------------------------------------------------------------------------------
+// IMU algorithm update
+void AHRS_KERNEL_NAME(madgwick_ahrs_bank_update_imu)(MadgwickAHRSBank* bank, const MA_PRECISION* gx, const MA_PRECISION* gy, const MA_PRECISION* gz, const MA_PRECISION* ax, const MA_PRECISION* ay, const MA_PRECISION* az)
+{
+	if(bank == NULL) return;
+	AHRS_STATS_START(start);
+	const MA_PRECISION* in[MADGWICK_BANK_INPUTS] = { gx, gy, gz, ax, ay, az, NULL, NULL, NULL };
+	madgwick_bank_run(bank, in, 0);
+	AHRS_STAT_ADD(AHRS_STAT_UPDATES, bank->count);
+	AHRS_STATS_STOP(start, bank->count);
+}
+
+//---------------------------------------------------------------------------------------------------
+// AHRS algorithm update
+void AHRS_KERNEL_NAME(madgwick_ahrs_bank_update)(MadgwickAHRSBank* bank, const MA_PRECISION* gx, const MA_PRECISION* gy, const MA_PRECISION* gz, const MA_PRECISION* ax, const MA_PRECISION* ay, const MA_PRECISION* az, const MA_PRECISION* mx, const MA_PRECISION* my, const MA_PRECISION* mz)
+{
+	if(bank == NULL) return;
+	AHRS_STATS_START(start);
+	const MA_PRECISION* in[MADGWICK_BANK_INPUTS] = { gx, gy, gz, ax, ay, az, mx, my, mz };
+	madgwick_bank_run(bank, in, 1);
+	AHRS_STAT_ADD(AHRS_STAT_UPDATES, bank->count);
+	AHRS_STATS_STOP(start, bank->count);
+}
@@ -0,0 +1,240 @@
+//=====================================================================================================
+// madgwick_ahrs_fixed.c
+//=====================================================================================================
+//
+// Fixed-point Madgwick filter, see madgwick_ahrs_fixed.h.
+//
+// The gradient is computed in Q_GRAD (Q28, range +-8 per factor) with 64-bit sums: its components
+// leave the +-2 of Q_UNIT, and only its direction is kept.
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "madgwick_ahrs_fixed.h"
+#include <stdlib.h>
+
+#define Q_GRAD 28
+#define M(A, B) ahrs_fixed_mul((A), (B), Q_GRAD)
+
+//---------------------------------------------------------------------------------------------------
+// Variable definitions
+
+int madgwick_ahrs_fixed_init(MadgwickAHRSFixed* workspace, uint32_t sample_rate){
+	if(workspace == NULL || sample_rate == 0) return -1;
+	workspace->sample_rate = sample_rate;
+	workspace->sample_period = ahrs_fixed_period(sample_rate);
+	workspace->beta = BETA_FIXED;
+	workspace->q0 = 1 << AHRS_FIXED_Q_UNIT;
+	workspace->q1 = 0;
+	workspace->q2 = 0;
+	workspace->q3 = 0;
+	return 0;
+}
+
+MadgwickAHRSFixed* create_madgwick_ahrs_fixed(uint32_t sample_rate){
+	if(sample_rate == 0) return NULL;
+	MadgwickAHRSFixed* workspace = (MadgwickAHRSFixed *) malloc(sizeof(MadgwickAHRSFixed));
+	if(workspace == NULL) return NULL;
+	madgwick_ahrs_fixed_init(workspace, sample_rate);
+	return workspace;
+}
+
+void free_madgwick_ahrs_fixed(MadgwickAHRSFixed* workspace){
+	free(workspace);
+}
+
+void madgwick_ahrs_fixed_update_sample_rate(MadgwickAHRSFixed* workspace, uint32_t sample_rate){
+	if(workspace == NULL || sample_rate == 0) return;
+	if(sample_rate != workspace->sample_rate) { // Reset the parameters when sample rates are different
+		int32_t beta = workspace->beta;
+		madgwick_ahrs_fixed_init(workspace, sample_rate);
+		workspace->beta = beta;
+	}
+}
+
+void madgwick_ahrs_fixed_set_gain(MadgwickAHRSFixed* workspace, int32_t beta){
+	if(workspace == NULL || beta < 0) return;
+	workspace->beta = beta;
+}
+
+//====================================================================================================
+// Kernels
+
+// Feedback step beta * dt * gradient / |gradient| (Q_UNIT) for the gradient s (Q_GRAD); 0 for a
+// zero gradient, which gives no feedback
+MA_INLINE int madgwick_fixed_feedback(const int64_t* s, int32_t dt, int32_t beta, int32_t* correction){
+	if(!ahrs_fixed_normalise_wide(s, correction, 4)) return 0;
+	int64_t step = ahrs_fixed_mul(beta, dt, AHRS_FIXED_Q_RATE); // Q_UNIT
+	for(int i = 0; i < 4; i++) correction[i] = (int32_t) ahrs_fixed_mul(correction[i], step, AHRS_FIXED_Q_UNIT);
+	return 1;
+}
+
+//---------------------------------------------------------------------------------------------------
+// IMU algorithm step
+MA_INLINE void madgwick_fixed_imu_step(int32_t* q, int32_t dt, int32_t beta, int32_t gx, int32_t gy, int32_t gz, int32_t ax, int32_t ay, int32_t az)
+{
+	int32_t correction[4];
+	int has_correction = 0;
+
+	// Compute feedback only if accelerometer measurement valid
+	if(!((ax == 0) && (ay == 0) && (az == 0))) {
+		int32_t a[3] = { ax, ay, az };
+		ahrs_fixed_normalise(a, 3);
+		int64_t a0 = a[0] >> 2, a1 = a[1] >> 2, a2 = a[2] >> 2; // Q_GRAD
+		int64_t q0 = q[0] >> 2, q1 = q[1] >> 2, q2 = q[2] >> 2, q3 = q[3] >> 2;
+
+		// Auxiliary variables to avoid repeated arithmetic
+		int64_t _2q0 = 2 * q0, _2q1 = 2 * q1, _2q2 = 2 * q2, _2q3 = 2 * q3;
+		int64_t _4q0 = 4 * q0, _4q1 = 4 * q1, _4q2 = 4 * q2, _8q1 = 8 * q1, _8q2 = 8 * q2;
+		int64_t q0q0 = M(q0, q0), q1q1 = M(q1, q1), q2q2 = M(q2, q2), q3q3 = M(q3, q3);
+
+		// Gradient decent algorithm corrective step
+		int64_t s[4];
+		s[0] = M(_4q0, q2q2) + M(_2q2, a0) + M(_4q0, q1q1) - M(_2q1, a1);
+		s[1] = M(_4q1, q3q3) - M(_2q3, a0) + M(4 * q0q0, q1) - M(_2q0, a1) - _4q1 + M(_8q1, q1q1) + M(_8q1, q2q2) + M(_4q1, a2);
+		s[2] = M(4 * q0q0, q2) + M(_2q0, a0) + M(_4q2, q3q3) - M(_2q3, a1) - _4q2 + M(_8q2, q1q1) + M(_8q2, q2q2) + M(_4q2, a2);
+		s[3] = M(4 * q1q1, q3) - M(_2q1, a0) + M(4 * q2q2, q3) - M(_2q2, a1);
+		has_correction = madgwick_fixed_feedback(s, dt, beta, correction);
+	}
+
+	ahrs_fixed_integrate(q, dt, gx, gy, gz, has_correction ? correction : NULL);
+}
+
+//---------------------------------------------------------------------------------------------------
+// AHRS algorithm step
+MA_INLINE void madgwick_fixed_step(int32_t* q, int32_t dt, int32_t beta, int32_t gx, int32_t gy, int32_t gz, int32_t ax, int32_t ay, int32_t az, int32_t mx, int32_t my, int32_t mz)
+{
+	// Use IMU algorithm if magnetometer measurement invalid
+	if((mx == 0) && (my == 0) && (mz == 0)) {
+		madgwick_fixed_imu_step(q, dt, beta, gx, gy, gz, ax, ay, az);
+		return;
+	}
+	int32_t correction[4];
+	int has_correction = 0;
+
+	// Compute feedback only if accelerometer measurement valid
+	if(!((ax == 0) && (ay == 0) && (az == 0))) {
+		int32_t a[3] = { ax, ay, az }, m[3] = { mx, my, mz };
+		ahrs_fixed_normalise(a, 3);
+		ahrs_fixed_normalise(m, 3);
+		int64_t a0 = a[0] >> 2, a1 = a[1] >> 2, a2 = a[2] >> 2; // Q_GRAD
+		int64_t m0 = m[0] >> 2, m1 = m[1] >> 2, m2 = m[2] >> 2;
+		int64_t q0 = q[0] >> 2, q1 = q[1] >> 2, q2 = q[2] >> 2, q3 = q[3] >> 2;
+		const int64_t one = (int64_t)1 << Q_GRAD, half = one >> 1;
+
+		// Auxiliary variables to avoid repeated arithmetic
+		int64_t _2q0mx = 2 * M(q0, m0), _2q0my = 2 * M(q0, m1), _2q0mz = 2 * M(q0, m2), _2q1mx = 2 * M(q1, m0);
+		int64_t _2q0 = 2 * q0, _2q1 = 2 * q1, _2q2 = 2 * q2, _2q3 = 2 * q3;
+		int64_t _2q0q2 = 2 * M(q0, q2), _2q2q3 = 2 * M(q2, q3);
+		int64_t q0q0 = M(q0, q0), q0q1 = M(q0, q1), q0q2 = M(q0, q2), q0q3 = M(q0, q3);
+		int64_t q1q1 = M(q1, q1), q1q2 = M(q1, q2), q1q3 = M(q1, q3);
+		int64_t q2q2 = M(q2, q2), q2q3 = M(q2, q3), q3q3 = M(q3, q3);
+
+		// Reference direction of Earth's magnetic field; |(hx, hy)| through the integer rsqrt
+		int64_t hx = M(m0, q0q0) - M(_2q0my, q3) + M(_2q0mz, q2) + M(m0, q1q1) + M(M(_2q1, m1), q2) + M(M(_2q1, m2), q3) - M(m0, q2q2) - M(m0, q3q3);
+		int64_t hy = M(_2q0mx, q3) + M(m1, q0q0) - M(_2q0mz, q1) + M(_2q1mx, q2) - M(m1, q1q1) + M(m1, q2q2) + M(M(_2q2, m2), q3) - M(m1, q3q3);
+		int32_t h[2] = { ahrs_fixed_saturate(hx), ahrs_fixed_saturate(hy) };
+		int64_t _2bx = ahrs_fixed_normalise(h, 2) ? ahrs_fixed_mul(hx, h[0], AHRS_FIXED_Q_UNIT) + ahrs_fixed_mul(hy, h[1], AHRS_FIXED_Q_UNIT) : 0;
+		int64_t _2bz = -M(_2q0mx, q2) + M(_2q0my, q1) + M(m2, q0q0) + M(_2q1mx, q3) - M(m2, q1q1) + M(M(_2q2, m1), q3) - M(m2, q2q2) + M(m2, q3q3);
+		int64_t _4bx = 2 * _2bx, _4bz = 2 * _2bz;
+
+		// Residuals of the objective function
+		int64_t fa = 2 * q1q3 - _2q0q2 - a0;
+		int64_t fb = 2 * q0q1 + _2q2q3 - a1;
+		int64_t fc = one - 2 * q1q1 - 2 * q2q2 - a2;
+		int64_t fx = M(_2bx, half - q2q2 - q3q3) + M(_2bz, q1q3 - q0q2) - m0;
+		int64_t fy = M(_2bx, q1q2 - q0q3) + M(_2bz, q0q1 + q2q3) - m1;
+		int64_t fz = M(_2bx, q0q2 + q1q3) + M(_2bz, half - q1q1 - q2q2) - m2;
+
+		// Gradient decent algorithm corrective step
+		int64_t s[4];
+		s[0] = -M(_2q2, fa) + M(_2q1, fb) - M(M(_2bz, q2), fx) + M(-M(_2bx, q3) + M(_2bz, q1), fy) + M(M(_2bx, q2), fz);
+		s[1] = M(_2q3, fa) + M(_2q0, fb) - M(4 * q1, fc) + M(M(_2bz, q3), fx) + M(M(_2bx, q2) + M(_2bz, q0), fy) + M(M(_2bx, q3) - M(_4bz, q1), fz);
+		s[2] = -M(_2q0, fa) + M(_2q3, fb) - M(4 * q2, fc) + M(-M(_4bx, q2) - M(_2bz, q0), fx) + M(M(_2bx, q1) + M(_2bz, q3), fy) + M(M(_2bx, q0) - M(_4bz, q2), fz);
+		s[3] = M(_2q1, fa) + M(_2q2, fb) + M(-M(_4bx, q3) + M(_2bz, q1), fx) + M(-M(_2bx, q0) + M(_2bz, q2), fy) + M(M(_2bx, q1), fz);
+		has_correction = madgwick_fixed_feedback(s, dt, beta, correction);
+	}
+
+	ahrs_fixed_integrate(q, dt, gx, gy, gz, has_correction ? correction : NULL);
+}
+
+//====================================================================================================
+// Functions
+
+//---------------------------------------------------------------------------------------------------
+// IMU algorithm update
+void madgwick_ahrs_fixed_update_imu(MadgwickAHRSFixed* workspace, int32_t gx, int32_t gy, int32_t gz, int32_t ax, int32_t ay, int32_t az)
+{
+	int32_t q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	madgwick_fixed_imu_step(q, workspace->sample_period, workspace->beta, gx, gy, gz, ax, ay, az);
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+}
+
+//---------------------------------------------------------------------------------------------------
+// AHRS algorithm update
+void madgwick_ahrs_fixed_update(MadgwickAHRSFixed* workspace, int32_t gx, int32_t gy, int32_t gz, int32_t ax, int32_t ay, int32_t az, int32_t mx, int32_t my, int32_t mz)
+{
+	int32_t q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	madgwick_fixed_step(q, workspace->sample_period, workspace->beta, gx, gy, gz, ax, ay, az, mx, my, mz);
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+}
+
+//---------------------------------------------------------------------------------------------------
+// Batched IMU algorithm update
+void madgwick_ahrs_fixed_update_imu_batch(MadgwickAHRSFixed* workspace, AHRSFixedSensorArray gyro, AHRSFixedSensorArray accel, size_t count, int32_t* quaternions)
+{
+	if(workspace == NULL || count == 0) return;
+	const int32_t dt = workspace->sample_period, beta = workspace->beta;
+	int32_t q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	size_t g = 0, a = 0;
+
+	for(size_t i = 0; i < count; i++, g += gyro.stride, a += accel.stride) {
+		madgwick_fixed_imu_step(q, dt, beta, gyro.x[g], gyro.y[g], gyro.z[g], accel.x[a], accel.y[a], accel.z[a]);
+		if(quaternions != NULL) {
+			quaternions[0] = q[0];
+			quaternions[1] = q[1];
+			quaternions[2] = q[2];
+			quaternions[3] = q[3];
+			quaternions += 4;
+		}
+	}
+
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+}
+
+//---------------------------------------------------------------------------------------------------
+// Batched AHRS algorithm update
+void madgwick_ahrs_fixed_update_batch(MadgwickAHRSFixed* workspace, AHRSFixedSensorArray gyro, AHRSFixedSensorArray accel, AHRSFixedSensorArray mag, size_t count, int32_t* quaternions)
+{
+	if(workspace == NULL || count == 0) return;
+	const int32_t dt = workspace->sample_period, beta = workspace->beta;
+	int32_t q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	size_t g = 0, a = 0, m = 0;
+
+	for(size_t i = 0; i < count; i++, g += gyro.stride, a += accel.stride, m += mag.stride) {
+		madgwick_fixed_step(q, dt, beta, gyro.x[g], gyro.y[g], gyro.z[g], accel.x[a], accel.y[a], accel.z[a], mag.x[m], mag.y[m], mag.z[m]);
+		if(quaternions != NULL) {
+			quaternions[0] = q[0];
+			quaternions[1] = q[1];
+			quaternions[2] = q[2];
+			quaternions[3] = q[3];
+			quaternions += 4;
+		}
+	}
+
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+}
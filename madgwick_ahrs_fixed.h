@@ -0,0 +1,57 @@
+//=====================================================================================================
+// madgwick_ahrs_fixed.h
+//=====================================================================================================
+//
+// Madgwick's AHRS algorithm in fixed point, for cores without an FPU and for integer batches. The
+// same algorithm and update sequence as madgwick_ahrs.h; Q formats and saturation in ahrs_fixed.h:
+// gyro in rad/s Q_RATE, accelerometer and magnetometer in any int32_t scale, quaternion Q_UNIT.
+//
+//=====================================================================================================
+#ifndef __MADGWICK_AHRS_FIXED_H__
+#define __MADGWICK_AHRS_FIXED_H__
+
+#include "ahrs_fixed.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t sample_rate;   // Hz
+    int32_t sample_period;  // s, Q_TIME
+    int32_t beta;           // Q_RATE, BETA_FIXED unless changed with madgwick_ahrs_fixed_set_gain
+    int32_t q0;             // Q_UNIT
+    int32_t q1;
+    int32_t q2;
+    int32_t q3;
+} MadgwickAHRSFixed;
+
+#define BETA_FIXED AHRS_FIXED(0.033, AHRS_FIXED_Q_RATE) // BETA of madgwick_ahrs.h
+
+MadgwickAHRSFixed* create_madgwick_ahrs_fixed(uint32_t sample_rate); // NULL for sample_rate 0 or out of memory
+void free_madgwick_ahrs_fixed(MadgwickAHRSFixed* workspace);
+
+// As create_madgwick_ahrs_fixed on caller-provided storage. Returns 0, or -1 for sample_rate 0.
+int madgwick_ahrs_fixed_init(MadgwickAHRSFixed* workspace, uint32_t sample_rate);
+
+//---------------------------------------------------------------------------------------------------
+// Function declarations
+void madgwick_ahrs_fixed_update_sample_rate(MadgwickAHRSFixed* workspace, uint32_t sample_rate);
+
+// `beta` in Q_RATE, >= 0; keeps the state
+void madgwick_ahrs_fixed_set_gain(MadgwickAHRSFixed* workspace, int32_t beta);
+
+void madgwick_ahrs_fixed_update_imu(MadgwickAHRSFixed* workspace, int32_t gx, int32_t gy, int32_t gz, int32_t ax, int32_t ay, int32_t az);
+
+void madgwick_ahrs_fixed_update(MadgwickAHRSFixed* workspace, int32_t gx, int32_t gy, int32_t gz, int32_t ax, int32_t ay, int32_t az, int32_t mx, int32_t my, int32_t mz);
+
+// Batched updates, as madgwick_ahrs_update_batch; `quaternions` (may be NULL) receives 4 * count Q_UNIT values
+void madgwick_ahrs_fixed_update_imu_batch(MadgwickAHRSFixed* workspace, AHRSFixedSensorArray gyro, AHRSFixedSensorArray accel, size_t count, int32_t* quaternions);
+
+void madgwick_ahrs_fixed_update_batch(MadgwickAHRSFixed* workspace, AHRSFixedSensorArray gyro, AHRSFixedSensorArray accel, AHRSFixedSensorArray mag, size_t count, int32_t* quaternions);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MADGWICK_AHRS_FIXED_H__ */
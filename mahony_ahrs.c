@@ -17,15 +17,25 @@
 // Header files
 
 #include "mahony_ahrs.h"
+#include "ahrs_stats.h"
 #include <stdlib.h>
 #include <math.h>
 
 //---------------------------------------------------------------------------------------------------
 // Variable definitions
-MahonyAHRS* create_mahony_ahrs(MA_PRECISION sample_rate){
-	if(sample_rate <= 0) return NULL;
-	MahonyAHRS* workspace = (MahonyAHRS *) malloc(sizeof(MahonyAHRS));
+#if MA_FIXED_GAINS
+#define MAHONY_TWO_KP(WS) TWO_KP
+#define MAHONY_TWO_KI(WS) TWO_KI
+#else
+#define MAHONY_TWO_KP(WS) ((WS)->two_kp)
+#define MAHONY_TWO_KI(WS) ((WS)->two_ki)
+#endif
+
+int mahony_ahrs_init(MahonyAHRS* workspace, MA_PRECISION sample_rate){
+	if(workspace == NULL || sample_rate <= 0) return -1;
 	workspace->sample_rate = sample_rate;
+	workspace->two_kp = TWO_KP;
+	workspace->two_ki = TWO_KI;
 	// quaternion of sensor frame relative to auxiliary frame
 	workspace->q0 = 1.0f;
 	workspace->q1 = 0.0f;
@@ -35,6 +45,26 @@ MahonyAHRS* create_mahony_ahrs(MA_PRECISION sample_rate){
 	workspace->integralFBx = 0.0f;
 	workspace->integralFBy = 0.0f;
 	workspace->integralFBz = 0.0f;
+	workspace->max_dt = 0.0f;
+	workspace->gap_policy = AHRS_GAP_PROPAGATE;
+	workspace->has_timestamp = 0;
+	workspace->timestamp = 0;
+	workspace->accel_timestamp = 0;
+	workspace->mag_timestamp = 0;
+	workspace->has_accel_timestamp = 0;
+	workspace->has_mag_timestamp = 0;
+	workspace->yaw = 0.0f;
+	workspace->pitch = 0.0f;
+	workspace->roll = 0.0f;
+	workspace->euler_dirty = 0;
+	return 0;
+}
+
+MahonyAHRS* create_mahony_ahrs(MA_PRECISION sample_rate){
+	if(sample_rate <= 0) return NULL;
+	MahonyAHRS* workspace = (MahonyAHRS *) malloc(sizeof(MahonyAHRS));
+	if(workspace == NULL) return NULL;
+	mahony_ahrs_init(workspace, sample_rate);
 	return workspace;
 }
 
@@ -50,26 +80,68 @@ void mahony_ahrs_update_sample_rate(MahonyAHRS* workspace, MA_PRECISION sample_r
 		workspace->integralFBx = 0.0f;
 		workspace->integralFBy = 0.0f;
 		workspace->integralFBz = 0.0f;
+		workspace->euler_dirty = 1;
+		AHRS_STAT_COLD(AHRS_STAT_RATE_RESET);
+	}
+}
+
+void mahony_ahrs_set_gains(MahonyAHRS* workspace, MA_PRECISION two_kp, MA_PRECISION two_ki) {
+	if(workspace == NULL) return;
+	if(two_kp < 0 || two_ki < 0) return;
+	workspace->two_kp = two_kp;
+	workspace->two_ki = two_ki;
+	if(MAHONY_TWO_KI(workspace) == 0.0f) { // no integral feedback: gyro-only predicts must not keep applying it
+		workspace->integralFBx = 0.0f;
+		workspace->integralFBy = 0.0f;
+		workspace->integralFBz = 0.0f;
 	}
 }
 
+void mahony_ahrs_set_gap_policy(MahonyAHRS* workspace, int policy, MA_PRECISION max_dt) {
+	if(workspace == NULL) return;
+	if(policy != AHRS_GAP_PROPAGATE && policy != AHRS_GAP_CLAMP) return;
+	if(max_dt < 0) return;
+	workspace->gap_policy = policy;
+	workspace->max_dt = max_dt;
+}
+
 void free_mahony_ahrs(MahonyAHRS* workspace){
 	free(workspace);
 }
 
+void mahony_ahrs_get_euler(MahonyAHRS* workspace, MA_PRECISION* yaw, MA_PRECISION* pitch, MA_PRECISION* roll){
+	if(workspace == NULL) return;
+	if(workspace->euler_dirty) {
+		COMPUTE_EULER_ANGLE(workspace);
+		workspace->euler_dirty = 0;
+	}
+	if(yaw != NULL) *yaw = workspace->yaw;
+	if(pitch != NULL) *pitch = workspace->pitch;
+	if(roll != NULL) *roll = workspace->roll;
+}
+
 //====================================================================================================
-// Functions
+// Filter kernels
+//
+// The kernels work on local copies of the quaternion and integral terms and take the sample period
+// rather than the sample rate, so the batch loops keep the state in registers and hoist the
+// reciprocal out of the loop. The gains are arguments so that constant ones fold into the inlined
+// kernel; with two_ki == 0 the integral feedback block disappears.
 
 //---------------------------------------------------------------------------------------------------
-// IMU algorithm update
-void mahony_ahrs_update_imu(MahonyAHRS* workspace, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az)
+// IMU algorithm step
+MA_INLINE void mahony_imu_step(MA_PRECISION* q, MA_PRECISION* integralFB, MA_PRECISION dt, MA_PRECISION two_kp, MA_PRECISION two_ki, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az)
 {
+	MA_PRECISION q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
 	// temp vars
 	MA_PRECISION recipNorm;
 	MA_PRECISION halfvx, halfvy, halfvz;
 	MA_PRECISION halfex, halfey, halfez;
 	MA_PRECISION qa, qb, qc;
 
+	AHRS_STAT_ADD(AHRS_STAT_UPDATES, 1);
+	AHRS_STAT_IF((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f), AHRS_STAT_ACCEL_INVALID);
+
 	// Compute feedback only if accelerometer measurement valid (avoids NaN in accelerometer normalisation)
 	if (!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f)))
 	{
@@ -81,9 +153,9 @@ void mahony_ahrs_update_imu(MahonyAHRS* workspace, MA_PRECISION gx, MA_PRECISION
 		az *= recipNorm;
 
 		// Estimated direction of gravity and vector perpendicular to magnetic flux
-		halfvx = workspace->q1 * workspace->q3 - workspace->q0 * workspace->q2;
-		halfvy = workspace->q0 * workspace->q1 + workspace->q2 * workspace->q3;
-		halfvz = workspace->q0 * workspace->q0 - 0.5f + workspace->q3 * workspace->q3;
+		halfvx = q1 * q3 - q0 * q2;
+		halfvy = q0 * q1 + q2 * q3;
+		halfvz = q0 * q0 - 0.5f + q3 * q3;
 
 		// Error is sum of cross product between estimated and measured direction of gravity
 		halfex = (ay * halfvz - az * halfvy);
@@ -91,51 +163,57 @@ void mahony_ahrs_update_imu(MahonyAHRS* workspace, MA_PRECISION gx, MA_PRECISION
 		halfez = (ax * halfvy - ay * halfvx);
 
 		// Compute and apply integral feedback if enabled
-		if (TWO_KI > 0.0f)
+		if (two_ki > 0.0f)
 		{
-			workspace->integralFBx += TWO_KI * halfex * (1.0f / workspace->sample_rate); // integral error scaled by Ki
-			workspace->integralFBy += TWO_KI * halfey * (1.0f / workspace->sample_rate);
-			workspace->integralFBz += TWO_KI * halfez * (1.0f / workspace->sample_rate);
-			gx += workspace->integralFBx; // apply integral feedback
-			gy += workspace->integralFBy;
-			gz += workspace->integralFBz;
+			integralFB[0] += two_ki * halfex * dt; // integral error scaled by Ki
+			integralFB[1] += two_ki * halfey * dt;
+			integralFB[2] += two_ki * halfez * dt;
+			AHRS_STAT_INTEGRAL(integralFB);
+			gx += integralFB[0]; // apply integral feedback
+			gy += integralFB[1];
+			gz += integralFB[2];
 		} else {
-			workspace->integralFBx = 0.0f; // prevent integral windup
-			workspace->integralFBy = 0.0f;
-			workspace->integralFBz = 0.0f;
+			integralFB[0] = 0.0f; // prevent integral windup
+			integralFB[1] = 0.0f;
+			integralFB[2] = 0.0f;
 		}
 
 		// Apply proportional feedback
-		gx += TWO_KP * halfex;
-		gy += TWO_KP * halfey;
-		gz += TWO_KP * halfez;
+		gx += two_kp * halfex;
+		gy += two_kp * halfey;
+		gz += two_kp * halfez;
 	}
 
 	// Integrate rate of change of quaternion
-	gx *= (0.5f / workspace->sample_rate); // pre-multiply common factors
-	gy *= (0.5f / workspace->sample_rate);
-	gz *= (0.5f / workspace->sample_rate);
-	qa = workspace->q0;
-	qb = workspace->q1;
-	qc = workspace->q2;
-	workspace->q0 += (-qb * gx - qc * gy - workspace->q3 * gz);
-	workspace->q1 += (qa * gx + qc * gz - workspace->q3 * gy);
-	workspace->q2 += (qa * gy - qb * gz + workspace->q3 * gx);
-	workspace->q3 += (qa * gz + qb * gy - qc * gx);
+	gx *= (0.5f * dt); // pre-multiply common factors
+	gy *= (0.5f * dt);
+	gz *= (0.5f * dt);
+	qa = q0;
+	qb = q1;
+	qc = q2;
+	q0 += (-qb * gx - qc * gy - q3 * gz);
+	q1 += (qa * gx + qc * gz - q3 * gy);
+	q2 += (qa * gy - qb * gz + q3 * gx);
+	q3 += (qa * gz + qb * gy - qc * gx);
 
 	// Normalise quaternion
-	recipNorm = inv_sqrt(workspace->q0 * workspace->q0 + workspace->q1 * workspace->q1 + workspace->q2 * workspace->q2 + workspace->q3 * workspace->q3);
-	workspace->q0 *= recipNorm;
-	workspace->q1 *= recipNorm;
-	workspace->q2 *= recipNorm;
-	workspace->q3 *= recipNorm;
-	COMPUTE_EULER_ANGLE(workspace);
+	recipNorm = inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	q0 *= recipNorm;
+	q1 *= recipNorm;
+	q2 *= recipNorm;
+	q3 *= recipNorm;
+	AHRS_STAT_IF(q0 != q0, AHRS_STAT_NAN);
+	q[0] = q0;
+	q[1] = q1;
+	q[2] = q2;
+	q[3] = q3;
 }
 
 //---------------------------------------------------------------------------------------------------
-// AHRS algorithm update
-void mahony_ahrs_update(MahonyAHRS* workspace, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz)
+// AHRS algorithm step
+MA_INLINE void mahony_step(MA_PRECISION* q, MA_PRECISION* integralFB, MA_PRECISION dt, MA_PRECISION two_kp, MA_PRECISION two_ki, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz)
 {
+	MA_PRECISION q0, q1, q2, q3;
 	MA_PRECISION recipNorm;
 	MA_PRECISION q0q0, q0q1, q0q2, q0q3, q1q1, q1q2, q1q3, q2q2, q2q3, q3q3;
 	MA_PRECISION hx, hy, bx, bz;
@@ -146,9 +224,17 @@ void mahony_ahrs_update(MahonyAHRS* workspace, MA_PRECISION gx, MA_PRECISION gy,
 	// Use IMU algorithm if magnetometer measurement invalid (avoids NaN in magnetometer normalisation)
 	if ((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f))
 	{
-		mahony_ahrs_update_imu(workspace, gx, gy, gz, ax, ay, az);
+		AHRS_STAT_ADD(AHRS_STAT_MAG_FALLBACK, 1);
+		mahony_imu_step(q, integralFB, dt, two_kp, two_ki, gx, gy, gz, ax, ay, az);
 		return;
 	}
+	q0 = q[0];
+	q1 = q[1];
+	q2 = q[2];
+	q3 = q[3];
+
+	AHRS_STAT_ADD(AHRS_STAT_UPDATES, 1);
+	AHRS_STAT_IF((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f), AHRS_STAT_ACCEL_INVALID);
 
 	// Compute feedback only if accelerometer measurement valid (avoids NaN in accelerometer normalisation)
 	if (!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f)))
@@ -167,21 +253,21 @@ void mahony_ahrs_update(MahonyAHRS* workspace, MA_PRECISION gx, MA_PRECISION gy,
 		mz *= recipNorm;
 
 		// Auxiliary variables to avoid repeated arithmetic
-		q0q0 = workspace->q0 * workspace->q0;
-		q0q1 = workspace->q0 * workspace->q1;
-		q0q2 = workspace->q0 * workspace->q2;
-		q0q3 = workspace->q0 * workspace->q3;
-		q1q1 = workspace->q1 * workspace->q1;
-		q1q2 = workspace->q1 * workspace->q2;
-		q1q3 = workspace->q1 * workspace->q3;
-		q2q2 = workspace->q2 * workspace->q2;
-		q2q3 = workspace->q2 * workspace->q3;
-		q3q3 = workspace->q3 * workspace->q3;
+		q0q0 = q0 * q0;
+		q0q1 = q0 * q1;
+		q0q2 = q0 * q2;
+		q0q3 = q0 * q3;
+		q1q1 = q1 * q1;
+		q1q2 = q1 * q2;
+		q1q3 = q1 * q3;
+		q2q2 = q2 * q2;
+		q2q3 = q2 * q3;
+		q3q3 = q3 * q3;
 
 		// Reference direction of Earth's magnetic field
 		hx = 2.0f * (mx * (0.5f - q2q2 - q3q3) + my * (q1q2 - q0q3) + mz * (q1q3 + q0q2));
 		hy = 2.0f * (mx * (q1q2 + q0q3) + my * (0.5f - q1q1 - q3q3) + mz * (q2q3 - q0q1));
-		bx = sqrt(hx * hx + hy * hy);
+		bx = SQRT(hx * hx + hy * hy);
 		bz = 2.0f * (mx * (q1q3 - q0q2) + my * (q2q3 + q0q1) + mz * (0.5f - q1q1 - q2q2));
 		
 		// Estimated direction of gravity and magnetic field
@@ -198,45 +284,702 @@ void mahony_ahrs_update(MahonyAHRS* workspace, MA_PRECISION gx, MA_PRECISION gy,
 		halfez = (ax * halfvy - ay * halfvx) + (mx * halfwy - my * halfwx);
 
 		// Compute and apply integral feedback if enabled
-		if (TWO_KI > 0.0f)
+		if (two_ki > 0.0f)
 		{
-			workspace->integralFBx += TWO_KI * halfex * (1.0f / workspace->sample_rate); // integral error scaled by Ki
-			workspace->integralFBy += TWO_KI * halfey * (1.0f / workspace->sample_rate);
-			workspace->integralFBz += TWO_KI * halfez * (1.0f / workspace->sample_rate);
-			gx += workspace->integralFBx; // apply integral feedback
-			gy += workspace->integralFBy;
-			gz += workspace->integralFBz;
+			integralFB[0] += two_ki * halfex * dt; // integral error scaled by Ki
+			integralFB[1] += two_ki * halfey * dt;
+			integralFB[2] += two_ki * halfez * dt;
+			AHRS_STAT_INTEGRAL(integralFB);
+			gx += integralFB[0]; // apply integral feedback
+			gy += integralFB[1];
+			gz += integralFB[2];
 		} else {
-			workspace->integralFBx = 0.0f; // prevent integral windup
-			workspace->integralFBy = 0.0f;
-			workspace->integralFBz = 0.0f;
+			integralFB[0] = 0.0f; // prevent integral windup
+			integralFB[1] = 0.0f;
+			integralFB[2] = 0.0f;
 		}
 
 		// Apply proportional feedback
-		gx += TWO_KP * halfex;
-		gy += TWO_KP * halfey;
-		gz += TWO_KP * halfez;
+		gx += two_kp * halfex;
+		gy += two_kp * halfey;
+		gz += two_kp * halfez;
 	}
 
 	// Integrate rate of change of quaternion
-	gx *= (0.5f / workspace->sample_rate); // pre-multiply common factors
-	gy *= (0.5f / workspace->sample_rate);
-	gz *= (0.5f / workspace->sample_rate);
-	qa = workspace->q0;
-	qb = workspace->q1;
-	qc = workspace->q2;
-	workspace->q0 += (-qb * gx - qc * gy - workspace->q3 * gz);
-	workspace->q1 += (qa * gx + qc * gz - workspace->q3 * gy);
-	workspace->q2 += (qa * gy - qb * gz + workspace->q3 * gx);
-	workspace->q3 += (qa * gz + qb * gy - qc * gx);
+	gx *= (0.5f * dt); // pre-multiply common factors
+	gy *= (0.5f * dt);
+	gz *= (0.5f * dt);
+	qa = q0;
+	qb = q1;
+	qc = q2;
+	q0 += (-qb * gx - qc * gy - q3 * gz);
+	q1 += (qa * gx + qc * gz - q3 * gy);
+	q2 += (qa * gy - qb * gz + q3 * gx);
+	q3 += (qa * gz + qb * gy - qc * gx);
 
 	// Normalise quaternion
-	recipNorm = inv_sqrt(workspace->q0 * workspace->q0 + workspace->q1 * workspace->q1 + workspace->q2 * workspace->q2 + workspace->q3 * workspace->q3);
-	workspace->q0 *= recipNorm;
-	workspace->q1 *= recipNorm;
-	workspace->q2 *= recipNorm;
-	workspace->q3 *= recipNorm;
-	
-	COMPUTE_EULER_ANGLE(workspace);
+	recipNorm = inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	q0 *= recipNorm;
+	q1 *= recipNorm;
+	q2 *= recipNorm;
+	q3 *= recipNorm;
+	AHRS_STAT_IF(q0 != q0, AHRS_STAT_NAN);
+	q[0] = q0;
+	q[1] = q1;
+	q[2] = q2;
+	q[3] = q3;
+}
+
+//---------------------------------------------------------------------------------------------------
+// Split steps of the multi-rate updates: the gyro with the integral feedback, and the feedback of the
+// accelerometer and magnetometer errors, each applied over the interval of its sensor
+
+// Gyro propagation, the steps with the integral feedback but no proportional feedback
+MA_INLINE void mahony_predict(MA_PRECISION* q, const MA_PRECISION* integralFB, MA_PRECISION dt, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz)
+{
+	MA_PRECISION q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	MA_PRECISION recipNorm;
+
+	AHRS_STAT_ADD(AHRS_STAT_UPDATES, 1);
+	gx = (gx + integralFB[0]) * (0.5f * dt);
+	gy = (gy + integralFB[1]) * (0.5f * dt);
+	gz = (gz + integralFB[2]) * (0.5f * dt);
+	q0 += (-q[1] * gx - q[2] * gy - q[3] * gz);
+	q1 += (q[0] * gx + q[2] * gz - q[3] * gy);
+	q2 += (q[0] * gy - q[1] * gz + q[3] * gx);
+	q3 += (q[0] * gz + q[1] * gy - q[2] * gx);
+
+	recipNorm = inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	q[0] = q0 * recipNorm;
+	q[1] = q1 * recipNorm;
+	q[2] = q2 * recipNorm;
+	q[3] = q3 * recipNorm;
+	AHRS_STAT_IF(q[0] != q[0], AHRS_STAT_NAN);
+}
+
+// Applies the error halfe over dt: integral feedback, then the rotation by two_kp * halfe * dt
+MA_INLINE void mahony_feedback(MA_PRECISION* q, MA_PRECISION* integralFB, MA_PRECISION dt, MA_PRECISION two_kp, MA_PRECISION two_ki, MA_PRECISION halfex, MA_PRECISION halfey, MA_PRECISION halfez)
+{
+	MA_PRECISION q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	MA_PRECISION recipNorm;
+	MA_PRECISION gx, gy, gz;
+
+	if (two_ki > 0.0f)
+	{
+		integralFB[0] += two_ki * halfex * dt; // integral error scaled by Ki
+		integralFB[1] += two_ki * halfey * dt;
+		integralFB[2] += two_ki * halfez * dt;
+		AHRS_STAT_INTEGRAL(integralFB);
+	} else {
+		integralFB[0] = 0.0f; // prevent integral windup
+		integralFB[1] = 0.0f;
+		integralFB[2] = 0.0f;
+	}
+
+	gx = two_kp * halfex * (0.5f * dt);
+	gy = two_kp * halfey * (0.5f * dt);
+	gz = two_kp * halfez * (0.5f * dt);
+	q0 += (-q[1] * gx - q[2] * gy - q[3] * gz);
+	q1 += (q[0] * gx + q[2] * gz - q[3] * gy);
+	q2 += (q[0] * gy - q[1] * gz + q[3] * gx);
+	q3 += (q[0] * gz + q[1] * gy - q[2] * gx);
+
+	recipNorm = inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	q[0] = q0 * recipNorm;
+	q[1] = q1 * recipNorm;
+	q[2] = q2 * recipNorm;
+	q[3] = q3 * recipNorm;
+}
+
+// Accelerometer correction: cross product of the measured and estimated direction of gravity
+MA_INLINE void mahony_correct_accel(MA_PRECISION* q, MA_PRECISION* integralFB, MA_PRECISION dt, MA_PRECISION two_kp, MA_PRECISION two_ki, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az)
+{
+	MA_PRECISION q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	MA_PRECISION recipNorm;
+	MA_PRECISION halfvx, halfvy, halfvz;
+
+	AHRS_STAT_IF((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f), AHRS_STAT_ACCEL_INVALID);
+	if ((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f)) return;
+
+	recipNorm = inv_sqrt(ax * ax + ay * ay + az * az);
+	ax *= recipNorm;
+	ay *= recipNorm;
+	az *= recipNorm;
+
+	halfvx = q1 * q3 - q0 * q2;
+	halfvy = q0 * q1 + q2 * q3;
+	halfvz = q0 * q0 - 0.5f + q3 * q3;
+
+	mahony_feedback(q, integralFB, dt, two_kp, two_ki, ay * halfvz - az * halfvy, az * halfvx - ax * halfvz, ax * halfvy - ay * halfvx);
+}
+
+// Magnetometer correction: cross product of the measured and estimated direction of the field
+MA_INLINE void mahony_correct_mag(MA_PRECISION* q, MA_PRECISION* integralFB, MA_PRECISION dt, MA_PRECISION two_kp, MA_PRECISION two_ki, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz)
+{
+	MA_PRECISION q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	MA_PRECISION recipNorm;
+	MA_PRECISION q0q1, q0q2, q0q3, q1q1, q1q2, q1q3, q2q2, q2q3, q3q3;
+	MA_PRECISION hx, hy, bx, bz;
+	MA_PRECISION halfwx, halfwy, halfwz;
+
+	AHRS_STAT_IF((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f), AHRS_STAT_MAG_FALLBACK);
+	if ((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f)) return;
+
+	recipNorm = inv_sqrt(mx * mx + my * my + mz * mz);
+	mx *= recipNorm;
+	my *= recipNorm;
+	mz *= recipNorm;
+
+	q0q1 = q0 * q1;
+	q0q2 = q0 * q2;
+	q0q3 = q0 * q3;
+	q1q1 = q1 * q1;
+	q1q2 = q1 * q2;
+	q1q3 = q1 * q3;
+	q2q2 = q2 * q2;
+	q2q3 = q2 * q3;
+	q3q3 = q3 * q3;
+
+	// Reference direction of Earth's magnetic field
+	hx = 2.0f * (mx * (0.5f - q2q2 - q3q3) + my * (q1q2 - q0q3) + mz * (q1q3 + q0q2));
+	hy = 2.0f * (mx * (q1q2 + q0q3) + my * (0.5f - q1q1 - q3q3) + mz * (q2q3 - q0q1));
+	bx = SQRT(hx * hx + hy * hy);
+	bz = 2.0f * (mx * (q1q3 - q0q2) + my * (q2q3 + q0q1) + mz * (0.5f - q1q1 - q2q2));
+
+	halfwx = bx * (0.5f - q2q2 - q3q3) + bz * (q1q3 - q0q2);
+	halfwy = bx * (q1q2 - q0q3) + bz * (q0q1 + q2q3);
+	halfwz = bx * (q0q2 + q1q3) + bz * (0.5f - q1q1 - q2q2);
+
+	mahony_feedback(q, integralFB, dt, two_kp, two_ki, my * halfwz - mz * halfwy, mz * halfwx - mx * halfwz, mx * halfwy - my * halfwx);
+}
+
+//---------------------------------------------------------------------------------------------------
+// Batch loops. Instantiated with a literal two_ki of zero when integral feedback is disabled and
+// with a NULL calibration, decimator and linear acceleration output for the plain batches, so those
+// specialisations run without the blocks. Return the quaternions written.
+MA_INLINE size_t mahony_imu_batch_run(MA_PRECISION* q, MA_PRECISION* integralFB, MA_PRECISION dt, MA_PRECISION two_kp, MA_PRECISION two_ki, const AHRSCalibration* calibration, AHRSDecimator* decimator, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions, const AHRSVectorArray* linear, MA_PRECISION gravity)
+{
+	size_t g = 0, a = 0, l = 0, written = 0;
+	const size_t factor = decimator != NULL ? decimator->factor : 1;
+	size_t phase = decimator != NULL ? decimator->phase : 0;
+	for(size_t i = 0; i < count; i++, g += gyro.stride, a += accel.stride) {
+		MA_PRECISION gx = gyro.x[g], gy = gyro.y[g], gz = gyro.z[g];
+		MA_PRECISION ax = accel.x[a], ay = accel.y[a], az = accel.z[a];
+		if(calibration != NULL) {
+			ahrs_calibrate(&calibration->gyro, 0, &gx, &gy, &gz);
+			ahrs_calibrate(&calibration->accel, 1, &ax, &ay, &az);
+		}
+		mahony_imu_step(q, integralFB, dt, two_kp, two_ki, gx, gy, gz, ax, ay, az);
+		if(linear != NULL) {
+			ahrs_linear_acceleration(q, ax, ay, az, gravity, &linear->x[l], &linear->y[l], &linear->z[l]);
+			l += linear->stride;
+		}
+		if(decimator != NULL) {
+			if(++phase < factor) continue;
+			phase = 0;
+		}
+		if(quaternions != NULL) {
+			quaternions[0] = q[0];
+			quaternions[1] = q[1];
+			quaternions[2] = q[2];
+			quaternions[3] = q[3];
+			quaternions += 4;
+			written++;
+		}
+	}
+	if(decimator != NULL) decimator->phase = phase;
+	return written;
+}
+
+MA_INLINE size_t mahony_batch_run(MA_PRECISION* q, MA_PRECISION* integralFB, MA_PRECISION dt, MA_PRECISION two_kp, MA_PRECISION two_ki, const AHRSCalibration* calibration, AHRSDecimator* decimator, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions, const AHRSVectorArray* linear, MA_PRECISION gravity)
+{
+	size_t g = 0, a = 0, m = 0, l = 0, written = 0;
+	const size_t factor = decimator != NULL ? decimator->factor : 1;
+	size_t phase = decimator != NULL ? decimator->phase : 0;
+	for(size_t i = 0; i < count; i++, g += gyro.stride, a += accel.stride, m += mag.stride) {
+		MA_PRECISION gx = gyro.x[g], gy = gyro.y[g], gz = gyro.z[g];
+		MA_PRECISION ax = accel.x[a], ay = accel.y[a], az = accel.z[a];
+		MA_PRECISION mx = mag.x[m], my = mag.y[m], mz = mag.z[m];
+		if(calibration != NULL) {
+			ahrs_calibrate(&calibration->gyro, 0, &gx, &gy, &gz);
+			ahrs_calibrate(&calibration->accel, 1, &ax, &ay, &az);
+			ahrs_calibrate(&calibration->mag, 1, &mx, &my, &mz);
+		}
+		mahony_step(q, integralFB, dt, two_kp, two_ki, gx, gy, gz, ax, ay, az, mx, my, mz);
+		if(linear != NULL) {
+			ahrs_linear_acceleration(q, ax, ay, az, gravity, &linear->x[l], &linear->y[l], &linear->z[l]);
+			l += linear->stride;
+		}
+		if(decimator != NULL) {
+			if(++phase < factor) continue;
+			phase = 0;
+		}
+		if(quaternions != NULL) {
+			quaternions[0] = q[0];
+			quaternions[1] = q[1];
+			quaternions[2] = q[2];
+			quaternions[3] = q[3];
+			quaternions += 4;
+			written++;
+		}
+	}
+	if(decimator != NULL) decimator->phase = phase;
+	return written;
+}
+
+//====================================================================================================
+// Functions
+
+//---------------------------------------------------------------------------------------------------
+// IMU algorithm update
+void mahony_ahrs_update_imu(MahonyAHRS* workspace, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az)
+{
+	AHRS_STATS_START(start);
+	MA_PRECISION q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	MA_PRECISION integralFB[3] = { workspace->integralFBx, workspace->integralFBy, workspace->integralFBz };
+	mahony_imu_step(q, integralFB, 1.0f / workspace->sample_rate, MAHONY_TWO_KP(workspace), MAHONY_TWO_KI(workspace), gx, gy, gz, ax, ay, az);
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+	workspace->integralFBx = integralFB[0];
+	workspace->integralFBy = integralFB[1];
+	workspace->integralFBz = integralFB[2];
+
+	workspace->euler_dirty = 1;
+	AHRS_STATS_STOP(start, 1);
+}
+
+//---------------------------------------------------------------------------------------------------
+// AHRS algorithm update
+void mahony_ahrs_update(MahonyAHRS* workspace, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz)
+{
+	AHRS_STATS_START(start);
+	MA_PRECISION q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	MA_PRECISION integralFB[3] = { workspace->integralFBx, workspace->integralFBy, workspace->integralFBz };
+	mahony_step(q, integralFB, 1.0f / workspace->sample_rate, MAHONY_TWO_KP(workspace), MAHONY_TWO_KI(workspace), gx, gy, gz, ax, ay, az, mx, my, mz);
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+	workspace->integralFBx = integralFB[0];
+	workspace->integralFBy = integralFB[1];
+	workspace->integralFBz = integralFB[2];
+
+	workspace->euler_dirty = 1;
+	AHRS_STATS_STOP(start, 1);
+}
+
+//---------------------------------------------------------------------------------------------------
+// Batched updates, `marg` constant per call site
+MA_INLINE size_t mahony_batch(MahonyAHRS* workspace, const AHRSCalibration* calibration, AHRSDecimator* decimator, int marg, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions, const AHRSVectorArray* linear, MA_PRECISION gravity)
+{
+	const MA_PRECISION dt = 1.0f / workspace->sample_rate;
+	const MA_PRECISION two_kp = MAHONY_TWO_KP(workspace);
+	const MA_PRECISION two_ki = MAHONY_TWO_KI(workspace);
+	MA_PRECISION q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	MA_PRECISION integralFB[3] = { workspace->integralFBx, workspace->integralFBy, workspace->integralFBz };
+
+	size_t written;
+	if(marg) {
+		if(two_ki > 0.0f) written = mahony_batch_run(q, integralFB, dt, two_kp, two_ki, calibration, decimator, gyro, accel, mag, count, quaternions, linear, gravity);
+		else written = mahony_batch_run(q, integralFB, dt, two_kp, 0.0f, calibration, decimator, gyro, accel, mag, count, quaternions, linear, gravity);
+	} else {
+		if(two_ki > 0.0f) written = mahony_imu_batch_run(q, integralFB, dt, two_kp, two_ki, calibration, decimator, gyro, accel, count, quaternions, linear, gravity);
+		else written = mahony_imu_batch_run(q, integralFB, dt, two_kp, 0.0f, calibration, decimator, gyro, accel, count, quaternions, linear, gravity);
+	}
+
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+	workspace->integralFBx = integralFB[0];
+	workspace->integralFBy = integralFB[1];
+	workspace->integralFBz = integralFB[2];
+
+	workspace->euler_dirty = 1;
+	return written;
+}
+
+//---------------------------------------------------------------------------------------------------
+// Batched IMU algorithm update
+void mahony_ahrs_update_imu_batch(MahonyAHRS* workspace, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions)
+{
+	if(workspace == NULL || count == 0) return;
+	AHRS_STATS_START(start);
+	AHRSSensorArray none = { NULL, NULL, NULL, 0 };
+	mahony_batch(workspace, NULL, NULL, 0, gyro, accel, none, count, quaternions, NULL, 0.0f);
+	AHRS_STATS_STOP(start, count);
+}
+
+//---------------------------------------------------------------------------------------------------
+// Batched AHRS algorithm update
+void mahony_ahrs_update_batch(MahonyAHRS* workspace, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions)
+{
+	if(workspace == NULL || count == 0) return;
+	AHRS_STATS_START(start);
+	mahony_batch(workspace, NULL, NULL, 1, gyro, accel, mag, count, quaternions, NULL, 0.0f);
+	AHRS_STATS_STOP(start, count);
+}
+
+//---------------------------------------------------------------------------------------------------
+// Batched updates with calibration. The loop reads a local copy of the calibration, which the
+// quaternion stores cannot alias.
+void mahony_ahrs_update_imu_batch_calibrated(MahonyAHRS* workspace, const AHRSCalibration* calibration, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions)
+{
+	if(workspace == NULL || count == 0) return;
+	if(calibration == NULL) {
+		mahony_ahrs_update_imu_batch(workspace, gyro, accel, count, quaternions);
+		return;
+	}
+	AHRS_STATS_START(start);
+	const AHRSCalibration local = *calibration;
+	AHRSSensorArray none = { NULL, NULL, NULL, 0 };
+	mahony_batch(workspace, &local, NULL, 0, gyro, accel, none, count, quaternions, NULL, 0.0f);
+	AHRS_STATS_STOP(start, count);
+}
+
+void mahony_ahrs_update_batch_calibrated(MahonyAHRS* workspace, const AHRSCalibration* calibration, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions)
+{
+	if(workspace == NULL || count == 0) return;
+	if(calibration == NULL) {
+		mahony_ahrs_update_batch(workspace, gyro, accel, mag, count, quaternions);
+		return;
+	}
+	AHRS_STATS_START(start);
+	const AHRSCalibration local = *calibration;
+	mahony_batch(workspace, &local, NULL, 1, gyro, accel, mag, count, quaternions, NULL, 0.0f);
+	AHRS_STATS_STOP(start, count);
+}
+
+//---------------------------------------------------------------------------------------------------
+// Decimated batched updates
+size_t mahony_ahrs_update_imu_batch_decimated(MahonyAHRS* workspace, AHRSDecimator* decimator, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions)
+{
+	if(workspace == NULL || decimator == NULL || decimator->factor == 0 || count == 0) return 0;
+	AHRS_STATS_START(start);
+	AHRSSensorArray none = { NULL, NULL, NULL, 0 };
+	size_t written = mahony_batch(workspace, NULL, decimator, 0, gyro, accel, none, count, quaternions, NULL, 0.0f);
+	AHRS_STATS_STOP(start, count);
+	return written;
+}
+
+size_t mahony_ahrs_update_batch_decimated(MahonyAHRS* workspace, AHRSDecimator* decimator, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions)
+{
+	if(workspace == NULL || decimator == NULL || decimator->factor == 0 || count == 0) return 0;
+	AHRS_STATS_START(start);
+	size_t written = mahony_batch(workspace, NULL, decimator, 1, gyro, accel, mag, count, quaternions, NULL, 0.0f);
+	AHRS_STATS_STOP(start, count);
+	return written;
+}
+
+//---------------------------------------------------------------------------------------------------
+// Batched updates with the linear acceleration computed while the quaternion is in registers
+void mahony_ahrs_update_imu_batch_linear(MahonyAHRS* workspace, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions, MA_PRECISION gravity, AHRSVectorArray linear)
+{
+	if(workspace == NULL || linear.x == NULL || count == 0) return;
+	AHRS_STATS_START(start);
+	AHRSSensorArray none = { NULL, NULL, NULL, 0 };
+	mahony_batch(workspace, NULL, NULL, 0, gyro, accel, none, count, quaternions, &linear, gravity);
+	AHRS_STATS_STOP(start, count);
+}
+
+void mahony_ahrs_update_batch_linear(MahonyAHRS* workspace, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions, MA_PRECISION gravity, AHRSVectorArray linear)
+{
+	if(workspace == NULL || linear.x == NULL || count == 0) return;
+	AHRS_STATS_START(start);
+	mahony_batch(workspace, NULL, NULL, 1, gyro, accel, mag, count, quaternions, &linear, gravity);
+	AHRS_STATS_STOP(start, count);
+}
+
+//====================================================================================================
+// Per-sample dt updates
+
+static MA_PRECISION mahony_max_dt(const MahonyAHRS* workspace){
+	return workspace->max_dt > 0.0f ? workspace->max_dt : AHRS_GAP_PERIODS / workspace->sample_rate;
+}
+
+// Gyro propagation over a gap, with the integral term as bias correction
+MA_INLINE void mahony_gap_propagate(MA_PRECISION* q, const MA_PRECISION* integralFB, MA_PRECISION dt, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz)
+{
+	ahrs_gyro_propagate(q, dt, gx + integralFB[0], gy + integralFB[1], gz + integralFB[2]);
+}
+
+//---------------------------------------------------------------------------------------------------
+// IMU algorithm update over dt
+void mahony_ahrs_update_imu_dt(MahonyAHRS* workspace, MA_PRECISION dt, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az)
+{
+	if(workspace == NULL || !(dt > 0.0f)) return;
+	AHRS_STATS_START(start);
+	MA_PRECISION q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	MA_PRECISION integralFB[3] = { workspace->integralFBx, workspace->integralFBy, workspace->integralFBz };
+	const MA_PRECISION max_dt = mahony_max_dt(workspace);
+	AHRS_STAT_IF(dt > max_dt, AHRS_STAT_GAP);
+	if(ahrs_gap_propagate_only(&dt, max_dt, workspace->gap_policy)) mahony_gap_propagate(q, integralFB, dt, gx, gy, gz);
+	else mahony_imu_step(q, integralFB, dt, MAHONY_TWO_KP(workspace), MAHONY_TWO_KI(workspace), gx, gy, gz, ax, ay, az);
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+	workspace->integralFBx = integralFB[0];
+	workspace->integralFBy = integralFB[1];
+	workspace->integralFBz = integralFB[2];
+
+	workspace->euler_dirty = 1;
+	AHRS_STATS_STOP(start, 1);
+}
+
+//---------------------------------------------------------------------------------------------------
+// AHRS algorithm update over dt
+void mahony_ahrs_update_dt(MahonyAHRS* workspace, MA_PRECISION dt, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz)
+{
+	if(workspace == NULL || !(dt > 0.0f)) return;
+	AHRS_STATS_START(start);
+	MA_PRECISION q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	MA_PRECISION integralFB[3] = { workspace->integralFBx, workspace->integralFBy, workspace->integralFBz };
+	const MA_PRECISION max_dt = mahony_max_dt(workspace);
+	AHRS_STAT_IF(dt > max_dt, AHRS_STAT_GAP);
+	if(ahrs_gap_propagate_only(&dt, max_dt, workspace->gap_policy)) mahony_gap_propagate(q, integralFB, dt, gx, gy, gz);
+	else mahony_step(q, integralFB, dt, MAHONY_TWO_KP(workspace), MAHONY_TWO_KI(workspace), gx, gy, gz, ax, ay, az, mx, my, mz);
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+	workspace->integralFBx = integralFB[0];
+	workspace->integralFBy = integralFB[1];
+	workspace->integralFBz = integralFB[2];
+
+	workspace->euler_dirty = 1;
+	AHRS_STATS_STOP(start, 1);
+}
+
+//---------------------------------------------------------------------------------------------------
+// Batched timestamped update. `marg` is constant per call site and two_ki a literal zero when the
+// integral feedback is disabled, as for the batch loops above, and the decimator a literal NULL for
+// the plain batches. Intervals are integer differences scaled by 1e-9: no division per sample.
+// Returns the quaternions written.
+MA_INLINE size_t mahony_timestamped_run(MA_PRECISION* q, MA_PRECISION* integralFB, uint64_t* last, MA_PRECISION max_dt, int policy, MA_PRECISION two_kp, MA_PRECISION two_ki, AHRSDecimator* decimator, const uint64_t* timestamps, size_t timestamp_stride, int marg, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions, uint64_t* output_timestamps)
+{
+	size_t t = 0, g = 0, a = 0, m = 0, written = 0;
+	uint64_t previous = *last, next = 0;
+	if(decimator != NULL) next = ahrs_decimator_start(decimator, timestamps[0]);
+	for(size_t i = 0; i < count; i++, t += timestamp_stride, g += gyro.stride, a += accel.stride, m += mag.stride) {
+		int64_t delta = (int64_t)(timestamps[t] - previous);
+		AHRS_STAT_IF(delta <= 0, AHRS_STAT_STALE_TIMESTAMP);
+		if(delta > 0) {
+			const MA_PRECISION before[4] = { q[0], q[1], q[2], q[3] };
+			const uint64_t before_time = previous;
+			previous = timestamps[t];
+			MA_PRECISION dt = (MA_PRECISION) delta * (MA_PRECISION) 1e-9;
+			AHRS_STAT_IF(dt > max_dt, AHRS_STAT_GAP);
+			if(ahrs_gap_propagate_only(&dt, max_dt, policy)) mahony_gap_propagate(q, integralFB, dt, gyro.x[g], gyro.y[g], gyro.z[g]);
+			else if(marg) mahony_step(q, integralFB, dt, two_kp, two_ki, gyro.x[g], gyro.y[g], gyro.z[g], accel.x[a], accel.y[a], accel.z[a], mag.x[m], mag.y[m], mag.z[m]);
+			else mahony_imu_step(q, integralFB, dt, two_kp, two_ki, gyro.x[g], gyro.y[g], gyro.z[g], accel.x[a], accel.y[a], accel.z[a]);
+			if(decimator != NULL) {
+				for(; next < previous; next += decimator->period) {
+					ahrs_decimator_output(decimator, next, before, before_time, q, delta, quaternions, output_timestamps, written);
+					written++;
+				}
+			}
+		}
+		if(decimator != NULL) continue;
+		if(quaternions != NULL) {
+			quaternions[0] = q[0];
+			quaternions[1] = q[1];
+			quaternions[2] = q[2];
+			quaternions[3] = q[3];
+			quaternions += 4;
+		}
+	}
+	if(decimator != NULL) decimator->next = next;
+	*last = previous;
+	return written;
+}
+
+// `marg` and the decimator constant per call site
+MA_INLINE size_t mahony_timestamped(MahonyAHRS* workspace, AHRSDecimator* decimator, const uint64_t* timestamps, size_t timestamp_stride, int marg, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions, uint64_t* output_timestamps)
+{
+	AHRS_STATS_START(start);
+	const MA_PRECISION max_dt = mahony_max_dt(workspace);
+	const int policy = workspace->gap_policy;
+	const MA_PRECISION two_kp = MAHONY_TWO_KP(workspace);
+	const MA_PRECISION two_ki = MAHONY_TWO_KI(workspace);
+	MA_PRECISION q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	MA_PRECISION integralFB[3] = { workspace->integralFBx, workspace->integralFBy, workspace->integralFBz };
+	uint64_t previous = workspace->has_timestamp ? workspace->timestamp : timestamps[0] - (uint64_t)(1e9 / workspace->sample_rate);
+
+	size_t written;
+	if(marg) {
+		if(two_ki > 0.0f) written = mahony_timestamped_run(q, integralFB, &previous, max_dt, policy, two_kp, two_ki, decimator, timestamps, timestamp_stride, 1, gyro, accel, mag, count, quaternions, output_timestamps);
+		else written = mahony_timestamped_run(q, integralFB, &previous, max_dt, policy, two_kp, 0.0f, decimator, timestamps, timestamp_stride, 1, gyro, accel, mag, count, quaternions, output_timestamps);
+	} else {
+		if(two_ki > 0.0f) written = mahony_timestamped_run(q, integralFB, &previous, max_dt, policy, two_kp, two_ki, decimator, timestamps, timestamp_stride, 0, gyro, accel, mag, count, quaternions, output_timestamps);
+		else written = mahony_timestamped_run(q, integralFB, &previous, max_dt, policy, two_kp, 0.0f, decimator, timestamps, timestamp_stride, 0, gyro, accel, mag, count, quaternions, output_timestamps);
+	}
+
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+	workspace->integralFBx = integralFB[0];
+	workspace->integralFBy = integralFB[1];
+	workspace->integralFBz = integralFB[2];
+	workspace->timestamp = previous;
+	workspace->has_timestamp = 1;
+
+	workspace->euler_dirty = 1;
+	AHRS_STATS_STOP(start, count);
+	return written;
+}
+
+void mahony_ahrs_update_imu_batch_timestamped(MahonyAHRS* workspace, const uint64_t* timestamps, size_t timestamp_stride, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions)
+{
+	if(workspace == NULL || timestamps == NULL || count == 0) return;
+	AHRSSensorArray none = { NULL, NULL, NULL, 0 };
+	mahony_timestamped(workspace, NULL, timestamps, timestamp_stride, 0, gyro, accel, none, count, quaternions, NULL);
+}
+
+void mahony_ahrs_update_batch_timestamped(MahonyAHRS* workspace, const uint64_t* timestamps, size_t timestamp_stride, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions)
+{
+	if(workspace == NULL || timestamps == NULL || count == 0) return;
+	mahony_timestamped(workspace, NULL, timestamps, timestamp_stride, 1, gyro, accel, mag, count, quaternions, NULL);
+}
+
+size_t mahony_ahrs_update_imu_batch_timestamped_decimated(MahonyAHRS* workspace, AHRSDecimator* decimator, const uint64_t* timestamps, size_t timestamp_stride, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions, uint64_t* output_timestamps)
+{
+	if(workspace == NULL || decimator == NULL || decimator->period == 0 || timestamps == NULL || count == 0) return 0;
+	AHRSSensorArray none = { NULL, NULL, NULL, 0 };
+	return mahony_timestamped(workspace, decimator, timestamps, timestamp_stride, 0, gyro, accel, none, count, quaternions, output_timestamps);
+}
+
+size_t mahony_ahrs_update_batch_timestamped_decimated(MahonyAHRS* workspace, AHRSDecimator* decimator, const uint64_t* timestamps, size_t timestamp_stride, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions, uint64_t* output_timestamps)
+{
+	if(workspace == NULL || decimator == NULL || decimator->period == 0 || timestamps == NULL || count == 0) return 0;
+	return mahony_timestamped(workspace, decimator, timestamps, timestamp_stride, 1, gyro, accel, mag, count, quaternions, output_timestamps);
+}
+
+//====================================================================================================
+// Multi-rate updates
+
+void mahony_ahrs_predict(MahonyAHRS* workspace, MA_PRECISION dt, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz)
+{
+	if(workspace == NULL || !(dt > 0.0f)) return;
+	AHRS_STATS_START(start);
+	MA_PRECISION q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	const MA_PRECISION integralFB[3] = { workspace->integralFBx, workspace->integralFBy, workspace->integralFBz };
+	const MA_PRECISION max_dt = mahony_max_dt(workspace);
+	AHRS_STAT_IF(dt > max_dt, AHRS_STAT_GAP);
+	if(ahrs_gap_propagate_only(&dt, max_dt, workspace->gap_policy)) mahony_gap_propagate(q, integralFB, dt, gx, gy, gz);
+	else mahony_predict(q, integralFB, dt, gx, gy, gz);
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+
+	workspace->euler_dirty = 1;
+	AHRS_STATS_STOP(start, 1);
+}
+
+void mahony_ahrs_correct_accel(MahonyAHRS* workspace, MA_PRECISION dt, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az)
+{
+	if(workspace == NULL || !(dt > 0.0f)) return;
+	AHRS_STATS_START(start);
+	MA_PRECISION q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	MA_PRECISION integralFB[3] = { workspace->integralFBx, workspace->integralFBy, workspace->integralFBz };
+	mahony_correct_accel(q, integralFB, dt < AHRS_CORRECTION_MAX_DT ? dt : AHRS_CORRECTION_MAX_DT, MAHONY_TWO_KP(workspace), MAHONY_TWO_KI(workspace), ax, ay, az);
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+	workspace->integralFBx = integralFB[0];
+	workspace->integralFBy = integralFB[1];
+	workspace->integralFBz = integralFB[2];
+
+	workspace->euler_dirty = 1;
+	AHRS_STATS_STOP(start, 1);
 }
 
+void mahony_ahrs_correct_mag(MahonyAHRS* workspace, MA_PRECISION dt, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz)
+{
+	if(workspace == NULL || !(dt > 0.0f)) return;
+	AHRS_STATS_START(start);
+	MA_PRECISION q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	MA_PRECISION integralFB[3] = { workspace->integralFBx, workspace->integralFBy, workspace->integralFBz };
+	mahony_correct_mag(q, integralFB, dt < AHRS_CORRECTION_MAX_DT ? dt : AHRS_CORRECTION_MAX_DT, MAHONY_TWO_KP(workspace), MAHONY_TWO_KI(workspace), mx, my, mz);
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+	workspace->integralFBx = integralFB[0];
+	workspace->integralFBy = integralFB[1];
+	workspace->integralFBz = integralFB[2];
+
+	workspace->euler_dirty = 1;
+	AHRS_STATS_STOP(start, 1);
+}
+
+void mahony_ahrs_update_events(MahonyAHRS* workspace, const AHRSSensorEvent* events, size_t count, MA_PRECISION* quaternions)
+{
+	if(workspace == NULL || events == NULL || count == 0) return;
+	AHRS_STATS_START(start);
+	const MA_PRECISION two_kp = MAHONY_TWO_KP(workspace);
+	const MA_PRECISION two_ki = MAHONY_TWO_KI(workspace);
+	const MA_PRECISION max_dt = mahony_max_dt(workspace);
+	const int policy = workspace->gap_policy;
+	MA_PRECISION q[4] = { workspace->q0, workspace->q1, workspace->q2, workspace->q3 };
+	MA_PRECISION integralFB[3] = { workspace->integralFBx, workspace->integralFBy, workspace->integralFBz };
+	const uint64_t period = (uint64_t)(1e9 / workspace->sample_rate);
+	uint64_t previous = workspace->timestamp;
+	int has_timestamp = workspace->has_timestamp;
+	uint64_t accel_timestamp = workspace->accel_timestamp, mag_timestamp = workspace->mag_timestamp;
+	int has_accel_timestamp = workspace->has_accel_timestamp, has_mag_timestamp = workspace->has_mag_timestamp;
+
+	for(size_t i = 0; i < count; i++) {
+		const AHRSSensorEvent* e = &events[i];
+		if(e->sensor == AHRS_SENSOR_GYRO) {
+			if(!has_timestamp) {
+				previous = e->timestamp - period;
+				has_timestamp = 1;
+			}
+			int64_t delta = (int64_t)(e->timestamp - previous);
+			AHRS_STAT_IF(delta <= 0, AHRS_STAT_STALE_TIMESTAMP);
+			if(delta > 0) {
+				previous = e->timestamp;
+				MA_PRECISION dt = (MA_PRECISION) delta * (MA_PRECISION) 1e-9;
+				AHRS_STAT_IF(dt > max_dt, AHRS_STAT_GAP);
+				if(ahrs_gap_propagate_only(&dt, max_dt, policy)) mahony_gap_propagate(q, integralFB, dt, e->x, e->y, e->z);
+				else mahony_predict(q, integralFB, dt, e->x, e->y, e->z);
+			}
+		} else if(e->sensor == AHRS_SENSOR_ACCEL) {
+			MA_PRECISION dt = ahrs_correction_dt(&accel_timestamp, &has_accel_timestamp, e->timestamp);
+			if(dt > 0.0f) mahony_correct_accel(q, integralFB, dt, two_kp, two_ki, e->x, e->y, e->z);
+		} else if(e->sensor == AHRS_SENSOR_MAG) {
+			MA_PRECISION dt = ahrs_correction_dt(&mag_timestamp, &has_mag_timestamp, e->timestamp);
+			if(dt > 0.0f) mahony_correct_mag(q, integralFB, dt, two_kp, two_ki, e->x, e->y, e->z);
+		}
+		if(quaternions != NULL) {
+			quaternions[0] = q[0];
+			quaternions[1] = q[1];
+			quaternions[2] = q[2];
+			quaternions[3] = q[3];
+			quaternions += 4;
+		}
+	}
+
+	workspace->q0 = q[0];
+	workspace->q1 = q[1];
+	workspace->q2 = q[2];
+	workspace->q3 = q[3];
+	workspace->integralFBx = integralFB[0];
+	workspace->integralFBy = integralFB[1];
+	workspace->integralFBz = integralFB[2];
+	workspace->timestamp = previous;
+	workspace->has_timestamp = has_timestamp;
+	workspace->accel_timestamp = accel_timestamp;
+	workspace->mag_timestamp = mag_timestamp;
+	workspace->has_accel_timestamp = has_accel_timestamp;
+	workspace->has_mag_timestamp = has_mag_timestamp;
+
+	workspace->euler_dirty = 1;
+	AHRS_STATS_STOP(start, count);
+}
@@ -17,8 +17,14 @@
 
 #include "arhs.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct {
     MA_PRECISION sample_rate;
+    MA_PRECISION two_kp;    // 2 * proportional gain, TWO_KP unless changed with mahony_ahrs_set_gains
+    MA_PRECISION two_ki;    // 2 * integral gain, TWO_KI unless changed with mahony_ahrs_set_gains
     MA_PRECISION q0;
     MA_PRECISION q1;
     MA_PRECISION q2;
@@ -27,27 +33,134 @@ typedef struct {
     MA_PRECISION integralFBx;
     MA_PRECISION integralFBy;
     MA_PRECISION integralFBz;
+
+    // Per-sample dt updates, see AHRS_GAP_* in arhs.h
+    MA_PRECISION max_dt;    // longest interval integrated normally, 0: AHRS_GAP_PERIODS sample periods
+    int gap_policy;         // AHRS_GAP_PROPAGATE unless changed with mahony_ahrs_set_gap_policy
+    int has_timestamp;      // timestamp is the last sample of a timestamped update
+    uint64_t timestamp;     // ns
+    uint64_t accel_timestamp;   // ns of the last accelerometer / magnetometer event
+    uint64_t mag_timestamp;
+    int has_accel_timestamp;    // accel_timestamp / mag_timestamp are set
+    int has_mag_timestamp;
     
-    // Result variables
+    // Result variables, computed on demand by mahony_ahrs_get_euler
     MA_PRECISION yaw;
     MA_PRECISION pitch;
     MA_PRECISION roll;
+    int euler_dirty;    // quaternion changed since yaw/pitch/roll were last computed
 } MahonyAHRS;
 //----------------------------------------------------------------------------------------------------
 // Variable declaration
 // https://ahrs.readthedocs.io/en/latest/filters/mahony.html
+// Defaults of MahonyAHRS.two_kp / two_ki
 #define TWO_KP (2.0f * 1.0f)   // 2 * proportional gain (Kp), original 2 * 0.5
 #define TWO_KI (2.0f * 0.3f)     // 2 * integral gain (Ki)
 
-MahonyAHRS* create_mahony_ahrs(MA_PRECISION sample_rate);
+MahonyAHRS* create_mahony_ahrs(MA_PRECISION sample_rate); // NULL for sample_rate <= 0 or out of memory
 void free_mahony_ahrs(MahonyAHRS* workspace);
 
+// Initialises a workspace the caller allocated (e.g. a pool slot) as create_mahony_ahrs does.
+// Returns 0, or -1 for sample_rate <= 0.
+int mahony_ahrs_init(MahonyAHRS* workspace, MA_PRECISION sample_rate);
+
 //---------------------------------------------------------------------------------------------------
 // Function declarations
 void mahony_ahrs_update_sample_rate(MahonyAHRS* workspace, MA_PRECISION sample_rate);
 
+// Changes the gains of this filter without resetting its state, e.g. high gains while converging and
+// low ones in steady state. two_ki == 0 selects the kernels without integral feedback and clears the
+// integral terms at once. Ignored by the kernels when built with MA_FIXED_GAINS.
+void mahony_ahrs_set_gains(MahonyAHRS* workspace, MA_PRECISION two_kp, MA_PRECISION two_ki);
+
+// Gap handling of the per-sample dt updates: intervals longer than `max_dt` seconds (0: AHRS_GAP_PERIODS
+// sample periods) are handled by `policy`, see AHRS_GAP_* in arhs.h. Keeps the state.
+void mahony_ahrs_set_gap_policy(MahonyAHRS* workspace, int policy, MA_PRECISION max_dt);
+
+// Euler angles of the current quaternion. The updates only maintain the quaternion, the angles are
+// computed here when it changed since the last call. Any of the output pointers may be NULL.
+void mahony_ahrs_get_euler(MahonyAHRS* workspace, MA_PRECISION* yaw, MA_PRECISION* pitch, MA_PRECISION* roll);
+
 void mahony_ahrs_update_imu(MahonyAHRS* workspace, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az);
 
 void mahony_ahrs_update(MahonyAHRS* workspace, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz);
 
+//---------------------------------------------------------------------------------------------------
+// Batched updates: run `count` consecutive samples through the filter in one call.
+// Equivalent to calling the per-sample update in a loop. When `quaternions` is not NULL it receives
+// q0, q1, q2, q3 of every sample (4 * count elements).
+void mahony_ahrs_update_imu_batch(MahonyAHRS* workspace, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions);
+
+void mahony_ahrs_update_batch(MahonyAHRS* workspace, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions);
+
+// Batched updates with the sensor calibration (arhs.h) applied to every sample inside the loop, in
+// one pass over the raw samples. NULL `calibration`: as the plain batch updates.
+void mahony_ahrs_update_imu_batch_calibrated(MahonyAHRS* workspace, const AHRSCalibration* calibration, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions);
+
+void mahony_ahrs_update_batch_calibrated(MahonyAHRS* workspace, const AHRSCalibration* calibration, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions);
+
+// Decimated batched updates (AHRSDecimator, arhs.h): every sample goes through the filter, but only
+// every decimator->factor-th quaternion is written to `quaternions`. Returns the quaternions written,
+// at most ahrs_decimator_outputs(decimator, count, 0, 0).
+size_t mahony_ahrs_update_imu_batch_decimated(MahonyAHRS* workspace, AHRSDecimator* decimator, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions);
+
+size_t mahony_ahrs_update_batch_decimated(MahonyAHRS* workspace, AHRSDecimator* decimator, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions);
+
+// Batched updates that also write the earth frame linear acceleration of every sample to `linear`,
+// as madgwick_ahrs_update_batch_linear; `quaternions` may be NULL.
+void mahony_ahrs_update_imu_batch_linear(MahonyAHRS* workspace, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions, MA_PRECISION gravity, AHRSVectorArray linear);
+
+void mahony_ahrs_update_batch_linear(MahonyAHRS* workspace, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions, MA_PRECISION gravity, AHRSVectorArray linear);
+
+//---------------------------------------------------------------------------------------------------
+// Per-sample dt updates, for jittery or dropped samples: each sample is integrated over its own
+// interval instead of 1 / sample_rate, with the gap policy for long ones, and nothing is reset. Gyro
+// propagation over a gap keeps the integral term as gyro bias correction.
+// sample_rate only sets the default max_dt and the interval of the first timestamped sample.
+
+// `dt`: seconds since the previous sample
+void mahony_ahrs_update_imu_dt(MahonyAHRS* workspace, MA_PRECISION dt, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az);
+
+void mahony_ahrs_update_dt(MahonyAHRS* workspace, MA_PRECISION dt, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz);
+
+// Batched updates with a timestamp in ns per sample, timestamps[i * timestamp_stride] (the stride
+// counts uint64_t elements, e.g. sizeof(record) / 8 for timestamps inside records). Intervals are
+// differences to the previous sample, across calls too; as the batch updates otherwise.
+void mahony_ahrs_update_imu_batch_timestamped(MahonyAHRS* workspace, const uint64_t* timestamps, size_t timestamp_stride, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions);
+
+void mahony_ahrs_update_batch_timestamped(MahonyAHRS* workspace, const uint64_t* timestamps, size_t timestamp_stride, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions);
+
+// Decimated timestamped updates: the quaternions at the output times of a period decimator (arhs.h),
+// with their times in `output_timestamps` unless NULL. Returns the quaternions written, at most
+// ahrs_decimator_outputs(decimator, count, first timestamp, last timestamp).
+size_t mahony_ahrs_update_imu_batch_timestamped_decimated(MahonyAHRS* workspace, AHRSDecimator* decimator, const uint64_t* timestamps, size_t timestamp_stride, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions, uint64_t* output_timestamps);
+
+size_t mahony_ahrs_update_batch_timestamped_decimated(MahonyAHRS* workspace, AHRSDecimator* decimator, const uint64_t* timestamps, size_t timestamp_stride, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions, uint64_t* output_timestamps);
+
+//---------------------------------------------------------------------------------------------------
+// Multi-rate updates, for sensors sampled at different rates (e.g. gyro 1 kHz, accelerometer 200 Hz,
+// magnetometer 50 Hz): the gyro, plus the integral feedback, propagates the quaternion at its rate and
+// each accelerometer or magnetometer sample applies the proportional and integral feedback of its own
+// cross product error over `dt`, the interval since the previous sample of its sensor (at most
+// AHRS_CORRECTION_MAX_DT), so the feedback per second does not depend on the rates. Zero
+// accelerometer / magnetometer samples are ignored, dt <= 0 does nothing.
+
+// Gyro-only step over dt seconds, with the gap policy for long intervals
+void mahony_ahrs_predict(MahonyAHRS* workspace, MA_PRECISION dt, MA_PRECISION gx, MA_PRECISION gy, MA_PRECISION gz);
+
+void mahony_ahrs_correct_accel(MahonyAHRS* workspace, MA_PRECISION dt, MA_PRECISION ax, MA_PRECISION ay, MA_PRECISION az);
+
+void mahony_ahrs_correct_mag(MahonyAHRS* workspace, MA_PRECISION dt, MA_PRECISION mx, MA_PRECISION my, MA_PRECISION mz);
+
+// Runs `count` sensor events (arhs.h) in timestamp order: gyro events predict over the interval since
+// the previous gyro sample (shared with the timestamped updates), accelerometer and magnetometer events
+// correct over the interval since the previous sample of their sensor; the first sample of each only
+// sets its time. Stale events are dropped. When `quaternions` is not NULL it receives the quaternion
+// after every event (4 * count elements).
+void mahony_ahrs_update_events(MahonyAHRS* workspace, const AHRSSensorEvent* events, size_t count, MA_PRECISION* quaternions);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* mahony_ahrs_h */
\ No newline at end of file
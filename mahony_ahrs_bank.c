@@ -0,0 +1,108 @@
+//=====================================================================================================
+// mahony_ahrs_bank.c
+//=====================================================================================================
+//
+// Structure-of-arrays bank of Mahony filters, see mahony_ahrs_bank.h.
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "mahony_ahrs_bank.h"
+#include "ahrs_simd.h"
+#include <stdlib.h>
+
+//---------------------------------------------------------------------------------------------------
+// Variable definitions
+static void mahony_bank_reset(MahonyAHRSBank* bank, size_t index, MA_PRECISION sample_rate){
+	bank->sample_rate[index] = sample_rate;
+	bank->sample_period[index] = 1.0f / sample_rate;
+	// quaternion of sensor frame relative to auxiliary frame
+	bank->q0[index] = 1.0f;
+	bank->q1[index] = 0.0f;
+	bank->q2[index] = 0.0f;
+	bank->q3[index] = 0.0f;
+	// integral error terms scaled by Ki
+	bank->integralFBx[index] = 0.0f;
+	bank->integralFBy[index] = 0.0f;
+	bank->integralFBz[index] = 0.0f;
+}
+
+MahonyAHRSBank* create_mahony_ahrs_bank(size_t count, MA_PRECISION sample_rate){
+	if(count == 0 || sample_rate <= 0) return NULL;
+	MahonyAHRSBank* bank = (MahonyAHRSBank *) malloc(sizeof(MahonyAHRSBank));
+	if(bank == NULL) return NULL;
+	bank->count = count;
+	bank->capacity = (count + AHRS_BANK_PADDING - 1) / AHRS_BANK_PADDING * AHRS_BANK_PADDING;
+
+	// One aligned block, carved into the state arrays
+	MA_PRECISION* memory = (MA_PRECISION *) ahrs_aligned_alloc(AHRS_BANK_ALIGNMENT, 11 * bank->capacity * sizeof(MA_PRECISION));
+	if(memory == NULL) {
+		free(bank);
+		return NULL;
+	}
+	bank->sample_rate = memory;
+	bank->sample_period = memory + 1 * bank->capacity;
+	bank->q0 = memory + 2 * bank->capacity;
+	bank->q1 = memory + 3 * bank->capacity;
+	bank->q2 = memory + 4 * bank->capacity;
+	bank->q3 = memory + 5 * bank->capacity;
+	bank->integralFBx = memory + 6 * bank->capacity;
+	bank->integralFBy = memory + 7 * bank->capacity;
+	bank->integralFBz = memory + 8 * bank->capacity;
+	bank->two_kp = memory + 9 * bank->capacity;
+	bank->two_ki = memory + 10 * bank->capacity;
+
+	// Padding lanes are initialised too: they run through the kernel with zero samples
+	for(size_t i = 0; i < bank->capacity; i++) {
+		mahony_bank_reset(bank, i, sample_rate);
+		bank->two_kp[i] = TWO_KP;
+		bank->two_ki[i] = TWO_KI;
+	}
+	return bank;
+}
+
+void mahony_ahrs_bank_update_sample_rate(MahonyAHRSBank* bank, size_t index, MA_PRECISION sample_rate){
+	if(bank == NULL || index >= bank->count) return;
+	if(sample_rate <= 0) return;
+	if(sample_rate != bank->sample_rate[index]) {// Reset the parameters when sample rates are different;
+		mahony_bank_reset(bank, index, sample_rate);
+	}
+}
+
+void mahony_ahrs_bank_set_gains(MahonyAHRSBank* bank, size_t index, MA_PRECISION two_kp, MA_PRECISION two_ki){
+	if(bank == NULL || index >= bank->count) return;
+	if(two_kp < 0 || two_ki < 0) return;
+	bank->two_kp[index] = two_kp;
+	bank->two_ki[index] = two_ki;
+}
+
+void mahony_ahrs_bank_reset(MahonyAHRSBank* bank, size_t index, MA_PRECISION sample_rate){
+	if(bank == NULL || index >= bank->capacity) return;
+	if(sample_rate <= 0) return;
+	mahony_bank_reset(bank, index, sample_rate);
+	bank->two_kp[index] = TWO_KP;
+	bank->two_ki[index] = TWO_KI;
+}
+
+void mahony_ahrs_bank_move(MahonyAHRSBank* bank, size_t from, size_t to){
+	if(bank == NULL || from >= bank->capacity || to >= bank->capacity) return;
+	bank->sample_rate[to] = bank->sample_rate[from];
+	bank->sample_period[to] = bank->sample_period[from];
+	bank->q0[to] = bank->q0[from];
+	bank->q1[to] = bank->q1[from];
+	bank->q2[to] = bank->q2[from];
+	bank->q3[to] = bank->q3[from];
+	bank->integralFBx[to] = bank->integralFBx[from];
+	bank->integralFBy[to] = bank->integralFBy[from];
+	bank->integralFBz[to] = bank->integralFBz[from];
+	bank->two_kp[to] = bank->two_kp[from];
+	bank->two_ki[to] = bank->two_ki[from];
+}
+
+void free_mahony_ahrs_bank(MahonyAHRSBank* bank){
+	if(bank == NULL) return;
+	ahrs_aligned_free(bank->sample_rate);
+	free(bank);
+}
@@ -0,0 +1,221 @@
+//=====================================================================================================
+// mahony_ahrs_bank_kernel.c
+//=====================================================================================================
+//
+// Update kernels of the Mahony filter bank, see mahony_ahrs_bank.h. With runtime dispatch this file
+// is compiled once per instruction set and ahrs_dispatch.c picks the variant (see ahrs_simd.h).
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "mahony_ahrs_bank.h"
+#include "ahrs_simd.h"
+#include "ahrs_stats.h"
+
+#define MAHONY_BANK_INPUTS 9 // gx gy gz ax ay az mx my mz
+
+// Gains of the AHRS_SIMD_WIDTH filters at `index`; TWO_KP / TWO_KI in every lane with MA_FIXED_GAINS,
+// where the choice of the kernel without integral feedback is made at compile time
+#if MA_FIXED_GAINS
+#define MAHONY_BANK_TWO_KP(BANK, INDEX) ahrs_vec_set1(TWO_KP)
+#define MAHONY_BANK_TWO_KI(BANK, INDEX) ahrs_vec_set1(TWO_KI)
+#define MAHONY_BANK_KI_ZERO(BANK, INDEX) (TWO_KI == 0.0f)
+#else
+#define MAHONY_BANK_TWO_KP(BANK, INDEX) ahrs_vec_load((BANK)->two_kp + (INDEX))
+#define MAHONY_BANK_TWO_KI(BANK, INDEX) ahrs_vec_load((BANK)->two_ki + (INDEX))
+#define MAHONY_BANK_KI_ZERO(BANK, INDEX) ahrs_mask_all(ahrs_vec_eq_zero(MAHONY_BANK_TWO_KI(BANK, INDEX)))
+#endif
+
+//====================================================================================================
+// Filter kernel
+//
+// Steps the AHRS_SIMD_WIDTH filters starting at `index`, reading their samples from in[k] + offset.
+// Mirrors mahony_step in mahony_ahrs.c; `marg` and `integral` are compile-time constants at every
+// call site. With integral == 0 every lane has two_ki == 0 and the integral feedback is dropped.
+
+static inline void mahony_bank_step(MahonyAHRSBank* bank, size_t index, const MA_PRECISION* const* in, size_t offset, int marg, int integral)
+{
+	const ahrs_vec zero = ahrs_vec_set1(0.0f);
+	const ahrs_vec one = ahrs_vec_set1(1.0f);
+	const ahrs_vec half = ahrs_vec_set1(0.5f);
+	const ahrs_vec two = ahrs_vec_set1(2.0f);
+	ahrs_vec q0 = ahrs_vec_load(bank->q0 + index);
+	ahrs_vec q1 = ahrs_vec_load(bank->q1 + index);
+	ahrs_vec q2 = ahrs_vec_load(bank->q2 + index);
+	ahrs_vec q3 = ahrs_vec_load(bank->q3 + index);
+	ahrs_vec dt = ahrs_vec_load(bank->sample_period + index);
+	ahrs_vec gx = ahrs_vec_loadu(in[0] + offset);
+	ahrs_vec gy = ahrs_vec_loadu(in[1] + offset);
+	ahrs_vec gz = ahrs_vec_loadu(in[2] + offset);
+	ahrs_vec ax = ahrs_vec_loadu(in[3] + offset);
+	ahrs_vec ay = ahrs_vec_loadu(in[4] + offset);
+	ahrs_vec az = ahrs_vec_loadu(in[5] + offset);
+	ahrs_vec recipNorm;
+	ahrs_vec halfex, halfey, halfez;
+	ahrs_vec qa, qb, qc;
+
+	// Lanes with an all-zero accelerometer sample get no feedback (avoids NaN in accelerometer normalisation)
+	ahrs_mask accel_invalid = ahrs_vec_all_zero3(ax, ay, az);
+
+	// Normalise accelerometer measurement
+	recipNorm = ahrs_vec_rsqrt(ahrs_vec_select(accel_invalid, one, ahrs_vec_add(ahrs_vec_add(ahrs_vec_mul(ax, ax), ahrs_vec_mul(ay, ay)), ahrs_vec_mul(az, az))));
+	ax = ahrs_vec_mul(ax, recipNorm);
+	ay = ahrs_vec_mul(ay, recipNorm);
+	az = ahrs_vec_mul(az, recipNorm);
+
+	// Estimated direction of gravity
+	ahrs_vec halfvx = ahrs_vec_sub(ahrs_vec_mul(q1, q3), ahrs_vec_mul(q0, q2));
+	ahrs_vec halfvy = ahrs_vec_add(ahrs_vec_mul(q0, q1), ahrs_vec_mul(q2, q3));
+	ahrs_vec halfvz = ahrs_vec_add(ahrs_vec_sub(ahrs_vec_mul(q0, q0), half), ahrs_vec_mul(q3, q3));
+
+	// Error is cross product between estimated and measured direction of gravity
+	halfex = ahrs_vec_sub(ahrs_vec_mul(ay, halfvz), ahrs_vec_mul(az, halfvy));
+	halfey = ahrs_vec_sub(ahrs_vec_mul(az, halfvx), ahrs_vec_mul(ax, halfvz));
+	halfez = ahrs_vec_sub(ahrs_vec_mul(ax, halfvy), ahrs_vec_mul(ay, halfvx));
+
+	if(marg) {
+		ahrs_vec mx = ahrs_vec_loadu(in[6] + offset);
+		ahrs_vec my = ahrs_vec_loadu(in[7] + offset);
+		ahrs_vec mz = ahrs_vec_loadu(in[8] + offset);
+
+		// Normalise magnetometer measurement. Lanes with an all-zero sample stay zero, which removes the
+		// magnetic error below and reduces them to the IMU update, as mahony_ahrs_update does.
+		ahrs_mask mag_invalid = ahrs_vec_all_zero3(mx, my, mz);
+		recipNorm = ahrs_vec_rsqrt(ahrs_vec_select(mag_invalid, one, ahrs_vec_add(ahrs_vec_add(ahrs_vec_mul(mx, mx), ahrs_vec_mul(my, my)), ahrs_vec_mul(mz, mz))));
+		mx = ahrs_vec_mul(mx, recipNorm);
+		my = ahrs_vec_mul(my, recipNorm);
+		mz = ahrs_vec_mul(mz, recipNorm);
+
+		// Auxiliary variables to avoid repeated arithmetic
+		ahrs_vec q0q1 = ahrs_vec_mul(q0, q1);
+		ahrs_vec q0q2 = ahrs_vec_mul(q0, q2);
+		ahrs_vec q0q3 = ahrs_vec_mul(q0, q3);
+		ahrs_vec q1q1 = ahrs_vec_mul(q1, q1);
+		ahrs_vec q1q2 = ahrs_vec_mul(q1, q2);
+		ahrs_vec q1q3 = ahrs_vec_mul(q1, q3);
+		ahrs_vec q2q2 = ahrs_vec_mul(q2, q2);
+		ahrs_vec q2q3 = ahrs_vec_mul(q2, q3);
+		ahrs_vec q3q3 = ahrs_vec_mul(q3, q3);
+
+		// Reference direction of Earth's magnetic field
+		ahrs_vec hx = ahrs_vec_mul(two, ahrs_vec_add(ahrs_vec_add(ahrs_vec_mul(mx, ahrs_vec_sub(ahrs_vec_sub(half, q2q2), q3q3)), ahrs_vec_mul(my, ahrs_vec_sub(q1q2, q0q3))), ahrs_vec_mul(mz, ahrs_vec_add(q1q3, q0q2))));
+		ahrs_vec hy = ahrs_vec_mul(two, ahrs_vec_add(ahrs_vec_add(ahrs_vec_mul(mx, ahrs_vec_add(q1q2, q0q3)), ahrs_vec_mul(my, ahrs_vec_sub(ahrs_vec_sub(half, q1q1), q3q3))), ahrs_vec_mul(mz, ahrs_vec_sub(q2q3, q0q1))));
+		ahrs_vec bx = ahrs_vec_sqrt(ahrs_vec_add(ahrs_vec_mul(hx, hx), ahrs_vec_mul(hy, hy)));
+		ahrs_vec bz = ahrs_vec_mul(two, ahrs_vec_add(ahrs_vec_add(ahrs_vec_mul(mx, ahrs_vec_sub(q1q3, q0q2)), ahrs_vec_mul(my, ahrs_vec_add(q2q3, q0q1))), ahrs_vec_mul(mz, ahrs_vec_sub(ahrs_vec_sub(half, q1q1), q2q2))));
+
+		// Estimated direction of magnetic field
+		ahrs_vec halfwx = ahrs_vec_add(ahrs_vec_mul(bx, ahrs_vec_sub(ahrs_vec_sub(half, q2q2), q3q3)), ahrs_vec_mul(bz, ahrs_vec_sub(q1q3, q0q2)));
+		ahrs_vec halfwy = ahrs_vec_add(ahrs_vec_mul(bx, ahrs_vec_sub(q1q2, q0q3)), ahrs_vec_mul(bz, ahrs_vec_add(q0q1, q2q3)));
+		ahrs_vec halfwz = ahrs_vec_add(ahrs_vec_mul(bx, ahrs_vec_add(q0q2, q1q3)), ahrs_vec_mul(bz, ahrs_vec_sub(ahrs_vec_sub(half, q1q1), q2q2)));
+
+		// Error is sum of cross product between estimated direction and measured direction of field vectors
+		halfex = ahrs_vec_add(halfex, ahrs_vec_sub(ahrs_vec_mul(my, halfwz), ahrs_vec_mul(mz, halfwy)));
+		halfey = ahrs_vec_add(halfey, ahrs_vec_sub(ahrs_vec_mul(mz, halfwx), ahrs_vec_mul(mx, halfwz)));
+		halfez = ahrs_vec_add(halfez, ahrs_vec_sub(ahrs_vec_mul(mx, halfwy), ahrs_vec_mul(my, halfwx)));
+	}
+
+	// Compute and apply integral feedback if enabled. Lanes with two_ki == 0 accumulate nothing and
+	// are reset to zero (prevent integral windup), as in mahony_step.
+	ahrs_vec fbx = gx, fby = gy, fbz = gz;
+	if (integral)
+	{
+		const ahrs_vec two_ki = MAHONY_BANK_TWO_KI(bank, index);
+		const ahrs_mask ki_zero = ahrs_vec_eq_zero(two_ki);
+		const ahrs_vec two_ki_dt = ahrs_vec_mul(two_ki, dt);
+		ahrs_vec integralFBx = ahrs_vec_load(bank->integralFBx + index);
+		ahrs_vec integralFBy = ahrs_vec_load(bank->integralFBy + index);
+		ahrs_vec integralFBz = ahrs_vec_load(bank->integralFBz + index);
+		integralFBx = ahrs_vec_select(accel_invalid, integralFBx, ahrs_vec_select(ki_zero, zero, ahrs_vec_add(integralFBx, ahrs_vec_mul(two_ki_dt, halfex))));
+		integralFBy = ahrs_vec_select(accel_invalid, integralFBy, ahrs_vec_select(ki_zero, zero, ahrs_vec_add(integralFBy, ahrs_vec_mul(two_ki_dt, halfey))));
+		integralFBz = ahrs_vec_select(accel_invalid, integralFBz, ahrs_vec_select(ki_zero, zero, ahrs_vec_add(integralFBz, ahrs_vec_mul(two_ki_dt, halfez))));
+		ahrs_vec_store(bank->integralFBx + index, integralFBx);
+		ahrs_vec_store(bank->integralFBy + index, integralFBy);
+		ahrs_vec_store(bank->integralFBz + index, integralFBz);
+		fbx = ahrs_vec_add(fbx, integralFBx);
+		fby = ahrs_vec_add(fby, integralFBy);
+		fbz = ahrs_vec_add(fbz, integralFBz);
+	} else {
+		ahrs_vec_store(bank->integralFBx + index, ahrs_vec_select(accel_invalid, ahrs_vec_load(bank->integralFBx + index), zero)); // prevent integral windup
+		ahrs_vec_store(bank->integralFBy + index, ahrs_vec_select(accel_invalid, ahrs_vec_load(bank->integralFBy + index), zero));
+		ahrs_vec_store(bank->integralFBz + index, ahrs_vec_select(accel_invalid, ahrs_vec_load(bank->integralFBz + index), zero));
+	}
+
+	// Apply proportional feedback, only on lanes with a valid accelerometer sample
+	const ahrs_vec two_kp = MAHONY_BANK_TWO_KP(bank, index);
+	gx = ahrs_vec_select(accel_invalid, gx, ahrs_vec_add(fbx, ahrs_vec_mul(two_kp, halfex)));
+	gy = ahrs_vec_select(accel_invalid, gy, ahrs_vec_add(fby, ahrs_vec_mul(two_kp, halfey)));
+	gz = ahrs_vec_select(accel_invalid, gz, ahrs_vec_add(fbz, ahrs_vec_mul(two_kp, halfez)));
+
+	// Integrate rate of change of quaternion
+	const ahrs_vec half_dt = ahrs_vec_mul(half, dt); // pre-multiply common factors
+	gx = ahrs_vec_mul(gx, half_dt);
+	gy = ahrs_vec_mul(gy, half_dt);
+	gz = ahrs_vec_mul(gz, half_dt);
+	qa = q0;
+	qb = q1;
+	qc = q2;
+	q0 = ahrs_vec_add(q0, ahrs_vec_sub(ahrs_vec_sub(ahrs_vec_sub(zero, ahrs_vec_mul(qb, gx)), ahrs_vec_mul(qc, gy)), ahrs_vec_mul(q3, gz)));
+	q1 = ahrs_vec_add(q1, ahrs_vec_sub(ahrs_vec_add(ahrs_vec_mul(qa, gx), ahrs_vec_mul(qc, gz)), ahrs_vec_mul(q3, gy)));
+	q2 = ahrs_vec_add(q2, ahrs_vec_add(ahrs_vec_sub(ahrs_vec_mul(qa, gy), ahrs_vec_mul(qb, gz)), ahrs_vec_mul(q3, gx)));
+	q3 = ahrs_vec_add(q3, ahrs_vec_sub(ahrs_vec_add(ahrs_vec_mul(qa, gz), ahrs_vec_mul(qb, gy)), ahrs_vec_mul(qc, gx)));
+
+	// Normalise quaternion
+	recipNorm = ahrs_vec_rsqrt(ahrs_vec_add(ahrs_vec_add(ahrs_vec_add(ahrs_vec_mul(q0, q0), ahrs_vec_mul(q1, q1)), ahrs_vec_mul(q2, q2)), ahrs_vec_mul(q3, q3)));
+	ahrs_vec_store(bank->q0 + index, ahrs_vec_mul(q0, recipNorm));
+	ahrs_vec_store(bank->q1 + index, ahrs_vec_mul(q1, recipNorm));
+	ahrs_vec_store(bank->q2 + index, ahrs_vec_mul(q2, recipNorm));
+	ahrs_vec_store(bank->q3 + index, ahrs_vec_mul(q3, recipNorm));
+}
+
+// Picks the kernel without integral feedback for vectors where every lane has two_ki == 0
+static inline void mahony_bank_dispatch(MahonyAHRSBank* bank, size_t index, const MA_PRECISION* const* in, size_t offset, int marg)
+{
+	if(MAHONY_BANK_KI_ZERO(bank, index))
+		mahony_bank_step(bank, index, in, offset, marg, 0);
+	else
+		mahony_bank_step(bank, index, in, offset, marg, 1);
+}
+
+// Runs the kernel over all filters, staging the last partial vector through zero padded buffers
+static inline void mahony_bank_run(MahonyAHRSBank* bank, const MA_PRECISION* const* in, int marg)
+{
+	const size_t inputs = marg ? MAHONY_BANK_INPUTS : 6;
+	size_t i = 0;
+	for(; i + AHRS_SIMD_WIDTH <= bank->count; i += AHRS_SIMD_WIDTH)
+		mahony_bank_dispatch(bank, i, in, i, marg);
+	if(i < bank->count) {
+		MA_PRECISION staged[MAHONY_BANK_INPUTS][AHRS_SIMD_WIDTH];
+		const MA_PRECISION* staged_in[MAHONY_BANK_INPUTS];
+		ahrs_bank_stage_tail(staged, staged_in, in, inputs, i, bank->count - i);
+		mahony_bank_dispatch(bank, i, staged_in, 0, marg);
+	}
+}
+
+//====================================================================================================
+// Functions
+
+//---------------------------------------------------------------------------------------------------
+// IMU algorithm update
+void AHRS_KERNEL_NAME(mahony_ahrs_bank_update_imu)(MahonyAHRSBank* bank, const MA_PRECISION* gx, const MA_PRECISION* gy, const MA_PRECISION* gz, const MA_PRECISION* ax, const MA_PRECISION* ay, const MA_PRECISION* az)
+{
+	if(bank == NULL) return;
+	AHRS_STATS_START(start);
+	const MA_PRECISION* in[MAHONY_BANK_INPUTS] = { gx, gy, gz, ax, ay, az, NULL, NULL, NULL };
+	mahony_bank_run(bank, in, 0);
+	AHRS_STAT_ADD(AHRS_STAT_UPDATES, bank->count);
+	AHRS_STATS_STOP(start, bank->count);
+}
+
+//---------------------------------------------------------------------------------------------------
+// AHRS algorithm update
+void AHRS_KERNEL_NAME(mahony_ahrs_bank_update)(MahonyAHRSBank* bank, const MA_PRECISION* gx, const MA_PRECISION* gy, const MA_PRECISION* gz, const MA_PRECISION* ax, const MA_PRECISION* ay, const MA_PRECISION* az, const MA_PRECISION* mx, const MA_PRECISION* my, const MA_PRECISION* mz)
+{
+	if(bank == NULL) return;
+	AHRS_STATS_START(start);
+	const MA_PRECISION* in[MAHONY_BANK_INPUTS] = { gx, gy, gz, ax, ay, az, mx, my, mz };
+	mahony_bank_run(bank, in, 1);
+	AHRS_STAT_ADD(AHRS_STAT_UPDATES, bank->count);
+	AHRS_STATS_STOP(start, bank->count);
+}
@@ -0,0 +1,244 @@
+//=====================================================================================================
+// mahony_ahrs_fixed.c
+//=====================================================================================================
+//
+// Fixed-point Mahony filter, see mahony_ahrs_fixed.h.
+//
+// Everything but the angular rates is in Q_UNIT: with unit quaternion and measurements the
+// estimated field directions and the errors stay within +-1.
+//
+//=====================================================================================================
+
+//---------------------------------------------------------------------------------------------------
+// Header files
+
+#include "mahony_ahrs_fixed.h"
+#include <stdlib.h>
+
+#define M(A, B) ahrs_fixed_mul((A), (B), AHRS_FIXED_Q_UNIT)
+
+//---------------------------------------------------------------------------------------------------
+// Variable definitions
+
+int mahony_ahrs_fixed_init(MahonyAHRSFixed* workspace, uint32_t sample_rate){
+	if(workspace == NULL || sample_rate == 0) return -1;
+	workspace->sample_rate = sample_rate;
+	workspace->sample_period = ahrs_fixed_period(sample_rate);
+	workspace->two_kp = TWO_KP_FIXED;
+	workspace->two_ki = TWO_KI_FIXED;
+	workspace->q0 = 1 << AHRS_FIXED_Q_UNIT;
+	workspace->q1 = 0;
+	workspace->q2 = 0;
+	workspace->q3 = 0;
+	workspace->integralFBx = 0;
+	workspace->integralFBy = 0;
+	workspace->integralFBz = 0;
+	return 0;
+}
+
+MahonyAHRSFixed* create_mahony_ahrs_fixed(uint32_t sample_rate){
+	if(sample_rate == 0) return NULL;
+	MahonyAHRSFixed* workspace = (MahonyAHRSFixed *) malloc(sizeof(MahonyAHRSFixed));
+	if(workspace == NULL) return NULL;
+	mahony_ahrs_fixed_init(workspace, sample_rate);
+	return workspace;
+}
+
+void free_mahony_ahrs_fixed(MahonyAHRSFixed* workspace){
+	free(workspace);
+}
+
+void mahony_ahrs_fixed_update_sample_rate(MahonyAHRSFixed* workspace, uint32_t sample_rate){
+	if(workspace == NULL || sample_rate == 0) return;
+	if(sample_rate != workspace->sample_rate) { // Reset the parameters when sample rates are different
+		int32_t two_kp = workspace->two_kp, two_ki = workspace->two_ki;
+		mahony_ahrs_fixed_init(workspace, sample_rate);
+		workspace->two_kp = two_kp;
+		workspace->two_ki = two_ki;
+	}
+}
+
+void mahony_ahrs_fixed_set_gains(MahonyAHRSFixed* workspace, int32_t two_kp, int32_t two_ki){
+	if(workspace == NULL || two_kp < 0 || two_ki < 0) return;
+	workspace->two_kp = two_kp;
+	workspace->two_ki = two_ki;
+}
+
+//====================================================================================================
+// Kernels
+
+// Applies the error (halfex, halfey, halfez) (Q_UNIT) as integral and proportional feedback to the
+// gyro (Q_RATE)
+MA_INLINE void mahony_fixed_feedback(int32_t* integralFB, int32_t dt, int32_t two_kp, int32_t two_ki, int64_t halfex, int64_t halfey, int64_t halfez, int32_t* g)
+{
+	int64_t e[3] = { halfex, halfey, halfez };
+	for(int i = 0; i < 3; i++) {
+		int64_t feedback = ahrs_fixed_mul(two_kp, e[i], AHRS_FIXED_Q_UNIT); // Q_RATE
+		// Compute and apply integral feedback if enabled
+		if(two_ki > 0) {
+			int64_t integral = integralFB[i] + ahrs_fixed_mul(ahrs_fixed_mul(two_ki, e[i], AHRS_FIXED_Q_RATE), dt, AHRS_FIXED_Q_TIME);
+			integralFB[i] = ahrs_fixed_saturate(integral); // also the windup limit
+			feedback += integralFB[i] >> (AHRS_FIXED_Q_UNIT - AHRS_FIXED_Q_RATE);
+		} else {
+			integralFB[i] = 0; // prevent integral windup
+		}
+		g[i] = ahrs_fixed_saturate(g[i] + feedback);
+	}
+}
+
+//---------------------------------------------------------------------------------------------------
+// IMU algorithm step
+MA_INLINE void mahony_fixed_imu_step(int32_t* q, int32_t* integralFB, int32_t dt, int32_t two_kp, int32_t two_ki, int32_t gx, int32_t gy, int32_t gz, int32_t ax, int32_t ay, int32_t az)
+{
+	int32_t g[3] = { gx, gy, gz };
+
+	// Compute feedback only if accelerometer measurement valid
+	if(!((ax == 0) && (ay == 0) && (az == 0))) {
+		int32_t a[3] = { ax, ay, az };
+		ahrs_fixed_normalise(a, 3);
+		int64_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+
+		// Estimated direction of gravity
+		int64_t halfvx = M(q1, q3) - M(q0, q2);
+		int64_t halfvy = M(q0, q1) + M(q2, q3);
+		int64_t halfvz = M(q0, q0) - (1 << (AHRS_FIXED_Q_UNIT - 1)) + M(q3, q3);
+
+		// Error is cross product between estimated and measured direction of gravity
+		int64_t halfex = M(a[1], halfvz) - M(a[2], halfvy);
+		int64_t halfey = M(a[2], halfvx) - M(a[0], halfvz);
+		int64_t halfez = M(a[0], halfvy) - M(a[1], halfvx);
+		mahony_fixed_feedback(integralFB, dt, two_kp, two_ki, halfex, halfey, halfez, g);
+	}
+
+	ahrs_fixed_integrate(q, dt, g[0], g[1], g[2], NULL);
+}
+
+//---------------------------------------------------------------------------------------------------
+// AHRS algorithm step
+MA_INLINE void mahony_fixed_step(int32_t* q, int32_t* integralFB, int32_t dt, int32_t two_kp, int32_t two_ki, int32_t gx, int32_t gy, int32_t gz, int32_t ax, int32_t ay, int32_t az, int32_t mx, int32_t my, int32_t mz)
+{
+	// Use IMU algorithm if magnetometer measurement invalid
+	if((mx == 0) && (my == 0) && (mz == 0)) {
+		mahony_fixed_imu_step(q, integralFB, dt, two_kp, two_ki, gx, gy, gz, ax, ay, az);
+		return;
+	}
+	int32_t g[3] = { gx, gy, gz };
+
+	// Compute feedback only if accelerometer measurement valid
+	if(!((ax == 0) && (ay == 0) && (az == 0))) {
+		int32_t a[3] = { ax, ay, az }, m[3] = { mx, my, mz };
+		ahrs_fixed_normalise(a, 3);
+		ahrs_fixed_normalise(m, 3);
+		int64_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+		const int64_t half = (int64_t)1 << (AHRS_FIXED_Q_UNIT - 1);
+
+		// Auxiliary variables to avoid repeated arithmetic
+		int64_t q0q0 = M(q0, q0), q0q1 = M(q0, q1), q0q2 = M(q0, q2), q0q3 = M(q0, q3);
+		int64_t q1q1 = M(q1, q1), q1q2 = M(q1, q2), q1q3 = M(q1, q3);
+		int64_t q2q2 = M(q2, q2), q2q3 = M(q2, q3), q3q3 = M(q3, q3);
+
+		// Reference direction of Earth's magnetic field; |(hx, hy)| through the integer rsqrt
+		int64_t hx = 2 * (M(m[0], half - q2q2 - q3q3) + M(m[1], q1q2 - q0q3) + M(m[2], q1q3 + q0q2));
+		int64_t hy = 2 * (M(m[0], q1q2 + q0q3) + M(m[1], half - q1q1 - q3q3) + M(m[2], q2q3 - q0q1));
+		int32_t h[2] = { ahrs_fixed_saturate(hx), ahrs_fixed_saturate(hy) };
+		int64_t bx = ahrs_fixed_normalise(h, 2) ? M(hx, h[0]) + M(hy, h[1]) : 0;
+		int64_t bz = 2 * (M(m[0], q1q3 - q0q2) + M(m[1], q2q3 + q0q1) + M(m[2], half - q1q1 - q2q2));
+
+		// Estimated direction of gravity and magnetic field
+		int64_t halfvx = q1q3 - q0q2;
+		int64_t halfvy = q0q1 + q2q3;
+		int64_t halfvz = q0q0 - half + q3q3;
+		int64_t halfwx = M(bx, half - q2q2 - q3q3) + M(bz, q1q3 - q0q2);
+		int64_t halfwy = M(bx, q1q2 - q0q3) + M(bz, q0q1 + q2q3);
+		int64_t halfwz = M(bx, q0q2 + q1q3) + M(bz, half - q1q1 - q2q2);
+
+		// Error is sum of cross product between estimated direction and measured direction of field vectors
+		int64_t halfex = (M(a[1], halfvz) - M(a[2], halfvy)) + (M(m[1], halfwz) - M(m[2], halfwy));
+		int64_t halfey = (M(a[2], halfvx) - M(a[0], halfvz)) + (M(m[2], halfwx) - M(m[0], halfwz));
+		int64_t halfez = (M(a[0], halfvy) - M(a[1], halfvx)) + (M(m[0], halfwy) - M(m[1], halfwx));
+		mahony_fixed_feedback(integralFB, dt, two_kp, two_ki, halfex, halfey, halfez, g);
+	}
+
+	ahrs_fixed_integrate(q, dt, g[0], g[1], g[2], NULL);
+}
+
+//====================================================================================================
+// Functions
+
+#define LOAD_STATE(WS) \
+	int32_t q[4] = { (WS)->q0, (WS)->q1, (WS)->q2, (WS)->q3 }; \
+	int32_t integralFB[3] = { (WS)->integralFBx, (WS)->integralFBy, (WS)->integralFBz }
+
+#define STORE_STATE(WS) do { \
+	(WS)->q0 = q[0]; \
+	(WS)->q1 = q[1]; \
+	(WS)->q2 = q[2]; \
+	(WS)->q3 = q[3]; \
+	(WS)->integralFBx = integralFB[0]; \
+	(WS)->integralFBy = integralFB[1]; \
+	(WS)->integralFBz = integralFB[2]; \
+} while(0)
+
+//---------------------------------------------------------------------------------------------------
+// IMU algorithm update
+void mahony_ahrs_fixed_update_imu(MahonyAHRSFixed* workspace, int32_t gx, int32_t gy, int32_t gz, int32_t ax, int32_t ay, int32_t az)
+{
+	LOAD_STATE(workspace);
+	mahony_fixed_imu_step(q, integralFB, workspace->sample_period, workspace->two_kp, workspace->two_ki, gx, gy, gz, ax, ay, az);
+	STORE_STATE(workspace);
+}
+
+//---------------------------------------------------------------------------------------------------
+// AHRS algorithm update
+void mahony_ahrs_fixed_update(MahonyAHRSFixed* workspace, int32_t gx, int32_t gy, int32_t gz, int32_t ax, int32_t ay, int32_t az, int32_t mx, int32_t my, int32_t mz)
+{
+	LOAD_STATE(workspace);
+	mahony_fixed_step(q, integralFB, workspace->sample_period, workspace->two_kp, workspace->two_ki, gx, gy, gz, ax, ay, az, mx, my, mz);
+	STORE_STATE(workspace);
+}
+
+//---------------------------------------------------------------------------------------------------
+// Batched IMU algorithm update
+void mahony_ahrs_fixed_update_imu_batch(MahonyAHRSFixed* workspace, AHRSFixedSensorArray gyro, AHRSFixedSensorArray accel, size_t count, int32_t* quaternions)
+{
+	if(workspace == NULL || count == 0) return;
+	const int32_t dt = workspace->sample_period, two_kp = workspace->two_kp, two_ki = workspace->two_ki;
+	LOAD_STATE(workspace);
+	size_t g = 0, a = 0;
+
+	for(size_t i = 0; i < count; i++, g += gyro.stride, a += accel.stride) {
+		mahony_fixed_imu_step(q, integralFB, dt, two_kp, two_ki, gyro.x[g], gyro.y[g], gyro.z[g], accel.x[a], accel.y[a], accel.z[a]);
+		if(quaternions != NULL) {
+			quaternions[0] = q[0];
+			quaternions[1] = q[1];
+			quaternions[2] = q[2];
+			quaternions[3] = q[3];
+			quaternions += 4;
+		}
+	}
+
+	STORE_STATE(workspace);
+}
+
+//---------------------------------------------------------------------------------------------------
+// Batched AHRS algorithm update
+void mahony_ahrs_fixed_update_batch(MahonyAHRSFixed* workspace, AHRSFixedSensorArray gyro, AHRSFixedSensorArray accel, AHRSFixedSensorArray mag, size_t count, int32_t* quaternions)
+{
+	if(workspace == NULL || count == 0) return;
+	const int32_t dt = workspace->sample_period, two_kp = workspace->two_kp, two_ki = workspace->two_ki;
+	LOAD_STATE(workspace);
+	size_t g = 0, a = 0, m = 0;
+
+	for(size_t i = 0; i < count; i++, g += gyro.stride, a += accel.stride, m += mag.stride) {
+		mahony_fixed_step(q, integralFB, dt, two_kp, two_ki, gyro.x[g], gyro.y[g], gyro.z[g], accel.x[a], accel.y[a], accel.z[a], mag.x[m], mag.y[m], mag.z[m]);
+		if(quaternions != NULL) {
+			quaternions[0] = q[0];
+			quaternions[1] = q[1];
+			quaternions[2] = q[2];
+			quaternions[3] = q[3];
+			quaternions += 4;
+		}
+	}
+
+	STORE_STATE(workspace);
+}
@@ -0,0 +1,64 @@
+//=====================================================================================================
+// mahony_ahrs_fixed.h
+//=====================================================================================================
+//
+// Mahony's AHRS algorithm in fixed point, for cores without an FPU and for integer batches. The
+// same algorithm and update sequence as mahony_ahrs.h; Q formats and saturation in ahrs_fixed.h:
+// gyro in rad/s Q_RATE, accelerometer and magnetometer in any int32_t scale, quaternion Q_UNIT.
+//
+//=====================================================================================================
+#ifndef __MAHONY_AHRS_FIXED_H__
+#define __MAHONY_AHRS_FIXED_H__
+
+#include "ahrs_fixed.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t sample_rate;   // Hz
+    int32_t sample_period;  // s, Q_TIME
+    int32_t two_kp;         // Q_RATE, TWO_KP_FIXED unless changed with mahony_ahrs_fixed_set_gains
+    int32_t two_ki;         // Q_RATE, TWO_KI_FIXED unless changed with mahony_ahrs_fixed_set_gains
+    int32_t q0;             // Q_UNIT
+    int32_t q1;
+    int32_t q2;
+    int32_t q3;
+    // Integral feedback, rad/s in Q_UNIT (held within +-2 rad/s)
+    int32_t integralFBx;
+    int32_t integralFBy;
+    int32_t integralFBz;
+} MahonyAHRSFixed;
+
+// TWO_KP / TWO_KI of mahony_ahrs.h
+#define TWO_KP_FIXED AHRS_FIXED(2.0 * 1.0, AHRS_FIXED_Q_RATE)
+#define TWO_KI_FIXED AHRS_FIXED(2.0 * 0.3, AHRS_FIXED_Q_RATE)
+
+MahonyAHRSFixed* create_mahony_ahrs_fixed(uint32_t sample_rate); // NULL for sample_rate 0 or out of memory
+void free_mahony_ahrs_fixed(MahonyAHRSFixed* workspace);
+
+// As create_mahony_ahrs_fixed on caller-provided storage. Returns 0, or -1 for sample_rate 0.
+int mahony_ahrs_fixed_init(MahonyAHRSFixed* workspace, uint32_t sample_rate);
+
+//---------------------------------------------------------------------------------------------------
+// Function declarations
+void mahony_ahrs_fixed_update_sample_rate(MahonyAHRSFixed* workspace, uint32_t sample_rate);
+
+// Gains in Q_RATE, >= 0; keeps the state. two_ki == 0 disables the integral feedback.
+void mahony_ahrs_fixed_set_gains(MahonyAHRSFixed* workspace, int32_t two_kp, int32_t two_ki);
+
+void mahony_ahrs_fixed_update_imu(MahonyAHRSFixed* workspace, int32_t gx, int32_t gy, int32_t gz, int32_t ax, int32_t ay, int32_t az);
+
+void mahony_ahrs_fixed_update(MahonyAHRSFixed* workspace, int32_t gx, int32_t gy, int32_t gz, int32_t ax, int32_t ay, int32_t az, int32_t mx, int32_t my, int32_t mz);
+
+// Batched updates, as mahony_ahrs_update_batch; `quaternions` (may be NULL) receives 4 * count Q_UNIT values
+void mahony_ahrs_fixed_update_imu_batch(MahonyAHRSFixed* workspace, AHRSFixedSensorArray gyro, AHRSFixedSensorArray accel, size_t count, int32_t* quaternions);
+
+void mahony_ahrs_fixed_update_batch(MahonyAHRSFixed* workspace, AHRSFixedSensorArray gyro, AHRSFixedSensorArray accel, AHRSFixedSensorArray mag, size_t count, int32_t* quaternions);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MAHONY_AHRS_FIXED_H__ */
@@ -0,0 +1,306 @@
+//=====================================================================================================
+// ahrs_replay.c
+//=====================================================================================================
+//
+// Replays a binary IMU log (ahrs_log.h) through the filters and writes the quaternion after every
+// sample to a quaternion log, one record per input record, in the same order.
+//
+// Both files are memory mapped. Every run of consecutive records of one device goes through one
+// batch update of that device's filter; in float builds the batch reads the mapped input records
+// and writes the mapped output in place, so samples are never parsed or copied. Double builds
+// convert through a small buffer. Each device keeps its filter for the whole log.
+//
+// Usage: ahrs_replay [--algorithm madgwick|mahony|eskf] [--imu] [--smooth] [--stats] INPUT OUTPUT
+//
+// --smooth writes the offline forward-backward estimate of ahrs_smooth.h instead of the causal one
+// (float builds): every run is smoothed on its own from a fresh filter, so the log should hold one
+// run per device.
+// --stats prints the counters and time per sample of ahrs_stats.h (library built with AHRS_STATS).
+//
+//=====================================================================================================
+#include "madgwick_ahrs.h"
+#include "mahony_ahrs.h"
+#include "eskf_ahrs.h"
+#include "ahrs_smooth.h"
+#include "ahrs_log.h"
+#include "ahrs_stats.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REPLAY_CHUNK 4096 // records per batch call in double builds
+
+//---------------------------------------------------------------------------------------------------
+// Algorithms
+
+typedef struct {
+    const char* name;
+    void* (*create)(MA_PRECISION sample_rate);
+    void (*destroy)(void* filter);
+    void (*update_imu_batch)(void* filter, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions);
+    void (*update_batch)(void* filter, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions);
+    int (*smooth)(const void* filter, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions);
+} ReplayAlgorithm;
+
+static void* madgwick_create(MA_PRECISION sample_rate){ return create_madgwick_ahrs(sample_rate); }
+static void madgwick_destroy(void* filter){ free_madgwick_ahrs((MadgwickAHRS *) filter); }
+static void madgwick_imu_batch(void* filter, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions){
+	madgwick_ahrs_update_imu_batch((MadgwickAHRS *) filter, gyro, accel, count, quaternions);
+}
+static void madgwick_batch(void* filter, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions){
+	madgwick_ahrs_update_batch((MadgwickAHRS *) filter, gyro, accel, mag, count, quaternions);
+}
+static int madgwick_smooth(const void* filter, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions){
+	return madgwick_ahrs_smooth((const MadgwickAHRS *) filter, 0.0f, gyro, accel, mag, count, quaternions);
+}
+
+static void* mahony_create(MA_PRECISION sample_rate){ return create_mahony_ahrs(sample_rate); }
+static void mahony_destroy(void* filter){ free_mahony_ahrs((MahonyAHRS *) filter); }
+static void mahony_imu_batch(void* filter, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions){
+	mahony_ahrs_update_imu_batch((MahonyAHRS *) filter, gyro, accel, count, quaternions);
+}
+static void mahony_batch(void* filter, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions){
+	mahony_ahrs_update_batch((MahonyAHRS *) filter, gyro, accel, mag, count, quaternions);
+}
+static int mahony_smooth(const void* filter, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions){
+	return mahony_ahrs_smooth((const MahonyAHRS *) filter, 0.0f, gyro, accel, mag, count, quaternions);
+}
+
+static void* eskf_create(MA_PRECISION sample_rate){ return create_eskf_ahrs(sample_rate, 1); }
+static void eskf_destroy(void* filter){ free_eskf_ahrs((EskfAHRS *) filter); }
+static void eskf_imu_batch(void* filter, AHRSSensorArray gyro, AHRSSensorArray accel, size_t count, MA_PRECISION* quaternions){
+	eskf_ahrs_update_imu_batch((EskfAHRS *) filter, gyro, accel, count, quaternions);
+}
+static void eskf_batch(void* filter, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions){
+	eskf_ahrs_update_batch((EskfAHRS *) filter, gyro, accel, mag, count, quaternions);
+}
+static int eskf_smooth(const void* filter, AHRSSensorArray gyro, AHRSSensorArray accel, AHRSSensorArray mag, size_t count, MA_PRECISION* quaternions){
+	return eskf_ahrs_smooth((const EskfAHRS *) filter, 0.0f, gyro, accel, mag, count, quaternions);
+}
+
+static const ReplayAlgorithm algorithms[] = {
+	{ "madgwick", madgwick_create, madgwick_destroy, madgwick_imu_batch, madgwick_batch, madgwick_smooth },
+	{ "mahony", mahony_create, mahony_destroy, mahony_imu_batch, mahony_batch, mahony_smooth },
+	{ "eskf", eskf_create, eskf_destroy, eskf_imu_batch, eskf_batch, eskf_smooth },
+};
+
+//---------------------------------------------------------------------------------------------------
+// Device table: open addressing on the device id, grown at half load
+
+typedef struct {
+    uint32_t device_id;
+    void* filter;   // NULL: empty slot
+} ReplayDevice;
+
+typedef struct {
+    ReplayDevice* slots;
+    size_t capacity;    // power of two
+    size_t count;
+} ReplayDevices;
+
+static size_t device_slot(const ReplayDevices* devices, uint32_t device_id){
+	size_t i = (device_id * 2654435761u) & (devices->capacity - 1);
+	while(devices->slots[i].filter != NULL && devices->slots[i].device_id != device_id)
+		i = (i + 1) & (devices->capacity - 1);
+	return i;
+}
+
+// Filter of `device_id`, created on first use; NULL when out of memory
+static void* device_filter(ReplayDevices* devices, uint32_t device_id, const ReplayAlgorithm* algorithm, MA_PRECISION sample_rate){
+	size_t i = device_slot(devices, device_id);
+	if(devices->slots[i].filter != NULL) return devices->slots[i].filter;
+	if(2 * (devices->count + 1) > devices->capacity) {
+		ReplayDevices grown = { (ReplayDevice *) calloc(2 * devices->capacity, sizeof(ReplayDevice)), 2 * devices->capacity, devices->count };
+		if(grown.slots == NULL) return NULL;
+		for(size_t k = 0; k < devices->capacity; k++)
+			if(devices->slots[k].filter != NULL) grown.slots[device_slot(&grown, devices->slots[k].device_id)] = devices->slots[k];
+		free(devices->slots);
+		*devices = grown;
+		i = device_slot(devices, device_id);
+	}
+	void* filter = algorithm->create(sample_rate);
+	if(filter == NULL) return NULL;
+	devices->slots[i].device_id = device_id;
+	devices->slots[i].filter = filter;
+	devices->count++;
+	return filter;
+}
+
+//---------------------------------------------------------------------------------------------------
+// Replay
+
+// Runs `count` records of one device through its filter, writing `count` quaternions. Smoothing
+// leaves the filter as it is and returns -1 when out of memory or, in double builds, always.
+static int replay_run(const ReplayAlgorithm* algorithm, void* filter, int marg, int smooth, const AHRSLogRecord* records, size_t count, AHRSLogQuaternion* out){
+#if !MA_DOUBLE_PRECISION
+	AHRSSensorArray none = { NULL, NULL, NULL, 0 };
+	if(smooth) return algorithm->smooth(filter, ahrs_log_gyro(records), ahrs_log_accel(records), marg ? ahrs_log_mag(records) : none, count, out->q);
+	// Zero copy: views into the mapped records, quaternions written straight into the mapped output
+	if(marg) algorithm->update_batch(filter, ahrs_log_gyro(records), ahrs_log_accel(records), ahrs_log_mag(records), count, out->q);
+	else algorithm->update_imu_batch(filter, ahrs_log_gyro(records), ahrs_log_accel(records), count, out->q);
+	return 0;
+#else
+	if(smooth) return -1; // the smoother needs the whole run as MA_PRECISION samples
+	static MA_PRECISION samples[REPLAY_CHUNK * 9];
+	static MA_PRECISION quaternions[REPLAY_CHUNK * 4];
+	for(size_t done = 0; done < count; done += REPLAY_CHUNK) {
+		size_t n = count - done < REPLAY_CHUNK ? count - done : REPLAY_CHUNK;
+		for(size_t i = 0; i < n; i++) {
+			const AHRSLogRecord* r = records + done + i;
+			for(int k = 0; k < 3; k++) {
+				samples[9 * i + k] = r->gyro[k];
+				samples[9 * i + 3 + k] = r->accel[k];
+				samples[9 * i + 6 + k] = r->mag[k];
+			}
+		}
+		if(marg) algorithm->update_batch(filter, ahrs_sensor_array_interleaved(samples, 9), ahrs_sensor_array_interleaved(samples + 3, 9), ahrs_sensor_array_interleaved(samples + 6, 9), n, quaternions);
+		else algorithm->update_imu_batch(filter, ahrs_sensor_array_interleaved(samples, 9), ahrs_sensor_array_interleaved(samples + 3, 9), n, quaternions);
+		for(size_t i = 0; i < n; i++)
+			for(int k = 0; k < 4; k++) out[done + i].q[k] = (float) quaternions[4 * i + k];
+	}
+	return 0;
+#endif
+}
+
+static void usage(const char* program){
+	fprintf(stderr, "usage: %s [--algorithm madgwick|mahony|eskf] [--imu] [--smooth] [--stats] INPUT OUTPUT\n", program);
+}
+
+static void print_stats(void){
+	if(!ahrs_stats_enabled()) {
+		fprintf(stderr, "stats: not compiled in, configure with -DAHRS_STATS=ON\n");
+		return;
+	}
+	AHRSStats stats;
+	ahrs_stats_snapshot(&stats);
+	for(int i = 0; i < AHRS_STAT_COUNT; i++) fprintf(stderr, "  %-16s %llu\n", ahrs_stats_name((AHRSStat) i), (unsigned long long) stats.count[i]);
+	fprintf(stderr, "  %-16s %g\n", "integral_max", stats.integral_max);
+	fprintf(stderr, "  %s per sample: p50 <= %llu, p99 <= %llu, p99.9 <= %llu\n", ahrs_stats_clock(),
+		(unsigned long long) ahrs_stats_ticks_quantile(&stats, 0.5), (unsigned long long) ahrs_stats_ticks_quantile(&stats, 0.99),
+		(unsigned long long) ahrs_stats_ticks_quantile(&stats, 0.999));
+}
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv){
+	const ReplayAlgorithm* algorithm = &algorithms[0];
+	int marg = 1, smooth = 0, stats = 0;
+	const char* paths[2] = { NULL, NULL };
+	int path_count = 0;
+
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "--algorithm") == 0 && i + 1 < argc) {
+			const char* name = argv[++i];
+			algorithm = NULL;
+			for(size_t a = 0; a < sizeof(algorithms) / sizeof(algorithms[0]); a++)
+				if(strcmp(name, algorithms[a].name) == 0) algorithm = &algorithms[a];
+			if(algorithm == NULL) {
+				usage(argv[0]);
+				return 2;
+			}
+		} else if(strcmp(argv[i], "--imu") == 0) {
+			marg = 0;
+		} else if(strcmp(argv[i], "--smooth") == 0) {
+			smooth = 1;
+		} else if(strcmp(argv[i], "--stats") == 0) {
+			stats = 1;
+		} else if(argv[i][0] != '-' && path_count < 2) {
+			paths[path_count++] = argv[i];
+		} else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if(path_count != 2) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	// Input: read-only shared mapping, read once front to back
+	int input_fd = open(paths[0], O_RDONLY);
+	struct stat st;
+	if(input_fd < 0 || fstat(input_fd, &st) != 0) {
+		perror(paths[0]);
+		return 1;
+	}
+	if((uint64_t)st.st_size < sizeof(AHRSLogHeader)) {
+		fprintf(stderr, "%s: not an IMU log\n", paths[0]);
+		return 1;
+	}
+	const AHRSLogHeader* input = (const AHRSLogHeader *) mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, input_fd, 0);
+	if(input == MAP_FAILED) {
+		perror(paths[0]);
+		return 1;
+	}
+	if(!ahrs_log_header_valid(input, AHRS_LOG_KIND_SAMPLES, (uint64_t)st.st_size)) {
+		fprintf(stderr, "%s: not an IMU log, or truncated\n", paths[0]);
+		return 1;
+	}
+	madvise((void *) input, (size_t)st.st_size, MADV_SEQUENTIAL);
+	const size_t count = (size_t) input->record_count;
+	const AHRSLogRecord* records = ahrs_log_records(input);
+
+	// Output: sized up front, written through a shared mapping
+	const size_t output_size = sizeof(AHRSLogHeader) + count * sizeof(AHRSLogQuaternion);
+	int output_fd = open(paths[1], O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(output_fd < 0 || ftruncate(output_fd, (off_t)output_size) != 0) {
+		perror(paths[1]);
+		return 1;
+	}
+	AHRSLogHeader* output = (AHRSLogHeader *) mmap(NULL, output_size, PROT_READ | PROT_WRITE, MAP_SHARED, output_fd, 0);
+	if(output == MAP_FAILED) {
+		perror(paths[1]);
+		return 1;
+	}
+	madvise(output, output_size, MADV_SEQUENTIAL);
+	ahrs_log_header_init(output, AHRS_LOG_KIND_QUATERNIONS, input->sample_rate, count);
+	AHRSLogQuaternion* quaternions = ahrs_log_quaternions(output);
+
+	ReplayDevices devices = { (ReplayDevice *) calloc(64, sizeof(ReplayDevice)), 64, 0 };
+	if(devices.slots == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	size_t runs = 0;
+	double t0 = now();
+	for(size_t start = 0; start < count; runs++) {
+		uint32_t device_id = records[start].device_id;
+		size_t end = start + 1;
+		while(end < count && records[end].device_id == device_id) end++;
+		void* filter = device_filter(&devices, device_id, algorithm, (MA_PRECISION) input->sample_rate);
+		if(filter == NULL) {
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+		if(replay_run(algorithm, filter, marg, smooth, records + start, end - start, quaternions + start) != 0) {
+			fprintf(stderr, MA_DOUBLE_PRECISION ? "--smooth needs a float build\n" : "out of memory\n");
+			return 1;
+		}
+		start = end;
+	}
+	double seconds = now() - t0;
+
+	if(msync(output, output_size, MS_ASYNC) != 0) perror(paths[1]);
+	munmap(output, output_size);
+	munmap((void *) input, (size_t)st.st_size);
+	close(output_fd);
+	close(input_fd);
+	for(size_t i = 0; i < devices.capacity; i++)
+		if(devices.slots[i].filter != NULL) algorithm->destroy(devices.slots[i].filter);
+	free(devices.slots);
+
+	fprintf(stderr, "%s %s%s: %zu records, %zu devices, %zu runs in %.3f s: %.1f Msamples/s, %.0f MB/s in\n",
+		algorithm->name, marg ? "marg" : "imu", smooth ? " smoothed" : "", count, devices.count, runs, seconds,
+		count / seconds * 1e-6, count * sizeof(AHRSLogRecord) / seconds * 1e-6);
+	if(stats) print_stats();
+	return 0;
+}
@@ -0,0 +1,393 @@
+//=====================================================================================================
+// ahrs_tune.c
+//=====================================================================================================
+//
+// Gain sweep over a recorded log: runs every parameter set of a grid or random search over the log
+// and ranks them by attitude error against a reference quaternion log (e.g. ahrs_log_generate
+// --truth, or a motion capture recording converted to ahrs_log.h).
+//
+// The parameter sets are the lanes of structure-of-arrays filter banks with per-lane gains, split
+// across threads. Every thread streams the shared, read-only mapping of the log once and steps all
+// of its lanes with each sample, so the cost per trial is one vector lane of the bank kernel.
+//
+// Each run of consecutive records of one device is a segment: the filters start from identity at
+// its first record and its first --settle seconds are not scored. The error of a sample is the
+// rotation angle to the reference (the tilt angle with --imu, which cannot observe heading); the
+// table reports, per parameter set, the RMS of sin(angle / 2) as an angle, which is the RMS angle
+// for small errors, and the largest angle.
+//
+// Usage: ahrs_tune [--algorithm madgwick|mahony] [--imu] [--grid N | --random N] [--beta MIN:MAX]
+//                  [--kp MIN:MAX] [--ki MIN:MAX] [--threads N] [--settle S] [--top N] [--csv FILE]
+//                  INPUT TRUTH
+// Gains are searched log-uniformly when MIN > 0, else linearly; MIN == MAX holds a gain constant.
+// --grid N takes N values per searched gain, --random N draws N parameter sets.
+//
+//=====================================================================================================
+#include "madgwick_ahrs_bank.h"
+#include "mahony_ahrs_bank.h"
+#include "ahrs_log.h"
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    double gain[2];     // beta, or two_kp and two_ki
+    double error_sum;   // sum of sin^2(angle / 2) over the scored samples
+    double error_max;   // largest sin^2(angle / 2)
+    size_t scored;
+} TuneTrial;
+
+typedef struct {
+    double min;
+    double max;
+} TuneRange;
+
+typedef struct {
+    // Shared, read-only
+    const AHRSLogRecord* records;
+    const AHRSLogQuaternion* truth;
+    size_t count;
+    MA_PRECISION sample_rate;
+    int mahony;
+    int marg;
+    size_t settle;          // samples per segment before scoring
+    // Per thread
+    TuneTrial* trials;
+    size_t trial_count;
+    size_t segments;
+    int failed;
+} TuneJob;
+
+//---------------------------------------------------------------------------------------------------
+// Scoring
+
+// sin^2 of half the rotation angle between the reference t and the estimate (e0, e1, e2, e3): the
+// squared vector part of conj(t) * e, free of the cancellation in 1 - dot^2
+static inline double attitude_error(const float* t, double e0, double e1, double e2, double e3){
+	double x = t[0] * e1 - e0 * t[1] - (t[2] * e3 - t[3] * e2);
+	double y = t[0] * e2 - e0 * t[2] - (t[3] * e1 - t[1] * e3);
+	double z = t[0] * e3 - e0 * t[3] - (t[1] * e2 - t[2] * e1);
+	return x * x + y * y + z * z;
+}
+
+// Gravity direction in the sensor frame of unit quaternion q
+static inline void gravity(double q0, double q1, double q2, double q3, double* g){
+	g[0] = 2.0 * (q1 * q3 - q0 * q2);
+	g[1] = 2.0 * (q0 * q1 + q2 * q3);
+	g[2] = q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3;
+}
+
+// sin^2 of half the tilt angle between the unit gravity directions a and b: sin^2 / (2 (1 + cos))
+static inline double tilt_error(const double* a, const double* b){
+	double c = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+	double x = a[1] * b[2] - a[2] * b[1], y = a[2] * b[0] - a[0] * b[2], z = a[0] * b[1] - a[1] * b[0];
+	return c > -0.999999 ? (x * x + y * y + z * z) / (2.0 * (1.0 + c)) : 1.0;
+}
+
+static double error_degrees(double sin2_half){
+	return 2.0 * asin(sqrt(sin2_half < 1.0 ? sin2_half : 1.0)) * 180.0 / M_PI;
+}
+
+//---------------------------------------------------------------------------------------------------
+// Worker: one bank over this thread's trials, fed every sample of the log
+
+static void reset_lanes(const TuneJob* job, void* bank){
+	for(size_t l = 0; l < job->trial_count; l++) {
+		const double* gain = job->trials[l].gain;
+		if(job->mahony) {
+			mahony_ahrs_bank_reset((MahonyAHRSBank *) bank, l, job->sample_rate);
+			mahony_ahrs_bank_set_gains((MahonyAHRSBank *) bank, l, (MA_PRECISION) gain[0], (MA_PRECISION) gain[1]);
+		} else {
+			madgwick_ahrs_bank_reset((MadgwickAHRSBank *) bank, l, job->sample_rate);
+			madgwick_ahrs_bank_set_gain((MadgwickAHRSBank *) bank, l, (MA_PRECISION) gain[0]);
+		}
+	}
+}
+
+static void* tune_worker(void* argument){
+	TuneJob* job = (TuneJob *) argument;
+	const size_t lanes = job->trial_count;
+	void* bank = job->mahony ? (void *) create_mahony_ahrs_bank(lanes, job->sample_rate) : (void *) create_madgwick_ahrs_bank(lanes, job->sample_rate);
+	MA_PRECISION* inputs = (MA_PRECISION *) ahrs_aligned_alloc(64, 9 * lanes * sizeof(MA_PRECISION));
+	if(bank == NULL || inputs == NULL) {
+		ahrs_aligned_free(inputs);
+		if(job->mahony) free_mahony_ahrs_bank((MahonyAHRSBank *) bank);
+		else free_madgwick_ahrs_bank((MadgwickAHRSBank *) bank);
+		job->failed = 1;
+		return NULL;
+	}
+	MA_PRECISION* in[9];
+	for(int k = 0; k < 9; k++) in[k] = inputs + k * lanes;
+	const MA_PRECISION *q0, *q1, *q2, *q3;
+	if(job->mahony) {
+		MahonyAHRSBank* b = (MahonyAHRSBank *) bank;
+		q0 = b->q0, q1 = b->q1, q2 = b->q2, q3 = b->q3;
+	} else {
+		MadgwickAHRSBank* b = (MadgwickAHRSBank *) bank;
+		q0 = b->q0, q1 = b->q1, q2 = b->q2, q3 = b->q3;
+	}
+
+	size_t position = 0; // sample index within the segment
+	for(size_t i = 0; i < job->count; i++) {
+		const AHRSLogRecord* r = job->records + i;
+		if(i == 0 || r->device_id != r[-1].device_id) {
+			reset_lanes(job, bank);
+			position = 0;
+			job->segments++;
+		}
+
+		// Every lane sees the same sample
+		const float* sample[3] = { r->gyro, r->accel, r->mag };
+		for(int k = 0; k < 9; k++) {
+			MA_PRECISION v = sample[k / 3][k % 3];
+			for(size_t l = 0; l < lanes; l++) in[k][l] = v;
+		}
+		if(job->mahony) {
+			if(job->marg) mahony_ahrs_bank_update((MahonyAHRSBank *) bank, in[0], in[1], in[2], in[3], in[4], in[5], in[6], in[7], in[8]);
+			else mahony_ahrs_bank_update_imu((MahonyAHRSBank *) bank, in[0], in[1], in[2], in[3], in[4], in[5]);
+		} else {
+			if(job->marg) madgwick_ahrs_bank_update((MadgwickAHRSBank *) bank, in[0], in[1], in[2], in[3], in[4], in[5], in[6], in[7], in[8]);
+			else madgwick_ahrs_bank_update_imu((MadgwickAHRSBank *) bank, in[0], in[1], in[2], in[3], in[4], in[5]);
+		}
+		if(position++ < job->settle) continue;
+
+		const float* t = job->truth[i].q;
+		double g_true[3];
+		gravity(t[0], t[1], t[2], t[3], g_true);
+		for(size_t l = 0; l < lanes; l++) {
+			double e;
+			if(job->marg) {
+				e = attitude_error(t, q0[l], q1[l], q2[l], q3[l]);
+			} else {
+				double g[3];
+				gravity(q0[l], q1[l], q2[l], q3[l], g);
+				e = tilt_error(g_true, g);
+			}
+			TuneTrial* trial = &job->trials[l];
+			trial->error_sum += e;
+			if(e > trial->error_max) trial->error_max = e;
+			trial->scored++;
+		}
+	}
+
+	ahrs_aligned_free(inputs);
+	if(job->mahony) free_mahony_ahrs_bank((MahonyAHRSBank *) bank);
+	else free_madgwick_ahrs_bank((MadgwickAHRSBank *) bank);
+	return NULL;
+}
+
+//---------------------------------------------------------------------------------------------------
+// Search space
+
+// Value `u` in [0, 1] of a range: log-uniform when min > 0, else linear
+static double range_value(TuneRange range, double u){
+	if(range.min > 0.0) return range.min * pow(range.max / range.min, u);
+	return range.min + (range.max - range.min) * u;
+}
+
+static int parse_range(const char* text, TuneRange* range){
+	char* end;
+	range->min = strtod(text, &end);
+	if(*end != ':') return -1;
+	range->max = strtod(end + 1, &end);
+	return *end == '\0' && range->min >= 0.0 && range->max >= range->min ? 0 : -1;
+}
+
+static double trial_rms(const TuneTrial* trial){
+	return trial->scored > 0 ? trial->error_sum / (double) trial->scored : 1.0;
+}
+
+static int compare_trials(const void* a, const void* b){
+	double x = trial_rms((const TuneTrial *) a), y = trial_rms((const TuneTrial *) b);
+	return x < y ? -1 : x > y;
+}
+
+static const void* map_log(const char* path, uint16_t kind, uint64_t* record_count){
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st) != 0) {
+		perror(path);
+		return NULL;
+	}
+	const AHRSLogHeader* header = (uint64_t) st.st_size >= sizeof(AHRSLogHeader)
+		? (const AHRSLogHeader *) mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0) : (const AHRSLogHeader *) MAP_FAILED;
+	close(fd);
+	if(header == MAP_FAILED || !ahrs_log_header_valid(header, kind, (uint64_t) st.st_size)) {
+		fprintf(stderr, "%s: not a %s log, or truncated\n", path, kind == AHRS_LOG_KIND_SAMPLES ? "sample" : "quaternion");
+		return NULL;
+	}
+	*record_count = header->record_count;
+	return header;
+}
+
+static void usage(const char* program){
+	fprintf(stderr, "usage: %s [--algorithm madgwick|mahony] [--imu] [--grid N | --random N] [--beta MIN:MAX]\n"
+		"       [--kp MIN:MAX] [--ki MIN:MAX] [--threads N] [--settle S] [--top N] [--csv FILE] INPUT TRUTH\n", program);
+}
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv){
+	int mahony = 0, marg = 1, random_search = 0;
+	size_t points = 32, top = 20;
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	double settle = 10.0;
+	TuneRange beta = { 0.001, 1.0 }, kp = { 0.05, 20.0 }, ki = { 0.001, 2.0 };
+	const char* csv_path = NULL;
+	const char* paths[2] = { NULL, NULL };
+	int path_count = 0;
+
+	for(int i = 1; i < argc; i++) {
+		int ok = 1;
+		if(strcmp(argv[i], "--algorithm") == 0 && i + 1 < argc) {
+			const char* name = argv[++i];
+			mahony = strcmp(name, "mahony") == 0;
+			ok = mahony || strcmp(name, "madgwick") == 0;
+		}
+		else if(strcmp(argv[i], "--imu") == 0) marg = 0;
+		else if(strcmp(argv[i], "--grid") == 0 && i + 1 < argc) points = strtoul(argv[++i], NULL, 10), random_search = 0;
+		else if(strcmp(argv[i], "--random") == 0 && i + 1 < argc) points = strtoul(argv[++i], NULL, 10), random_search = 1;
+		else if(strcmp(argv[i], "--beta") == 0 && i + 1 < argc) ok = parse_range(argv[++i], &beta) == 0;
+		else if(strcmp(argv[i], "--kp") == 0 && i + 1 < argc) ok = parse_range(argv[++i], &kp) == 0;
+		else if(strcmp(argv[i], "--ki") == 0 && i + 1 < argc) ok = parse_range(argv[++i], &ki) == 0;
+		else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads = strtol(argv[++i], NULL, 10);
+		else if(strcmp(argv[i], "--settle") == 0 && i + 1 < argc) settle = atof(argv[++i]);
+		else if(strcmp(argv[i], "--top") == 0 && i + 1 < argc) top = strtoul(argv[++i], NULL, 10);
+		else if(strcmp(argv[i], "--csv") == 0 && i + 1 < argc) csv_path = argv[++i];
+		else if(argv[i][0] != '-' && path_count < 2) paths[path_count++] = argv[i];
+		else ok = 0;
+		if(!ok) {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if(path_count != 2 || points == 0 || threads < 1 || !(settle >= 0.0)) {
+		usage(argv[0]);
+		return 2;
+	}
+#if MA_FIXED_GAINS
+	fprintf(stderr, "%s: built with MA_FIXED_GAINS, the filters ignore per-instance gains\n", argv[0]);
+	return 1;
+#endif
+
+	uint64_t count, truth_count;
+	const AHRSLogHeader* input = (const AHRSLogHeader *) map_log(paths[0], AHRS_LOG_KIND_SAMPLES, &count);
+	const AHRSLogHeader* truth = input != NULL ? (const AHRSLogHeader *) map_log(paths[1], AHRS_LOG_KIND_QUATERNIONS, &truth_count) : NULL;
+	if(input == NULL || truth == NULL) return 1;
+	if(truth_count != count || count == 0) {
+		fprintf(stderr, "%s: %llu quaternions for %llu samples\n", paths[1], (unsigned long long) truth_count, (unsigned long long) count);
+		return 1;
+	}
+
+	// Parameter sets
+	const TuneRange* ranges[2] = { mahony ? &kp : &beta, mahony ? &ki : NULL };
+	size_t trial_count = points;
+	if(!random_search && mahony) trial_count = (kp.min == kp.max ? 1 : points) * (ki.min == ki.max ? 1 : points);
+	else if(!random_search && beta.min == beta.max) trial_count = 1;
+	TuneTrial* trials = (TuneTrial *) calloc(trial_count, sizeof(TuneTrial));
+	if(trials == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	uint64_t rng = 0x9E3779B97F4A7C15ULL;
+	for(size_t t = 0; t < trial_count; t++) {
+		size_t index = t;
+		for(int d = 0; d < (mahony ? 2 : 1); d++) {
+			const TuneRange range = *ranges[d];
+			double u;
+			if(random_search) {
+				rng ^= rng >> 12, rng ^= rng << 25, rng ^= rng >> 27;
+				u = (double)((rng * 0x2545F4914F6CDD1DULL) >> 11) / 9007199254740992.0;
+			} else {
+				size_t n = range.min == range.max ? 1 : points;
+				u = n > 1 ? (double)(index % n) / (double)(n - 1) : 0.0;
+				index /= n;
+			}
+			trials[t].gain[d] = range_value(range, u);
+		}
+	}
+
+	// Contiguous slices of the trials, one bank per thread
+	if((size_t) threads > trial_count) threads = (long) trial_count;
+	TuneJob* jobs = (TuneJob *) calloc((size_t) threads, sizeof(TuneJob));
+	pthread_t* workers = (pthread_t *) malloc((size_t) threads * sizeof(pthread_t));
+	if(jobs == NULL || workers == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	double t0 = now();
+	for(long w = 0; w < threads; w++) {
+		size_t first = trial_count * (size_t) w / (size_t) threads, last = trial_count * (size_t)(w + 1) / (size_t) threads;
+		TuneJob* job = &jobs[w];
+		job->records = ahrs_log_records(input);
+		job->truth = (const AHRSLogQuaternion *) (truth + 1);
+		job->count = (size_t) count;
+		job->sample_rate = (MA_PRECISION) input->sample_rate;
+		job->mahony = mahony;
+		job->marg = marg;
+		job->settle = (size_t)(settle * input->sample_rate);
+		job->trials = trials + first;
+		job->trial_count = last - first;
+		if(w > 0 && pthread_create(&workers[w], NULL, tune_worker, job) != 0) job->failed = 1;
+	}
+	tune_worker(&jobs[0]);
+	for(long w = 1; w < threads; w++)
+		if(!jobs[w].failed) pthread_join(workers[w], NULL);
+	double seconds = now() - t0;
+	for(long w = 0; w < threads; w++) {
+		if(jobs[w].failed) {
+			fprintf(stderr, "out of memory, or could not start a thread\n");
+			return 1;
+		}
+	}
+
+	// Error-vs-gain table
+	if(csv_path != NULL) {
+		FILE* csv = fopen(csv_path, "w");
+		if(csv == NULL) {
+			perror(csv_path);
+			return 1;
+		}
+		fprintf(csv, mahony ? "two_kp,two_ki,rms_deg,max_deg\n" : "beta,rms_deg,max_deg\n");
+		for(size_t t = 0; t < trial_count; t++) {
+			if(mahony) fprintf(csv, "%.6g,%.6g,", trials[t].gain[0], trials[t].gain[1]);
+			else fprintf(csv, "%.6g,", trials[t].gain[0]);
+			fprintf(csv, "%.4f,%.4f\n", error_degrees(trial_rms(&trials[t])), error_degrees(trials[t].error_max));
+		}
+		if(fclose(csv) != 0) {
+			perror(csv_path);
+			return 1;
+		}
+	}
+	qsort(trials, trial_count, sizeof(TuneTrial), compare_trials);
+
+	printf("%s %s, %zu segments, %llu samples, %zu parameter sets on %ld threads: %.2f s, %.1f M filter updates/s\n",
+		mahony ? "mahony" : "madgwick", marg ? "marg" : "imu", jobs[0].segments, (unsigned long long) count, trial_count, threads,
+		seconds, (double) count * (double) trial_count / seconds * 1e-6);
+	if(mahony) printf("%6s %12s %12s %10s %10s\n", "rank", "two_kp", "two_ki", "rms deg", "max deg");
+	else printf("%6s %12s %10s %10s\n", "rank", "beta", "rms deg", "max deg");
+	for(size_t t = 0; t < trial_count && t < top; t++) {
+		printf("%6zu ", t + 1);
+		if(mahony) printf("%12.6g %12.6g ", trials[t].gain[0], trials[t].gain[1]);
+		else printf("%12.6g ", trials[t].gain[0]);
+		printf("%10.4f %10.4f\n", error_degrees(trial_rms(&trials[t])), error_degrees(trials[t].error_max));
+	}
+	if(mahony) printf("best: two_kp %.6g two_ki %.6g\n", trials[0].gain[0], trials[0].gain[1]);
+	else printf("best: beta %.6g\n", trials[0].gain[0]);
+
+	free(workers);
+	free(jobs);
+	free(trials);
+	return 0;
+}